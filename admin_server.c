@@ -0,0 +1,777 @@
+/**
+ * @file admin_server.c
+ * @brief Implementation of the local admin HTTP listener exporting metrics in Prometheus text format.
+ *
+ * Each scrape copies the per worker metrics into private snapshots and renders the response
+ * from the copies, so the worker threads are never locked or waited for.
+ */
+
+#include "admin_server.h"
+#include "metrics.h"
+#include "log.h"
+#include "utils.h"
+#include "sip_overload.h"
+#include "rate_limiter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define ADMIN_EPOLL_WAIT_MS 500
+#define ADMIN_ACCEPT_BACKOFF_MS 1000
+
+/**
+ * @struct admin_buffer_t
+ * @brief Growable text buffer holding a rendered response.
+ */
+typedef struct
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} admin_buffer_t;
+
+/**
+ * @struct admin_connection_t
+ * @brief State of an admin HTTP connection.
+ */
+typedef struct
+{
+    int fd; // -1 when the slot is free
+    char request[ADMIN_REQUEST_MAX_LENGTH + 1];
+    size_t request_length;
+    admin_buffer_t response;
+    size_t response_sent;
+    uint64_t last_activity_ms;
+} admin_connection_t;
+
+/**
+ * @struct admin_counter_descriptor_t
+ * @brief Name, help and location of a per worker counter.
+ */
+typedef struct
+{
+    const char *name;
+    const char *help;
+    size_t offset;
+} admin_counter_descriptor_t;
+
+#define ADMIN_WORKER_COUNTER(name, help) {#name, help, offsetof(worker_metrics_t, worker.name)},
+#define ADMIN_WORKER_QUEUE_COUNTER(name, help) {#name, help, offsetof(worker_metrics_t, queue.name)},
+
+static const admin_counter_descriptor_t worker_counters[] = {
+    WORKER_COUNTERS(ADMIN_WORKER_COUNTER)
+    WORKER_QUEUE_COUNTERS(ADMIN_WORKER_QUEUE_COUNTER)};
+
+#define ADMIN_RECEIVER_COUNTER(name, help) {#name, help, offsetof(receiver_metrics_t, receiver.name)},
+
+static const admin_counter_descriptor_t receiver_counters[] = {
+    RECEIVER_COUNTERS(ADMIN_RECEIVER_COUNTER)};
+
+#define ADMIN_TIMER_COUNTER(name, help) {#name, help, offsetof(timer_metrics_t, timer.name)},
+
+static const admin_counter_descriptor_t timer_counters[] = {
+    TIMER_COUNTERS(ADMIN_TIMER_COUNTER)};
+
+#define ADMIN_TLS_COUNTER(name, help) {#name, help, offsetof(tls_metrics_t, tls.name)},
+
+static const admin_counter_descriptor_t tls_counters[] = {
+    TLS_COUNTERS(ADMIN_TLS_COUNTER)};
+
+// indexed by sip_msg_error_t
+static const char *parse_error_names[METRICS_PARSE_ERROR_COUNT] = {
+    "none", "invalid_parameters", "unsupported_sip_version", "malformed_message",
+    "unknown_method", "missing_mandatory_header", "missing_mandatory_parameter"};
+
+#define ADMIN_STAGE_NAME(id, name, help) #name,
+
+static const char *stage_names[METRICS_STAGE_COUNT] = {
+    LATENCY_STAGES(ADMIN_STAGE_NAME)};
+
+// indexed by message_queue_lane_t
+static const char *lane_names[MESSAGE_QUEUE_LANE_COUNT] = {"priority", "normal"};
+
+// latency histogram bucket bounds exported to Prometheus, in nanoseconds
+static const uint64_t latency_bounds_ns[] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000,
+    250000000, 500000000, 1000000000};
+
+static int admin_socket = -1;
+static int admin_epoll = -1;
+static pthread_t admin_thread;
+static atomic_int admin_running = 0;
+static worker_thread_t *admin_workers = NULL;
+static int admin_worker_count = 0;
+static admin_connection_t admin_connections[ADMIN_MAX_CONNECTIONS];
+static uint64_t admin_accept_paused_until_ms = 0; // 0 while the listener is watched
+static bool admin_accept_exhausted = false;       // descriptor exhaustion already logged
+
+/**
+ * @brief Appends formatted text to a buffer, growing it as needed.
+ */
+static void buffer_printf(admin_buffer_t *buffer, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void buffer_printf(admin_buffer_t *buffer, const char *format, ...)
+{
+    if (buffer->failed)
+    {
+        return;
+    }
+    while (1)
+    {
+        size_t available = buffer->capacity - buffer->length;
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(buffer->data + buffer->length, available, format, args);
+        va_end(args);
+        if (written < 0)
+        {
+            buffer->failed = true;
+            return;
+        }
+        if ((size_t)written < available)
+        {
+            buffer->length += (size_t)written;
+            return;
+        }
+        size_t capacity = buffer->capacity == 0 ? 16384 : buffer->capacity * 2;
+        while (capacity - buffer->length <= (size_t)written)
+        {
+            capacity *= 2;
+        }
+        char *data = realloc(buffer->data, capacity);
+        if (data == NULL)
+        {
+            error("Memory allocation failed");
+            buffer->failed = true;
+            return;
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+}
+
+static void buffer_free(admin_buffer_t *buffer)
+{
+    free(buffer->data);
+    memset(buffer, 0, sizeof(admin_buffer_t));
+}
+
+static uint64_t counter_at(const void *metrics, size_t offset)
+{
+    return metrics_counter_get((const metrics_counter_t *)((const char *)metrics + offset));
+}
+
+/**
+ * @brief Returns the number of objects a worker holds from its created and deleted counters.
+ * The counters are read one after the other while the worker updates them, deleted first
+ * since every object is counted created before deleted, and a race is clamped to 0.
+ */
+static uint64_t active_count(const metrics_counter_t *created, const metrics_counter_t *deleted)
+{
+    uint64_t deleted_count = metrics_counter_get(deleted);
+    uint64_t created_count = metrics_counter_get(created);
+    return created_count > deleted_count ? created_count - deleted_count : 0;
+}
+
+static void render_family_header(admin_buffer_t *out, const char *name, const char *help, const char *type)
+{
+    buffer_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * @brief Renders a latency histogram. Bounds that fall inside a bucket count the whole bucket above them.
+ */
+static void render_latency_histogram(admin_buffer_t *out, const char *name, const char *label, const char *value, const latency_histogram_t *histogram)
+{
+    uint64_t cumulative = 0;
+    int bucket = 0;
+    for (size_t i = 0; i < sizeof(latency_bounds_ns) / sizeof(latency_bounds_ns[0]); i++)
+    {
+        while (bucket < HISTOGRAM_BUCKET_COUNT && histogram_bucket_upper_bound(bucket) <= latency_bounds_ns[i])
+        {
+            cumulative += metrics_counter_get(&histogram->buckets[bucket]);
+            bucket++;
+        }
+        buffer_printf(out, "%s_bucket{%s=\"%s\",le=\"%g\"} %llu\n", name, label, value,
+                      latency_bounds_ns[i] / 1e9, (unsigned long long)cumulative);
+    }
+    buffer_printf(out, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %llu\n", name, label, value,
+                  (unsigned long long)metrics_counter_get(&histogram->count));
+    buffer_printf(out, "%s_sum{%s=\"%s\"} %.9f\n", name, label, value, metrics_counter_get(&histogram->sum) / 1e9);
+    buffer_printf(out, "%s_count{%s=\"%s\"} %llu\n", name, label, value,
+                  (unsigned long long)metrics_counter_get(&histogram->count));
+}
+
+/**
+ * @brief Renders the metrics of the TLS handshake threads, summed over the threads.
+ */
+static void render_tls_metrics(admin_buffer_t *out)
+{
+    char name[128];
+    tls_metrics_t *total = calloc(1, sizeof(tls_metrics_t));
+    if (total == NULL)
+    {
+        error("Memory allocation failed");
+        out->failed = true;
+        return;
+    }
+    for (int i = 0; i < METRICS_MAX_TLS_THREADS; i++)
+    {
+        metrics_add_tls(total, &tls_metrics[i]);
+    }
+    for (size_t c = 0; c < sizeof(tls_counters) / sizeof(tls_counters[0]); c++)
+    {
+        snprintf(name, sizeof(name), "sip_tls_%s_total", tls_counters[c].name);
+        render_family_header(out, name, tls_counters[c].help, "counter");
+        buffer_printf(out, "%s %llu\n", name, (unsigned long long)counter_at(total, tls_counters[c].offset));
+    }
+    render_family_header(out, "sip_tls_handshake_latency_seconds", "Time from accepting a TLS connection to the end of its handshake", "histogram");
+    render_latency_histogram(out, "sip_tls_handshake_latency_seconds", "handshake", "full", &total->tls.handshake_latency[0]);
+    render_latency_histogram(out, "sip_tls_handshake_latency_seconds", "handshake", "resumed", &total->tls.handshake_latency[1]);
+    free(total);
+}
+
+/**
+ * @brief Renders all metrics in Prometheus text format.
+ * @param out The buffer to append to.
+ */
+static void render_metrics(admin_buffer_t *out)
+{
+    char name[128];
+    int worker_count = admin_worker_count;
+    worker_metrics_t *workers = calloc(worker_count + 1, sizeof(worker_metrics_t));
+    if (workers == NULL)
+    {
+        error("Memory allocation failed");
+        out->failed = true;
+        return;
+    }
+    // the last slot holds the sum of all workers
+    worker_metrics_t *total = &workers[worker_count];
+    for (int i = 0; i < worker_count; i++)
+    {
+        if (admin_workers[i].metrics != NULL)
+        {
+            metrics_snapshot_worker(admin_workers[i].metrics, &workers[i]);
+        }
+    }
+
+    for (size_t c = 0; c < sizeof(worker_counters) / sizeof(worker_counters[0]); c++)
+    {
+        snprintf(name, sizeof(name), "sip_worker_%s_total", worker_counters[c].name);
+        render_family_header(out, name, worker_counters[c].help, "counter");
+        for (int i = 0; i < worker_count; i++)
+        {
+            buffer_printf(out, "%s{worker=\"%d\"} %llu\n", name, i,
+                          (unsigned long long)counter_at(&workers[i], worker_counters[c].offset));
+        }
+    }
+
+    render_family_header(out, "sip_worker_requests_received_total", "SIP requests received by method", "counter");
+    for (int i = 0; i < worker_count; i++)
+    {
+        for (int method = INVITE; method < METRICS_METHOD_COUNT; method++)
+        {
+            buffer_printf(out, "sip_worker_requests_received_total{worker=\"%d\",method=\"%s\"} %llu\n", i, metrics_method_names[method],
+                          (unsigned long long)metrics_counter_get(&workers[i].worker.requests_received[method]));
+        }
+    }
+
+    render_family_header(out, "sip_worker_parse_errors_total", "SIP messages that failed to parse by error", "counter");
+    for (int i = 0; i < worker_count; i++)
+    {
+        for (int err = ERROR_NONE + 1; err < METRICS_PARSE_ERROR_COUNT; err++)
+        {
+            buffer_printf(out, "sip_worker_parse_errors_total{worker=\"%d\",error=\"%s\"} %llu\n", i, parse_error_names[err],
+                          (unsigned long long)metrics_counter_get(&workers[i].worker.parse_errors[err]));
+        }
+    }
+
+    render_family_header(out, "sip_worker_responses_sent_total", "SIP responses sent by status code", "counter");
+    for (int i = 0; i < worker_count; i++)
+    {
+        for (int code = 0; code < METRICS_STATUS_CODE_COUNT; code++)
+        {
+            uint64_t value = metrics_counter_get(&workers[i].worker.responses_sent[code]);
+            if (value > 0)
+            {
+                buffer_printf(out, "sip_worker_responses_sent_total{worker=\"%d\",code=\"%d\"} %llu\n", i,
+                              code + METRICS_STATUS_CODE_MIN, (unsigned long long)value);
+            }
+        }
+    }
+
+    render_family_header(out, "sip_worker_queue_depth", "Messages waiting in a lane of the worker queue", "gauge");
+    for (int i = 0; i < worker_count; i++)
+    {
+        for (int lane = 0; lane < MESSAGE_QUEUE_LANE_COUNT; lane++)
+        {
+            buffer_printf(out, "sip_worker_queue_depth{worker=\"%d\",lane=\"%s\"} %d\n", i, lane_names[lane],
+                          get_message_queue_lane_depth(&admin_workers[i].queue, lane));
+        }
+    }
+    render_family_header(out, "sip_worker_queue_capacity", "Capacity of each lane of the worker queue", "gauge");
+    for (int i = 0; i < worker_count; i++)
+    {
+        buffer_printf(out, "sip_worker_queue_capacity{worker=\"%d\"} %d\n", i, admin_workers[i].queue.capacity);
+    }
+
+    render_family_header(out, "sip_worker_overloaded", "Whether new calls to the worker are rejected with 503", "gauge");
+    for (int i = 0; i < worker_count; i++)
+    {
+        buffer_printf(out, "sip_worker_overloaded{worker=\"%d\"} %d\n", i, sip_overload_is_shedding(&sip_overload, i) ? 1 : 0);
+    }
+    render_family_header(out, "sip_worker_queue_delay_seconds", "Moving average of the time messages wait in the worker queue", "gauge");
+    for (int i = 0; i < worker_count; i++)
+    {
+        buffer_printf(out, "sip_worker_queue_delay_seconds{worker=\"%d\"} %.9f\n", i,
+                      atomic_load_explicit(&admin_workers[i].queue_delay_ns, memory_order_relaxed) / 1e9);
+    }
+
+    render_family_header(out, "sip_worker_active_calls", "Calls currently held by the worker", "gauge");
+    for (int i = 0; i < worker_count; i++)
+    {
+        buffer_printf(out, "sip_worker_active_calls{worker=\"%d\"} %llu\n", i,
+                      (unsigned long long)active_count(&workers[i].worker.calls_created, &workers[i].worker.calls_deleted));
+    }
+    render_family_header(out, "sip_worker_active_dialogs", "Dialogs currently held by the worker", "gauge");
+    for (int i = 0; i < worker_count; i++)
+    {
+        buffer_printf(out, "sip_worker_active_dialogs{worker=\"%d\"} %llu\n", i,
+                      (unsigned long long)active_count(&workers[i].worker.dialogs_created, &workers[i].worker.dialogs_deleted));
+    }
+    render_family_header(out, "sip_worker_active_transactions", "Transactions currently held by the worker", "gauge");
+    for (int i = 0; i < worker_count; i++)
+    {
+        buffer_printf(out, "sip_worker_active_transactions{worker=\"%d\"} %llu\n", i,
+                      (unsigned long long)active_count(&workers[i].worker.transactions_created, &workers[i].worker.transactions_deleted));
+    }
+
+    for (size_t c = 0; c < sizeof(receiver_counters) / sizeof(receiver_counters[0]); c++)
+    {
+        snprintf(name, sizeof(name), "sip_receiver_%s_total", receiver_counters[c].name);
+        render_family_header(out, name, receiver_counters[c].help, "counter");
+        buffer_printf(out, "%s %llu\n", name, (unsigned long long)counter_at(&receiver_metrics, receiver_counters[c].offset));
+    }
+    for (size_t c = 0; c < sizeof(timer_counters) / sizeof(timer_counters[0]); c++)
+    {
+        snprintf(name, sizeof(name), "sip_timer_%s_total", timer_counters[c].name);
+        render_family_header(out, name, timer_counters[c].help, "counter");
+        buffer_printf(out, "%s %llu\n", name, (unsigned long long)counter_at(&timer_metrics, timer_counters[c].offset));
+    }
+    render_tls_metrics(out);
+    rate_limiter_talker_t talkers[RATE_LIMITER_TOP_TALKERS];
+    int talker_count = rate_limiter_get_top_talkers(&rate_limiter, talkers, RATE_LIMITER_TOP_TALKERS);
+    if (talker_count > 0)
+    {
+        render_family_header(out, "sip_source_packets_total", "Packets received from the top talking source addresses", "counter");
+        for (int i = 0; i < talker_count; i++)
+        {
+            buffer_printf(out, "sip_source_packets_total{source=\"%s\"} %llu\n", talkers[i].address, (unsigned long long)talkers[i].packets);
+        }
+        render_family_header(out, "sip_source_rate_limited_total", "Packets of the top talking source addresses above their rate", "counter");
+        for (int i = 0; i < talker_count; i++)
+        {
+            buffer_printf(out, "sip_source_rate_limited_total{source=\"%s\"} %llu\n", talkers[i].address, (unsigned long long)talkers[i].limited);
+        }
+    }
+
+    render_family_header(out, "sip_log_messages_dropped_total", "Log messages dropped because a log ring was full", "counter");
+    buffer_printf(out, "sip_log_messages_dropped_total %llu\n", (unsigned long long)log_get_dropped_count());
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        metrics_add_worker(total, &workers[i]);
+    }
+    render_family_header(out, "sip_processing_latency_seconds", "Time from receiving a message to finishing its processing", "histogram");
+    for (int method = 0; method < METRICS_METHOD_COUNT; method++)
+    {
+        if (metrics_counter_get(&total->worker.processing_latency[method].count) > 0)
+        {
+            render_latency_histogram(out, "sip_processing_latency_seconds", "method", metrics_method_names[method], &total->worker.processing_latency[method]);
+        }
+    }
+    render_family_header(out, "sip_stage_latency_seconds", "Time messages spend in each stage of the server", "histogram");
+    for (int stage = 0; stage < METRICS_STAGE_COUNT; stage++)
+    {
+        render_latency_histogram(out, "sip_stage_latency_seconds", "stage", stage_names[stage], &total->worker.stage_latency[stage]);
+    }
+
+    free(workers);
+}
+
+/**
+ * @brief Builds the HTTP response to a complete request.
+ * @param connection The connection holding the request.
+ */
+static void build_response(admin_connection_t *connection)
+{
+    char method[8] = {0};
+    char path[256] = {0};
+    admin_buffer_t body = {0};
+    int status = 200;
+    const char *reason = "OK";
+    const char *content_type = "text/plain; version=0.0.4; charset=utf-8";
+
+    if (sscanf(connection->request, "%7s %255s", method, path) != 2)
+    {
+        status = 400;
+        reason = "Bad Request";
+    }
+    else if (strcmp(method, "GET") != 0)
+    {
+        status = 405;
+        reason = "Method Not Allowed";
+    }
+    else if (strcmp(path, "/metrics") == 0)
+    {
+        render_metrics(&body);
+    }
+    else
+    {
+        status = 404;
+        reason = "Not Found";
+    }
+
+    if (body.failed)
+    {
+        status = 500;
+        reason = "Internal Server Error";
+        body.length = 0;
+    }
+    if (status != 200)
+    {
+        content_type = "text/plain; charset=utf-8";
+        buffer_printf(&body, "%d %s\n", status, reason);
+    }
+
+    buffer_printf(&connection->response, "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                  status, reason, content_type, body.length);
+    if (body.length > 0)
+    {
+        buffer_printf(&connection->response, "%.*s", (int)body.length, body.data);
+    }
+    buffer_free(&body);
+    connection->response_sent = 0;
+}
+
+static void close_connection(admin_connection_t *connection)
+{
+    epoll_ctl(admin_epoll, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+    buffer_free(&connection->response);
+    connection->fd = -1;
+}
+
+/**
+ * @brief Stops or resumes watching the listener, the listener is level triggered so pending
+ * connections that cannot be accepted would otherwise wake the loop on every pass.
+ */
+static void watch_listener(bool watch)
+{
+    struct epoll_event event = {.events = watch ? EPOLLIN : 0, .data.ptr = NULL};
+    epoll_ctl(admin_epoll, EPOLL_CTL_MOD, admin_socket, &event);
+}
+
+static void accept_connections(void)
+{
+    while (1)
+    {
+        int fd = accept(admin_socket, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EMFILE || errno == ENFILE)
+            {
+                // the connections stay in the backlog until descriptors are freed
+                if (!admin_accept_exhausted)
+                {
+                    error("Failed to accept admin connection: %s, pausing accepts", strerror(errno));
+                    admin_accept_exhausted = true;
+                }
+                admin_accept_paused_until_ms = get_monotonic_time_ms() + ADMIN_ACCEPT_BACKOFF_MS;
+                watch_listener(false);
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (admin_accept_exhausted)
+                {
+                    info("Admin connection backlog drained");
+                    admin_accept_exhausted = false;
+                }
+            }
+            else if (errno != EINTR)
+            {
+                error("Failed to accept admin connection: %s", strerror(errno));
+            }
+            return;
+        }
+        int flags = fcntl(fd, F_GETFL, 0);
+        if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+        {
+            error("Failed to set non-blocking admin connection: %s", strerror(errno));
+            close(fd);
+            continue;
+        }
+
+        admin_connection_t *connection = NULL;
+        for (int i = 0; i < ADMIN_MAX_CONNECTIONS; i++)
+        {
+            if (admin_connections[i].fd < 0)
+            {
+                connection = &admin_connections[i];
+                break;
+            }
+        }
+        if (connection == NULL)
+        {
+            error("Too many admin connections");
+            close(fd);
+            continue;
+        }
+
+        memset(connection, 0, sizeof(admin_connection_t));
+        connection->fd = fd;
+        connection->last_activity_ms = get_monotonic_time_ms();
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = connection};
+        if (epoll_ctl(admin_epoll, EPOLL_CTL_ADD, fd, &event) < 0)
+        {
+            error("Failed to watch admin connection: %s", strerror(errno));
+            close(fd);
+            connection->fd = -1;
+        }
+    }
+}
+
+/**
+ * @brief Reads the request until the end of its headers, then switches to writing the response.
+ */
+static void handle_readable(admin_connection_t *connection)
+{
+    while (1)
+    {
+        size_t available = ADMIN_REQUEST_MAX_LENGTH - connection->request_length;
+        if (available == 0)
+        {
+            close_connection(connection);
+            return;
+        }
+        ssize_t bytes = recv(connection->fd, connection->request + connection->request_length, available, 0);
+        if (bytes == 0)
+        {
+            close_connection(connection);
+            return;
+        }
+        if (bytes < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                close_connection(connection);
+            }
+            return;
+        }
+        connection->request_length += (size_t)bytes;
+        connection->request[connection->request_length] = '\0';
+        if (strstr(connection->request, "\r\n\r\n") != NULL || strstr(connection->request, "\n\n") != NULL)
+        {
+            break;
+        }
+    }
+
+    build_response(connection);
+    if (connection->response.failed)
+    {
+        close_connection(connection);
+        return;
+    }
+    struct epoll_event event = {.events = EPOLLOUT, .data.ptr = connection};
+    epoll_ctl(admin_epoll, EPOLL_CTL_MOD, connection->fd, &event);
+}
+
+static void handle_writable(admin_connection_t *connection)
+{
+    while (connection->response_sent < connection->response.length)
+    {
+        ssize_t bytes = send(connection->fd, connection->response.data + connection->response_sent,
+                             connection->response.length - connection->response_sent, MSG_NOSIGNAL);
+        if (bytes < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                close_connection(connection);
+            }
+            return;
+        }
+        connection->response_sent += (size_t)bytes;
+    }
+    close_connection(connection);
+}
+
+static void *admin_server_loop(void *arg)
+{
+    (void)arg;
+    struct epoll_event events[ADMIN_MAX_CONNECTIONS + 1];
+
+    while (atomic_load(&admin_running))
+    {
+        int count = epoll_wait(admin_epoll, events, ADMIN_MAX_CONNECTIONS + 1, ADMIN_EPOLL_WAIT_MS);
+        if (count < 0 && errno != EINTR)
+        {
+            error("Admin epoll wait failed: %s", strerror(errno));
+            break;
+        }
+
+        uint64_t now_ms = get_monotonic_time_ms();
+        if (admin_accept_paused_until_ms != 0 && now_ms >= admin_accept_paused_until_ms)
+        {
+            admin_accept_paused_until_ms = 0;
+            watch_listener(true);
+        }
+        for (int i = 0; i < count; i++)
+        {
+            admin_connection_t *connection = events[i].data.ptr;
+            if (connection == NULL)
+            {
+                accept_connections();
+                continue;
+            }
+            if (connection->fd < 0)
+            {
+                continue;
+            }
+            connection->last_activity_ms = now_ms;
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                close_connection(connection);
+            }
+            else if (events[i].events & EPOLLIN)
+            {
+                handle_readable(connection);
+            }
+            else if (events[i].events & EPOLLOUT)
+            {
+                handle_writable(connection);
+            }
+        }
+
+        for (int i = 0; i < ADMIN_MAX_CONNECTIONS; i++)
+        {
+            if (admin_connections[i].fd >= 0 && now_ms - admin_connections[i].last_activity_ms > ADMIN_IDLE_TIMEOUT_MS)
+            {
+                close_connection(&admin_connections[i]);
+            }
+        }
+    }
+
+    for (int i = 0; i < ADMIN_MAX_CONNECTIONS; i++)
+    {
+        if (admin_connections[i].fd >= 0)
+        {
+            close_connection(&admin_connections[i]);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts the admin listener on the loopback address.
+ * @param port The TCP port to listen on.
+ * @param workers The worker threads whose metrics and queues are exported.
+ * @param worker_count The number of worker threads.
+ * @return 0 on success, -1 on failure.
+ */
+int admin_server_start(int port, worker_thread_t *workers, int worker_count)
+{
+    if (port <= 0 || port > 65535 || workers == NULL || worker_count < 0)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+
+    admin_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (admin_socket < 0)
+    {
+        error("Failed to create admin socket: %s", strerror(errno));
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(admin_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (bind(admin_socket, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(admin_socket, ADMIN_MAX_CONNECTIONS) < 0)
+    {
+        error("Failed to listen on admin port %d: %s", port, strerror(errno));
+        close(admin_socket);
+        admin_socket = -1;
+        return -1;
+    }
+
+    admin_epoll = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    if (admin_epoll < 0 || epoll_ctl(admin_epoll, EPOLL_CTL_ADD, admin_socket, &event) < 0)
+    {
+        error("Failed to watch admin socket: %s", strerror(errno));
+        if (admin_epoll >= 0)
+        {
+            close(admin_epoll);
+            admin_epoll = -1;
+        }
+        close(admin_socket);
+        admin_socket = -1;
+        return -1;
+    }
+
+    for (int i = 0; i < ADMIN_MAX_CONNECTIONS; i++)
+    {
+        admin_connections[i].fd = -1;
+    }
+    admin_accept_paused_until_ms = 0;
+    admin_accept_exhausted = false;
+    admin_workers = workers;
+    admin_worker_count = worker_count;
+    atomic_store(&admin_running, 1);
+    if (pthread_create(&admin_thread, NULL, admin_server_loop, NULL) != 0)
+    {
+        error("Failed to create admin thread: %s", strerror(errno));
+        atomic_store(&admin_running, 0);
+        close(admin_epoll);
+        close(admin_socket);
+        admin_epoll = -1;
+        admin_socket = -1;
+        return -1;
+    }
+
+    info("Admin server started on 127.0.0.1:%d", port);
+    return 0;
+}
+
+/**
+ * @brief Stops the admin listener and waits for its thread.
+ */
+void admin_server_stop(void)
+{
+    if (!atomic_exchange(&admin_running, 0))
+    {
+        return;
+    }
+    pthread_join(admin_thread, NULL);
+    close(admin_epoll);
+    close(admin_socket);
+    admin_epoll = -1;
+    admin_socket = -1;
+}
@@ -0,0 +1,21 @@
+/**
+ * @file admin_server.h
+ * @brief Header for the local admin HTTP listener exporting metrics in Prometheus text format.
+ *
+ * The listener runs on its own thread, only binds to the loopback address and uses
+ * non-blocking sockets, so a slow or stuck scraper never delays SIP processing.
+ */
+
+#ifndef ADMIN_SERVER_H
+#define ADMIN_SERVER_H
+
+#include "sip_server.h"
+
+#define ADMIN_MAX_CONNECTIONS 16
+#define ADMIN_REQUEST_MAX_LENGTH 2048
+#define ADMIN_IDLE_TIMEOUT_MS 5000
+
+int admin_server_start(int port, worker_thread_t *workers, int worker_count);
+void admin_server_stop(void);
+
+#endif // ADMIN_SERVER_H
@@ -0,0 +1,227 @@
+/**
+ * @file bench_io_backend.c
+ * @brief Loopback echo benchmark comparing the classic recvmsg and sendto path with the io_uring backend.
+ *
+ * A client thread keeps a window of datagrams in flight to an echo server running one of
+ * the two backends, and the server counts the system calls it makes per datagram.
+ *
+ * Usage: bench_io_backend [datagrams] [window] [payload_bytes]
+ */
+
+#include "uring.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_IDLE_TIMEOUT_MS 1000
+
+typedef struct
+{
+    int server_socket;
+    struct sockaddr_in server_address;
+    long count;
+    int window;
+    size_t payload;
+    long echoed;
+} bench_client_t;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int open_server_socket(struct sockaddr_in *address)
+{
+    int server_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(address, 0, sizeof(struct sockaddr_in));
+    address->sin_family = AF_INET;
+    address->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(struct sockaddr_in);
+    if (server_socket < 0 || bind(server_socket, (struct sockaddr *)address, length) < 0 ||
+        getsockname(server_socket, (struct sockaddr *)address, &length) < 0)
+    {
+        fprintf(stderr, "Failed to open the server socket: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fcntl(server_socket, F_SETFL, fcntl(server_socket, F_GETFL, 0) | O_NONBLOCK);
+    return server_socket;
+}
+
+/**
+ * @brief Sends the datagrams, keeping at most a window of them unanswered.
+ */
+static void *client_thread_func(void *arg)
+{
+    bench_client_t *client = (bench_client_t *)arg;
+    int client_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    struct timeval timeout = {.tv_sec = BENCH_IDLE_TIMEOUT_MS / 1000, .tv_usec = 0};
+    setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char *buffer = malloc(client->payload);
+    memset(buffer, 'x', client->payload);
+
+    long sent = 0;
+    while (sent < client->count && sent < client->window)
+    {
+        sendto(client_socket, buffer, client->payload, 0, (struct sockaddr *)&client->server_address, sizeof(struct sockaddr_in));
+        sent++;
+    }
+    while (client->echoed < client->count)
+    {
+        if (recv(client_socket, buffer, client->payload, 0) < 0)
+        {
+            break;
+        }
+        client->echoed++;
+        if (sent < client->count)
+        {
+            sendto(client_socket, buffer, client->payload, 0, (struct sockaddr *)&client->server_address, sizeof(struct sockaddr_in));
+            sent++;
+        }
+    }
+    free(buffer);
+    close(client_socket);
+    return NULL;
+}
+
+/**
+ * @brief Echoes with one recvmsg and one sendto per datagram, woken up by epoll like the receiver.
+ * @return The number of system calls made.
+ */
+static long run_classic_server(int server_socket, bench_client_t *client)
+{
+    int epoll_fd = epoll_create1(0);
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = server_socket};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &event);
+
+    char buffer[URING_SEND_BUFFER_SIZE];
+    struct sockaddr_in address;
+    long syscalls = 0;
+    long echoed = 0;
+    while (echoed < client->count)
+    {
+        syscalls++;
+        if (epoll_wait(epoll_fd, &event, 1, BENCH_IDLE_TIMEOUT_MS) <= 0)
+        {
+            break;
+        }
+        while (1)
+        {
+            struct iovec iov = {.iov_base = buffer, .iov_len = sizeof(buffer)};
+            struct msghdr header = {.msg_name = &address, .msg_namelen = sizeof(address), .msg_iov = &iov, .msg_iovlen = 1};
+            syscalls++;
+            ssize_t length = recvmsg(server_socket, &header, 0);
+            if (length < 0)
+            {
+                break;
+            }
+            syscalls++;
+            sendto(server_socket, buffer, (size_t)length, 0, (struct sockaddr *)&address, header.msg_namelen);
+            echoed++;
+        }
+    }
+    close(epoll_fd);
+    return syscalls;
+}
+
+/**
+ * @brief Echoes with the multishot receive and batched sends of the io_uring backend.
+ * @return The number of system calls made.
+ */
+static long run_uring_server(int server_socket, bench_client_t *client)
+{
+    uring_receiver_t receiver;
+    uring_sender_t sender;
+    if (uring_receiver_init(&receiver, server_socket) != 0 || uring_sender_init(&sender) != 0)
+    {
+        fprintf(stderr, "io_uring is not available\n");
+        exit(EXIT_FAILURE);
+    }
+    int epoll_fd = epoll_create1(0);
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = receiver.ring.fd};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, receiver.ring.fd, &event);
+
+    long syscalls = 2; // the initial multishot submission and the sender setup are not counted
+    long echoed = 0;
+    while (echoed < client->count)
+    {
+        syscalls++;
+        int ready = epoll_wait(epoll_fd, &event, 1, BENCH_IDLE_TIMEOUT_MS);
+        if (ready == 0)
+        {
+            break;
+        }
+        uring_datagram_t datagram;
+        while (uring_receiver_next(&receiver, &datagram))
+        {
+            uring_sender_queue(&sender, server_socket, datagram.payload, datagram.length,
+                               (const struct sockaddr_storage *)datagram.address, datagram.address_length);
+            uring_receiver_release(&receiver, &datagram);
+            echoed++;
+            if (sender.pending >= URING_SEND_BATCH)
+            {
+                syscalls++;
+                uring_sender_flush(&sender, 0);
+            }
+        }
+        if (sender.pending > 0)
+        {
+            syscalls++;
+            uring_sender_flush(&sender, 0);
+        }
+    }
+    uring_sender_destroy(&sender);
+    uring_receiver_destroy(&receiver);
+    close(epoll_fd);
+    return syscalls;
+}
+
+/**
+ * @brief Runs one backend against the client and reports throughput and system calls per datagram.
+ */
+static void run_bench(const char *name, long (*server)(int, bench_client_t *), long count, int window, size_t payload)
+{
+    bench_client_t client;
+    memset(&client, 0, sizeof(client));
+    client.server_socket = open_server_socket(&client.server_address);
+    client.count = count;
+    client.window = window;
+    client.payload = payload;
+
+    pthread_t thread;
+    double start = now_seconds();
+    pthread_create(&thread, NULL, client_thread_func, &client);
+    long syscalls = server(client.server_socket, &client);
+    pthread_join(thread, NULL);
+    double elapsed = now_seconds() - start;
+
+    printf("%-8s datagrams=%-9ld window=%-4d payload=%-5zu %8.1f kpps %6.2f syscalls/datagram lost=%ld\n",
+           name, client.echoed, window, payload, client.echoed / elapsed / 1e3,
+           client.echoed > 0 ? (double)syscalls / client.echoed : 0.0, count - client.echoed);
+    close(client.server_socket);
+}
+
+int main(int argc, char *argv[])
+{
+    long count = argc > 1 ? atol(argv[1]) : 200000;
+    int window = argc > 2 ? atoi(argv[2]) : 64;
+    size_t payload = argc > 3 ? (size_t)atol(argv[3]) : 500;
+    if (count <= 0 || window <= 0 || payload == 0 || payload > URING_SEND_BUFFER_SIZE)
+    {
+        fprintf(stderr, "Usage: %s [datagrams] [window] [payload_bytes]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    run_bench("classic", run_classic_server, count, window, payload);
+    run_bench("io_uring", run_uring_server, count, window, payload);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,272 @@
+/**
+ * @file bench_parser.c
+ * @brief Parser microbenchmarks over a corpus of realistic SIP messages.
+ *
+ * Every message of the corpus is run through parse_message, get_header_value for the
+ * headers the server reads, get_message_method and the tag and branch extractors, and
+ * each step reports its cost per message and the message bytes processed per second.
+ * The cached fields of the message are reset before every iteration, so each iteration
+ * parses from scratch like a freshly received datagram.
+ *
+ * Usage: bench_parser [iterations]
+ */
+
+#include "sip_message.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct
+{
+    const char *name;
+    const char *text;
+} bench_message_t;
+
+static const bench_message_t corpus[] = {
+    {"ack",
+     "ACK sip:service@192.0.2.10:5060 SIP/2.0\r\n"
+     "Via: SIP/2.0/UDP 198.51.100.7:5060;branch=z9hG4bK-524287-1---a9f3c1b2d4e5\r\n"
+     "From: <sip:alice@example.com>;tag=8f2a1c\r\n"
+     "To: <sip:service@192.0.2.10>;tag=1234567890abcdef\r\n"
+     "Call-ID: 5d1e7f2a9c3b@198.51.100.7\r\n"
+     "CSeq: 1 ACK\r\n"
+     "Max-Forwards: 70\r\n"
+     "Content-Length: 0\r\n"
+     "\r\n"},
+    {"invite_sdp",
+     "INVITE sip:service@192.0.2.10:5060 SIP/2.0\r\n"
+     "Via: SIP/2.0/UDP 198.51.100.7:5060;branch=z9hG4bK-524287-1---77f1a3e9c2d0;rport\r\n"
+     "Max-Forwards: 70\r\n"
+     "Contact: <sip:alice@198.51.100.7:5060;transport=udp>\r\n"
+     "To: <sip:service@192.0.2.10>\r\n"
+     "From: \"Alice\" <sip:alice@example.com>;tag=3c9a77e1\r\n"
+     "Call-ID: a84b4c76e66710@pc33.example.com\r\n"
+     "CSeq: 314159 INVITE\r\n"
+     "Allow: INVITE, ACK, CANCEL, BYE, OPTIONS, UPDATE, PRACK, INFO\r\n"
+     "Supported: replaces, timer, 100rel\r\n"
+     "Session-Expires: 1800;refresher=uac\r\n"
+     "Min-SE: 90\r\n"
+     "User-Agent: ExampleSoftphone/5.2.1\r\n"
+     "Content-Type: application/sdp\r\n"
+     "Content-Length: 262\r\n"
+     "\r\n"
+     "v=0\r\n"
+     "o=alice 2890844526 2890844526 IN IP4 198.51.100.7\r\n"
+     "s=-\r\n"
+     "c=IN IP4 198.51.100.7\r\n"
+     "t=0 0\r\n"
+     "m=audio 49170 RTP/AVP 0 8 101\r\n"
+     "a=rtpmap:0 PCMU/8000\r\n"
+     "a=rtpmap:8 PCMA/8000\r\n"
+     "a=rtpmap:101 telephone-event/8000\r\n"
+     "a=fmtp:101 0-16\r\n"
+     "a=ptime:20\r\n"
+     "a=sendrecv\r\n"},
+    {"proxied_bye",
+     "BYE sip:service@192.0.2.10:5060 SIP/2.0\r\n"
+     "Via: SIP/2.0/UDP 203.0.113.5:5060;branch=z9hG4bK4b43c2ff8.1\r\n"
+     "Via: SIP/2.0/UDP 203.0.113.2:5060;branch=z9hG4bK9a8e3f1.1;received=203.0.113.2\r\n"
+     "Via: SIP/2.0/UDP 198.51.100.7:5060;branch=z9hG4bK-524287-1---c40f51a2;rport=5060\r\n"
+     "Record-Route: <sip:203.0.113.5;lr>\r\n"
+     "Record-Route: <sip:203.0.113.2;lr>\r\n"
+     "Max-Forwards: 68\r\n"
+     "From: \"Alice\" <sip:alice@example.com>;tag=3c9a77e1\r\n"
+     "To: <sip:service@192.0.2.10>;tag=1234567890abcdef\r\n"
+     "Call-ID: a84b4c76e66710@pc33.example.com\r\n"
+     "CSeq: 314160 BYE\r\n"
+     "Reason: Q.850;cause=16;text=\"Normal call clearing\"\r\n"
+     "User-Agent: ExampleSoftphone/5.2.1\r\n"
+     "Content-Length: 0\r\n"
+     "\r\n"},
+    {"reinvite_refresh",
+     "INVITE sip:service@192.0.2.10:5060 SIP/2.0\r\n"
+     "Via: SIP/2.0/UDP 198.51.100.7:5060;branch=z9hG4bK-524287-1---5b6e0f3a;rport\r\n"
+     "Max-Forwards: 70\r\n"
+     "From: \"Alice\" <sip:alice@example.com>;tag=3c9a77e1\r\n"
+     "To: <sip:service@192.0.2.10>;tag=1234567890abcdef\r\n"
+     "Call-ID: a84b4c76e66710@pc33.example.com\r\n"
+     "CSeq: 314161 INVITE\r\n"
+     "Contact: <sip:alice@198.51.100.7:5060;transport=udp>\r\n"
+     "Supported: timer\r\n"
+     "Session-Expires: 1800;refresher=uac\r\n"
+     "Content-Length: 0\r\n"
+     "\r\n"},
+    {"update_refresh",
+     "UPDATE sip:service@192.0.2.10:5060 SIP/2.0\r\n"
+     "Via: SIP/2.0/UDP 198.51.100.7:5060;branch=z9hG4bK-524287-1---9d2c4e71;rport\r\n"
+     "Max-Forwards: 70\r\n"
+     "From: \"Alice\" <sip:alice@example.com>;tag=3c9a77e1\r\n"
+     "To: <sip:service@192.0.2.10>;tag=1234567890abcdef\r\n"
+     "Call-ID: a84b4c76e66710@pc33.example.com\r\n"
+     "CSeq: 314162 UPDATE\r\n"
+     "Contact: <sip:alice@198.51.100.7:5060;transport=udp>\r\n"
+     "Supported: timer\r\n"
+     "Session-Expires: 1800;refresher=uac\r\n"
+     "Content-Length: 0\r\n"
+     "\r\n"},
+    {"compact",
+     "INVITE sip:service@192.0.2.10:5060 SIP/2.0\r\n"
+     "v: SIP/2.0/UDP 198.51.100.7:5060;branch=z9hG4bK-524287-1---0e1d2c3b\r\n"
+     "Max-Forwards: 70\r\n"
+     "m: <sip:alice@198.51.100.7:5060>\r\n"
+     "t: <sip:service@192.0.2.10>\r\n"
+     "f: <sip:alice@example.com>;tag=91b2c3\r\n"
+     "i: 0f9e8d7c6b5a@198.51.100.7\r\n"
+     "CSeq: 1 INVITE\r\n"
+     "k: timer\r\n"
+     "c: application/sdp\r\n"
+     "l: 130\r\n"
+     "\r\n"
+     "v=0\r\n"
+     "o=alice 1 1 IN IP4 198.51.100.7\r\n"
+     "s=-\r\n"
+     "c=IN IP4 198.51.100.7\r\n"
+     "t=0 0\r\n"
+     "m=audio 49170 RTP/AVP 0\r\n"
+     "a=rtpmap:0 PCMU/8000\r\n"},
+};
+
+#define CORPUS_SIZE (sizeof(corpus) / sizeof(corpus[0]))
+
+// the headers read by the server for every request
+static const char *const lookup_headers[] = {
+    HEADER_NAME_CALL_ID, HEADER_NAME_FROM, HEADER_NAME_TO, HEADER_NAME_VIA,
+    HEADER_NAME_CSEQ, HEADER_NAME_MAX_FORWARDS, HEADER_NAME_CONTENT_LENGTH,
+};
+
+#define LOOKUP_HEADER_COUNT (sizeof(lookup_headers) / sizeof(lookup_headers[0]))
+
+static volatile size_t sink;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Clears the fields cached by the parser, keeping the buffer.
+ */
+static void reset_message(sip_message_t *message)
+{
+    memset(&message->call_id, 0, sizeof(sip_message_t) - offsetof(sip_message_t, call_id));
+}
+
+static void load_message(sip_message_t *message, const char *text)
+{
+    memset(message, 0, sizeof(sip_message_t));
+    message->buffer_length = strlen(text);
+    memcpy(message->buffer, text, message->buffer_length + 1);
+}
+
+static void bench_parse_message(sip_message_t *message)
+{
+    reset_message(message);
+    sink += parse_message(message);
+}
+
+static void bench_get_header_value(sip_message_t *message)
+{
+    for (size_t i = 0; i < LOOKUP_HEADER_COUNT; i++)
+    {
+        size_t length = 0;
+        get_header_value(message->buffer, lookup_headers[i], &length);
+        sink += length;
+    }
+}
+
+// the request line is parsed once by the caller, only the method comparison is measured
+static void bench_get_message_method(sip_message_t *message)
+{
+    message->method_type = UNKNOWN;
+    sink += get_message_method(message);
+}
+
+// the headers are located once by the caller, only the parameter extraction is measured
+static void bench_extractors(sip_message_t *message)
+{
+    size_t length = 0;
+    get_from_tag(message, &length);
+    sink += length;
+    get_to_tag(message, &length);
+    sink += length;
+    get_branch_param(message, &length);
+    sink += length;
+}
+
+/**
+ * @brief Times a step over one message and reports nanoseconds per message and throughput.
+ */
+static void run_bench(const char *step, const bench_message_t *entry, sip_message_t *message,
+                      void (*function)(sip_message_t *), long iterations)
+{
+    double start = now_seconds();
+    for (long i = 0; i < iterations; i++)
+    {
+        function(message);
+    }
+    double elapsed = now_seconds() - start;
+    printf("%-18s %-12s %5zu bytes %9.1f ns/message %9.1f MB/s\n", step, entry->name, message->buffer_length,
+           elapsed * 1e9 / iterations, message->buffer_length * iterations / elapsed / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    if (iterations <= 0)
+    {
+        fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    sip_message_t *message = malloc(sizeof(sip_message_t));
+    if (message == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < CORPUS_SIZE; i++)
+    {
+        const bench_message_t *entry = &corpus[i];
+        if (strlen(entry->text) >= BUFFER_SIZE)
+        {
+            fprintf(stderr, "Message %s does not fit the message buffer\n", entry->name);
+            return EXIT_FAILURE;
+        }
+        load_message(message, entry->text);
+        sip_msg_error_t rc = parse_message(message);
+        if (rc == ERROR_NONE)
+        {
+            run_bench("parse_message", entry, message, bench_parse_message, iterations);
+        }
+        else
+        {
+            // failures are logged, so they are reported once instead of timed
+            printf("%-18s %-12s %5zu bytes rejected with error %d\n", "parse_message", entry->name, message->buffer_length, rc);
+        }
+        run_bench("get_header_value", entry, message, bench_get_header_value, iterations);
+
+        reset_message(message);
+        if (parse_first_line(message) == ERROR_NONE)
+        {
+            run_bench("get_message_method", entry, message, bench_get_message_method, iterations);
+        }
+
+        size_t length = 0;
+        reset_message(message);
+        if (get_message_from(message, &length) != NULL && get_message_to(message, &length) != NULL &&
+            get_message_via(message, &length) != NULL)
+        {
+            run_bench("tag/branch", entry, message, bench_extractors, iterations);
+        }
+        else
+        {
+            printf("%-18s %-12s %5zu bytes skipped, From, To or Via not found\n", "tag/branch", entry->name, message->buffer_length);
+        }
+    }
+    free(message);
+    return EXIT_SUCCESS;
+}
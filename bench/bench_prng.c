@@ -0,0 +1,120 @@
+/**
+ * @file bench_prng.c
+ * @brief Contention benchmark comparing rand() based tag generation with the per-thread generator.
+ *
+ * Usage: bench_prng [threads] [tags_per_thread]
+ */
+
+#include "prng.h"
+#include "sip_message.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef void (*tag_generator_t)(char *buffer, size_t length);
+
+typedef struct
+{
+    pthread_t thread;
+    tag_generator_t generator;
+    char *tags;
+    long count;
+} bench_thread_t;
+
+/**
+ * @brief The to-tag generator used before the per-thread generator, kept as the baseline.
+ */
+static void rand_tag(char *buffer, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        buffer[i] = '0' + (rand() % 10);
+    }
+}
+
+static void *bench_thread_func(void *arg)
+{
+    bench_thread_t *bench = (bench_thread_t *)arg;
+    for (long i = 0; i < bench->count; i++)
+    {
+        bench->generator(bench->tags + i * SIP_BUILD_TAG_LENGTH, SIP_BUILD_TAG_LENGTH);
+    }
+    return NULL;
+}
+
+static int compare_tags(const void *a, const void *b)
+{
+    return memcmp(a, b, SIP_BUILD_TAG_LENGTH);
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Runs one generator on all threads and reports throughput and duplicates.
+ */
+static void run_bench(const char *name, tag_generator_t generator, int threads, long count)
+{
+    bench_thread_t *bench = calloc(threads, sizeof(bench_thread_t));
+    char *tags = malloc((size_t)threads * count * SIP_BUILD_TAG_LENGTH);
+    if (bench == NULL || tags == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    double start = now_seconds();
+    for (int i = 0; i < threads; i++)
+    {
+        bench[i].generator = generator;
+        bench[i].tags = tags + (size_t)i * count * SIP_BUILD_TAG_LENGTH;
+        bench[i].count = count;
+        pthread_create(&bench[i].thread, NULL, bench_thread_func, &bench[i]);
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(bench[i].thread, NULL);
+    }
+    double elapsed = now_seconds() - start;
+
+    long total = threads * count;
+    qsort(tags, total, SIP_BUILD_TAG_LENGTH, compare_tags);
+    long duplicates = 0;
+    for (long i = 1; i < total; i++)
+    {
+        if (memcmp(tags + (i - 1) * SIP_BUILD_TAG_LENGTH, tags + i * SIP_BUILD_TAG_LENGTH, SIP_BUILD_TAG_LENGTH) == 0)
+        {
+            duplicates++;
+        }
+    }
+
+    printf("%-12s threads=%-3d tags=%-10ld %8.1f ns/tag %8.2f Mtags/s duplicates=%ld\n",
+           name, threads, total, elapsed * 1e9 / count, total / elapsed / 1e6, duplicates);
+
+    free(tags);
+    free(bench);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 7;
+    long count = argc > 2 ? atol(argv[2]) : 1000000;
+    if (threads <= 0 || count <= 0)
+    {
+        fprintf(stderr, "Usage: %s [threads] [tags_per_thread]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (int t = 1; t <= threads; t = t < threads && t * 2 > threads ? threads : t * 2)
+    {
+        run_bench("rand()", rand_tag, t, count);
+        run_bench("prng", create_unique_token, t, count);
+    }
+    return EXIT_SUCCESS;
+}
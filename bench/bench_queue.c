@@ -0,0 +1,141 @@
+/**
+ * @file bench_queue.c
+ * @brief Handoff benchmark of the message queue between receiver and worker threads.
+ *
+ * Producer threads enqueue timestamped messages to a single consumer thread, one producer
+ * like the receiver feeding a worker, and several producers for the contention of a shared
+ * queue. A producer retries a full queue after yielding where the receiver would drop the
+ * message, so every message is handed off and the number of retries shows how often the
+ * consumer fell behind. The consumer records the time from enqueue to dequeue of every
+ * message. The default capacity is the one of the worker queues.
+ *
+ * Usage: bench_queue [producers] [messages_per_producer] [capacity]
+ */
+
+#include "message_queue.h"
+#include "metrics.h"
+#include "utils.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    uint64_t enqueue_ns;
+} bench_message_t;
+
+typedef struct
+{
+    pthread_t thread;
+    message_queue_t *queue;
+    bench_message_t *messages;
+    long count;
+    long full_retries;
+} bench_producer_t;
+
+typedef struct
+{
+    message_queue_t *queue;
+    long count;
+    latency_histogram_t latency;
+} bench_consumer_t;
+
+static void *producer_thread_func(void *arg)
+{
+    bench_producer_t *producer = (bench_producer_t *)arg;
+    for (long i = 0; i < producer->count; i++)
+    {
+        bench_message_t *message = &producer->messages[i];
+        message->enqueue_ns = get_monotonic_time_ns();
+        while (!enqueue_message(producer->queue, message))
+        {
+            producer->full_retries++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void *consumer_thread_func(void *arg)
+{
+    bench_consumer_t *consumer = (bench_consumer_t *)arg;
+    for (long i = 0; i < consumer->count; i++)
+    {
+        void *message = NULL;
+        dequeue_message(consumer->queue, &message);
+        histogram_record(&consumer->latency, get_monotonic_time_ns() - ((bench_message_t *)message)->enqueue_ns);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Hands off the messages of all producers to one consumer and reports throughput and handoff latency.
+ */
+static void run_bench(int producers, long count, int capacity)
+{
+    message_queue_t queue;
+    initialize_message_queue(&queue, capacity);
+    bench_producer_t *bench = calloc((size_t)producers, sizeof(bench_producer_t));
+    bench_message_t *messages = malloc((size_t)producers * count * sizeof(bench_message_t));
+    bench_consumer_t *consumer = calloc(1, sizeof(bench_consumer_t));
+    if (bench == NULL || messages == NULL || consumer == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    consumer->queue = &queue;
+    consumer->count = producers * count;
+
+    pthread_t consumer_thread;
+    uint64_t start = get_monotonic_time_ns();
+    pthread_create(&consumer_thread, NULL, consumer_thread_func, consumer);
+    for (int i = 0; i < producers; i++)
+    {
+        bench[i].queue = &queue;
+        bench[i].messages = messages + (size_t)i * count;
+        bench[i].count = count;
+        pthread_create(&bench[i].thread, NULL, producer_thread_func, &bench[i]);
+    }
+    long full_retries = 0;
+    for (int i = 0; i < producers; i++)
+    {
+        pthread_join(bench[i].thread, NULL);
+        full_retries += bench[i].full_retries;
+    }
+    pthread_join(consumer_thread, NULL);
+    double elapsed = (get_monotonic_time_ns() - start) / 1e9;
+
+    long total = producers * count;
+    printf("%d:1 producers=%-3d messages=%-9ld capacity=%-6d %8.1f ns/message %6.2f M messages/s full_retries=%-8ld"
+           " handoff p50 %.1f us p99 %.1f us p99.9 %.1f us max %.1f us\n",
+           producers, producers, total, capacity, elapsed * 1e9 / total, total / elapsed / 1e6, full_retries,
+           histogram_percentile(&consumer->latency, 50) / 1e3, histogram_percentile(&consumer->latency, 99) / 1e3,
+           histogram_percentile(&consumer->latency, 99.9) / 1e3, metrics_counter_get(&consumer->latency.max) / 1e3);
+
+    // the messages belong to the producers, the queue is empty and frees nothing
+    destroy_message_queue(&queue);
+    free(consumer);
+    free(messages);
+    free(bench);
+}
+
+int main(int argc, char *argv[])
+{
+    int producers = argc > 1 ? atoi(argv[1]) : 4;
+    long count = argc > 2 ? atol(argv[2]) : 1000000;
+    int capacity = argc > 3 ? atoi(argv[3]) : 1024;
+    if (producers <= 0 || count <= 0 || capacity <= 0)
+    {
+        fprintf(stderr, "Usage: %s [producers] [messages_per_producer] [capacity]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    run_bench(1, count, capacity);
+    if (producers > 1)
+    {
+        run_bench(producers, count, capacity);
+    }
+    return EXIT_SUCCESS;
+}
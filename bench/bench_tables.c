@@ -0,0 +1,273 @@
+/**
+ * @file bench_tables.c
+ * @brief Insert, find and delete benchmarks of the call, dialog and transaction tables.
+ *
+ * Each table is filled with the given number of entries, then found and deleted by key in
+ * random order. The tables are linked lists, so a find or a delete walks half the table on
+ * average, and the number of finds and deletes is scaled down with the table size to keep
+ * the run time bounded. Misses look up keys that are not in the table, the path of every
+ * request that creates a new call, dialog or transaction. What is left is deleted with the
+ * delete_all function of the table, reported per entry.
+ *
+ * Usage: bench_tables [entries...]
+ */
+
+#include "prng.h"
+#include "sip_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_KEY_LENGTH 48
+#define BENCH_VISIT_BUDGET 20000000L // list nodes visited by the finds, and by the deletes, of one table size
+#define BENCH_MIN_LOOKUPS 50
+
+typedef struct
+{
+    const char *name;
+    void *(*insert)(void **table, const char *key, size_t length);
+    void *(*find)(void *table, const char *key, size_t length);
+    void (*delete)(void **table, const char *key, size_t length);
+    void (*delete_all)(void **table);
+    // the key of an inserted entry, which is not always the key it was created with
+    const char *(*entry_key)(void *entry, size_t *length);
+} bench_table_t;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *insert_call(void **table, const char *key, size_t length)
+{
+    return create_new_call((sip_call_t **)table, key, length);
+}
+
+static void *find_call(void *table, const char *key, size_t length)
+{
+    return find_call_by_id((sip_call_t *)table, key, length);
+}
+
+static void delete_call(void **table, const char *key, size_t length)
+{
+    delete_call_by_id((sip_call_t **)table, key, length);
+}
+
+static void delete_calls(void **table)
+{
+    delete_all_calls((sip_call_t **)table);
+}
+
+static const char *call_key(void *entry, size_t *length)
+{
+    *length = ((sip_call_t *)entry)->call_id_length;
+    return ((sip_call_t *)entry)->call_id;
+}
+
+static void *insert_dialog(void **table, const char *key, size_t length)
+{
+    return create_new_dialog((sip_dialog_t **)table, key, length);
+}
+
+// dialogs are found by both tags, the key holds the From tag, a space and the generated To tag
+static void *find_dialog(void *table, const char *key, size_t length)
+{
+    const char *to_tag = memchr(key, ' ', length);
+    return find_dialog_by_id((sip_dialog_t *)table, key, (size_t)(to_tag - key), to_tag + 1, length - (size_t)(to_tag - key) - 1);
+}
+
+static void delete_dialog(void **table, const char *key, size_t length)
+{
+    const char *to_tag = memchr(key, ' ', length);
+    delete_dialog_by_id((sip_dialog_t **)table, key, (size_t)(to_tag - key), to_tag + 1, length - (size_t)(to_tag - key) - 1);
+}
+
+static void delete_dialogs(void **table)
+{
+    delete_all_dialogs((sip_dialog_t **)table);
+}
+
+static const char *dialog_key(void *entry, size_t *length)
+{
+    static char key[BENCH_KEY_LENGTH];
+    sip_dialog_t *dialog = (sip_dialog_t *)entry;
+    *length = (size_t)snprintf(key, sizeof(key), "%.*s %.*s", (int)dialog->from_tag_length, dialog->from_tag,
+                               (int)dialog->to_tag_length, dialog->to_tag);
+    return key;
+}
+
+static void *insert_transaction(void **table, const char *key, size_t length)
+{
+    return create_new_transaction((sip_transaction_t **)table, key, length);
+}
+
+static void *find_transaction(void *table, const char *key, size_t length)
+{
+    return find_transaction_by_id((sip_transaction_t *)table, key, length);
+}
+
+static void delete_transaction(void **table, const char *key, size_t length)
+{
+    delete_transaction_by_id((sip_transaction_t **)table, key, length);
+}
+
+static void delete_transactions(void **table)
+{
+    delete_all_transactions((sip_transaction_t **)table);
+}
+
+static const char *transaction_key(void *entry, size_t *length)
+{
+    *length = ((sip_transaction_t *)entry)->branch_length;
+    return ((sip_transaction_t *)entry)->branch;
+}
+
+static const bench_table_t tables[] = {
+    {"calls", insert_call, find_call, delete_call, delete_calls, call_key},
+    {"dialogs", insert_dialog, find_dialog, delete_dialog, delete_dialogs, dialog_key},
+    {"transactions", insert_transaction, find_transaction, delete_transaction, delete_transactions, transaction_key},
+};
+
+static void report(const bench_table_t *table, const char *operation, long entries, long operations, double elapsed)
+{
+    printf("%-12s %-10s entries=%-8ld ops=%-8ld %14.1f ns/op\n", table->name, operation, entries, operations,
+           operations > 0 ? elapsed * 1e9 / operations : 0.0);
+}
+
+/**
+ * @brief Generates the key an entry is created with, a Call-ID, a From tag or a branch.
+ */
+static size_t make_key(const bench_table_t *table, long index, char *key)
+{
+    if (table->insert == insert_call)
+    {
+        return (size_t)snprintf(key, BENCH_KEY_LENGTH, "%08lx-%ld@bench.example.com", (unsigned long)prng_next() & 0xffffffffUL, index);
+    }
+    if (table->insert == insert_dialog)
+    {
+        return (size_t)snprintf(key, BENCH_KEY_LENGTH, "%08lx%ld", (unsigned long)prng_next() & 0xffffffffUL, index);
+    }
+    return (size_t)snprintf(key, BENCH_KEY_LENGTH, "z9hG4bK-%08lx-%ld", (unsigned long)prng_next() & 0xffffffffUL, index);
+}
+
+static void run_bench(const bench_table_t *table, long entries)
+{
+    char(*keys)[BENCH_KEY_LENGTH] = malloc((size_t)entries * BENCH_KEY_LENGTH);
+    size_t *lengths = malloc((size_t)entries * sizeof(size_t));
+    if (keys == NULL || lengths == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < entries; i++)
+    {
+        lengths[i] = make_key(table, i, keys[i]);
+    }
+
+    void *head = NULL;
+    double start = now_seconds();
+    for (long i = 0; i < entries; i++)
+    {
+        if (table->insert(&head, keys[i], lengths[i]) == NULL)
+        {
+            fprintf(stderr, "Failed to insert entry %ld\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    report(table, "insert", entries, entries, now_seconds() - start);
+
+    // the keys found and deleted are the ones the entries ended up with, next is the first member of every entry
+    long index = entries - 1;
+    for (void *entry = head; entry != NULL; entry = *(void **)entry, index--)
+    {
+        size_t length = 0;
+        const char *key = table->entry_key(entry, &length);
+        memcpy(keys[index], key, length);
+        lengths[index] = length;
+    }
+
+    long lookups = BENCH_VISIT_BUDGET / (entries / 2 + 1);
+    lookups = lookups < BENCH_MIN_LOOKUPS ? BENCH_MIN_LOOKUPS : lookups;
+    long found = 0;
+    start = now_seconds();
+    for (long i = 0; i < lookups; i++)
+    {
+        long k = (long)(prng_next() % (uint64_t)entries);
+        found += table->find(head, keys[k], lengths[k]) != NULL;
+    }
+    report(table, "find", entries, lookups, now_seconds() - start);
+    if (found != lookups)
+    {
+        fprintf(stderr, "%s: %ld of %ld keys not found\n", table->name, lookups - found, lookups);
+    }
+
+    char missing[BENCH_KEY_LENGTH];
+    size_t missing_length = make_key(table, -1, missing);
+    if (table->insert == insert_dialog)
+    {
+        missing_length += (size_t)snprintf(missing + missing_length, BENCH_KEY_LENGTH - missing_length, " 0");
+    }
+    start = now_seconds();
+    for (long i = 0; i < lookups; i++)
+    {
+        found += table->find(head, missing, missing_length) != NULL;
+    }
+    report(table, "miss", entries, lookups, now_seconds() - start);
+
+    // deletes of distinct random entries, a partial shuffle of the key indexes
+    long deletes = lookups < entries ? lookups : entries;
+    long *order = malloc((size_t)entries * sizeof(long));
+    if (order == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < entries; i++)
+    {
+        order[i] = i;
+    }
+    for (long i = 0; i < deletes; i++)
+    {
+        long j = i + (long)(prng_next() % (uint64_t)(entries - i));
+        long swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    start = now_seconds();
+    for (long i = 0; i < deletes; i++)
+    {
+        table->delete(&head, keys[order[i]], lengths[order[i]]);
+    }
+    report(table, "delete", entries, deletes, now_seconds() - start);
+
+    start = now_seconds();
+    table->delete_all(&head);
+    report(table, "delete_all", entries, entries - deletes, now_seconds() - start);
+
+    free(order);
+    free(lengths);
+    free(keys);
+}
+
+int main(int argc, char *argv[])
+{
+    long default_sizes[] = {1000, 100000, 1000000};
+    int size_count = argc > 1 ? argc - 1 : (int)(sizeof(default_sizes) / sizeof(default_sizes[0]));
+    for (int s = 0; s < size_count; s++)
+    {
+        long entries = argc > 1 ? atol(argv[s + 1]) : default_sizes[s];
+        if (entries <= 0)
+        {
+            fprintf(stderr, "Usage: %s [entries...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+        {
+            run_bench(&tables[t], entries);
+        }
+    }
+    return EXIT_SUCCESS;
+}
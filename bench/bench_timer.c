@@ -0,0 +1,127 @@
+/**
+ * @file bench_timer.c
+ * @brief Throughput and expiry jitter benchmark of the one-shot timers.
+ *
+ * A burst adds timers as fast as possible, measuring the cost of timer_one_shot_add, and
+ * the lateness of their expiry when they all fire at once. A paced run then adds a timer
+ * every millisecond, measuring the lateness of a lightly loaded timer thread. Lateness is
+ * the time from the requested expiry to the callback. Every timer holds a timerfd, so the
+ * burst is limited by the open file limit.
+ *
+ * Usage: bench_timer [burst_timers] [paced_timers]
+ */
+
+#include "metrics.h"
+#include "timer_manager.h"
+#include "utils.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define BENCH_BURST_DELAY_MS 1000
+#define BENCH_PACED_DELAY_MS 10
+#define BENCH_PACED_INTERVAL_NS 1000000L
+#define BENCH_RESERVED_FDS 64 // descriptors kept free for the timer thread and stdio
+#define BENCH_FIRE_TIMEOUT_MS 10000
+
+typedef struct
+{
+    uint64_t deadline_ns;
+} bench_timer_t;
+
+static latency_histogram_t lateness; // written by the timer thread only
+static atomic_long fired;
+
+static void timer_callback(void *user_data)
+{
+    bench_timer_t *timer = (bench_timer_t *)user_data;
+    uint64_t now = get_monotonic_time_ns();
+    histogram_record(&lateness, now > timer->deadline_ns ? now - timer->deadline_ns : 0);
+    atomic_fetch_add(&fired, 1);
+}
+
+/**
+ * @brief Waits for the timers to fire, and reports the lateness of their expiry.
+ */
+static void report_lateness(const char *name, long count)
+{
+    uint64_t give_up = get_monotonic_time_ms() + BENCH_FIRE_TIMEOUT_MS;
+    while (atomic_load(&fired) < count && get_monotonic_time_ms() < give_up)
+    {
+        struct timespec pause = {.tv_sec = 0, .tv_nsec = 1000000};
+        nanosleep(&pause, NULL);
+    }
+    printf("%-6s expiry timers=%-7ld fired=%-7ld lateness p50 %.1f us p99 %.1f us p99.9 %.1f us max %.1f us\n",
+           name, count, atomic_load(&fired), histogram_percentile(&lateness, 50) / 1e3,
+           histogram_percentile(&lateness, 99) / 1e3, histogram_percentile(&lateness, 99.9) / 1e3,
+           metrics_counter_get(&lateness.max) / 1e3);
+}
+
+static void reset(void)
+{
+    memset(&lateness, 0, sizeof(lateness));
+    atomic_store(&fired, 0);
+}
+
+static void run_burst(bench_timer_t *timers, long count)
+{
+    reset();
+    long added = 0;
+    uint64_t start = get_monotonic_time_ns();
+    for (long i = 0; i < count; i++)
+    {
+        timers[i].deadline_ns = get_monotonic_time_ns() + BENCH_BURST_DELAY_MS * 1000000ULL;
+        added += timer_one_shot_add(BENCH_BURST_DELAY_MS, timer_callback, &timers[i]) == 0;
+    }
+    double elapsed = (get_monotonic_time_ns() - start) / 1e9;
+    printf("burst  add    timers=%-7ld added=%-7ld %8.1f ns/add %8.0f adds/s\n", count, added, elapsed * 1e9 / count, count / elapsed);
+    report_lateness("burst", added);
+}
+
+static void run_paced(bench_timer_t *timers, long count)
+{
+    reset();
+    long added = 0;
+    for (long i = 0; i < count; i++)
+    {
+        timers[i].deadline_ns = get_monotonic_time_ns() + BENCH_PACED_DELAY_MS * 1000000ULL;
+        added += timer_one_shot_add(BENCH_PACED_DELAY_MS, timer_callback, &timers[i]) == 0;
+        struct timespec pause = {.tv_sec = 0, .tv_nsec = BENCH_PACED_INTERVAL_NS};
+        nanosleep(&pause, NULL);
+    }
+    report_lateness("paced", added);
+}
+
+int main(int argc, char *argv[])
+{
+    long burst = argc > 1 ? atol(argv[1]) : 10000;
+    long paced = argc > 2 ? atol(argv[2]) : 1000;
+    if (burst <= 0 || paced <= 0)
+    {
+        fprintf(stderr, "Usage: %s [burst_timers] [paced_timers]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY &&
+        burst > (long)limit.rlim_cur - BENCH_RESERVED_FDS)
+    {
+        burst = (long)limit.rlim_cur - BENCH_RESERVED_FDS;
+        fprintf(stderr, "Burst limited to %ld timers by the open file limit\n", burst);
+    }
+    bench_timer_t *timers = calloc((size_t)(burst > paced ? burst : paced), sizeof(bench_timer_t));
+    if (timers == NULL || timer_one_shot_init() != 0)
+    {
+        fprintf(stderr, "Failed to start the timers\n");
+        return EXIT_FAILURE;
+    }
+
+    run_burst(timers, burst);
+    run_paced(timers, paced);
+
+    timer_one_shot_shutdown();
+    free(timers);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,547 @@
+/**
+ * @file config.c
+ * @brief Implementation of SIP server runtime configuration.
+ */
+
+#include "config.h"
+#include "log.h"
+#include "sip_trace.h"
+#include "sip_overload.h"
+#include "rate_limiter.h"
+#include "source_filter.h"
+#include "uring.h"
+#include "utils.h"
+#include "tcp_transport.h"
+#include "tls_server.h"
+#include "sip_capture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+server_config_t server_config;
+
+/**
+ * @brief Prints the command line usage.
+ * @param program The program name.
+ */
+static void print_usage(const char *program)
+{
+    fprintf(stdout,
+            "Usage: %s [options]\n"
+            "  --listen <ip[:port]>       UDP address to receive on, repeatable up to %d times, IPv6 as [ip]:port,\n"
+            "                             an IPv6 wildcard also receives IPv4 unless 0.0.0.0 has the same port (default 0.0.0.0:%d)\n"
+            "  --tcp-listen <ip[:port]>   also receive SIP over TCP on this address, IPv6 as [ip]:port\n"
+            "  --tcp-max-connections <n>  TCP and TLS connections served at once (default %d)\n"
+            "  --tls-listen <ip[:port]>   also receive SIP over TLS on this address, IPv6 as [ip]:port (default port %d)\n"
+            "  --tls-cert <path>          PEM certificate chain of the TLS listener\n"
+            "  --tls-key <path>           PEM private key of the TLS certificate\n"
+            "  --tls-handshake-threads <n> threads running TLS handshakes, up to %d (default %d)\n"
+            "  --call-idle-timeout <sec>  reap calls and dialogs idle for this long, 0 disables (default %d)\n"
+            "  --reaper-batch <count>     calls and dialogs examined per worker loop iteration (default %d)\n"
+            "  --answer-delay <ms>        time from the 180 Ringing to the 200 OK, a CANCEL in between ends the call (default 0)\n"
+            "  --log-level <level>        error, info or debug (default debug)\n"
+            "  --log-rate-limit <count>   messages per log call site, thread and second, 0 disables (default %d)\n"
+            "  --trace-call-id <call-id>  trace the messages of a Call-ID regardless of the log level\n"
+            "  --trace-source <ip[:port]> trace the messages from a source address regardless of the log level\n"
+            "  --trace-file <path>        trace selection file, reloaded on SIGUSR2\n"
+            "  --metrics-interval <sec>   log a metrics summary at this interval, 0 disables (default 0)\n"
+            "  --admin-port <port>        serve Prometheus metrics on 127.0.0.1:<port>/metrics, 0 disables (default 0)\n"
+            "  --overload-queue-high <%%>  reject new INVITEs with 503 above this worker queue fill level, 0 disables (default %d)\n"
+            "  --overload-queue-low <%%>   admit new INVITEs again below this worker queue fill level (default %d)\n"
+            "  --overload-delay <ms>      reject new INVITEs above this average worker queue delay, 0 disables (default %d)\n"
+            "  --retry-after <sec>        Retry-After of the 503 responses to rejected INVITEs (default %d)\n"
+            "  --rate-limit <pps>         packets per second allowed per source address, 0 disables (default 0)\n"
+            "  --rate-limit-burst <count> packets a source can send at once, 0 means the rate (default 0)\n"
+            "  --rate-limit-action <act>  drop, or reject to answer new INVITEs above the rate with 503 (default drop)\n"
+            "  --rate-limit-table <count> source addresses tracked (default %d)\n"
+            "  --source-filter <path>     block and allow list of source prefixes, reloaded on SIGUSR2\n"
+            "  --drain-timeout <sec>      longest wait for in-flight transactions on SIGTERM, 0 stops at once (default %d)\n"
+            "  --io-backend <backend>     classic for recvmsg and sendto, or io_uring (default classic)\n"
+            "  --udp-gro                  let the kernel coalesce datagrams of a flow into one receive\n"
+            "  --udp-gso                  send consecutive responses to one peer with UDP segmentation offload\n"
+            "  --replay <path>            inject the SIP over UDP datagrams of a pcap or pcapng file, report and stop\n"
+            "  --replay-speed <factor>    pace of the replay relative to the capture, 0 for full speed (default 1)\n"
+            "  --replay-port <port>       replay only datagrams to this port, 0 replays all of them (default %d)\n"
+            "  --capture <prefix>         capture the UDP datagrams of the workers to <prefix>-w<worker>-<number>.pcap\n"
+            "  --capture-file-size <MB>   size of a capture file before the next one is started (default %d)\n"
+            "  --capture-files <count>    capture files kept per worker, 0 keeps all of them (default %d)\n"
+            "  --capture-sample <%%>       share of the calls captured, selected by Call-ID (default 100)\n"
+            "  --capture-call-id <id>     capture only the call with this Call-ID\n"
+            "  --cdr <path>               append a call detail record of every call to this CSV file\n"
+            "  --help                     show this help\n"
+            "SIGUSR1 cycles the log level through error, info and debug.\n"
+            "SIGHUP and SIGUSR2 reload the trace and source filter files.\n"
+            "SIGTERM and SIGINT reject new INVITEs and stop once in-flight transactions are done, a second one stops at once.\n",
+            program, MAX_LISTEN_ADDRESSES, DEFAULT_SIP_PORT, TCP_DEFAULT_MAX_CONNECTIONS,
+            DEFAULT_SIPS_PORT, METRICS_MAX_TLS_THREADS, TLS_DEFAULT_HANDSHAKE_THREADS, DEFAULT_CALL_IDLE_TIMEOUT_SEC, DEFAULT_REAPER_BATCH_SIZE, DEFAULT_LOG_RATE_LIMIT,
+            DEFAULT_OVERLOAD_QUEUE_HIGH_PERCENT, DEFAULT_OVERLOAD_QUEUE_LOW_PERCENT, DEFAULT_OVERLOAD_DELAY_HIGH_MS,
+            DEFAULT_OVERLOAD_RETRY_AFTER_SEC, DEFAULT_RATE_LIMIT_TABLE_SIZE, DEFAULT_DRAIN_TIMEOUT_SEC, DEFAULT_SIP_PORT,
+            SIP_CAPTURE_DEFAULT_FILE_SIZE_MB, SIP_CAPTURE_DEFAULT_FILES);
+}
+
+/**
+ * @brief Initializes the configuration with default values.
+ * @param config The configuration to initialize.
+ */
+void init_server_config(server_config_t *config)
+{
+    if (config == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    config->call_idle_timeout_sec = DEFAULT_CALL_IDLE_TIMEOUT_SEC;
+    config->reaper_batch_size = DEFAULT_REAPER_BATCH_SIZE;
+    config->answer_delay_ms = 0;
+    config->log_level = LOG_LEVEL_DEBUG;
+    config->log_rate_limit = DEFAULT_LOG_RATE_LIMIT;
+    config->trace_file = NULL;
+    config->metrics_interval_sec = 0;
+    config->admin_port = 0;
+    config->overload_queue_high = DEFAULT_OVERLOAD_QUEUE_HIGH_PERCENT;
+    config->overload_queue_low = DEFAULT_OVERLOAD_QUEUE_LOW_PERCENT;
+    config->overload_delay_high_ms = DEFAULT_OVERLOAD_DELAY_HIGH_MS;
+    config->overload_retry_after_sec = DEFAULT_OVERLOAD_RETRY_AFTER_SEC;
+    config->rate_limit = 0;
+    config->rate_limit_burst = 0;
+    config->rate_limit_action = RATE_LIMIT_ACTION_DROP;
+    config->rate_limit_table_size = DEFAULT_RATE_LIMIT_TABLE_SIZE;
+    config->source_filter = NULL;
+    config->drain_timeout_sec = DEFAULT_DRAIN_TIMEOUT_SEC;
+    config->io_backend = IO_BACKEND_CLASSIC;
+    config->udp_gro = 0;
+    config->udp_gso = 0;
+    config->listen_count = 0;
+    config->tcp_listen_address_length = 0;
+    config->tcp_max_connections = TCP_DEFAULT_MAX_CONNECTIONS;
+    config->tls_listen_address_length = 0;
+    config->tls_certificate = NULL;
+    config->tls_key = NULL;
+    config->tls_handshake_threads = TLS_DEFAULT_HANDSHAKE_THREADS;
+    config->replay_file = NULL;
+    config->replay_speed = 1.0;
+    config->replay_port = DEFAULT_SIP_PORT;
+    config->capture_prefix = NULL;
+    config->capture_file_size_mb = SIP_CAPTURE_DEFAULT_FILE_SIZE_MB;
+    config->capture_files = SIP_CAPTURE_DEFAULT_FILES;
+    config->capture_sample_percent = 100;
+    config->capture_call_id = NULL;
+    config->cdr_file = NULL;
+}
+
+/**
+ * @brief Parses command line arguments into the configuration.
+ * @param config The configuration to fill.
+ * @param argc The argument count.
+ * @param argv The argument vector.
+ * @return 0 on success, 1 if the program should exit successfully, -1 on invalid arguments.
+ */
+int parse_server_config_args(server_config_t *config, int argc, char *argv[])
+{
+    enum
+    {
+        OPTION_LISTEN = 256,
+        OPTION_TCP_LISTEN,
+        OPTION_TCP_MAX_CONNECTIONS,
+        OPTION_TLS_LISTEN,
+        OPTION_TLS_CERT,
+        OPTION_TLS_KEY,
+        OPTION_TLS_HANDSHAKE_THREADS,
+        OPTION_CALL_IDLE_TIMEOUT,
+        OPTION_REAPER_BATCH,
+        OPTION_ANSWER_DELAY,
+        OPTION_LOG_LEVEL,
+        OPTION_LOG_RATE_LIMIT,
+        OPTION_TRACE_CALL_ID,
+        OPTION_TRACE_SOURCE,
+        OPTION_TRACE_FILE,
+        OPTION_METRICS_INTERVAL,
+        OPTION_ADMIN_PORT,
+        OPTION_OVERLOAD_QUEUE_HIGH,
+        OPTION_OVERLOAD_QUEUE_LOW,
+        OPTION_OVERLOAD_DELAY,
+        OPTION_RETRY_AFTER,
+        OPTION_RATE_LIMIT,
+        OPTION_RATE_LIMIT_BURST,
+        OPTION_RATE_LIMIT_ACTION,
+        OPTION_RATE_LIMIT_TABLE,
+        OPTION_SOURCE_FILTER,
+        OPTION_DRAIN_TIMEOUT,
+        OPTION_IO_BACKEND,
+        OPTION_UDP_GRO,
+        OPTION_UDP_GSO,
+        OPTION_REPLAY,
+        OPTION_REPLAY_SPEED,
+        OPTION_REPLAY_PORT,
+        OPTION_CAPTURE,
+        OPTION_CAPTURE_FILE_SIZE,
+        OPTION_CAPTURE_FILES,
+        OPTION_CAPTURE_SAMPLE,
+        OPTION_CAPTURE_CALL_ID,
+        OPTION_CDR,
+        OPTION_HELP
+    };
+    static const struct option options[] = {
+        {"listen", required_argument, NULL, OPTION_LISTEN},
+        {"tcp-listen", required_argument, NULL, OPTION_TCP_LISTEN},
+        {"tcp-max-connections", required_argument, NULL, OPTION_TCP_MAX_CONNECTIONS},
+        {"tls-listen", required_argument, NULL, OPTION_TLS_LISTEN},
+        {"tls-cert", required_argument, NULL, OPTION_TLS_CERT},
+        {"tls-key", required_argument, NULL, OPTION_TLS_KEY},
+        {"tls-handshake-threads", required_argument, NULL, OPTION_TLS_HANDSHAKE_THREADS},
+        {"call-idle-timeout", required_argument, NULL, OPTION_CALL_IDLE_TIMEOUT},
+        {"reaper-batch", required_argument, NULL, OPTION_REAPER_BATCH},
+        {"answer-delay", required_argument, NULL, OPTION_ANSWER_DELAY},
+        {"log-level", required_argument, NULL, OPTION_LOG_LEVEL},
+        {"log-rate-limit", required_argument, NULL, OPTION_LOG_RATE_LIMIT},
+        {"trace-call-id", required_argument, NULL, OPTION_TRACE_CALL_ID},
+        {"trace-source", required_argument, NULL, OPTION_TRACE_SOURCE},
+        {"trace-file", required_argument, NULL, OPTION_TRACE_FILE},
+        {"metrics-interval", required_argument, NULL, OPTION_METRICS_INTERVAL},
+        {"admin-port", required_argument, NULL, OPTION_ADMIN_PORT},
+        {"overload-queue-high", required_argument, NULL, OPTION_OVERLOAD_QUEUE_HIGH},
+        {"overload-queue-low", required_argument, NULL, OPTION_OVERLOAD_QUEUE_LOW},
+        {"overload-delay", required_argument, NULL, OPTION_OVERLOAD_DELAY},
+        {"retry-after", required_argument, NULL, OPTION_RETRY_AFTER},
+        {"rate-limit", required_argument, NULL, OPTION_RATE_LIMIT},
+        {"rate-limit-burst", required_argument, NULL, OPTION_RATE_LIMIT_BURST},
+        {"rate-limit-action", required_argument, NULL, OPTION_RATE_LIMIT_ACTION},
+        {"rate-limit-table", required_argument, NULL, OPTION_RATE_LIMIT_TABLE},
+        {"source-filter", required_argument, NULL, OPTION_SOURCE_FILTER},
+        {"drain-timeout", required_argument, NULL, OPTION_DRAIN_TIMEOUT},
+        {"io-backend", required_argument, NULL, OPTION_IO_BACKEND},
+        {"udp-gro", no_argument, NULL, OPTION_UDP_GRO},
+        {"udp-gso", no_argument, NULL, OPTION_UDP_GSO},
+        {"replay", required_argument, NULL, OPTION_REPLAY},
+        {"replay-speed", required_argument, NULL, OPTION_REPLAY_SPEED},
+        {"replay-port", required_argument, NULL, OPTION_REPLAY_PORT},
+        {"capture", required_argument, NULL, OPTION_CAPTURE},
+        {"capture-file-size", required_argument, NULL, OPTION_CAPTURE_FILE_SIZE},
+        {"capture-files", required_argument, NULL, OPTION_CAPTURE_FILES},
+        {"capture-sample", required_argument, NULL, OPTION_CAPTURE_SAMPLE},
+        {"capture-call-id", required_argument, NULL, OPTION_CAPTURE_CALL_ID},
+        {"cdr", required_argument, NULL, OPTION_CDR},
+        {"help", no_argument, NULL, OPTION_HELP},
+        {NULL, 0, NULL, 0}};
+
+    if (config == NULL || argv == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case OPTION_LISTEN:
+            if (config->listen_count == MAX_LISTEN_ADDRESSES)
+            {
+                error("Too many listen addresses");
+                return -1;
+            }
+            config->listen_address_lengths[config->listen_count] = parse_socket_address(optarg, DEFAULT_SIP_PORT, &config->listen_addresses[config->listen_count]);
+            if (config->listen_address_lengths[config->listen_count] == 0)
+            {
+                error("Invalid listen address: %s", optarg);
+                return -1;
+            }
+            config->listen_count++;
+            break;
+        case OPTION_TCP_LISTEN:
+            config->tcp_listen_address_length = parse_socket_address(optarg, DEFAULT_SIP_PORT, &config->tcp_listen_address);
+            if (config->tcp_listen_address_length == 0)
+            {
+                error("Invalid TCP listen address: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_TCP_MAX_CONNECTIONS:
+            config->tcp_max_connections = atoi(optarg);
+            if (config->tcp_max_connections <= 0)
+            {
+                error("Invalid TCP connection limit: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_TLS_LISTEN:
+            config->tls_listen_address_length = parse_socket_address(optarg, DEFAULT_SIPS_PORT, &config->tls_listen_address);
+            if (config->tls_listen_address_length == 0)
+            {
+                error("Invalid TLS listen address: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_TLS_CERT:
+            config->tls_certificate = optarg;
+            break;
+        case OPTION_TLS_KEY:
+            config->tls_key = optarg;
+            break;
+        case OPTION_TLS_HANDSHAKE_THREADS:
+            config->tls_handshake_threads = atoi(optarg);
+            if (config->tls_handshake_threads <= 0 || config->tls_handshake_threads > METRICS_MAX_TLS_THREADS)
+            {
+                error("Invalid TLS handshake thread count: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_CALL_IDLE_TIMEOUT:
+            config->call_idle_timeout_sec = atoi(optarg);
+            if (config->call_idle_timeout_sec < 0)
+            {
+                error("Invalid call idle timeout: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_REAPER_BATCH:
+            config->reaper_batch_size = atoi(optarg);
+            if (config->reaper_batch_size <= 0)
+            {
+                error("Invalid reaper batch size: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_ANSWER_DELAY:
+            config->answer_delay_ms = atoi(optarg);
+            if (config->answer_delay_ms < 0)
+            {
+                error("Invalid answer delay: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_LOG_LEVEL:
+            config->log_level = log_level_from_string(optarg);
+            if (config->log_level < 0)
+            {
+                error("Invalid log level: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_LOG_RATE_LIMIT:
+            config->log_rate_limit = atoi(optarg);
+            if (config->log_rate_limit < 0)
+            {
+                error("Invalid log rate limit: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_TRACE_CALL_ID:
+            if (sip_trace_add_call_id(optarg, strlen(optarg)) != 0)
+            {
+                return -1;
+            }
+            break;
+        case OPTION_TRACE_SOURCE:
+            if (sip_trace_add_source(optarg) != 0)
+            {
+                return -1;
+            }
+            break;
+        case OPTION_TRACE_FILE:
+            config->trace_file = optarg;
+            if (sip_trace_load_file(config->trace_file) != 0)
+            {
+                return -1;
+            }
+            break;
+        case OPTION_METRICS_INTERVAL:
+            config->metrics_interval_sec = atoi(optarg);
+            if (config->metrics_interval_sec < 0)
+            {
+                error("Invalid metrics interval: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_ADMIN_PORT:
+            config->admin_port = atoi(optarg);
+            if (config->admin_port < 0 || config->admin_port > 65535)
+            {
+                error("Invalid admin port: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_OVERLOAD_QUEUE_HIGH:
+            config->overload_queue_high = atoi(optarg);
+            if (config->overload_queue_high < 0 || config->overload_queue_high > 100)
+            {
+                error("Invalid overload queue high watermark: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_OVERLOAD_QUEUE_LOW:
+            config->overload_queue_low = atoi(optarg);
+            if (config->overload_queue_low < 0 || config->overload_queue_low > 100)
+            {
+                error("Invalid overload queue low watermark: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_OVERLOAD_DELAY:
+            config->overload_delay_high_ms = atoi(optarg);
+            if (config->overload_delay_high_ms < 0)
+            {
+                error("Invalid overload delay: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_RETRY_AFTER:
+            config->overload_retry_after_sec = atoi(optarg);
+            if (config->overload_retry_after_sec < 0)
+            {
+                error("Invalid Retry-After: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_RATE_LIMIT:
+            config->rate_limit = atoi(optarg);
+            if (config->rate_limit < 0)
+            {
+                error("Invalid rate limit: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_RATE_LIMIT_BURST:
+            config->rate_limit_burst = atoi(optarg);
+            if (config->rate_limit_burst < 0)
+            {
+                error("Invalid rate limit burst: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_RATE_LIMIT_ACTION:
+            if (strcmp(optarg, "drop") == 0)
+            {
+                config->rate_limit_action = RATE_LIMIT_ACTION_DROP;
+            }
+            else if (strcmp(optarg, "reject") == 0)
+            {
+                config->rate_limit_action = RATE_LIMIT_ACTION_REJECT;
+            }
+            else
+            {
+                error("Invalid rate limit action: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_RATE_LIMIT_TABLE:
+            config->rate_limit_table_size = atoi(optarg);
+            if (config->rate_limit_table_size <= 0)
+            {
+                error("Invalid rate limit table size: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_SOURCE_FILTER:
+            config->source_filter = optarg;
+            if (source_filter_load_file(config->source_filter) != 0)
+            {
+                return -1;
+            }
+            break;
+        case OPTION_DRAIN_TIMEOUT:
+            config->drain_timeout_sec = atoi(optarg);
+            if (config->drain_timeout_sec < 0)
+            {
+                error("Invalid drain timeout: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_IO_BACKEND:
+            if (strcmp(optarg, "classic") == 0)
+            {
+                config->io_backend = IO_BACKEND_CLASSIC;
+            }
+            else if (strcmp(optarg, "io_uring") == 0)
+            {
+                config->io_backend = IO_BACKEND_IO_URING;
+            }
+            else
+            {
+                error("Invalid I/O backend: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_UDP_GRO:
+            config->udp_gro = 1;
+            break;
+        case OPTION_UDP_GSO:
+            config->udp_gso = 1;
+            break;
+        case OPTION_REPLAY:
+            config->replay_file = optarg;
+            break;
+        case OPTION_REPLAY_SPEED:
+        {
+            char *end = NULL;
+            config->replay_speed = strtod(optarg, &end);
+            if (end == optarg || *end != '\0' || config->replay_speed < 0)
+            {
+                error("Invalid replay speed: %s", optarg);
+                return -1;
+            }
+            break;
+        }
+        case OPTION_REPLAY_PORT:
+            config->replay_port = atoi(optarg);
+            if (config->replay_port < 0 || config->replay_port > 65535)
+            {
+                error("Invalid replay port: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_CAPTURE:
+            config->capture_prefix = optarg;
+            break;
+        case OPTION_CAPTURE_FILE_SIZE:
+            config->capture_file_size_mb = atoi(optarg);
+            if (config->capture_file_size_mb <= 0)
+            {
+                error("Invalid capture file size: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_CAPTURE_FILES:
+            config->capture_files = atoi(optarg);
+            if (config->capture_files < 0)
+            {
+                error("Invalid capture file count: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_CAPTURE_SAMPLE:
+            config->capture_sample_percent = atoi(optarg);
+            if (config->capture_sample_percent <= 0 || config->capture_sample_percent > 100)
+            {
+                error("Invalid capture sample percentage: %s", optarg);
+                return -1;
+            }
+            break;
+        case OPTION_CAPTURE_CALL_ID:
+            config->capture_call_id = optarg;
+            break;
+        case OPTION_CDR:
+            config->cdr_file = optarg;
+            break;
+        case OPTION_HELP:
+            print_usage(argv[0]);
+            return 1;
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if (config->tls_listen_address_length > 0 && (config->tls_certificate == NULL || config->tls_key == NULL))
+    {
+        error("--tls-listen needs --tls-cert and --tls-key");
+        return -1;
+    }
+    if (config->listen_count == 0)
+    {
+        config->listen_address_lengths[0] = parse_socket_address("0.0.0.0", DEFAULT_SIP_PORT, &config->listen_addresses[0]);
+        config->listen_count = 1;
+    }
+    return 0;
+}
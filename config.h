@@ -0,0 +1,73 @@
+/**
+ * @file config.h
+ * @brief Header for SIP server runtime configuration.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <sys/socket.h>
+
+#define DEFAULT_CALL_IDLE_TIMEOUT_SEC 3600
+#define DEFAULT_REAPER_BATCH_SIZE 16
+#define DEFAULT_LOG_RATE_LIMIT 1000
+#define DEFAULT_DRAIN_TIMEOUT_SEC 32
+#define DEFAULT_SIP_PORT 5060
+#define DEFAULT_SIPS_PORT 5061
+#define MAX_LISTEN_ADDRESSES 8
+
+/**
+ * @struct server_config_t
+ * @brief Structure holding the runtime configuration of the SIP server.
+ */
+typedef struct
+{
+    int call_idle_timeout_sec;    // calls and dialogs without activity for this long are reaped, 0 disables
+    int reaper_batch_size;        // maximum number of calls and dialogs examined per worker loop iteration
+    int answer_delay_ms;          // time from the 180 Ringing to the 200 OK of an INVITE, 0 answers at once
+    int log_level;                // most verbose log level recorded at runtime
+    int log_rate_limit;           // maximum messages per log call site and second, 0 disables
+    const char *trace_file;       // trace selection reloaded on SIGUSR2
+    int metrics_interval_sec;     // interval of the metrics summary log, 0 disables
+    int admin_port;               // loopback TCP port of the Prometheus metrics endpoint, 0 disables
+    int overload_queue_high;      // worker queue fill percentage starting to reject new calls, 0 disables
+    int overload_queue_low;       // worker queue fill percentage admitting new calls again
+    int overload_delay_high_ms;   // average worker queue delay starting to reject new calls, 0 disables
+    int overload_retry_after_sec; // Retry-After of the 503 responses to rejected calls
+    int rate_limit;               // packets per second and source address, 0 disables
+    int rate_limit_burst;         // token bucket size in packets, 0 means the rate
+    int rate_limit_action;        // rate_limit_action_t applied above the rate
+    int rate_limit_table_size;    // number of source addresses tracked
+    const char *source_filter;    // source address block and allow list reloaded on SIGUSR2
+    int drain_timeout_sec;        // longest wait for in-flight transactions on SIGTERM, 0 stops at once
+    int io_backend;               // io_backend_t used to receive and send datagrams
+    int udp_gro;                  // receive datagrams coalesced by UDP GRO, classic backend only
+    int udp_gso;                  // send batched responses to one peer with UDP GSO, classic backend only
+    struct sockaddr_storage listen_addresses[MAX_LISTEN_ADDRESSES]; // one UDP socket each, 0.0.0.0:5060 when none is given
+    socklen_t listen_address_lengths[MAX_LISTEN_ADDRESSES];
+    int listen_count;
+    struct sockaddr_storage tcp_listen_address; // TCP listener, unused when tcp_listen_address_length is 0
+    socklen_t tcp_listen_address_length;
+    int tcp_max_connections; // TCP and TLS connections served at once
+    struct sockaddr_storage tls_listen_address; // TLS listener, unused when tls_listen_address_length is 0
+    socklen_t tls_listen_address_length;
+    const char *tls_certificate;   // PEM certificate chain of the TLS listener
+    const char *tls_key;           // PEM private key of the certificate
+    int tls_handshake_threads;     // threads running TLS handshakes
+    const char *replay_file;       // pcap or pcapng file replayed into the server, which stops once it is processed
+    double replay_speed;           // factor of the original pace of the replay, 0 for as fast as the workers keep up
+    int replay_port;               // destination port of the replayed datagrams, 0 replays all of them
+    const char *capture_prefix;    // path prefix of the pcap capture files of the workers, NULL disables capture
+    int capture_file_size_mb;      // size of a capture file
+    int capture_files;             // capture files kept per worker, 0 keeps all of them
+    int capture_sample_percent;    // share of the calls captured
+    const char *capture_call_id;   // only Call-ID captured, NULL captures all of them
+    const char *cdr_file;          // CSV file the call detail records are appended to, NULL disables them
+} server_config_t;
+
+extern server_config_t server_config;
+
+void init_server_config(server_config_t *config);
+int parse_server_config_args(server_config_t *config, int argc, char *argv[]);
+
+#endif // CONFIG_H
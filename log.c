@@ -0,0 +1,865 @@
+/**
+ * @file log.c
+ * @brief Implementation of the asynchronous per-thread ring buffer logger.
+ *
+ * Every thread that logs owns a single producer single consumer ring. A record holds a
+ * pointer to the static call site (format, function, level) followed by the arguments,
+ * encoded by walking the printf conversions of the format. Strings are copied, since the
+ * buffers they point into are usually freed long before the record is formatted. When a
+ * ring is full the record is dropped and counted instead of blocking the caller. The rate
+ * limit is kept per thread as well, so a flooding call site shares no cache line between
+ * the threads logging it.
+ */
+
+#include "log.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define LOG_RING_SIZE (256 * 1024)
+#define LOG_RECORD_MAX_SIZE 4096
+#define LOG_OUTPUT_BUFFER_SIZE (64 * 1024)
+#define LOG_LINE_MAX_SIZE 8192
+#define LOG_IDLE_SLEEP_MS 10
+#define LOG_DEFAULT_RATE_LIMIT 1000
+#define LOG_CALLSITE_SLOTS 1024 // rate limited call sites per thread, further ones share slots
+
+#define LOG_RECORD_WRAP 0
+
+typedef enum
+{
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STRING,
+    LOG_ARG_POINTER,
+    LOG_ARG_NONE
+} log_arg_type_t;
+
+/**
+ * @struct log_conversion_t
+ * @brief A single printf conversion of a format string.
+ */
+typedef struct
+{
+    const char *start;
+    size_t length;
+    bool width_star;
+    bool precision_star;
+    int precision; // -1 if no precision is given
+    char length_modifier[3];
+    log_arg_type_t type;
+} log_conversion_t;
+
+typedef struct
+{
+    uint32_t size; // record size including the header, LOG_RECORD_WRAP marks the end of the ring
+    uint32_t suppressed;
+    const log_callsite_t *callsite;
+} log_record_header_t;
+
+/**
+ * @struct log_callsite_window_t
+ * @brief Rate limit state of a call site in one logging thread.
+ */
+typedef struct
+{
+    uint64_t window; // second of the monotonic clock the count belongs to
+    uint32_t count;
+    uint32_t suppressed; // reported with the next message of the call site from this thread
+} log_callsite_window_t;
+
+typedef struct log_ring_s
+{
+    struct log_ring_s *next;
+    int tid;
+    _Alignas(64) atomic_uint_fast64_t head;
+    _Alignas(64) atomic_uint_fast64_t tail;
+    _Alignas(64) char data[LOG_RING_SIZE];
+} log_ring_t;
+
+typedef struct
+{
+    int fd;
+    size_t length;
+    char data[LOG_OUTPUT_BUFFER_SIZE];
+} log_output_t;
+
+static const char *level_names[] = {"ERROR", "INFO", "LOG"};
+
+atomic_int log_level = LOG_LEVEL_DEBUG;
+static atomic_uint rate_limit = LOG_DEFAULT_RATE_LIMIT;
+static atomic_uint_fast64_t dropped = 0;
+
+static _Atomic(log_ring_t *) rings = NULL;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread log_ring_t *thread_ring = NULL;
+static __thread int thread_tid = 0;
+static atomic_uint callsite_slots = 0;
+static __thread log_callsite_window_t thread_windows[LOG_CALLSITE_SLOTS];
+
+static pthread_t writer_thread;
+static atomic_bool running = false;
+
+static log_output_t stdout_output = {.fd = STDOUT_FILENO};
+static log_output_t stderr_output = {.fd = STDERR_FILENO};
+
+/**
+ * @brief Parses the printf conversion starting at the given '%'.
+ * @param p Pointer to the '%' character.
+ * @param conversion The parsed conversion.
+ * @return Pointer to the character after the conversion.
+ */
+static const char *parse_conversion(const char *p, log_conversion_t *conversion)
+{
+    memset(conversion, 0, sizeof(log_conversion_t));
+    conversion->start = p;
+    conversion->precision = -1;
+    p++;
+
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0')
+    {
+        p++;
+    }
+    if (*p == '*')
+    {
+        conversion->width_star = true;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9')
+    {
+        p++;
+    }
+    if (*p == '.')
+    {
+        p++;
+        conversion->precision = 0;
+        if (*p == '*')
+        {
+            conversion->precision_star = true;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9')
+        {
+            conversion->precision = conversion->precision * 10 + (*p - '0');
+            p++;
+        }
+    }
+    int modifier_length = 0;
+    while ((*p == 'h' || *p == 'l' || *p == 'z' || *p == 'j' || *p == 't' || *p == 'L') && modifier_length < 2)
+    {
+        conversion->length_modifier[modifier_length++] = *p++;
+    }
+
+    switch (*p)
+    {
+    case 'd':
+    case 'i':
+    case 'c':
+        conversion->type = LOG_ARG_INT;
+        break;
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+        conversion->type = LOG_ARG_UINT;
+        break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        conversion->type = LOG_ARG_DOUBLE;
+        break;
+    case 's':
+        conversion->type = LOG_ARG_STRING;
+        break;
+    case 'p':
+        conversion->type = LOG_ARG_POINTER;
+        break;
+    default:
+        // '%%' and anything unsupported consume no argument
+        conversion->type = LOG_ARG_NONE;
+        break;
+    }
+    if (*p != '\0')
+    {
+        p++;
+    }
+    conversion->length = p - conversion->start;
+    return p;
+}
+
+/**
+ * @brief Appends bytes to a record, returns false if the record is full.
+ */
+static bool record_append(char *record, size_t *length, const void *data, size_t size)
+{
+    if (*length + size > LOG_RECORD_MAX_SIZE)
+    {
+        return false;
+    }
+    memcpy(record + *length, data, size);
+    *length += size;
+    return true;
+}
+
+/**
+ * @brief Returns the smallest record space the conversions left in a format need, with
+ * their strings truncated to nothing.
+ */
+static size_t get_remaining_arguments_size(const char *p)
+{
+    log_conversion_t conversion;
+    size_t size = 0;
+    while ((p = strchr(p, '%')) != NULL)
+    {
+        p = parse_conversion(p, &conversion);
+        size += (conversion.width_star ? sizeof(int) : 0) + (conversion.precision_star ? sizeof(int) : 0);
+        if (conversion.type == LOG_ARG_STRING)
+            size += sizeof(uint32_t) + 1;
+        else if (conversion.type != LOG_ARG_NONE)
+            size += sizeof(uint64_t);
+    }
+    return size;
+}
+
+/**
+ * @brief Encodes the arguments of a format into a record.
+ * @return The record length, or 0 if the arguments do not fit.
+ */
+static size_t encode_arguments(char *record, size_t length, const char *format, va_list args)
+{
+    const char *p = format;
+    log_conversion_t conversion;
+
+    while ((p = strchr(p, '%')) != NULL)
+    {
+        p = parse_conversion(p, &conversion);
+        if (conversion.width_star)
+        {
+            int width = va_arg(args, int);
+            if (!record_append(record, &length, &width, sizeof(width)))
+                return 0;
+        }
+        int precision = conversion.precision;
+        if (conversion.precision_star)
+        {
+            precision = va_arg(args, int);
+            if (!record_append(record, &length, &precision, sizeof(precision)))
+                return 0;
+        }
+
+        const char *m = conversion.length_modifier;
+        switch (conversion.type)
+        {
+        case LOG_ARG_INT:
+        {
+            int64_t value;
+            if (m[0] == 'l' || m[0] == 'j')
+                value = m[1] == 'l' ? va_arg(args, long long) : va_arg(args, long);
+            else if (m[0] == 'z' || m[0] == 't')
+                value = va_arg(args, ssize_t);
+            else
+                value = va_arg(args, int);
+            if (!record_append(record, &length, &value, sizeof(value)))
+                return 0;
+            break;
+        }
+        case LOG_ARG_UINT:
+        {
+            uint64_t value;
+            if (m[0] == 'l' || m[0] == 'j')
+                value = m[1] == 'l' ? va_arg(args, unsigned long long) : va_arg(args, unsigned long);
+            else if (m[0] == 'z' || m[0] == 't')
+                value = va_arg(args, size_t);
+            else
+                value = va_arg(args, unsigned int);
+            if (!record_append(record, &length, &value, sizeof(value)))
+                return 0;
+            break;
+        }
+        case LOG_ARG_DOUBLE:
+        {
+            double value = m[0] == 'L' ? (double)va_arg(args, long double) : va_arg(args, double);
+            if (!record_append(record, &length, &value, sizeof(value)))
+                return 0;
+            break;
+        }
+        case LOG_ARG_POINTER:
+        {
+            uint64_t value = (uintptr_t)va_arg(args, void *);
+            if (!record_append(record, &length, &value, sizeof(value)))
+                return 0;
+            break;
+        }
+        case LOG_ARG_STRING:
+        {
+            const char *value = va_arg(args, const char *);
+            if (value == NULL)
+            {
+                value = "(null)";
+            }
+            uint32_t string_length = precision >= 0 ? strnlen(value, precision) : strlen(value);
+            // truncate long strings such as message dumps instead of dropping the record, leaving
+            // room for the arguments that follow; shorter strings leave more than the format can use
+            if (length + sizeof(string_length) + string_length + 1 > LOG_RECORD_MAX_SIZE / 2)
+            {
+                size_t reserved = length + sizeof(string_length) + 1 + get_remaining_arguments_size(p);
+                if (reserved > LOG_RECORD_MAX_SIZE)
+                    return 0;
+                if (string_length > LOG_RECORD_MAX_SIZE - reserved)
+                    string_length = LOG_RECORD_MAX_SIZE - reserved;
+            }
+            record_append(record, &length, &string_length, sizeof(string_length));
+            record_append(record, &length, value, string_length);
+            record[length++] = '\0';
+            break;
+        }
+        case LOG_ARG_NONE:
+            break;
+        }
+    }
+    return length;
+}
+
+/**
+ * @brief Formats a record into a line.
+ * @return The line length.
+ */
+static size_t format_record(const log_record_header_t *header, int tid, const char *args, char *line, size_t line_size)
+{
+    const log_callsite_t *callsite = header->callsite;
+    const char *format = callsite->format;
+    const char *p = format;
+    log_conversion_t conversion;
+    char spec[32];
+    size_t length = snprintf(line, line_size, "%s: [tid:%d] [%s] ", level_names[callsite->level], tid, callsite->function);
+
+    while (*p != '\0' && length < line_size)
+    {
+        const char *next = strchr(p, '%');
+        size_t literal = next != NULL ? (size_t)(next - p) : strlen(p);
+        if (literal > line_size - length)
+        {
+            literal = line_size - length;
+        }
+        memcpy(line + length, p, literal);
+        length += literal;
+        if (next == NULL)
+        {
+            break;
+        }
+
+        p = parse_conversion(next, &conversion);
+        if (conversion.type == LOG_ARG_NONE)
+        {
+            if (conversion.length == 2 && next[1] == '%' && length < line_size)
+            {
+                line[length++] = '%';
+            }
+            continue;
+        }
+
+        int width = 0;
+        int precision = 0;
+        if (conversion.width_star)
+        {
+            memcpy(&width, args, sizeof(width));
+            args += sizeof(width);
+        }
+        if (conversion.precision_star)
+        {
+            memcpy(&precision, args, sizeof(precision));
+            args += sizeof(precision);
+        }
+
+        // rebuild the conversion without length modifiers, the values are stored widened
+        size_t spec_length = 0;
+        for (size_t i = 0; i < conversion.length && spec_length < sizeof(spec) - 4; i++)
+        {
+            char c = conversion.start[i];
+            if (c == 'h' || c == 'l' || c == 'z' || c == 'j' || c == 't' || c == 'L')
+            {
+                continue;
+            }
+            if (i == conversion.length - 1)
+            {
+                if (conversion.type == LOG_ARG_INT && c != 'c')
+                {
+                    spec[spec_length++] = 'l';
+                    spec[spec_length++] = 'l';
+                }
+                else if (conversion.type == LOG_ARG_UINT)
+                {
+                    spec[spec_length++] = 'l';
+                    spec[spec_length++] = 'l';
+                }
+            }
+            spec[spec_length++] = c;
+        }
+        spec[spec_length] = '\0';
+
+        size_t remaining = line_size - length;
+        int written = 0;
+        switch (conversion.type)
+        {
+        case LOG_ARG_INT:
+        {
+            int64_t value;
+            memcpy(&value, args, sizeof(value));
+            args += sizeof(value);
+            if (conversion.start[conversion.length - 1] == 'c')
+                written = snprintf(line + length, remaining, conversion.width_star ? "%*c" : "%c",
+                                   conversion.width_star ? width : (int)value, (int)value);
+            else if (conversion.width_star && conversion.precision_star)
+                written = snprintf(line + length, remaining, spec, width, precision, (long long)value);
+            else if (conversion.width_star || conversion.precision_star)
+                written = snprintf(line + length, remaining, spec, conversion.width_star ? width : precision, (long long)value);
+            else
+                written = snprintf(line + length, remaining, spec, (long long)value);
+            break;
+        }
+        case LOG_ARG_UINT:
+        case LOG_ARG_POINTER:
+        {
+            uint64_t value;
+            memcpy(&value, args, sizeof(value));
+            args += sizeof(value);
+            if (conversion.type == LOG_ARG_POINTER)
+                written = snprintf(line + length, remaining, "%p", (void *)(uintptr_t)value);
+            else if (conversion.width_star && conversion.precision_star)
+                written = snprintf(line + length, remaining, spec, width, precision, (unsigned long long)value);
+            else if (conversion.width_star || conversion.precision_star)
+                written = snprintf(line + length, remaining, spec, conversion.width_star ? width : precision, (unsigned long long)value);
+            else
+                written = snprintf(line + length, remaining, spec, (unsigned long long)value);
+            break;
+        }
+        case LOG_ARG_DOUBLE:
+        {
+            double value;
+            memcpy(&value, args, sizeof(value));
+            args += sizeof(value);
+            if (conversion.width_star && conversion.precision_star)
+                written = snprintf(line + length, remaining, spec, width, precision, value);
+            else if (conversion.width_star || conversion.precision_star)
+                written = snprintf(line + length, remaining, spec, conversion.width_star ? width : precision, value);
+            else
+                written = snprintf(line + length, remaining, spec, value);
+            break;
+        }
+        case LOG_ARG_STRING:
+        {
+            uint32_t string_length;
+            memcpy(&string_length, args, sizeof(string_length));
+            args += sizeof(string_length);
+            const char *value = args;
+            args += string_length + 1;
+            // the stored copy is already cut to the precision
+            if (conversion.width_star && conversion.precision_star)
+                written = snprintf(line + length, remaining, spec, width, precision, value);
+            else if (conversion.width_star || conversion.precision_star)
+                written = snprintf(line + length, remaining, spec, conversion.width_star ? width : precision, value);
+            else
+                written = snprintf(line + length, remaining, spec, value);
+            break;
+        }
+        case LOG_ARG_NONE:
+            break;
+        }
+        if (written > 0)
+        {
+            length += (size_t)written < remaining ? (size_t)written : remaining;
+        }
+    }
+
+    if (length >= line_size)
+    {
+        length = line_size - 1;
+    }
+    if (header->suppressed > 0)
+    {
+        // formatted apart and cut to the room left, the message may have filled the line
+        char suffix[48];
+        int written = snprintf(suffix, sizeof(suffix), " [%u similar messages suppressed]", header->suppressed);
+        size_t room = line_size - 1 - length;
+        size_t copied = written > 0 && (size_t)written < room ? (size_t)written : room;
+        memcpy(line + length, suffix, copied);
+        length += copied;
+    }
+    if (length >= line_size - 1)
+    {
+        length = line_size - 2;
+    }
+    line[length++] = '\n';
+    return length;
+}
+
+/**
+ * @brief Writes out everything buffered for an output.
+ */
+static void output_flush(log_output_t *output)
+{
+    size_t offset = 0;
+    while (offset < output->length)
+    {
+        ssize_t written = write(output->fd, output->data + offset, output->length - offset);
+        if (written <= 0)
+        {
+            break;
+        }
+        offset += written;
+    }
+    output->length = 0;
+}
+
+/**
+ * @brief Appends a line to an output, flushing it when it is full.
+ */
+static void output_append(log_output_t *output, const char *line, size_t length)
+{
+    if (output->length + length > sizeof(output->data))
+    {
+        output_flush(output);
+    }
+    memcpy(output->data + output->length, line, length);
+    output->length += length;
+}
+
+/**
+ * @brief Returns the ring of the calling thread, creating it on first use.
+ */
+static log_ring_t *get_thread_ring(void)
+{
+    if (thread_ring != NULL)
+    {
+        return thread_ring;
+    }
+    log_ring_t *ring = aligned_alloc(64, sizeof(log_ring_t));
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+    ring->tid = gettid();
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+
+    pthread_mutex_lock(&rings_mutex);
+    ring->next = atomic_load(&rings);
+    atomic_store_explicit(&rings, ring, memory_order_release);
+    pthread_mutex_unlock(&rings_mutex);
+
+    thread_ring = ring;
+    return ring;
+}
+
+/**
+ * @brief Copies a record into a ring.
+ * @return true on success, false if the ring is full.
+ */
+static bool ring_push(log_ring_t *ring, const char *record, size_t length)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t position = head % LOG_RING_SIZE;
+    size_t padding = 0;
+
+    if (position + length > LOG_RING_SIZE)
+    {
+        // records are contiguous, skip the rest of the ring and start over
+        padding = LOG_RING_SIZE - position;
+    }
+    if (LOG_RING_SIZE - (head - tail) < padding + length)
+    {
+        return false;
+    }
+    if (padding > 0)
+    {
+        uint32_t wrap = LOG_RECORD_WRAP;
+        memcpy(ring->data + position, &wrap, sizeof(wrap));
+        position = 0;
+    }
+    memcpy(ring->data + position, record, length);
+    atomic_store_explicit(&ring->head, head + padding + length, memory_order_release);
+    return true;
+}
+
+/**
+ * @brief Formats and writes a record synchronously, used while the writer thread is not running.
+ */
+static void write_record_now(const char *record)
+{
+    char line[LOG_LINE_MAX_SIZE];
+    const log_record_header_t *header = (const log_record_header_t *)record;
+    size_t length = format_record(header, thread_tid, record + sizeof(log_record_header_t), line, sizeof(line));
+    fwrite(line, 1, length, header->callsite->level == LOG_LEVEL_ERROR ? stderr : stdout);
+}
+
+/**
+ * @brief Returns the rate limit state of a call site in the calling thread.
+ */
+static log_callsite_window_t *get_callsite_window(log_callsite_t *callsite)
+{
+    unsigned int slot = atomic_load_explicit(&callsite->slot, memory_order_relaxed);
+    if (slot == 0)
+    {
+        // written once per call site, a thread losing the race takes the slot of the winner
+        unsigned int assigned = atomic_fetch_add_explicit(&callsite_slots, 1, memory_order_relaxed) + 1;
+        slot = atomic_compare_exchange_strong_explicit(&callsite->slot, &slot, assigned, memory_order_relaxed, memory_order_relaxed)
+                   ? assigned
+                   : slot;
+    }
+    return &thread_windows[(slot - 1) % LOG_CALLSITE_SLOTS];
+}
+
+/**
+ * @brief Records a log message. Called by the logging macros only.
+ * @param callsite The static call site of the message.
+ * @param format The format of the message, the same as the call site format.
+ */
+void log_write(log_callsite_t *callsite, const char *format, ...)
+{
+    uint32_t suppressed = 0;
+    unsigned int limit = atomic_load_explicit(&rate_limit, memory_order_relaxed);
+    if (limit > 0)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        log_callsite_window_t *window = get_callsite_window(callsite);
+        if (window->window != (uint64_t)ts.tv_sec)
+        {
+            window->window = ts.tv_sec;
+            window->count = 0;
+        }
+        if (window->count >= limit)
+        {
+            window->suppressed++;
+            return;
+        }
+        window->count++;
+        suppressed = window->suppressed;
+        window->suppressed = 0;
+    }
+
+    if (thread_tid == 0)
+    {
+        thread_tid = gettid();
+    }
+
+    _Alignas(8) char record[LOG_RECORD_MAX_SIZE];
+    log_record_header_t *header = (log_record_header_t *)record;
+    header->suppressed = suppressed;
+    header->callsite = callsite;
+
+    va_list args;
+    va_start(args, format);
+    size_t length = encode_arguments(record, sizeof(log_record_header_t), format, args);
+    va_end(args);
+    if (length == 0)
+    {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+    length = (length + 7) & ~(size_t)7;
+    header->size = length;
+
+    if (!atomic_load_explicit(&running, memory_order_acquire))
+    {
+        write_record_now(record);
+        return;
+    }
+
+    log_ring_t *ring = get_thread_ring();
+    if (ring == NULL || !ring_push(ring, record, length))
+    {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Formats and writes out all records of a ring.
+ * @return The number of records written.
+ */
+static int drain_ring(log_ring_t *ring)
+{
+    char line[LOG_LINE_MAX_SIZE];
+    int count = 0;
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    while (tail != head)
+    {
+        size_t position = tail % LOG_RING_SIZE;
+        uint32_t size;
+        memcpy(&size, ring->data + position, sizeof(size));
+        if (size == LOG_RECORD_WRAP)
+        {
+            tail += LOG_RING_SIZE - position;
+            continue;
+        }
+        const log_record_header_t *header = (const log_record_header_t *)(ring->data + position);
+        size_t length = format_record(header, ring->tid, ring->data + position + sizeof(log_record_header_t), line, sizeof(line));
+        output_append(header->callsite->level == LOG_LEVEL_ERROR ? &stderr_output : &stdout_output, line, length);
+        tail += size;
+        count++;
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    return count;
+}
+
+/**
+ * @brief Drains all rings once and writes out the result.
+ * @return The number of records written.
+ */
+static int drain_all_rings(void)
+{
+    int count = 0;
+    for (log_ring_t *ring = atomic_load_explicit(&rings, memory_order_acquire); ring != NULL; ring = ring->next)
+    {
+        count += drain_ring(ring);
+    }
+    output_flush(&stdout_output);
+    output_flush(&stderr_output);
+    return count;
+}
+
+/**
+ * @brief Writer thread function, formats the records of all rings.
+ */
+static void *writer_thread_func(void *arg)
+{
+    uint64_t reported_dropped = 0;
+    while (atomic_load_explicit(&running, memory_order_acquire))
+    {
+        int count = drain_all_rings();
+
+        uint64_t current_dropped = atomic_load_explicit(&dropped, memory_order_relaxed);
+        if (current_dropped != reported_dropped)
+        {
+            char line[128];
+            int length = snprintf(line, sizeof(line), "ERROR: [logger] %llu log messages dropped, %llu in total\n",
+                                  (unsigned long long)(current_dropped - reported_dropped), (unsigned long long)current_dropped);
+            output_append(&stderr_output, line, length);
+            output_flush(&stderr_output);
+            reported_dropped = current_dropped;
+        }
+
+        if (count == 0)
+        {
+            struct timespec ts = {.tv_sec = 0, .tv_nsec = LOG_IDLE_SLEEP_MS * 1000000};
+            nanosleep(&ts, NULL);
+        }
+    }
+    drain_all_rings();
+    return NULL;
+}
+
+/**
+ * @brief Starts the background writer thread. Until then messages are written synchronously.
+ * @return 0 on success, -1 on failure.
+ */
+int log_init(void)
+{
+    fflush(stdout);
+    fflush(stderr);
+    atomic_store_explicit(&running, true, memory_order_release);
+    if (pthread_create(&writer_thread, NULL, writer_thread_func, NULL) != 0)
+    {
+        atomic_store_explicit(&running, false, memory_order_release);
+        error("Failed to create log writer thread");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Stops the background writer thread after writing out all pending records.
+ */
+void log_shutdown(void)
+{
+    if (!atomic_exchange(&running, false))
+    {
+        return;
+    }
+    pthread_join(writer_thread, NULL);
+}
+
+/**
+ * @brief Sets the runtime log level.
+ * @param level The most verbose level that is recorded.
+ */
+void log_set_level(log_level_t level)
+{
+    atomic_store_explicit(&log_level, level, memory_order_relaxed);
+}
+
+/**
+ * @brief Converts a log level name to a log level.
+ * @param name The level name, error, info or debug.
+ * @return The log level, or -1 if the name is unknown.
+ */
+int log_level_from_string(const char *name)
+{
+    if (name == NULL)
+    {
+        return -1;
+    }
+    if (strcasecmp(name, "error") == 0)
+    {
+        return LOG_LEVEL_ERROR;
+    }
+    if (strcasecmp(name, "info") == 0)
+    {
+        return LOG_LEVEL_INFO;
+    }
+    if (strcasecmp(name, "debug") == 0)
+    {
+        return LOG_LEVEL_DEBUG;
+    }
+    return -1;
+}
+
+/**
+ * @brief Converts a log level to its name.
+ * @param level The log level.
+ * @return The level name.
+ */
+const char *log_level_to_string(log_level_t level)
+{
+    switch (level)
+    {
+    case LOG_LEVEL_ERROR:
+        return "error";
+    case LOG_LEVEL_INFO:
+        return "info";
+    case LOG_LEVEL_DEBUG:
+        return "debug";
+    }
+    return "unknown";
+}
+
+/**
+ * @brief Sets the per call site rate limit.
+ * @param messages_per_second The maximum number of messages per call site, thread and second, 0 disables the limit.
+ */
+void log_set_rate_limit(unsigned int messages_per_second)
+{
+    atomic_store_explicit(&rate_limit, messages_per_second, memory_order_relaxed);
+}
+
+/**
+ * @brief Returns the number of log messages dropped because a ring was full.
+ * @return The number of dropped messages.
+ */
+uint64_t log_get_dropped_count(void)
+{
+    return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
@@ -1,3 +1,12 @@
+/**
+ * @file log.h
+ * @brief Logging macros backed by an asynchronous per-thread ring buffer logger.
+ *
+ * The macros only record the format pointer and the arguments in binary form into a ring
+ * owned by the calling thread. A background thread formats the records and writes them out,
+ * so logging never blocks the SIP processing threads on stdout or stderr.
+ */
+
 #ifndef LOG_H
 #define LOG_H
 
@@ -5,14 +14,79 @@
 #define __USE_GNU
 #include <sys/syscall.h>
 #include <unistd.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+typedef enum
+{
+    LOG_LEVEL_ERROR = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG
+} log_level_t;
+
+/**
+ * @struct log_callsite_t
+ * @brief Static per call site data. The rate limit state lives in the logging threads, in
+ * the slot assigned to the call site on its first message.
+ */
+typedef struct
+{
+    log_level_t level;
+    const char *format;
+    const char *function;
+    atomic_uint slot; // 0 until the first message
+} log_callsite_t;
+
+extern atomic_int log_level;
+
+int log_init(void);
+void log_shutdown(void);
+void log_set_level(log_level_t level);
+int log_level_from_string(const char *name);
+const char *log_level_to_string(log_level_t level);
+void log_set_rate_limit(unsigned int messages_per_second);
+uint64_t log_get_dropped_count(void);
+void log_write(log_callsite_t *callsite, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#define log_level_enabled(level) (__builtin_expect(atomic_load_explicit(&log_level, memory_order_relaxed) >= (level), 0))
+
+#define log_at_level(level, format, ...)                                                   \
+    do                                                                                     \
+    {                                                                                      \
+        if (log_level_enabled(level))                                                      \
+        {                                                                                  \
+            static log_callsite_t log_callsite_ = {(level), (format), __FUNCTION__};       \
+            log_write(&log_callsite_, format, ##__VA_ARGS__);                              \
+        }                                                                                  \
+    } while (0)
 
 #ifdef HIDE_LOGS
 #define log(format, ...)
 #else
-#define log(format, ...) fprintf(stdout, "LOG: [tid:%d] [%s]" format "\n", gettid(), __FUNCTION__, ##__VA_ARGS__)
+#define log(format, ...) log_at_level(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
 #endif
 
-#define info(format, ...) fprintf(stdout, "INFO: [tid:%d] [%s] " format "\n", gettid(), __FUNCTION__, ##__VA_ARGS__)
-#define error(format, ...) fprintf(stderr, "ERROR: [tid:%d] [%s] " format "\n", gettid(), __FUNCTION__, ##__VA_ARGS__)
+/*
+ * Traces are debug messages that are also recorded below the debug level when the message
+ * they belong to is selected for tracing, so they are not removed by HIDE_LOGS.
+ */
+#ifdef HIDE_LOGS
+#define trace_enabled(selected) __builtin_expect((selected), 0)
+#else
+#define trace_enabled(selected) (__builtin_expect((selected), 0) || log_level_enabled(LOG_LEVEL_DEBUG))
+#endif
 
-#endif
\ No newline at end of file
+#define trace(selected, format, ...)                                                      \
+    do                                                                                     \
+    {                                                                                      \
+        if (trace_enabled(selected))                                                       \
+        {                                                                                  \
+            static log_callsite_t log_callsite_ = {LOG_LEVEL_DEBUG, (format), __FUNCTION__}; \
+            log_write(&log_callsite_, format, ##__VA_ARGS__);                              \
+        }                                                                                  \
+    } while (0)
+
+#define info(format, ...) log_at_level(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define error(format, ...) log_at_level(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+
+#endif
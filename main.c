@@ -8,33 +8,212 @@
 #include "timer_manager.h"
 #include "log.h"
 #include "utils.h"
+#include "config.h"
+#include "sip_trace.h"
+#include "metrics.h"
+#include "admin_server.h"
+#include "sip_overload.h"
+#include "rate_limiter.h"
+#include "source_filter.h"
+#include "rcu.h"
+#include "uring.h"
+#include "send_batch.h"
+#include "tcp_transport.h"
+#include "tls_server.h"
+#include "sip_replay.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
-#include <sys/select.h>
-#include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
 
 #define MAX_THREADS 7 // TODO make it system cpu - 1
 #define QUEUE_CAPACITY 1024
-#define SIP_PORT 5060
+#define RECEIVER_MAX_EVENTS 8
+#define RECEIVER_BATCH_SIZE 64 // datagrams read per readiness event before looking at the other events
+#define UDP_GRO_BUFFER_SIZE 65535
+#define REPLAY_IDLE_POLL_MS 10 // interval of the checks for the workers to be done with a finished replay
+
+// epoll event data of the receiver, listeners follow the control fds by index
+#define RECEIVER_SIGNAL_EVENT 0
+#define RECEIVER_DRAIN_EVENT 1
+#define RECEIVER_TCP_EVENT 2 // the epoll fd of the TCP connections
+#define RECEIVER_REPLAY_EVENT 3 // the timerfd pacing a replay
+#define RECEIVER_LISTENER_EVENT 4
 
 worker_thread_t worker_threads[MAX_THREADS];
 
-void setup_server_socket(int *server_socket, struct sockaddr_in *server_addr);
-void handle_new_message(int server_socket);
+// receive buffer owned by the receiver until a message is dispatched, so dropping costs no allocation
+static sip_message_t *spare_message = NULL;
+
+// set on SIGTERM, new INVITEs are rejected until the workers have no transaction left
+static bool draining = false;
+static bool stop_requested = false;
+static uint64_t drain_start_ms = 0;
+
+/**
+ * @struct listener_t
+ * @brief A bound UDP socket with its own receive path, read in batches by the receiver.
+ */
+typedef struct
+{
+    int socket;
+    struct sockaddr_storage address;
+    uring_receiver_t uring_receiver; // multishot receive of the io_uring backend, the ring fd replaces the socket in the event loop
+    bool gro;                        // UDP_GRO enabled, receives are split into datagrams
+} listener_t;
+
+static listener_t listeners[MAX_LISTEN_ADDRESSES];
+static int listener_count = 0;
+
+// datagrams coalesced by UDP GRO are received here and split into the spare buffers
+static char gro_buffer[UDP_GRO_BUFFER_SIZE];
+
+void setup_server_socket(listener_t *listener, const struct sockaddr_storage *address, socklen_t address_length, bool ipv6_only);
+void close_listeners(void);
+int setup_stream_listeners(void);
+int setup_event_loop(int signal_fd, int drain_fd);
+int setup_signal_fd(void);
+void handle_signal(int signal_fd);
+void reload_configuration(void);
+void start_drain(void);
+bool workers_drained(void);
+bool workers_busy(void);
+bool workers_idle(void);
+void dispatch_message(sip_message_t *message);
+bool handle_new_message(listener_t *listener);
+bool handle_gro_message(listener_t *listener);
+bool handle_uring_message(listener_t *listener);
+void handle_tcp_message(const char *data, size_t length, uint64_t connection, int fd,
+                        const struct sockaddr_storage *address, socklen_t address_length);
+void handle_replay_message(const pcap_datagram_t *datagram, int socket);
 
-int main()
+int main(int argc, char *argv[])
 {
-    int server_socket;
-    struct sockaddr_in server_addr;
+    init_server_config(&server_config);
+    int rc = parse_server_config_args(&server_config, argc, argv);
+    if (rc != 0)
+    {
+        exit(rc > 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Control signals are blocked in every thread and read from a signalfd by the receiver
+    int signal_fd = setup_signal_fd();
+    if (signal_fd < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // Start the asynchronous logger
+    log_set_level(server_config.log_level);
+    log_set_rate_limit(server_config.log_rate_limit);
+    log_init();
+    atexit(log_shutdown);
+
+    // Setup a server socket per listen address, an IPv6 wildcard is dual stack unless IPv4 has its own socket on the port
+    for (int i = 0; i < server_config.listen_count; i++)
+    {
+        const struct sockaddr_storage *address = &server_config.listen_addresses[i];
+        bool ipv6_only = false;
+        for (int j = 0; j < server_config.listen_count && address->ss_family == AF_INET6; j++)
+        {
+            const struct sockaddr_storage *other = &server_config.listen_addresses[j];
+            ipv6_only |= other->ss_family == AF_INET &&
+                         ((const struct sockaddr_in *)other)->sin_port == ((const struct sockaddr_in6 *)address)->sin6_port;
+        }
+        setup_server_socket(&listeners[i], address, server_config.listen_address_lengths[i], ipv6_only);
+        listener_count++;
+    }
+    if ((server_config.tcp_listen_address_length > 0 || server_config.tls_listen_address_length > 0) &&
+        setup_stream_listeners() != 0)
+    {
+        close_listeners();
+        exit(EXIT_FAILURE);
+    }
+
+    init_sip_overload(&sip_overload, server_config.overload_queue_high, server_config.overload_queue_low,
+                      server_config.overload_delay_high_ms, server_config.overload_retry_after_sec);
+    if (init_rate_limiter(&rate_limiter, server_config.rate_limit_table_size, server_config.rate_limit,
+                          server_config.rate_limit_burst, server_config.rate_limit_action) != 0)
+    {
+        close_listeners();
+        exit(EXIT_FAILURE);
+    }
+    if (server_config.capture_prefix != NULL &&
+        sip_capture_configure(server_config.capture_prefix, server_config.capture_file_size_mb, server_config.capture_files,
+                              server_config.capture_sample_percent, server_config.capture_call_id) != 0)
+    {
+        close_listeners();
+        exit(EXIT_FAILURE);
+    }
+    if (server_config.cdr_file != NULL && sip_cdr_open(server_config.cdr_file, MAX_THREADS) != 0)
+    {
+        close_listeners();
+        exit(EXIT_FAILURE);
+    }
+    if (server_config.replay_file != NULL &&
+        sip_replay_init(&sip_replay, server_config.replay_file, server_config.replay_speed, server_config.replay_port) != 0)
+    {
+        close_listeners();
+        exit(EXIT_FAILURE);
+    }
+
+    // The io_uring backend falls back to the classic one when the kernel refuses it
+    for (int i = 0; i < listener_count && server_config.io_backend == IO_BACKEND_IO_URING; i++)
+    {
+        if (uring_receiver_init(&listeners[i].uring_receiver, listeners[i].socket) != 0)
+        {
+            error("io_uring backend unavailable, using recvmsg and sendto");
+            server_config.io_backend = IO_BACKEND_CLASSIC;
+            for (int j = 0; j < i; j++)
+            {
+                uring_receiver_destroy(&listeners[j].uring_receiver);
+            }
+        }
+    }
+
+    // The io_uring backend has its own batching, GRO and GSO only apply to the classic one
+    if ((server_config.udp_gro || server_config.udp_gso) && server_config.io_backend != IO_BACKEND_CLASSIC)
+    {
+        info("UDP GRO and GSO are only used by the classic backend");
+        server_config.udp_gro = 0;
+        server_config.udp_gso = 0;
+    }
+    int enable = 1;
+    bool gso = server_config.udp_gso != 0;
+    for (int i = 0; i < listener_count; i++)
+    {
+        listeners[i].gro = server_config.udp_gro && setsockopt(listeners[i].socket, SOL_UDP, UDP_GRO, &enable, sizeof(enable)) == 0;
+        if (server_config.udp_gro && !listeners[i].gro)
+        {
+            error("Failed to enable UDP GRO: %s", strerror(errno));
+        }
+        gso = gso && send_batch_gso_supported(listeners[i].socket);
+    }
+    if (server_config.udp_gso && !gso)
+    {
+        error("UDP GSO is not supported, batching responses with sendmmsg only");
+    }
 
-    // Setup server socket
-    setup_server_socket(&server_socket, &server_addr);
+    // Workers wake up the receiver through this eventfd when they are done draining
+    int drain_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int epoll_fd = setup_event_loop(signal_fd, drain_fd);
+    if (drain_fd < 0 || epoll_fd < 0)
+    {
+        error("Failed to set up the receiver event loop: %s", strerror(errno));
+        close_listeners();
+        exit(EXIT_FAILURE);
+    }
 
     // Initialize timer manager
     timer_one_shot_init();
@@ -43,128 +222,869 @@ int main()
     for (int i = 0; i < MAX_THREADS; i++)
     {
         worker_threads[i].calls = NULL;
-        worker_threads[i].server_socket = server_socket;
+        worker_threads[i].metrics = metrics_register_worker();
+        worker_threads[i].drain_eventfd = drain_fd;
+        worker_threads[i].sender = NULL;
+        worker_threads[i].send_batch = NULL;
+        worker_threads[i].tcp_batch = NULL;
+        worker_threads[i].capture = NULL;
+        worker_threads[i].cdr = sip_cdr_get_ring(i);
+        if (server_config.capture_prefix != NULL && (worker_threads[i].capture = sip_capture_create(i)) == NULL)
+        {
+            close_listeners();
+            exit(EXIT_FAILURE);
+        }
+        if (tcp_transport_enabled(&tcp_transport))
+        {
+            worker_threads[i].tcp_batch = malloc(sizeof(tcp_send_batch_t));
+            if (worker_threads[i].tcp_batch == NULL)
+            {
+                error("Memory allocation failed");
+                close_listeners();
+                exit(EXIT_FAILURE);
+            }
+            init_tcp_send_batch(worker_threads[i].tcp_batch, &tcp_transport);
+        }
+        if (server_config.udp_gso)
+        {
+            worker_threads[i].send_batch = malloc(sizeof(send_batch_t));
+            if (worker_threads[i].send_batch == NULL)
+            {
+                error("Memory allocation failed");
+                close_listeners();
+                exit(EXIT_FAILURE);
+            }
+            init_send_batch(worker_threads[i].send_batch, gso);
+        }
+        if (server_config.io_backend == IO_BACKEND_IO_URING)
+        {
+            worker_threads[i].sender = malloc(sizeof(uring_sender_t));
+            if (worker_threads[i].sender == NULL || uring_sender_init(worker_threads[i].sender) != 0)
+            {
+                error("Worker %d sends with sendto", i);
+                free(worker_threads[i].sender);
+                worker_threads[i].sender = NULL;
+            }
+        }
+        atomic_init(&worker_threads[i].queue_delay_ns, 0);
+        atomic_init(&worker_threads[i].drained, false);
+        init_sip_reaper(&worker_threads[i].reaper, (uint64_t)server_config.call_idle_timeout_sec * 1000, server_config.reaper_batch_size);
+        worker_threads[i].answer_delay_ms = server_config.answer_delay_ms;
         initialize_message_queue(&worker_threads[i].queue, QUEUE_CAPACITY);
         if (pthread_create(&worker_threads[i].thread, NULL, process_sip_messages, &worker_threads[i]) != 0)
         {
             error("Failed to create worker thread: %s", strerror(errno));
-            close(server_socket);
+            close_listeners();
             exit(EXIT_FAILURE);
         }
     }
 
+    // Start the metrics endpoint
+    if (server_config.admin_port > 0 && admin_server_start(server_config.admin_port, worker_threads, MAX_THREADS) != 0)
+    {
+        close_listeners();
+        exit(EXIT_FAILURE);
+    }
+
+    // The receiver reads the source filter under RCU
+    rcu_register_thread();
+
     // Main server loop
-    while (1)
+    struct epoll_event events[RECEIVER_MAX_EVENTS];
+    uint64_t last_summary_ms = get_monotonic_time_ms();
+    while (!stop_requested)
     {
-        handle_new_message(server_socket);
+        // sleep until the next metrics summary or the drain deadline
+        uint64_t now_ms = get_monotonic_time_ms();
+        int timeout_ms = -1;
+        if (server_config.metrics_interval_sec > 0)
+        {
+            uint64_t next_ms = last_summary_ms + (uint64_t)server_config.metrics_interval_sec * 1000;
+            timeout_ms = next_ms > now_ms ? (int)(next_ms - now_ms) : 0;
+        }
+        if (draining)
+        {
+            uint64_t deadline_ms = drain_start_ms + (uint64_t)server_config.drain_timeout_sec * 1000;
+            int drain_timeout_ms = deadline_ms > now_ms ? (int)(deadline_ms - now_ms) : 0;
+            timeout_ms = timeout_ms < 0 || drain_timeout_ms < timeout_ms ? drain_timeout_ms : timeout_ms;
+        }
+        if (sip_replay.finished)
+        {
+            timeout_ms = timeout_ms < 0 || REPLAY_IDLE_POLL_MS < timeout_ms ? REPLAY_IDLE_POLL_MS : timeout_ms;
+        }
+
+        rcu_quiescent_state();
+        rcu_thread_offline();
+        int count = epoll_wait(epoll_fd, events, RECEIVER_MAX_EVENTS, timeout_ms);
+        rcu_thread_online();
+        if (count < 0 && errno != EINTR)
+        {
+            error("epoll_wait error: %s", strerror(errno));
+        }
+
+        // completions can also be posted while epoll_wait is interrupted, so the rings are always checked
+        for (int l = 0; l < listener_count && server_config.io_backend == IO_BACKEND_IO_URING; l++)
+        {
+            for (int received = 0; received < RECEIVER_BATCH_SIZE && handle_uring_message(&listeners[l]); received++)
+            {
+                rcu_quiescent_state();
+            }
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            // the event data is the listener index, past the signalfd and drain eventfd slots
+            if (events[i].data.u32 >= RECEIVER_LISTENER_EVENT && server_config.io_backend == IO_BACKEND_CLASSIC)
+            {
+                listener_t *listener = &listeners[events[i].data.u32 - RECEIVER_LISTENER_EVENT];
+                bool (*handle)(listener_t *) = listener->gro ? handle_gro_message : handle_new_message;
+                for (int received = 0; received < RECEIVER_BATCH_SIZE && handle(listener); received++)
+                {
+                    rcu_quiescent_state();
+                }
+            }
+            else if (events[i].data.u32 == RECEIVER_TCP_EVENT)
+            {
+                tcp_transport_process(&tcp_transport, handle_tcp_message);
+                rcu_quiescent_state();
+            }
+            else if (events[i].data.u32 == RECEIVER_REPLAY_EVENT)
+            {
+                sip_replay_process(&sip_replay, RECEIVER_BATCH_SIZE, workers_busy, handle_replay_message);
+                rcu_quiescent_state();
+            }
+            else if (events[i].data.u32 == RECEIVER_SIGNAL_EVENT)
+            {
+                handle_signal(signal_fd);
+            }
+            else if (events[i].data.u32 == RECEIVER_DRAIN_EVENT)
+            {
+                uint64_t value;
+                if (read(drain_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+                {
+                    error("Failed to read drain event: %s", strerror(errno));
+                }
+            }
+        }
+
+        now_ms = get_monotonic_time_ms();
+        if (sip_replay.finished && !stop_requested && workers_idle())
+        {
+            sip_replay_report(&sip_replay, get_monotonic_time_ns());
+            stop_requested = true;
+        }
+        if (draining)
+        {
+            if (workers_drained())
+            {
+                info("All in-flight transactions completed");
+                stop_requested = true;
+            }
+            else if (now_ms - drain_start_ms >= (uint64_t)server_config.drain_timeout_sec * 1000)
+            {
+                info("Drain timeout of %d seconds reached, abandoning in-flight transactions", server_config.drain_timeout_sec);
+                stop_requested = true;
+            }
+        }
+
+        if (server_config.metrics_interval_sec > 0 && now_ms - last_summary_ms >= (uint64_t)server_config.metrics_interval_sec * 1000)
+        {
+            metrics_log_summary(now_ms - last_summary_ms);
+            rate_limiter_log_top_talkers(&rate_limiter, 3);
+            last_summary_ms = now_ms;
+        }
     }
 
-    // Cleanup (not reached in current setup)
+    // Timers enqueue to the workers, so they stop first, then the workers finish their queues
+    uint64_t stop_start_ms = get_monotonic_time_ms();
+    if (!draining)
+    {
+        drain_start_ms = stop_start_ms;
+    }
+    timer_one_shot_shutdown();
     for (int i = 0; i < MAX_THREADS; i++)
     {
-        pthread_join(worker_threads[i].thread, NULL);
+        sip_worker_stop(&worker_threads[i]);
         destroy_message_queue(&worker_threads[i].queue);
+        uring_sender_destroy(worker_threads[i].sender);
+        free(worker_threads[i].sender);
+        free(worker_threads[i].send_batch);
+        free(worker_threads[i].tcp_batch);
+        sip_capture_destroy(worker_threads[i].capture);
     }
-    close(server_socket);
+    sip_cdr_close();
+    tls_server_destroy(&tls_server);
+    tcp_transport_destroy(&tcp_transport);
+    admin_server_stop();
+    metrics_log_summary(get_monotonic_time_ms() - last_summary_ms);
+    close(epoll_fd);
+    close(drain_fd);
+    close(signal_fd);
+    close_listeners();
+    sip_replay_destroy(&sip_replay);
+    free(spare_message);
 
+    uint64_t end_ms = get_monotonic_time_ms();
+    info("Shutdown completed in %llu ms, drain %llu ms, stop %llu ms", (unsigned long long)(end_ms - drain_start_ms),
+         (unsigned long long)(stop_start_ms - drain_start_ms), (unsigned long long)(end_ms - stop_start_ms));
     return 0;
 }
 
-void setup_server_socket(int *server_socket, struct sockaddr_in *server_addr)
+/**
+ * @brief Creates a non-blocking UDP socket bound to a listen address, exits on failure.
+ * @param listener The listener to set up.
+ * @param address The IPv4 or IPv6 address to bind.
+ * @param address_length The length of the address.
+ * @param ipv6_only Whether an IPv6 socket leaves IPv4 to another socket.
+ */
+void setup_server_socket(listener_t *listener, const struct sockaddr_storage *address, socklen_t address_length, bool ipv6_only)
 {
-    *server_socket = socket(AF_INET, SOCK_DGRAM, 0);
-    if (*server_socket < 0)
+    char address_string[SOCKADDR_STRING_LENGTH];
+    sockaddr_to_string(address, address_string, sizeof(address_string));
+    memset(listener, 0, sizeof(listener_t));
+    listener->uring_receiver.ring.fd = -1;
+    memcpy(&listener->address, address, address_length);
+    listener->socket = socket(address->ss_family, SOCK_DGRAM, 0);
+    if (listener->socket < 0)
     {
         error("Failed to create server socket: %s", strerror(errno));
+        close_listeners();
         exit(EXIT_FAILURE);
     }
 
-    int flags = fcntl(*server_socket, F_GETFL, 0);
-    if (flags == -1 || fcntl(*server_socket, F_SETFL, flags | O_NONBLOCK) == -1)
+    int flags = fcntl(listener->socket, F_GETFL, 0);
+    if (flags == -1 || fcntl(listener->socket, F_SETFL, flags | O_NONBLOCK) == -1)
     {
         error("Failed to set non-blocking socket: %s", strerror(errno));
-        close(*server_socket);
+        close(listener->socket);
+        close_listeners();
         exit(EXIT_FAILURE);
     }
 
-    memset(server_addr, 0, sizeof(struct sockaddr_in));
-    server_addr->sin_family = AF_INET;
-    server_addr->sin_addr.s_addr = INADDR_ANY;
-    server_addr->sin_port = htons(SIP_PORT);
+    // Kernel receive timestamps measure the time packets wait in the socket buffer
+    int enable = 1;
+    if (setsockopt(listener->socket, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0)
+    {
+        error("Failed to enable receive timestamps: %s", strerror(errno));
+    }
 
-    if (bind(*server_socket, (struct sockaddr *)server_addr, sizeof(struct sockaddr_in)) < 0)
+    int only = ipv6_only ? 1 : 0;
+    if (address->ss_family == AF_INET6 && setsockopt(listener->socket, IPPROTO_IPV6, IPV6_V6ONLY, &only, sizeof(only)) < 0)
     {
-        error("Failed to bind server socket: %s", strerror(errno));
-        close(*server_socket);
+        error("Failed to set IPV6_V6ONLY on %s: %s", address_string, strerror(errno));
+    }
+
+    if (bind(listener->socket, (const struct sockaddr *)address, address_length) < 0)
+    {
+        error("Failed to bind server socket to %s: %s", address_string, strerror(errno));
+        close(listener->socket);
+        close_listeners();
         exit(EXIT_FAILURE);
     }
 
-    info("SIP server started on port %d (non-blocking mode)", SIP_PORT);
+    info("SIP server listening on %s%s (non-blocking mode)", address_string,
+         address->ss_family == AF_INET6 && !ipv6_only ? ", dual stack" : "");
 }
 
-void handle_new_message(int server_socket)
+/**
+ * @brief Creates the TCP transport with its TCP and TLS listeners.
+ * @return 0 on success, -1 on failure.
+ */
+int setup_stream_listeners(void)
 {
-    fd_set read_fds;
-    FD_ZERO(&read_fds);
-    FD_SET(server_socket, &read_fds);
+    if (tcp_transport_init(&tcp_transport, server_config.tcp_max_connections) != 0)
+    {
+        return -1;
+    }
+    if (server_config.tcp_listen_address_length > 0 &&
+        tcp_transport_listen(&tcp_transport, &server_config.tcp_listen_address, server_config.tcp_listen_address_length, NULL) != 0)
+    {
+        return -1;
+    }
+    if (server_config.tls_listen_address_length > 0 &&
+        (tls_server_init(&tls_server, &tcp_transport, server_config.tls_certificate, server_config.tls_key,
+                         server_config.tls_handshake_threads) != 0 ||
+         tcp_transport_listen(&tcp_transport, &server_config.tls_listen_address, server_config.tls_listen_address_length, &tls_server) != 0))
+    {
+        return -1;
+    }
+    return 0;
+}
 
-    struct timeval tv = {.tv_sec = 5, .tv_usec = 0};
+/**
+ * @brief Stops the receive paths of the listeners and closes their sockets and the TCP and TLS transport.
+ */
+void close_listeners(void)
+{
+    tls_server_destroy(&tls_server);
+    tcp_transport_destroy(&tcp_transport);
+    for (int i = 0; i < listener_count; i++)
+    {
+        uring_receiver_destroy(&listeners[i].uring_receiver);
+        close(listeners[i].socket);
+    }
+    listener_count = 0;
+}
 
-    if (select(server_socket + 1, &read_fds, NULL, NULL, &tv) < 0)
+/**
+ * @brief Registers the signalfd, the drain eventfd, the TCP connections, the replay timer and the receive fd of
+ * every listener with a new epoll instance. The event data identifies the source, not its fd.
+ * @return The epoll file descriptor, or -1 on failure.
+ */
+int setup_event_loop(int signal_fd, int drain_fd)
+{
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
     {
-        error("Select error: %s", strerror(errno));
+        return -1;
+    }
+    int fds[RECEIVER_LISTENER_EVENT + MAX_LISTEN_ADDRESSES] = {
+        [RECEIVER_SIGNAL_EVENT] = signal_fd, [RECEIVER_DRAIN_EVENT] = drain_fd, [RECEIVER_TCP_EVENT] = tcp_transport.epoll_fd,
+        [RECEIVER_REPLAY_EVENT] = sip_replay.timer_fd};
+    for (int i = 0; i < listener_count; i++)
+    {
+        bool uring = server_config.io_backend == IO_BACKEND_IO_URING;
+        fds[RECEIVER_LISTENER_EVENT + i] = uring ? listeners[i].uring_receiver.ring.fd : listeners[i].socket;
+    }
+    for (uint32_t i = 0; i < RECEIVER_LISTENER_EVENT + (uint32_t)listener_count; i++)
+    {
+        struct epoll_event event = {.events = EPOLLIN, .data.u32 = i};
+        if ((i == RECEIVER_TCP_EVENT && !tcp_transport_enabled(&tcp_transport)) ||
+            (i == RECEIVER_REPLAY_EVENT && server_config.replay_file == NULL))
+        {
+            continue;
+        }
+        if (fds[i] < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &event) < 0)
+        {
+            close(epoll_fd);
+            return -1;
+        }
+    }
+    return epoll_fd;
+}
+
+/**
+ * @brief Blocks the control signals and creates a signalfd reading them, and ignores SIGPIPE. Must be called
+ * before any thread is created, so every thread inherits the signal mask.
+ * @return The signalfd, or -1 on failure.
+ */
+int setup_signal_fd(void)
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0)
+    {
+        error("Failed to block control signals");
+        return -1;
+    }
+    // a TCP peer that resets its connection must fail the write, not stop the server
+    signal(SIGPIPE, SIG_IGN);
+    int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0)
+    {
+        error("Failed to create signalfd: %s", strerror(errno));
+    }
+    return signal_fd;
+}
+
+void handle_signal(int signal_fd)
+{
+    struct signalfd_siginfo siginfo;
+    while (read(signal_fd, &siginfo, sizeof(siginfo)) == sizeof(siginfo))
+    {
+        switch (siginfo.ssi_signo)
+        {
+        case SIGTERM:
+        case SIGINT:
+            if (draining)
+            {
+                info("Received %s while draining, stopping now", strsignal(siginfo.ssi_signo));
+                stop_requested = true;
+            }
+            else
+            {
+                info("Received %s, draining", strsignal(siginfo.ssi_signo));
+                start_drain();
+            }
+            break;
+        case SIGHUP:
+        case SIGUSR2:
+            reload_configuration();
+            break;
+        case SIGUSR1:
+        {
+            log_level_t level = (atomic_load(&log_level) + 1) % (LOG_LEVEL_DEBUG + 1);
+            log_set_level(level);
+            info("Log level set to %s", log_level_to_string(level));
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Reloads the configuration files given on the command line.
+ */
+void reload_configuration(void)
+{
+    if (server_config.source_filter != NULL)
+    {
+        info("Reloading source filter %s", server_config.source_filter);
+        source_filter_reload_async(server_config.source_filter);
+    }
+    if (server_config.trace_file != NULL)
+    {
+        info("Reloading trace file %s", server_config.trace_file);
+        sip_trace_load_file(server_config.trace_file);
+    }
+}
+
+/**
+ * @brief Starts rejecting new INVITEs and asks the workers to report when their
+ * in-flight transactions are done.
+ */
+void start_drain(void)
+{
+    draining = true;
+    drain_start_ms = get_monotonic_time_ms();
+    if (server_config.drain_timeout_sec == 0)
+    {
+        stop_requested = true;
         return;
     }
 
-    if (FD_ISSET(server_socket, &read_fds))
+    uint64_t transactions = 0;
+    for (int i = 0; i < MAX_THREADS; i++)
     {
-        sip_message_t *message = malloc(sizeof(sip_message_t));
-        if (message == NULL)
+        worker_metrics_t *metrics = worker_threads[i].metrics;
+        if (metrics != NULL)
+        {
+            uint64_t deleted = metrics_counter_get(&metrics->worker.transactions_deleted);
+            transactions += metrics_counter_get(&metrics->worker.transactions_created) - deleted;
+        }
+        sip_worker_start_drain(&worker_threads[i]);
+    }
+    info("Waiting up to %d seconds for %llu in-flight transactions", server_config.drain_timeout_sec, (unsigned long long)transactions);
+}
+
+/**
+ * @brief Checks whether every worker is out of transactions and queued messages.
+ */
+bool workers_drained(void)
+{
+    for (int i = 0; i < MAX_THREADS; i++)
+    {
+        if (!atomic_load(&worker_threads[i].drained) || get_message_queue_depth(&worker_threads[i].queue) > 0)
         {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Checks whether a worker queue is too deep for a full speed replay to go on.
+ */
+bool workers_busy(void)
+{
+    for (int i = 0; i < MAX_THREADS; i++)
+    {
+        if (get_message_queue_depth(&worker_threads[i].queue) >= SIP_REPLAY_MAX_QUEUE_DEPTH)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Checks whether every worker queue is empty.
+ */
+bool workers_idle(void)
+{
+    for (int i = 0; i < MAX_THREADS; i++)
+    {
+        if (get_message_queue_depth(&worker_threads[i].queue) > 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Converts the kernel receive timestamp of a message to the monotonic clock.
+ * @param header The header filled by recvmsg.
+ * @param receive_time_ns The monotonic time recvmsg returned.
+ * @return The kernel receive time on the monotonic clock, 0 if the message has no timestamp.
+ */
+static uint64_t get_kernel_receive_time_ns(struct msghdr *header, uint64_t receive_time_ns)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(header); cmsg != NULL; cmsg = CMSG_NXTHDR(header, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            uint64_t kernel_ns = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+            uint64_t now_ns = get_real_time_ns();
+            uint64_t wait_ns = now_ns > kernel_ns ? now_ns - kernel_ns : 0;
+            return wait_ns < receive_time_ns ? receive_time_ns - wait_ns : 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the cleared spare receive buffer, allocating it when the previous one was dispatched.
+ * @return The buffer, or NULL on allocation failure.
+ */
+static sip_message_t *get_spare_message(void)
+{
+    if (spare_message == NULL)
+    {
+        spare_message = malloc(sizeof(sip_message_t));
+        if (spare_message == NULL)
+        {
+            metrics_counter_add(&receiver_metrics.receiver.allocation_failures, 1);
             error("Memory allocation failed");
+            return NULL;
+        }
+    }
+    memset(spare_message, 0, sizeof(sip_message_t));
+    return spare_message;
+}
+
+/**
+ * @brief Filters a datagram received into the spare buffer and dispatches it to its worker.
+ * @param message The spare buffer filled with the datagram, its socket and its receive times.
+ */
+void dispatch_message(sip_message_t *message)
+{
+    metrics_counter_add(&receiver_metrics.receiver.packets_received, 1);
+    metrics_counter_add(&receiver_metrics.receiver.bytes_received, message->buffer_length);
+
+    if (!source_filter_allow((struct sockaddr *)&message->client_addr))
+    {
+        metrics_counter_add(&receiver_metrics.receiver.source_filter_drops, 1);
+        return;
+    }
+
+    // sources above their rate are handled before any parsing, keeping the spare buffer
+    if (!rate_limiter_allow(&rate_limiter, (struct sockaddr *)&message->client_addr, message->receive_time_ns / 1000000))
+    {
+        if (rate_limiter.action == RATE_LIMIT_ACTION_REJECT && classify_message(message) == SIP_MESSAGE_CLASS_INITIAL_INVITE &&
+            sip_overload_reject(&sip_overload, message->socket, message) == 0)
+        {
+            metrics_counter_add(&receiver_metrics.receiver.rate_limited_rejects, 1);
+        }
+        else
+        {
+            metrics_counter_add(&receiver_metrics.receiver.rate_limited_drops, 1);
+        }
+        return;
+    }
+    spare_message = NULL;
+
+    const char *call_id;
+    size_t call_id_length;
+    call_id = get_message_call_id(message, &call_id_length);
+    if (call_id == NULL)
+    {
+        metrics_counter_add(&receiver_metrics.receiver.missing_call_id_drops, 1);
+        error("Received SIP message without Call-ID");
+        free(message);
+    }
+    else
+    {
+        log("Received SIP message with Call-ID: %.*s", (int)call_id_length, call_id);
+        message->trace = sip_trace_match(call_id, call_id_length, &message->client_addr);
+        int hash = string_to_int_hash(call_id, call_id_length);
+        int selected_thread = 0;
+        if (MAX_THREADS > 0)
+        {
+            selected_thread = hash % MAX_THREADS;
+        }
+        log("Dispatching to worker thread %d", selected_thread);
+        worker_thread_t *worker = &worker_threads[selected_thread];
+        worker_metrics_t *metrics = worker->metrics;
+
+        message->message_class = classify_message(message);
+        if (message->message_class == SIP_MESSAGE_CLASS_IN_DIALOG && sip_overload_is_rejected_ack(message))
+        {
+            metrics_counter_add(&receiver_metrics.receiver.rejected_acks_absorbed, 1);
+            free(message);
             return;
         }
-        memset(message, 0, sizeof(sip_message_t));
 
-        message->client_addr_len = sizeof(message->client_addr);
-        ssize_t bytes_received = recvfrom(server_socket, message->buffer, sizeof(message->buffer) - 1, 0,
-                                          (struct sockaddr *)&message->client_addr, &message->client_addr_len);
+        // a draining server only finishes what it already accepted
+        if (draining && message->message_class == SIP_MESSAGE_CLASS_INITIAL_INVITE)
+        {
+            metrics_counter_add(&receiver_metrics.receiver.draining_rejects, 1);
+            sip_overload_reject(&sip_overload, message->socket, message);
+            free(message);
+            return;
+        }
 
-        if (bytes_received > 0)
+        // new calls are rejected early, established calls are always admitted, so only the lane new calls wait in counts
+        bool shedding = sip_overload_check(&sip_overload, selected_thread, get_message_queue_lane_depth(&worker->queue, MESSAGE_QUEUE_LANE_NORMAL),
+                                           worker->queue.capacity, atomic_load_explicit(&worker->queue_delay_ns, memory_order_relaxed));
+        if (shedding && message->message_class == SIP_MESSAGE_CLASS_INITIAL_INVITE)
         {
-            message->buffer_length = (size_t)bytes_received;
-            const char *call_id;
-            size_t call_id_length;
-            call_id = get_message_call_id(message, &call_id_length);
-            if (call_id == NULL)
+            if (metrics != NULL)
             {
-                error("Received SIP message without Call-ID");
-                free(message);
+                metrics_counter_add(&metrics->queue.invites_shed, 1);
             }
-            else
+            sip_overload_reject(&sip_overload, message->socket, message);
+            free(message);
+            return;
+        }
+
+        // messages completing established calls overtake new requests, a CANCEL stays behind the INVITE it cancels
+        message_queue_lane_t lane = MESSAGE_QUEUE_LANE_NORMAL;
+        if (message->message_class == SIP_MESSAGE_CLASS_RESPONSE || message->message_class == SIP_MESSAGE_CLASS_IN_DIALOG)
+        {
+            lane = MESSAGE_QUEUE_LANE_PRIORITY;
+        }
+
+        message->dispatch_time_ns = get_monotonic_time_ns();
+        if (!enqueue_message_to_lane(&worker->queue, message, lane))
+        {
+            if (message->message_class == SIP_MESSAGE_CLASS_INITIAL_INVITE)
             {
-                log("Received SIP message with Call-ID: %.*s", (int)call_id_length, call_id);
-                int hash = string_to_int_hash(call_id, call_id_length);
-                int selected_thread = 0;
-                if (MAX_THREADS > 0)
+                // a 503 stops the retransmissions a silent drop would cause
+                if (metrics != NULL)
                 {
-                    selected_thread = hash % MAX_THREADS;
+                    metrics_counter_add(&metrics->queue.invites_shed, 1);
                 }
-                log("Dispatching to worker thread %d", selected_thread);
-                if (!enqueue_message(&worker_threads[selected_thread].queue, message))
+                sip_overload_reject(&sip_overload, message->socket, message);
+            }
+            else
+            {
+                if (metrics != NULL)
                 {
-                    error("Failed to enqueue message");
-                    free(message);
+                    metrics_counter_add(&metrics->queue.enqueue_drops, 1);
                 }
+                error("Failed to enqueue message");
             }
+            free(message);
         }
-        else
+        else if (metrics != NULL)
         {
-            if (bytes_received < 0 && errno != EWOULDBLOCK)
-            {
-                error("Failed to receive SIP message: %s\n", strerror(errno));
-            }
-            free(message);
+            metrics_counter_add(&metrics->queue.messages_enqueued, 1);
+        }
+    }
+}
+
+/**
+ * @brief Receives one datagram from a listener socket and dispatches it to its worker.
+ * @param listener The listener with a non-blocking socket.
+ * @return false once the socket has no datagram left or receiving failed.
+ */
+bool handle_new_message(listener_t *listener)
+{
+    sip_message_t *message = get_spare_message();
+    if (message == NULL)
+    {
+        return false;
+    }
+
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec iov = {.iov_base = message->buffer, .iov_len = sizeof(message->buffer) - 1};
+    struct msghdr header = {
+        .msg_name = &message->client_addr,
+        .msg_namelen = sizeof(message->client_addr),
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)};
+    ssize_t bytes_received = recvmsg(listener->socket, &header, 0);
+
+    if (bytes_received > 0)
+    {
+        message->socket = listener->socket;
+        message->receive_time_ns = get_monotonic_time_ns();
+        message->kernel_receive_time_ns = get_kernel_receive_time_ns(&header, message->receive_time_ns);
+        message->client_addr_len = header.msg_namelen;
+        message->buffer_length = (size_t)bytes_received;
+        dispatch_message(message);
+    }
+    else if (bytes_received < 0 && errno != EWOULDBLOCK)
+    {
+        metrics_counter_add(&receiver_metrics.receiver.receive_errors, 1);
+        error("Failed to receive SIP message: %s\n", strerror(errno));
+    }
+    return bytes_received >= 0;
+}
+
+/**
+ * @brief Returns the segment size of a receive coalesced by UDP GRO.
+ * @param header The header filled by recvmsg.
+ * @param length The number of bytes received.
+ * @return The size of every segment but the last, the received length when nothing was coalesced.
+ */
+static size_t get_gro_segment_size(struct msghdr *header, size_t length)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(header); cmsg != NULL; cmsg = CMSG_NXTHDR(header, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+        {
+            int segment_size;
+            memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+            return segment_size > 0 ? (size_t)segment_size : length;
         }
     }
+    return length;
+}
+
+/**
+ * @brief Receives datagrams coalesced by UDP GRO and dispatches each of them to its worker.
+ * @param listener The listener with a non-blocking socket with UDP_GRO enabled.
+ * @return false once the socket has no datagram left or receiving failed.
+ */
+bool handle_gro_message(listener_t *listener)
+{
+    struct sockaddr_storage client_addr;
+    char control[CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {.iov_base = gro_buffer, .iov_len = sizeof(gro_buffer)};
+    struct msghdr header = {
+        .msg_name = &client_addr,
+        .msg_namelen = sizeof(client_addr),
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)};
+    ssize_t bytes_received = recvmsg(listener->socket, &header, 0);
+    if (bytes_received < 0)
+    {
+        if (errno != EWOULDBLOCK)
+        {
+            metrics_counter_add(&receiver_metrics.receiver.receive_errors, 1);
+            error("Failed to receive SIP message: %s\n", strerror(errno));
+        }
+        return false;
+    }
+
+    uint64_t receive_time_ns = get_monotonic_time_ns();
+    uint64_t kernel_receive_time_ns = get_kernel_receive_time_ns(&header, receive_time_ns);
+    size_t segment_size = get_gro_segment_size(&header, (size_t)bytes_received);
+    if (segment_size < (size_t)bytes_received)
+    {
+        metrics_counter_add(&receiver_metrics.receiver.coalesced_receives, 1);
+    }
+
+    // every segment is one datagram of the same source, copied into its own message
+    for (size_t offset = 0; offset < (size_t)bytes_received; offset += segment_size)
+    {
+        sip_message_t *message = get_spare_message();
+        if (message == NULL)
+        {
+            return false;
+        }
+        size_t length = (size_t)bytes_received - offset < segment_size ? (size_t)bytes_received - offset : segment_size;
+        message->buffer_length = length < sizeof(message->buffer) - 1 ? length : sizeof(message->buffer) - 1;
+        memcpy(message->buffer, gro_buffer + offset, message->buffer_length);
+        memcpy(&message->client_addr, &client_addr, header.msg_namelen);
+        message->client_addr_len = header.msg_namelen;
+        message->socket = listener->socket;
+        message->receive_time_ns = receive_time_ns;
+        message->kernel_receive_time_ns = kernel_receive_time_ns;
+        dispatch_message(message);
+    }
+    return true;
+}
+
+/**
+ * @brief Takes one datagram completed by the io_uring backend and dispatches it to its worker.
+ * @param listener The listener with an armed io_uring receiver.
+ * @return false once no completed datagram is left.
+ */
+bool handle_uring_message(listener_t *listener)
+{
+    uring_datagram_t datagram;
+    if (uring_receiver_next(&listener->uring_receiver, &datagram) == 0)
+    {
+        return false;
+    }
+    sip_message_t *message = get_spare_message();
+    if (message == NULL)
+    {
+        uring_receiver_release(&listener->uring_receiver, &datagram);
+        return false;
+    }
+
+    // the provided buffer goes back to the kernel right away, so the copy is the only cost
+    message->receive_time_ns = get_monotonic_time_ns();
+    struct msghdr header = {.msg_control = datagram.control, .msg_controllen = datagram.control_length};
+    message->kernel_receive_time_ns = get_kernel_receive_time_ns(&header, message->receive_time_ns);
+    message->buffer_length = datagram.length < sizeof(message->buffer) - 1 ? datagram.length : sizeof(message->buffer) - 1;
+    memcpy(message->buffer, datagram.payload, message->buffer_length);
+    message->client_addr_len = datagram.address_length;
+    memcpy(&message->client_addr, datagram.address, datagram.address_length);
+    message->socket = listener->socket;
+    uring_receiver_release(&listener->uring_receiver, &datagram);
+
+    dispatch_message(message);
+    return true;
+}
+
+/**
+ * @brief Copies a message framed by the TCP transport into the spare buffer and dispatches it to its worker.
+ * @param data The message, valid during the call only.
+ * @param length The length of the message.
+ * @param connection The handle of the connection, responses are written to it.
+ * @param fd The connection socket.
+ * @param address The peer address of the connection.
+ * @param address_length The length of the peer address.
+ */
+void handle_tcp_message(const char *data, size_t length, uint64_t connection, int fd,
+                        const struct sockaddr_storage *address, socklen_t address_length)
+{
+    if (length >= sizeof(((sip_message_t *)NULL)->buffer))
+    {
+        metrics_counter_add(&receiver_metrics.receiver.tcp_oversized_drops, 1);
+        return;
+    }
+    sip_message_t *message = get_spare_message();
+    if (message == NULL)
+    {
+        return;
+    }
+    memcpy(message->buffer, data, length);
+    message->buffer_length = length;
+    memcpy(&message->client_addr, address, address_length);
+    message->client_addr_len = address_length;
+    message->socket = fd;
+    message->connection = connection;
+    message->receive_time_ns = get_monotonic_time_ns();
+    dispatch_message(message);
+}
+
+/**
+ * @brief Copies a datagram of a replayed capture into the spare buffer and dispatches it to its worker.
+ * @param datagram The datagram, with the source address of the capture.
+ * @param socket The sink descriptor of the replay, responses sent on it are discarded.
+ */
+void handle_replay_message(const pcap_datagram_t *datagram, int socket)
+{
+    sip_message_t *message = get_spare_message();
+    if (message == NULL)
+    {
+        return;
+    }
+    // truncated like a received datagram
+    message->buffer_length = datagram->length < sizeof(message->buffer) - 1 ? datagram->length : sizeof(message->buffer) - 1;
+    memcpy(message->buffer, datagram->payload, message->buffer_length);
+    memcpy(&message->client_addr, &datagram->source, datagram->source_length);
+    message->client_addr_len = datagram->source_length;
+    message->socket = socket;
+    message->receive_time_ns = get_monotonic_time_ns();
+    dispatch_message(message);
 }
@@ -1,11 +1,12 @@
 #include "message_queue.h"
 #include "log.h"
 #include <stdlib.h>
+#include <time.h>
 
 /**
  * @brief Initializes a message queue.
  * @param queue Pointer to the message queue to initialize.
- * @param capacity The maximum number of messages the queue can hold.
+ * @param capacity The maximum number of messages each lane of the queue can hold.
  */
 void initialize_message_queue(message_queue_t *queue, int capacity)
 {
@@ -18,13 +19,23 @@ void initialize_message_queue(message_queue_t *queue, int capacity)
     {
         capacity = 1;
     }
-    queue->messages = malloc(sizeof(void *) * capacity);
+    for (int lane = 0; lane < MESSAGE_QUEUE_LANE_COUNT; lane++)
+    {
+        queue->lanes[lane].messages = malloc(sizeof(void *) * capacity);
+        queue->lanes[lane].size = 0;
+        queue->lanes[lane].front = 0;
+        queue->lanes[lane].rear = -1;
+    }
     queue->capacity = capacity;
     queue->size = 0;
-    queue->front = 0;
-    queue->rear = -1;
+    queue->priority_burst = 0;
     pthread_mutex_init(&queue->mutex, NULL);
-    pthread_cond_init(&queue->cond, NULL);
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue->cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
 }
 
 /**
@@ -38,37 +49,55 @@ void destroy_message_queue(message_queue_t *queue)
         error("Message queue is null");
         return;
     }
-    for (int i = 0; i < queue->size; i++)
+    for (int lane = 0; lane < MESSAGE_QUEUE_LANE_COUNT; lane++)
     {
-        free(queue->messages[(queue->front + i) % queue->capacity]);
+        message_queue_ring_t *ring = &queue->lanes[lane];
+        for (int i = 0; i < ring->size; i++)
+        {
+            free(ring->messages[(ring->front + i) % queue->capacity]);
+        }
+        free(ring->messages);
     }
-    free(queue->messages);
     pthread_mutex_destroy(&queue->mutex);
     pthread_cond_destroy(&queue->cond);
 }
 
 /**
- * @brief Enqueues a message into the queue.
+ * @brief Enqueues a message into the normal lane of the queue.
  * @param queue Pointer to the message queue where the message will be enqueued.
  * @param message Pointer to the message to enqueue.
- * @return 1 on success, 0 if the queue is full.
+ * @return 1 on success, 0 if the lane is full.
  */
 int enqueue_message(message_queue_t *queue, void *message)
 {
-    if (queue == NULL || message == NULL)
+    return enqueue_message_to_lane(queue, message, MESSAGE_QUEUE_LANE_NORMAL);
+}
+
+/**
+ * @brief Enqueues a message into a lane of the queue.
+ * @param queue Pointer to the message queue where the message will be enqueued.
+ * @param message Pointer to the message to enqueue.
+ * @param lane The lane of the message.
+ * @return 1 on success, 0 if the lane is full.
+ */
+int enqueue_message_to_lane(message_queue_t *queue, void *message, message_queue_lane_t lane)
+{
+    if (queue == NULL || message == NULL || lane < 0 || lane >= MESSAGE_QUEUE_LANE_COUNT)
     {
         error("Invalid parameters");
         return 0;
     }
+    message_queue_ring_t *ring = &queue->lanes[lane];
     pthread_mutex_lock(&queue->mutex);
-    if (queue->size == queue->capacity)
+    if (ring->size == queue->capacity)
     {
         pthread_mutex_unlock(&queue->mutex);
         return 0;
     }
 
-    queue->rear = (queue->rear + 1) % queue->capacity;
-    queue->messages[queue->rear] = message;
+    ring->rear = (ring->rear + 1) % queue->capacity;
+    ring->messages[ring->rear] = message;
+    ring->size++;
     queue->size++;
 
     pthread_cond_signal(&queue->cond);
@@ -76,6 +105,33 @@ int enqueue_message(message_queue_t *queue, void *message)
     return 1;
 }
 
+/**
+ * @brief Takes the next message from the lanes, the queue must be locked and not empty.
+ * The priority lane goes first, except that a normal message is taken after
+ * MESSAGE_QUEUE_PRIORITY_BURST consecutive priority messages.
+ */
+static void *take_message(message_queue_t *queue)
+{
+    message_queue_ring_t *priority = &queue->lanes[MESSAGE_QUEUE_LANE_PRIORITY];
+    message_queue_ring_t *normal = &queue->lanes[MESSAGE_QUEUE_LANE_NORMAL];
+    message_queue_ring_t *ring = priority;
+    if (priority->size == 0 || (normal->size > 0 && queue->priority_burst >= MESSAGE_QUEUE_PRIORITY_BURST))
+    {
+        ring = normal;
+        queue->priority_burst = 0;
+    }
+    else if (normal->size > 0)
+    {
+        queue->priority_burst++;
+    }
+
+    void *message = ring->messages[ring->front];
+    ring->front = (ring->front + 1) % queue->capacity;
+    ring->size--;
+    queue->size--;
+    return message;
+}
+
 /**
  * @brief Dequeues a message from the queue.
  * @param queue Pointer to the message queue to dequeue from.
@@ -96,10 +152,81 @@ int dequeue_message(message_queue_t *queue, void **message)
         pthread_cond_wait(&queue->cond, &queue->mutex);
     }
 
-    *message = queue->messages[queue->front];
-    queue->front = (queue->front + 1) % queue->capacity;
-    queue->size--;
+    *message = take_message(queue);
+
+    pthread_mutex_unlock(&queue->mutex);
+    return 1;
+}
+
+/**
+ * @brief Dequeues a message from the queue, waiting at most the given time.
+ * @param queue Pointer to the message queue to dequeue from.
+ * @param message Double pointer to store the dequeued message.
+ * @param timeout_ms The maximum time to wait for a message in milliseconds.
+ * @return 1 on success, 0 if no message arrived before the timeout.
+ */
+int dequeue_message_timeout(message_queue_t *queue, void **message, int timeout_ms)
+{
+    if (queue == NULL || message == NULL)
+    {
+        error("Invalid parameters");
+        return 0;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+
+    while (queue->size == 0)
+    {
+        if (pthread_cond_timedwait(&queue->cond, &queue->mutex, &deadline) != 0 && queue->size == 0)
+        {
+            pthread_mutex_unlock(&queue->mutex);
+            return 0;
+        }
+    }
+
+    *message = take_message(queue);
 
     pthread_mutex_unlock(&queue->mutex);
     return 1;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Returns the number of queued messages without taking the queue lock.
+ * @param queue Pointer to the message queue.
+ * @return The approximate number of queued messages in all lanes.
+ */
+int get_message_queue_depth(message_queue_t *queue)
+{
+    if (queue == NULL)
+    {
+        error("Invalid parameters");
+        return 0;
+    }
+    return __atomic_load_n(&queue->size, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Returns the number of messages queued in a lane without taking the queue lock.
+ * @param queue Pointer to the message queue.
+ * @param lane The lane.
+ * @return The approximate number of queued messages in the lane.
+ */
+int get_message_queue_lane_depth(message_queue_t *queue, message_queue_lane_t lane)
+{
+    if (queue == NULL || lane < 0 || lane >= MESSAGE_QUEUE_LANE_COUNT)
+    {
+        error("Invalid parameters");
+        return 0;
+    }
+    return __atomic_load_n(&queue->lanes[lane].size, __ATOMIC_RELAXED);
+}
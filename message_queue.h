@@ -8,17 +8,44 @@
 
 #include <pthread.h>
 
+// consecutive priority messages dequeued while normal messages wait, bounds their starvation
+#define MESSAGE_QUEUE_PRIORITY_BURST 32
+
 /**
- * @struct message_queue_t
- * @brief Structure for a thread-safe message queue used by the SIP server.
+ * @brief Lanes of a message queue, drained in order.
+ */
+typedef enum
+{
+    MESSAGE_QUEUE_LANE_PRIORITY = 0, // messages completing existing transactions and dialogs
+    MESSAGE_QUEUE_LANE_NORMAL,       // messages creating new transactions
+    MESSAGE_QUEUE_LANE_COUNT
+} message_queue_lane_t;
+
+/**
+ * @struct message_queue_ring_t
+ * @brief Ring buffer of a single queue lane.
  */
 typedef struct
 {
     void **messages;
-    int capacity;
     int size;
     int front;
     int rear;
+} message_queue_ring_t;
+
+/**
+ * @struct message_queue_t
+ * @brief Structure for a thread-safe message queue used by the SIP server.
+ *
+ * Each lane has its own capacity, so a burst of new requests never blocks the messages
+ * that complete established calls.
+ */
+typedef struct
+{
+    message_queue_ring_t lanes[MESSAGE_QUEUE_LANE_COUNT];
+    int capacity; // per lane
+    int size;     // all lanes
+    int priority_burst;
     pthread_mutex_t mutex;
     pthread_cond_t cond;
 } message_queue_t;
@@ -26,6 +53,10 @@ typedef struct
 void initialize_message_queue(message_queue_t *queue, int capacity);
 void destroy_message_queue(message_queue_t *queue);
 int enqueue_message(message_queue_t *queue, void *message);
+int enqueue_message_to_lane(message_queue_t *queue, void *message, message_queue_lane_t lane);
 int dequeue_message(message_queue_t *queue, void **message);
+int dequeue_message_timeout(message_queue_t *queue, void **message, int timeout_ms);
+int get_message_queue_depth(message_queue_t *queue);
+int get_message_queue_lane_depth(message_queue_t *queue, message_queue_lane_t lane);
 
 #endif // MESSAGE_QUEUE_H
\ No newline at end of file
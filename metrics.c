@@ -0,0 +1,308 @@
+/**
+ * @file metrics.c
+ * @brief Implementation of the metrics registry: per thread counters and latency histograms.
+ */
+
+#include "metrics.h"
+#include "log.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static worker_metrics_t worker_metrics[METRICS_MAX_WORKERS];
+static atomic_int worker_count = 0;
+
+__thread worker_metrics_t *thread_worker_metrics = NULL;
+receiver_metrics_t receiver_metrics;
+timer_metrics_t timer_metrics;
+tls_metrics_t tls_metrics[METRICS_MAX_TLS_THREADS];
+
+// indexed by sip_method_t, responses are accounted in the UNKNOWN slot of the histograms
+const char *const metrics_method_names[METRICS_METHOD_COUNT] = {
+    "response", METHOD_NAME_INVITE, METHOD_NAME_ACK, METHOD_NAME_BYE, METHOD_NAME_CANCEL,
+    METHOD_NAME_OPTIONS, METHOD_NAME_REGISTER, METHOD_NAME_PRACK, METHOD_NAME_UPDATE,
+    METHOD_NAME_SUBSCRIBE, METHOD_NAME_NOTIFY, METHOD_NAME_PUBLISH, METHOD_NAME_INFO,
+    METHOD_NAME_REFER, METHOD_NAME_MESSAGE};
+
+/**
+ * @brief Reserves the metrics of a new worker thread.
+ * @return The metrics of the worker, or NULL if there are too many workers.
+ */
+worker_metrics_t *metrics_register_worker(void)
+{
+    int index = atomic_fetch_add(&worker_count, 1);
+    if (index >= METRICS_MAX_WORKERS)
+    {
+        atomic_fetch_sub(&worker_count, 1);
+        error("Too many workers for metrics");
+        return NULL;
+    }
+    return &worker_metrics[index];
+}
+
+/**
+ * @brief Returns the metrics of a registered worker.
+ * @param index The registration index of the worker.
+ * @return The metrics of the worker, or NULL if the index is out of range.
+ */
+worker_metrics_t *metrics_get_worker(int index)
+{
+    if (index < 0 || index >= metrics_get_worker_count())
+    {
+        return NULL;
+    }
+    return &worker_metrics[index];
+}
+
+/**
+ * @brief Returns the number of registered workers.
+ */
+int metrics_get_worker_count(void)
+{
+    return atomic_load(&worker_count);
+}
+
+/**
+ * @brief Returns the bucket of a value.
+ */
+static int histogram_bucket(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_BUCKET_COUNT)
+    {
+        return (int)value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent > HISTOGRAM_MAX_EXPONENT)
+    {
+        return HISTOGRAM_BUCKET_COUNT - 1;
+    }
+    int shift = exponent - HISTOGRAM_SUB_BUCKET_BITS;
+    return (shift + 1) * HISTOGRAM_SUB_BUCKET_COUNT + (int)((value >> shift) & (HISTOGRAM_SUB_BUCKET_COUNT - 1));
+}
+
+/**
+ * @brief Returns the largest value that falls into a bucket.
+ * @param bucket The bucket index.
+ * @return The upper bound of the bucket in nanoseconds.
+ */
+uint64_t histogram_bucket_upper_bound(int bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKET_COUNT)
+    {
+        return (uint64_t)bucket;
+    }
+    int shift = bucket / HISTOGRAM_SUB_BUCKET_COUNT - 1;
+    uint64_t mantissa = HISTOGRAM_SUB_BUCKET_COUNT + bucket % HISTOGRAM_SUB_BUCKET_COUNT;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+/**
+ * @brief Records a latency. Must only be called by the thread owning the histogram.
+ * @param histogram The histogram.
+ * @param value_ns The latency in nanoseconds.
+ */
+void histogram_record(latency_histogram_t *histogram, uint64_t value_ns)
+{
+    metrics_counter_add(&histogram->buckets[histogram_bucket(value_ns)], 1);
+    metrics_counter_add(&histogram->count, 1);
+    metrics_counter_add(&histogram->sum, value_ns);
+    if (value_ns > metrics_counter_get(&histogram->max))
+    {
+        atomic_store_explicit(&histogram->max, value_ns, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Estimates a percentile of a histogram.
+ * @param histogram The histogram.
+ * @param percentile The percentile between 0 and 100.
+ * @return The upper bound of the bucket holding the percentile, in nanoseconds.
+ */
+uint64_t histogram_percentile(const latency_histogram_t *histogram, double percentile)
+{
+    uint64_t count = metrics_counter_get(&histogram->count);
+    if (count == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(count * percentile / 100.0);
+    if (rank >= count)
+    {
+        rank = count - 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; i++)
+    {
+        seen += metrics_counter_get(&histogram->buckets[i]);
+        if (seen > rank)
+        {
+            uint64_t bound = histogram_bucket_upper_bound(i);
+            uint64_t max = metrics_counter_get(&histogram->max);
+            return bound < max ? bound : max;
+        }
+    }
+    return metrics_counter_get(&histogram->max);
+}
+
+/**
+ * @brief Adds the counters of an array into another one.
+ */
+static void add_counters(metrics_counter_t *total, const metrics_counter_t *counters, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        metrics_counter_add(&total[i], metrics_counter_get(&counters[i]));
+    }
+}
+
+/**
+ * @brief Adds a histogram into another one.
+ */
+static void add_histogram(latency_histogram_t *total, const latency_histogram_t *histogram)
+{
+    add_counters(total->buckets, histogram->buckets, HISTOGRAM_BUCKET_COUNT);
+    metrics_counter_add(&total->count, metrics_counter_get(&histogram->count));
+    metrics_counter_add(&total->sum, metrics_counter_get(&histogram->sum));
+    if (metrics_counter_get(&histogram->max) > metrics_counter_get(&total->max))
+    {
+        atomic_store_explicit(&total->max, metrics_counter_get(&histogram->max), memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Adds the metrics of a worker into another one, which must not be written concurrently.
+ * @param total The metrics to add to.
+ * @param worker The metrics to add.
+ */
+void metrics_add_worker(worker_metrics_t *total, const worker_metrics_t *worker)
+{
+    // the counter groups are plain arrays of counters, see METRICS_DECLARE_COUNTER
+    add_counters((metrics_counter_t *)&total->worker, (const metrics_counter_t *)&worker->worker,
+                 (offsetof(worker_metrics_t, worker.processing_latency) - offsetof(worker_metrics_t, worker)) / sizeof(metrics_counter_t));
+    for (int method = 0; method < METRICS_METHOD_COUNT; method++)
+    {
+        add_histogram(&total->worker.processing_latency[method], &worker->worker.processing_latency[method]);
+    }
+    for (int stage = 0; stage < METRICS_STAGE_COUNT; stage++)
+    {
+        add_histogram(&total->worker.stage_latency[stage], &worker->worker.stage_latency[stage]);
+    }
+    add_counters((metrics_counter_t *)&total->queue, (const metrics_counter_t *)&worker->queue,
+                 sizeof(worker->queue) / sizeof(metrics_counter_t));
+}
+
+/**
+ * @brief Adds the metrics of a TLS handshake thread into another one, which must not be written concurrently.
+ * @param total The metrics to add to.
+ * @param tls The metrics to add.
+ */
+void metrics_add_tls(tls_metrics_t *total, const tls_metrics_t *tls)
+{
+    add_counters((metrics_counter_t *)&total->tls, (const metrics_counter_t *)&tls->tls,
+                 offsetof(tls_metrics_t, tls.handshake_latency) / sizeof(metrics_counter_t));
+    for (int resumed = 0; resumed < 2; resumed++)
+    {
+        add_histogram(&total->tls.handshake_latency[resumed], &tls->tls.handshake_latency[resumed]);
+    }
+}
+
+/**
+ * @brief Copies the metrics of a single worker. Never blocks the worker.
+ * @param worker The metrics of the worker.
+ * @param snapshot The copy to fill.
+ */
+void metrics_snapshot_worker(const worker_metrics_t *worker, worker_metrics_t *snapshot)
+{
+    if (worker == NULL || snapshot == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    memset(snapshot, 0, sizeof(worker_metrics_t));
+    metrics_add_worker(snapshot, worker);
+}
+
+/**
+ * @brief Aggregates the metrics of all threads. Never blocks the threads updating them.
+ * @param snapshot The snapshot to fill.
+ */
+void metrics_snapshot(metrics_snapshot_t *snapshot)
+{
+    if (snapshot == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    memset(snapshot, 0, sizeof(metrics_snapshot_t));
+    snapshot->worker_count = metrics_get_worker_count();
+
+    for (int i = 0; i < snapshot->worker_count; i++)
+    {
+        metrics_add_worker(&snapshot->total, &worker_metrics[i]);
+    }
+    add_counters((metrics_counter_t *)&snapshot->receiver.receiver, (const metrics_counter_t *)&receiver_metrics.receiver,
+                 sizeof(receiver_metrics.receiver) / sizeof(metrics_counter_t));
+    add_counters((metrics_counter_t *)&snapshot->timer.timer, (const metrics_counter_t *)&timer_metrics.timer,
+                 sizeof(timer_metrics.timer) / sizeof(metrics_counter_t));
+    for (int i = 0; i < METRICS_MAX_TLS_THREADS; i++)
+    {
+        metrics_add_tls(&snapshot->tls, &tls_metrics[i]);
+    }
+}
+
+/**
+ * @brief Logs a one line summary of the metrics, with rates since the previous summary.
+ * @param interval_ms The time since the previous summary in milliseconds.
+ */
+void metrics_log_summary(uint64_t interval_ms)
+{
+    static uint64_t previous_calls = 0;
+    static uint64_t previous_packets = 0;
+
+    metrics_snapshot_t *snapshot = malloc(sizeof(metrics_snapshot_t));
+    if (snapshot == NULL)
+    {
+        error("Memory allocation failed");
+        return;
+    }
+    metrics_snapshot(snapshot);
+
+    uint64_t calls = metrics_counter_get(&snapshot->total.worker.calls_created);
+    uint64_t packets = metrics_counter_get(&snapshot->receiver.receiver.packets_received);
+    uint64_t parse_errors = 0;
+    for (int i = 0; i < METRICS_PARSE_ERROR_COUNT; i++)
+    {
+        parse_errors += metrics_counter_get(&snapshot->total.worker.parse_errors[i]);
+    }
+    const latency_histogram_t *invite = &snapshot->total.worker.processing_latency[INVITE];
+    double seconds = interval_ms > 0 ? interval_ms / 1000.0 : 1.0;
+
+    info("cps=%.1f pps=%.1f calls=%llu active_calls=%llu drops=%llu parse_errors=%llu send_errors=%llu invite_p50=%lluus invite_p99=%lluus invite_max=%lluus",
+         (calls - previous_calls) / seconds, (packets - previous_packets) / seconds, (unsigned long long)calls,
+         (unsigned long long)(calls - metrics_counter_get(&snapshot->total.worker.calls_deleted)),
+         (unsigned long long)metrics_counter_get(&snapshot->total.queue.enqueue_drops),
+         (unsigned long long)parse_errors,
+         (unsigned long long)metrics_counter_get(&snapshot->total.worker.send_errors),
+         (unsigned long long)histogram_percentile(invite, 50) / 1000,
+         (unsigned long long)histogram_percentile(invite, 99) / 1000,
+         (unsigned long long)metrics_counter_get(&invite->max) / 1000);
+
+    static const char *stage_names[METRICS_STAGE_COUNT] = {
+#define METRICS_STAGE_NAME(id, name, help) #name,
+        LATENCY_STAGES(METRICS_STAGE_NAME)
+#undef METRICS_STAGE_NAME
+    };
+    char stages[256];
+    size_t length = 0;
+    for (int stage = 0; stage < METRICS_STAGE_COUNT && length < sizeof(stages); stage++)
+    {
+        length += snprintf(stages + length, sizeof(stages) - length, " %s=%lluus", stage_names[stage],
+                           (unsigned long long)histogram_percentile(&snapshot->total.worker.stage_latency[stage], 99) / 1000);
+    }
+    info("stage_p99%s", stages);
+
+    previous_calls = calls;
+    previous_packets = packets;
+    free(snapshot);
+}
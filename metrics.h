@@ -0,0 +1,251 @@
+/**
+ * @file metrics.h
+ * @brief Header for the metrics registry: per thread counters and latency histograms.
+ *
+ * Every counter has a single writer thread, so it is updated with a relaxed load and store
+ * instead of a locked instruction, and the counters of different threads live on different
+ * cache lines. Readers aggregate all threads into a snapshot without taking any lock.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "sip_message.h"
+
+#define METRICS_MAX_WORKERS 64
+#define METRICS_MAX_TLS_THREADS 16
+#define METRICS_METHOD_COUNT (MESSAGE + 1)
+#define METRICS_PARSE_ERROR_COUNT (ERROR_MISSING_MANDATORY_PARAMETER + 1)
+#define METRICS_STATUS_CODE_MIN 100
+#define METRICS_STATUS_CODE_COUNT 600
+
+// log-linear buckets with 16 sub-buckets per power of two, about 6% precision up to 2^40 ns
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_SUB_BUCKET_COUNT (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_MAX_EXPONENT 40
+#define HISTOGRAM_BUCKET_COUNT ((HISTOGRAM_MAX_EXPONENT - HISTOGRAM_SUB_BUCKET_BITS + 2) * HISTOGRAM_SUB_BUCKET_COUNT)
+
+typedef atomic_uint_fast64_t metrics_counter_t;
+
+/**
+ * @struct latency_histogram_t
+ * @brief HDR style histogram of nanosecond latencies with a single writer.
+ */
+typedef struct
+{
+    metrics_counter_t count;
+    metrics_counter_t sum;
+    metrics_counter_t max;
+    metrics_counter_t buckets[HISTOGRAM_BUCKET_COUNT];
+} latency_histogram_t;
+
+// counters written by a worker thread, X(name, help)
+#define WORKER_COUNTERS(X)                                                               \
+    X(packets_processed, "Packets dequeued and processed by the worker")                  \
+    X(responses_received, "SIP responses received")                                       \
+    X(retransmissions_absorbed, "Retransmitted requests answered with the last response") \
+    X(messages_sent, "SIP messages sent")                                                 \
+    X(bytes_sent, "Bytes of SIP messages sent")                                           \
+    X(send_errors, "SIP messages that failed to send")                                    \
+    X(segmented_sends, "Sends of several datagrams to one peer segmented by UDP GSO")     \
+    X(tcp_write_overflows, "TCP connections disconnected because they fell too far behind on responses") \
+    X(transactions_created, "Transactions created")                                       \
+    X(transactions_deleted, "Transactions deleted")                                       \
+    X(dialogs_created, "Dialogs created")                                                 \
+    X(dialogs_deleted, "Dialogs deleted")                                                 \
+    X(calls_created, "Calls created")                                                     \
+    X(calls_deleted, "Calls deleted")                                                     \
+    X(dialogs_reaped, "Idle dialogs deleted by the reaper")                               \
+    X(calls_reaped, "Idle calls deleted by the reaper")                                   \
+    X(timer_events_processed, "Timer events processed by the worker")                     \
+    X(invites_cancelled, "Pending INVITEs answered with 487 after a CANCEL")              \
+    X(session_refreshes, "re-INVITEs and UPDATEs answered within an existing dialog")   \
+    X(packets_captured, "Datagrams written to the capture files")                         \
+    X(capture_rotations, "Capture files completed and replaced by a new one")             \
+    X(capture_drops, "Datagrams not captured because no capture file could be created") \
+    X(cdrs_queued, "Call detail records queued to the writer thread")                     \
+    X(cdr_drops, "Call detail records dropped because the writer thread fell behind")
+
+// counters written by the receiver for a worker, X(name, help)
+#define WORKER_QUEUE_COUNTERS(X)                                       \
+    X(messages_enqueued, "Messages dispatched to the worker queue")    \
+    X(enqueue_drops, "Messages dropped because the worker queue was full") \
+    X(invites_shed, "New INVITEs rejected with 503 because the worker was overloaded")
+
+// counters written by the receiver thread, X(name, help)
+#define RECEIVER_COUNTERS(X)                                                  \
+    X(packets_received, "UDP packets and TCP messages received")               \
+    X(bytes_received, "Bytes of UDP packets and TCP messages received")        \
+    X(receive_errors, "Failed receive calls")                                  \
+    X(missing_call_id_drops, "Packets dropped because they have no Call-ID")   \
+    X(allocation_failures, "Packets dropped because allocation failed")         \
+    X(rejected_acks_absorbed, "ACKs of 503 overload responses absorbed by the receiver") \
+    X(source_filter_drops, "Packets dropped because their source is blocked")            \
+    X(rate_limited_drops, "Packets dropped because their source exceeded its rate")      \
+    X(rate_limited_rejects, "New INVITEs rejected with 503 because their source exceeded its rate") \
+    X(draining_rejects, "New INVITEs rejected with 503 while draining for shutdown") \
+    X(coalesced_receives, "Receives returning several datagrams coalesced by UDP GRO") \
+    X(tcp_connections_accepted, "TCP connections accepted")                              \
+    X(tcp_connections_closed, "TCP connections closed")                                  \
+    X(tcp_connections_rejected, "TCP connections refused because the connection table was full") \
+    X(tcp_framing_errors, "TCP connections closed because a message could not be framed") \
+    X(tcp_oversized_drops, "TCP messages dropped because they exceed the message buffer")
+
+// counters of the timer manager, written by several threads, X(name, help)
+#define TIMER_COUNTERS(X)                                                    \
+    X(timers_added, "One shot timers added")                                 \
+    X(timer_add_failures, "One shot timers that failed to be added")         \
+    X(timers_fired, "One shot timers fired")                                 \
+    X(timer_event_enqueue_failures, "Timer events lost because a worker queue was full")
+
+// counters written by a TLS handshake thread, X(name, help)
+#define TLS_COUNTERS(X)                                                                        \
+    X(handshakes_completed, "TLS handshakes completed")                                        \
+    X(handshakes_resumed, "TLS handshakes that resumed a session from a ticket")               \
+    X(handshake_failures, "TLS handshakes that failed")                                        \
+    X(ktls_offloads, "TLS connections whose records are encrypted by the kernel")
+
+// stages of the time a message spends in the server, X(id, name, help)
+#define LATENCY_STAGES(X)                                                                                      \
+    X(SOCKET_WAIT, socket_wait, "Time in the socket receive buffer, from the kernel timestamp to recvmsg")     \
+    X(DISPATCH, dispatch, "Time from recvmsg to queueing the message to its worker")                          \
+    X(QUEUE_WAIT, queue_wait, "Time in the worker queue")                                                      \
+    X(PARSE, parse, "Time parsing the message")                                                                \
+    X(STATE, state, "Time processing the message, excluding sending")                                          \
+    X(SEND, send, "Time sending the messages caused by the message")
+
+#define METRICS_DECLARE_COUNTER(name, help) metrics_counter_t name;
+#define METRICS_DECLARE_STAGE(id, name, help) METRICS_STAGE_##id,
+
+typedef enum
+{
+    LATENCY_STAGES(METRICS_DECLARE_STAGE)
+    METRICS_STAGE_COUNT
+} metrics_stage_t;
+
+/**
+ * @struct worker_metrics_t
+ * @brief Metrics of a worker thread.
+ */
+typedef struct
+{
+    _Alignas(64) struct
+    {
+        WORKER_COUNTERS(METRICS_DECLARE_COUNTER)
+        metrics_counter_t requests_received[METRICS_METHOD_COUNT];
+        metrics_counter_t parse_errors[METRICS_PARSE_ERROR_COUNT];
+        metrics_counter_t responses_sent[METRICS_STATUS_CODE_COUNT];
+        latency_histogram_t processing_latency[METRICS_METHOD_COUNT]; // receive to last response sent
+        latency_histogram_t stage_latency[METRICS_STAGE_COUNT];
+    } worker;
+    _Alignas(64) struct
+    {
+        WORKER_QUEUE_COUNTERS(METRICS_DECLARE_COUNTER)
+    } queue;
+} worker_metrics_t;
+
+/**
+ * @struct receiver_metrics_t
+ * @brief Metrics of the receiver thread.
+ */
+typedef struct
+{
+    _Alignas(64) struct
+    {
+        RECEIVER_COUNTERS(METRICS_DECLARE_COUNTER)
+    } receiver;
+} receiver_metrics_t;
+
+/**
+ * @struct timer_metrics_t
+ * @brief Metrics of the timer manager.
+ */
+typedef struct
+{
+    _Alignas(64) struct
+    {
+        TIMER_COUNTERS(METRICS_DECLARE_COUNTER)
+    } timer;
+} timer_metrics_t;
+
+/**
+ * @struct tls_metrics_t
+ * @brief Metrics of a TLS handshake thread.
+ */
+typedef struct
+{
+    _Alignas(64) struct
+    {
+        TLS_COUNTERS(METRICS_DECLARE_COUNTER)
+        latency_histogram_t handshake_latency[2]; // accept to handshake done, of full and of resumed handshakes
+    } tls;
+} tls_metrics_t;
+
+/**
+ * @struct metrics_snapshot_t
+ * @brief Metrics of all threads aggregated at one point in time.
+ */
+typedef struct
+{
+    int worker_count;
+    worker_metrics_t total;
+    receiver_metrics_t receiver;
+    timer_metrics_t timer;
+    tls_metrics_t tls;
+} metrics_snapshot_t;
+
+extern __thread worker_metrics_t *thread_worker_metrics;
+extern receiver_metrics_t receiver_metrics;
+extern timer_metrics_t timer_metrics;
+extern tls_metrics_t tls_metrics[METRICS_MAX_TLS_THREADS];
+extern const char *const metrics_method_names[METRICS_METHOD_COUNT];
+
+/**
+ * @brief Increments a counter that has a single writer thread.
+ */
+static inline void metrics_counter_add(metrics_counter_t *counter, uint64_t value)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+/**
+ * @brief Increments a counter that is written by several threads.
+ */
+static inline void metrics_counter_add_shared(metrics_counter_t *counter, uint64_t value)
+{
+    atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+static inline uint64_t metrics_counter_get(const metrics_counter_t *counter)
+{
+    return atomic_load_explicit((metrics_counter_t *)counter, memory_order_relaxed);
+}
+
+// increments a counter of the calling worker thread, does nothing on other threads
+#define worker_metrics_add(field, value)                      \
+    do                                                        \
+    {                                                         \
+        worker_metrics_t *worker_metrics_ = thread_worker_metrics; \
+        if (worker_metrics_ != NULL)                          \
+        {                                                     \
+            metrics_counter_add(&worker_metrics_->worker.field, (value)); \
+        }                                                     \
+    } while (0)
+
+#define worker_metrics_inc(field) worker_metrics_add(field, 1)
+
+worker_metrics_t *metrics_register_worker(void);
+worker_metrics_t *metrics_get_worker(int index);
+int metrics_get_worker_count(void);
+void histogram_record(latency_histogram_t *histogram, uint64_t value_ns);
+uint64_t histogram_bucket_upper_bound(int bucket);
+uint64_t histogram_percentile(const latency_histogram_t *histogram, double percentile);
+void metrics_snapshot(metrics_snapshot_t *snapshot);
+void metrics_add_worker(worker_metrics_t *total, const worker_metrics_t *worker);
+void metrics_add_tls(tls_metrics_t *total, const tls_metrics_t *tls);
+void metrics_snapshot_worker(const worker_metrics_t *worker, worker_metrics_t *snapshot);
+void metrics_log_summary(uint64_t interval_ms);
+
+#endif // METRICS_H
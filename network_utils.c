@@ -5,6 +5,7 @@
 
 #include "network_utils.h"
 #include "log.h"
+#include "utils.h"
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -17,13 +18,13 @@
  * @brief Sends a SIP message to the specified destination and port.
  *
  * @param message The SIP message to be sent.
- * @param destination The IP address of the destination.
+ * @param destination The IPv4 or IPv6 address of the destination.
  * @param port The port number on the destination.
  */
 void send_sip_message(const sip_message_t *message, const char *destination, int port)
 {
     int sockfd;
-    struct sockaddr_in dest_addr;
+    struct sockaddr_storage dest_addr;
 
     if (message == NULL || destination == NULL || port <= 0)
     {
@@ -31,27 +32,23 @@ void send_sip_message(const sip_message_t *message, const char *destination, int
         return;
     }
 
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0)
+    socklen_t dest_addr_len = parse_socket_address(destination, port, &dest_addr);
+    if (dest_addr_len == 0)
     {
-        error("Failed to create socket: %s", strerror(errno));
+        error("Invalid address/ Address not supported: %s", destination);
         return;
     }
 
-    memset(&dest_addr, 0, sizeof(dest_addr));
-    dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(port);
-
-    if (inet_pton(AF_INET, destination, &dest_addr.sin_addr) <= 0)
+    sockfd = socket(dest_addr.ss_family, SOCK_DGRAM, 0);
+    if (sockfd < 0)
     {
-        error("Invalid address/ Address not supported: %s", destination);
-        close(sockfd);
+        error("Failed to create socket: %s", strerror(errno));
         return;
     }
 
     // Send the message
     if (sendto(sockfd, message->buffer, strlen(message->buffer), 0,
-               (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0)
+               (struct sockaddr *)&dest_addr, dest_addr_len) < 0)
     {
         error("Failed to send SIP message: %s", strerror(errno));
     }
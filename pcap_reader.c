@@ -0,0 +1,483 @@
+/**
+ * @file pcap_reader.c
+ * @brief Implementation of the reader of UDP datagrams from pcap and pcapng capture files.
+ */
+
+#include "pcap_reader.h"
+#include "log.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PCAP_MAGIC_MICROSECONDS 0xa1b2c3d4
+#define PCAP_MAGIC_NANOSECONDS 0xa1b23c4d
+#define PCAP_FILE_HEADER_SIZE 24
+#define PCAP_RECORD_HEADER_SIZE 16
+
+#define PCAPNG_SECTION_HEADER_BLOCK 0x0a0d0d0a
+#define PCAPNG_INTERFACE_DESCRIPTION_BLOCK 1
+#define PCAPNG_SIMPLE_PACKET_BLOCK 3
+#define PCAPNG_ENHANCED_PACKET_BLOCK 6
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_OPTION_END 0
+#define PCAPNG_OPTION_IF_TSRESOL 9
+
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LOOP 108
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_IPV6 0x86dd
+#define ETHERTYPE_VLAN 0x8100
+#define ETHERTYPE_QINQ 0x88a8
+
+#define IPV6_HOP_BY_HOP 0
+#define IPV6_ROUTING 43
+#define IPV6_DESTINATION_OPTIONS 60
+
+static uint16_t read_u16(const pcap_reader_t *reader, const uint8_t *data)
+{
+    uint16_t value;
+    memcpy(&value, data, sizeof(value));
+    return reader->swapped ? __builtin_bswap16(value) : value;
+}
+
+static uint32_t read_u32(const pcap_reader_t *reader, const uint8_t *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return reader->swapped ? __builtin_bswap32(value) : value;
+}
+
+// protocol headers are in network byte order whatever the capture file uses
+static uint16_t read_be16(const uint8_t *data)
+{
+    return (uint16_t)(data[0] << 8 | data[1]);
+}
+
+/**
+ * @brief Opens a capture file and reads its file header, or the first pcapng section header.
+ * @param reader The reader to initialize.
+ * @param path The path of the pcap or pcapng file.
+ * @return 0 on success, -1 if the file cannot be opened or is not a capture.
+ */
+int pcap_reader_open(pcap_reader_t *reader, const char *path)
+{
+    if (reader == NULL || path == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    memset(reader, 0, sizeof(pcap_reader_t));
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL)
+    {
+        error("Failed to open capture file %s: %s", path, strerror(errno));
+        return -1;
+    }
+    reader->frame = malloc(PCAP_MAX_FRAME_SIZE);
+    if (reader->frame == NULL)
+    {
+        error("Memory allocation failed");
+        pcap_reader_close(reader);
+        return -1;
+    }
+
+    uint8_t header[PCAP_FILE_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), reader->file) != sizeof(header))
+    {
+        error("Capture file %s is too short", path);
+        pcap_reader_close(reader);
+        return -1;
+    }
+    uint32_t magic;
+    memcpy(&magic, header, sizeof(magic));
+    if (magic == PCAPNG_SECTION_HEADER_BLOCK)
+    {
+        // the section header is read again as the first block, which sets the byte order
+        reader->pcapng = true;
+        rewind(reader->file);
+        return 0;
+    }
+    reader->swapped = magic == __builtin_bswap32(PCAP_MAGIC_MICROSECONDS) || magic == __builtin_bswap32(PCAP_MAGIC_NANOSECONDS);
+    magic = read_u32(reader, header);
+    if (magic != PCAP_MAGIC_MICROSECONDS && magic != PCAP_MAGIC_NANOSECONDS)
+    {
+        error("%s is not a pcap or pcapng file", path);
+        pcap_reader_close(reader);
+        return -1;
+    }
+    reader->tick_ns = magic == PCAP_MAGIC_NANOSECONDS ? 1 : 1000;
+    reader->link_type = read_u32(reader, header + 20) & 0xffff; // the upper bits hold FCS flags
+    return 0;
+}
+
+/**
+ * @brief Closes the capture file.
+ * @param reader The reader, which may have failed to open.
+ */
+void pcap_reader_close(pcap_reader_t *reader)
+{
+    if (reader == NULL)
+    {
+        return;
+    }
+    if (reader->file != NULL)
+    {
+        fclose(reader->file);
+        reader->file = NULL;
+    }
+    free(reader->frame);
+    reader->frame = NULL;
+}
+
+/**
+ * @brief Stores an IP address and UDP port as a socket address.
+ */
+static socklen_t make_address(int family, const uint8_t *address, const uint8_t *port, struct sockaddr_storage *storage)
+{
+    memset(storage, 0, sizeof(struct sockaddr_storage));
+    if (family == AF_INET)
+    {
+        struct sockaddr_in *in = (struct sockaddr_in *)storage;
+        in->sin_family = AF_INET;
+        memcpy(&in->sin_addr, address, sizeof(in->sin_addr));
+        memcpy(&in->sin_port, port, sizeof(in->sin_port));
+        return sizeof(struct sockaddr_in);
+    }
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)storage;
+    in6->sin6_family = AF_INET6;
+    memcpy(&in6->sin6_addr, address, sizeof(in6->sin6_addr));
+    memcpy(&in6->sin6_port, port, sizeof(in6->sin6_port));
+    return sizeof(struct sockaddr_in6);
+}
+
+/**
+ * @brief Decodes an IPv4 or IPv6 packet carrying an unfragmented UDP datagram.
+ * @param data The IP header.
+ * @param length The captured bytes from the IP header on.
+ * @param datagram Filled with the addresses and payload of the datagram.
+ * @return true if the packet is such a datagram.
+ */
+static bool decode_ip(const uint8_t *data, size_t length, pcap_datagram_t *datagram)
+{
+    const uint8_t *source;
+    const uint8_t *destination;
+    int family;
+    size_t offset;
+    if (length >= 20 && data[0] >> 4 == 4)
+    {
+        size_t header_length = (size_t)(data[0] & 0x0f) * 4;
+        size_t total_length = read_be16(data + 2);
+        // fragments other than the first have no UDP header, first fragments only part of the payload
+        if (header_length < 20 || (read_be16(data + 6) & 0x3fff) != 0 || data[9] != IPPROTO_UDP)
+        {
+            return false;
+        }
+        length = total_length >= header_length && total_length < length ? total_length : length;
+        family = AF_INET;
+        source = data + 12;
+        destination = data + 16;
+        offset = header_length;
+    }
+    else if (length >= 40 && data[0] >> 4 == 6)
+    {
+        size_t total_length = 40 + (size_t)read_be16(data + 4);
+        length = total_length < length ? total_length : length;
+        family = AF_INET6;
+        source = data + 8;
+        destination = data + 24;
+        offset = 40;
+        uint8_t next_header = data[6];
+        while (next_header == IPV6_HOP_BY_HOP || next_header == IPV6_ROUTING || next_header == IPV6_DESTINATION_OPTIONS)
+        {
+            if (offset + 8 > length)
+            {
+                return false;
+            }
+            next_header = data[offset];
+            offset += ((size_t)data[offset + 1] + 1) * 8;
+        }
+        // a fragment header ends the chain like any other protocol
+        if (next_header != IPPROTO_UDP)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    if (offset + 8 > length)
+    {
+        return false;
+    }
+    const uint8_t *udp = data + offset;
+    size_t udp_length = read_be16(udp + 4);
+    if (udp_length < 8)
+    {
+        return false;
+    }
+    size_t captured = length - offset - 8;
+    datagram->source_length = make_address(family, source, udp, &datagram->source);
+    datagram->destination_length = make_address(family, destination, udp + 2, &datagram->destination);
+    datagram->payload = (const char *)udp + 8;
+    datagram->length = udp_length - 8 < captured ? udp_length - 8 : captured;
+    return true;
+}
+
+/**
+ * @brief Decodes a captured frame down to its UDP datagram.
+ * @param link_type The link type of the interface the frame was captured on.
+ * @param data The frame.
+ * @param length The captured length of the frame.
+ * @param datagram Filled with the addresses and payload of the datagram.
+ * @return true if the frame holds an unfragmented UDP datagram.
+ */
+static bool decode_frame(uint32_t link_type, const uint8_t *data, size_t length, pcap_datagram_t *datagram)
+{
+    size_t offset;
+    uint16_t ethertype = 0; // 0 leaves the IP version to the first byte of the packet
+    switch (link_type)
+    {
+    case LINKTYPE_ETHERNET:
+        offset = 14;
+        if (length < offset)
+        {
+            return false;
+        }
+        ethertype = read_be16(data + 12);
+        while ((ethertype == ETHERTYPE_VLAN || ethertype == ETHERTYPE_QINQ) && length >= offset + 4)
+        {
+            ethertype = read_be16(data + offset + 2);
+            offset += 4;
+        }
+        break;
+    case LINKTYPE_LINUX_SLL:
+        offset = 16;
+        ethertype = length >= offset ? read_be16(data + 14) : 0;
+        break;
+    case LINKTYPE_LINUX_SLL2:
+        offset = 20;
+        ethertype = length >= offset ? read_be16(data) : 0;
+        break;
+    case LINKTYPE_NULL:
+    case LINKTYPE_LOOP:
+        // the address family is in the byte order of the capturing host, the IP version tells
+        offset = 4;
+        break;
+    case LINKTYPE_RAW:
+    case LINKTYPE_IPV4:
+    case LINKTYPE_IPV6:
+        offset = 0;
+        break;
+    default:
+        return false;
+    }
+    if (length < offset || (ethertype != 0 && ethertype != ETHERTYPE_IPV4 && ethertype != ETHERTYPE_IPV6))
+    {
+        return false;
+    }
+    return decode_ip(data + offset, length - offset, datagram);
+}
+
+/**
+ * @brief Converts a pcapng timestamp in interface ticks to nanoseconds.
+ */
+static uint64_t ticks_to_ns(uint64_t ticks, uint64_t ticks_per_second)
+{
+    return ticks / ticks_per_second * 1000000000ULL + ticks % ticks_per_second * 1000000000ULL / ticks_per_second;
+}
+
+/**
+ * @brief Reads the timestamp resolution option of a pcapng interface description block.
+ * @param options The options of the block, after the link type, reserved field and snapshot length.
+ * @param length The length of the options.
+ * @return The timestamp ticks per second of the interface.
+ */
+static uint64_t read_interface_resolution(const pcap_reader_t *reader, const uint8_t *options, size_t length)
+{
+    size_t offset = 0;
+    while (offset + 4 <= length)
+    {
+        uint16_t code = read_u16(reader, options + offset);
+        uint16_t option_length = read_u16(reader, options + offset + 2);
+        if (code == PCAPNG_OPTION_END || offset + 4 + option_length > length)
+        {
+            break;
+        }
+        if (code == PCAPNG_OPTION_IF_TSRESOL && option_length >= 1)
+        {
+            // a power of two when the high bit is set, a power of ten otherwise
+            uint8_t resolution = options[offset + 4];
+            uint8_t exponent = resolution & 0x7f;
+            uint64_t ticks = 1;
+            for (uint8_t i = 0; i < exponent && ticks <= UINT64_MAX / 10; i++)
+            {
+                ticks *= resolution & 0x80 ? 2 : 10;
+            }
+            return ticks;
+        }
+        offset += 4 + ((option_length + 3u) & ~3u);
+    }
+    return 1000000;
+}
+
+/**
+ * @brief Reads the next frame of a classic pcap file.
+ * @return 1 with the frame read, 0 at the end of the file.
+ */
+static int read_pcap_frame(pcap_reader_t *reader, uint32_t *link_type, size_t *length, uint64_t *timestamp_ns)
+{
+    uint8_t header[PCAP_RECORD_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), reader->file) != sizeof(header))
+    {
+        return 0;
+    }
+    uint32_t captured = read_u32(reader, header + 8);
+    if (captured > PCAP_MAX_FRAME_SIZE)
+    {
+        error("Capture record of %u bytes is larger than %d bytes", captured, PCAP_MAX_FRAME_SIZE);
+        return 0;
+    }
+    if (fread(reader->frame, 1, captured, reader->file) != captured)
+    {
+        error("Capture file is truncated");
+        return 0;
+    }
+    *link_type = reader->link_type;
+    *length = captured;
+    *timestamp_ns = (uint64_t)read_u32(reader, header) * 1000000000ULL + (uint64_t)read_u32(reader, header + 4) * reader->tick_ns;
+    return 1;
+}
+
+/**
+ * @brief Reads pcapng blocks up to the next packet block, following the section and interface blocks on the way.
+ * @return 1 with the frame read, 0 at the end of the file.
+ */
+static int read_pcapng_frame(pcap_reader_t *reader, uint32_t *link_type, size_t *length, uint64_t *timestamp_ns)
+{
+    uint8_t header[8];
+    while (fread(header, 1, sizeof(header), reader->file) == sizeof(header))
+    {
+        uint32_t type;
+        memcpy(&type, header, sizeof(type));
+        if (type == PCAPNG_SECTION_HEADER_BLOCK)
+        {
+            // every section sets its own byte order, told by the magic following the block length
+            uint8_t magic[4];
+            if (fread(magic, 1, sizeof(magic), reader->file) != sizeof(magic))
+            {
+                break;
+            }
+            uint32_t byte_order;
+            memcpy(&byte_order, magic, sizeof(byte_order));
+            reader->swapped = byte_order != PCAPNG_BYTE_ORDER_MAGIC;
+            reader->interface_count = 0;
+            if (fseek(reader->file, -(long)sizeof(magic), SEEK_CUR) != 0)
+            {
+                break;
+            }
+        }
+        type = read_u32(reader, header);
+        uint32_t block_length = read_u32(reader, header + 4);
+        if (block_length < 12 || block_length % 4 != 0)
+        {
+            error("Invalid pcapng block length %u", block_length);
+            return 0;
+        }
+        size_t body_length = block_length - 8;
+        if (body_length > PCAP_MAX_FRAME_SIZE)
+        {
+            reader->frames_skipped += type == PCAPNG_ENHANCED_PACKET_BLOCK || type == PCAPNG_SIMPLE_PACKET_BLOCK;
+            if (fseek(reader->file, (long)body_length, SEEK_CUR) != 0)
+            {
+                break;
+            }
+            continue;
+        }
+        if (fread(reader->frame, 1, body_length, reader->file) != body_length)
+        {
+            error("Capture file is truncated");
+            return 0;
+        }
+        const uint8_t *body = reader->frame;
+        body_length -= 4; // the trailing copy of the block length
+
+        if (type == PCAPNG_INTERFACE_DESCRIPTION_BLOCK && body_length >= 8)
+        {
+            if (reader->interface_count < PCAP_MAX_INTERFACES)
+            {
+                reader->interface_link_types[reader->interface_count] = read_u16(reader, body);
+                reader->interface_ticks_per_second[reader->interface_count] = read_interface_resolution(reader, body + 8, body_length - 8);
+            }
+            reader->interface_count++;
+        }
+        else if (type == PCAPNG_ENHANCED_PACKET_BLOCK && body_length >= 20)
+        {
+            uint32_t interface = read_u32(reader, body);
+            uint32_t captured = read_u32(reader, body + 12);
+            if (interface >= reader->interface_count || interface >= PCAP_MAX_INTERFACES || captured > body_length - 20)
+            {
+                reader->frames_skipped++;
+                continue;
+            }
+            uint64_t ticks = (uint64_t)read_u32(reader, body + 4) << 32 | read_u32(reader, body + 8);
+            *timestamp_ns = ticks_to_ns(ticks, reader->interface_ticks_per_second[interface]);
+            *link_type = reader->interface_link_types[interface];
+            *length = captured;
+            memmove(reader->frame, body + 20, captured);
+            return 1;
+        }
+        else if (type == PCAPNG_SIMPLE_PACKET_BLOCK && body_length >= 4)
+        {
+            // simple packets belong to the first interface and have no timestamp, they keep the previous one
+            uint32_t original = read_u32(reader, body);
+            if (reader->interface_count == 0)
+            {
+                reader->frames_skipped++;
+                continue;
+            }
+            *link_type = reader->interface_link_types[0];
+            *length = original < body_length - 4 ? original : body_length - 4;
+            memmove(reader->frame, body + 4, *length);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads frames up to the next UDP datagram.
+ * @param reader The open reader.
+ * @param datagram Filled with the datagram, whose payload is valid until the next call. The timestamp is kept
+ * by frames without one, so it should be initialized before the first call.
+ * @return 1 if a datagram was read, 0 at the end of the capture, -1 on invalid parameters.
+ */
+int pcap_reader_next(pcap_reader_t *reader, pcap_datagram_t *datagram)
+{
+    if (reader == NULL || reader->file == NULL || datagram == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    uint32_t link_type;
+    size_t length;
+    while ((reader->pcapng ? read_pcapng_frame : read_pcap_frame)(reader, &link_type, &length, &datagram->timestamp_ns) == 1)
+    {
+        reader->frames_read++;
+        if (decode_frame(link_type, reader->frame, length, datagram))
+        {
+            return 1;
+        }
+        reader->frames_skipped++;
+    }
+    return 0;
+}
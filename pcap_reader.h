@@ -0,0 +1,63 @@
+/**
+ * @file pcap_reader.h
+ * @brief Header for the reader of UDP datagrams from pcap and pcapng capture files.
+ *
+ * Both the classic pcap format, in either byte order and with microsecond or nanosecond
+ * timestamps, and the pcapng format with any number of sections and interfaces are read.
+ * Frames are decoded from Ethernet, with VLAN tags, Linux cooked captures, BSD loopback and
+ * raw IP link types, down to the UDP payload over IPv4 or IPv6. Everything else, fragments
+ * included, is skipped and counted.
+ */
+
+#ifndef PCAP_READER_H
+#define PCAP_READER_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+
+#define PCAP_MAX_FRAME_SIZE 262144 // largest frame read, the snapshot length of tcpdump
+#define PCAP_MAX_INTERFACES 16     // interfaces of a pcapng section
+
+/**
+ * @struct pcap_datagram_t
+ * @brief A UDP datagram of a capture, valid until the next read.
+ */
+typedef struct
+{
+    uint64_t timestamp_ns; // capture time, nanoseconds since the epoch
+    struct sockaddr_storage source;
+    socklen_t source_length;
+    struct sockaddr_storage destination;
+    socklen_t destination_length;
+    const char *payload;
+    size_t length;
+} pcap_datagram_t;
+
+/**
+ * @struct pcap_reader_t
+ * @brief An open capture file and the state of its current section.
+ */
+typedef struct
+{
+    FILE *file;
+    bool pcapng;
+    bool swapped;          // the section was written with the other byte order
+    uint32_t link_type;    // link type of a classic pcap file
+    uint64_t tick_ns;      // timestamp unit of a classic pcap file
+    uint32_t interface_count;
+    uint32_t interface_link_types[PCAP_MAX_INTERFACES];
+    uint64_t interface_ticks_per_second[PCAP_MAX_INTERFACES];
+    uint8_t *frame;        // PCAP_MAX_FRAME_SIZE bytes
+    uint64_t frames_read;
+    uint64_t frames_skipped; // frames that are not an unfragmented UDP datagram of a supported link type
+} pcap_reader_t;
+
+int pcap_reader_open(pcap_reader_t *reader, const char *path);
+int pcap_reader_next(pcap_reader_t *reader, pcap_datagram_t *datagram);
+void pcap_reader_close(pcap_reader_t *reader);
+
+#endif // PCAP_READER_H
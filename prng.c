@@ -0,0 +1,162 @@
+/**
+ * @file prng.c
+ * @brief Implementation of the per-thread pseudo random number generator used for SIP identifiers.
+ *
+ * Every thread owns a xoshiro256** state seeded from getrandom(), so no locks are taken
+ * when generating tags, unlike rand() which serializes all workers on a global lock.
+ */
+
+#include "prng.h"
+#include "log.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/random.h>
+
+// token characters as defined by RFC 3261, 64 of them so every character takes exactly 6 bits
+static const char token_alphabet[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-.";
+
+typedef struct
+{
+    uint64_t s[4];
+    uint64_t sequence;
+    uint32_t slot;
+    bool seeded;
+} prng_state_t;
+
+static __thread prng_state_t prng_state;
+static atomic_uint next_thread_slot = 0;
+
+/**
+ * @brief splitmix64 step, used to expand a weak fallback seed.
+ */
+static uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/**
+ * @brief Seeds the calling thread's generator and assigns its thread slot.
+ */
+static void prng_seed_thread(prng_state_t *state)
+{
+    if (getrandom(state->s, sizeof(state->s), 0) != sizeof(state->s))
+    {
+        error("getrandom failed, seeding from clock");
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t x = ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec) ^ ((uint64_t)gettid() << 32);
+        for (int i = 0; i < 4; i++)
+        {
+            state->s[i] = splitmix64(&x);
+        }
+    }
+    if ((state->s[0] | state->s[1] | state->s[2] | state->s[3]) == 0)
+    {
+        state->s[0] = 1;
+    }
+    state->sequence = 0;
+    state->slot = atomic_fetch_add_explicit(&next_thread_slot, 1, memory_order_relaxed);
+    state->seeded = true;
+}
+
+/**
+ * @brief Returns the next 64 bit pseudo random value of the calling thread.
+ * @return The random value.
+ */
+uint64_t prng_next(void)
+{
+    prng_state_t *state = &prng_state;
+    if (__builtin_expect(!state->seeded, 0))
+    {
+        prng_seed_thread(state);
+    }
+    uint64_t *s = state->s;
+    const uint64_t result = rotl(s[1] * 5, 7) * 9;
+    const uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+/**
+ * @brief Fills a buffer with random token characters. The buffer is not null terminated.
+ * @param buffer The buffer to fill.
+ * @param length The number of characters to write.
+ */
+void prng_fill_token(char *buffer, size_t length)
+{
+    if (buffer == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    size_t i = 0;
+    while (i < length)
+    {
+        uint64_t r = prng_next();
+        // 10 characters of 6 bits each out of every 64 bit value
+        for (int j = 0; j < 10 && i < length; j++, i++)
+        {
+            buffer[i] = token_alphabet[r & 63];
+            r >>= 6;
+        }
+    }
+}
+
+/**
+ * @brief Writes the low bits of a value as fixed width token characters, most significant first.
+ */
+static void encode_token_bits(char *buffer, size_t chars, uint64_t value)
+{
+    for (size_t i = chars; i > 0; i--)
+    {
+        buffer[i - 1] = token_alphabet[value & 63];
+        value >>= 6;
+    }
+}
+
+/**
+ * @brief Creates a token that is unique across all threads of the process. The buffer is not null terminated.
+ *
+ * The token starts with the thread slot and a per thread sequence number, so tokens of different
+ * threads never collide, and is filled up with random characters so tokens of different process
+ * runs are unlikely to collide. Tokens shorter than PRNG_TOKEN_MIN_UNIQUE_LENGTH are only random.
+ *
+ * @param buffer The buffer to fill.
+ * @param length The number of characters to write.
+ */
+void create_unique_token(char *buffer, size_t length)
+{
+    if (buffer == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    if (length < PRNG_TOKEN_MIN_UNIQUE_LENGTH)
+    {
+        prng_fill_token(buffer, length);
+        return;
+    }
+    prng_state_t *state = &prng_state;
+    if (__builtin_expect(!state->seeded, 0))
+    {
+        prng_seed_thread(state);
+    }
+    encode_token_bits(buffer, PRNG_TOKEN_SLOT_CHARS, state->slot);
+    encode_token_bits(buffer + PRNG_TOKEN_SLOT_CHARS, PRNG_TOKEN_SEQUENCE_CHARS, state->sequence++);
+    prng_fill_token(buffer + PRNG_TOKEN_MIN_UNIQUE_LENGTH, length - PRNG_TOKEN_MIN_UNIQUE_LENGTH);
+}
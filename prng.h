@@ -0,0 +1,21 @@
+/**
+ * @file prng.h
+ * @brief Header for the per-thread pseudo random number generator used for SIP identifiers.
+ */
+
+#ifndef PRNG_H
+#define PRNG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PRNG_TOKEN_SLOT_CHARS 2      // 12 bits of thread slot, up to 4096 threads
+#define PRNG_TOKEN_SEQUENCE_CHARS 6  // 36 bits of per thread sequence
+#define PRNG_TOKEN_MIN_UNIQUE_LENGTH (PRNG_TOKEN_SLOT_CHARS + PRNG_TOKEN_SEQUENCE_CHARS)
+
+uint64_t prng_next(void);
+// both write exactly length token characters and no terminating null
+void prng_fill_token(char *buffer, size_t length);
+void create_unique_token(char *buffer, size_t length);
+
+#endif // PRNG_H
@@ -0,0 +1,264 @@
+/**
+ * @file rate_limiter.c
+ * @brief Implementation of the per source address token bucket rate limiter of the receiver.
+ */
+
+#include "rate_limiter.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+rate_limiter_t rate_limiter;
+
+/**
+ * @brief Initializes the rate limiter.
+ * @param limiter The rate limiter.
+ * @param table_size The number of tracked sources, rounded up to a power of two.
+ * @param rate The allowed packets per second and source, 0 disables the limiter.
+ * @param burst The bucket size in packets, 0 means one second of traffic.
+ * @param action What to do with packets above the rate.
+ * @return 0 on success, -1 on failure.
+ */
+int init_rate_limiter(rate_limiter_t *limiter, int table_size, int rate, int burst, rate_limit_action_t action)
+{
+    if (limiter == NULL || table_size <= 0 || rate < 0 || burst < 0)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    memset(limiter, 0, sizeof(rate_limiter_t));
+    limiter->rate = (uint64_t)rate;
+    limiter->burst = burst > 0 ? (uint64_t)burst : (uint64_t)rate;
+    limiter->action = action;
+    if (rate == 0)
+    {
+        return 0;
+    }
+
+    size_t size = RATE_LIMITER_PROBES;
+    while (size < (size_t)table_size)
+    {
+        size *= 2;
+    }
+    limiter->entries = calloc(size, sizeof(rate_limiter_entry_t));
+    if (limiter->entries == NULL)
+    {
+        error("Memory allocation failed");
+        return -1;
+    }
+    limiter->size = size;
+    info("Rate limiting sources to %llu packets per second, burst %llu, %zu sources tracked",
+         (unsigned long long)limiter->rate, (unsigned long long)limiter->burst, size);
+    return 0;
+}
+
+bool rate_limiter_enabled(const rate_limiter_t *limiter)
+{
+    return limiter != NULL && limiter->rate > 0;
+}
+
+#define SOURCE_KEY_IPV4_TAG (0xffffULL << 32)
+
+/**
+ * @brief Returns the bucket key of a source address: an IPv4 address, also when mapped into
+ * IPv6, tagged like ::ffff:0:0/96 in the upper half, or the first 64 bits of an IPv6 address.
+ * @return The key, 0 for the unspecified address and the ::/64 prefix, which are not limited.
+ */
+static uint64_t get_source_key(const struct sockaddr *address)
+{
+    if (address->sa_family == AF_INET)
+    {
+        uint32_t ipv4 = ntohl(((const struct sockaddr_in *)address)->sin_addr.s_addr);
+        return ipv4 != 0 ? SOURCE_KEY_IPV4_TAG | ipv4 : 0;
+    }
+    if (address->sa_family == AF_INET6)
+    {
+        const uint8_t *bytes = ((const struct sockaddr_in6 *)address)->sin6_addr.s6_addr;
+        if (IN6_IS_ADDR_V4MAPPED((const struct in6_addr *)bytes))
+        {
+            uint32_t ipv4 = (uint32_t)bytes[12] << 24 | (uint32_t)bytes[13] << 16 | (uint32_t)bytes[14] << 8 | bytes[15];
+            return ipv4 != 0 ? SOURCE_KEY_IPV4_TAG | ipv4 : 0;
+        }
+        uint64_t prefix = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            prefix = prefix << 8 | bytes[i];
+        }
+        return prefix;
+    }
+    return 0;
+}
+
+/**
+ * @brief Formats a bucket key as an IPv4 address or an IPv6 /64 prefix.
+ */
+static void format_source_key(uint64_t source, char *buffer, size_t size)
+{
+    if ((source & ~0xffffffffULL) == SOURCE_KEY_IPV4_TAG)
+    {
+        struct in_addr ipv4 = {.s_addr = htonl((uint32_t)source)};
+        inet_ntop(AF_INET, &ipv4, buffer, size);
+        return;
+    }
+    struct in6_addr ipv6;
+    memset(&ipv6, 0, sizeof(ipv6));
+    for (int i = 0; i < 8; i++)
+    {
+        ipv6.s6_addr[i] = (uint8_t)(source >> (56 - 8 * i));
+    }
+    char prefix[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, &ipv6, prefix, sizeof(prefix));
+    snprintf(buffer, size, "%s/64", prefix);
+}
+
+/**
+ * @brief Finds the entry of a source, or replaces the least recently seen entry of its probe window.
+ */
+static rate_limiter_entry_t *find_entry(rate_limiter_t *limiter, uint64_t source, uint64_t now_ms)
+{
+    size_t index = (size_t)(((source ^ (source >> 32)) * 0x9E3779B97F4A7C15ULL) >> 32) & (limiter->size - 1);
+    rate_limiter_entry_t *oldest = NULL;
+    for (int probe = 0; probe < RATE_LIMITER_PROBES; probe++)
+    {
+        rate_limiter_entry_t *entry = &limiter->entries[(index + probe) & (limiter->size - 1)];
+        uint64_t entry_source = atomic_load_explicit(&entry->source, memory_order_relaxed);
+        if (entry_source == source)
+        {
+            return entry;
+        }
+        if (entry_source == 0)
+        {
+            oldest = entry;
+            break;
+        }
+        if (oldest == NULL || entry->last_seen_ms < oldest->last_seen_ms)
+        {
+            oldest = entry;
+        }
+    }
+
+    // a new source starts with a full bucket
+    atomic_store_explicit(&oldest->source, source, memory_order_relaxed);
+    oldest->last_seen_ms = now_ms;
+    oldest->tokens = limiter->burst * 1000;
+    atomic_store_explicit(&oldest->packets, 0, memory_order_relaxed);
+    atomic_store_explicit(&oldest->limited, 0, memory_order_relaxed);
+    return oldest;
+}
+
+/**
+ * @brief Takes a token from the bucket of a source. Must only be called by the receiver thread.
+ * @param limiter The rate limiter.
+ * @param address The source address.
+ * @param now_ms The current monotonic time in milliseconds.
+ * @return true if the packet is within the rate of its source.
+ */
+bool rate_limiter_allow(rate_limiter_t *limiter, const struct sockaddr *address, uint64_t now_ms)
+{
+    if (!rate_limiter_enabled(limiter) || address == NULL)
+    {
+        return true;
+    }
+    uint64_t source = get_source_key(address);
+    if (source == 0)
+    {
+        return true;
+    }
+    rate_limiter_entry_t *entry = find_entry(limiter, source, now_ms);
+    metrics_counter_add(&entry->packets, 1);
+
+    // the rate is per second, so a millisecond refills rate thousandths of a packet
+    uint64_t tokens = entry->tokens + (now_ms - entry->last_seen_ms) * limiter->rate;
+    entry->tokens = tokens < limiter->burst * 1000 ? tokens : limiter->burst * 1000;
+    entry->last_seen_ms = now_ms;
+    if (entry->tokens < 1000)
+    {
+        metrics_counter_add(&entry->limited, 1);
+        return false;
+    }
+    entry->tokens -= 1000;
+    return true;
+}
+
+static int compare_talkers(const void *a, const void *b)
+{
+    const rate_limiter_talker_t *first = a;
+    const rate_limiter_talker_t *second = b;
+    if (first->packets != second->packets)
+    {
+        return first->packets < second->packets ? 1 : -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the sources that sent the most packets. Never blocks the receiver.
+ * @param limiter The rate limiter.
+ * @param talkers The array to fill, sorted by packets.
+ * @param count The size of the array.
+ * @return The number of sources filled in.
+ */
+int rate_limiter_get_top_talkers(rate_limiter_t *limiter, rate_limiter_talker_t *talkers, int count)
+{
+    if (limiter == NULL || talkers == NULL || count <= 0)
+    {
+        error("Invalid parameters");
+        return 0;
+    }
+    if (!rate_limiter_enabled(limiter))
+    {
+        return 0;
+    }
+
+    // keep the top count sources in the array, sorted by packets
+    int found = 0;
+    for (size_t i = 0; i < limiter->size; i++)
+    {
+        rate_limiter_entry_t *entry = &limiter->entries[i];
+        rate_limiter_talker_t talker;
+        talker.source = atomic_load_explicit(&entry->source, memory_order_relaxed);
+        if (talker.source == 0)
+        {
+            continue;
+        }
+        talker.packets = metrics_counter_get(&entry->packets);
+        talker.limited = metrics_counter_get(&entry->limited);
+        if (found == count && talker.packets <= talkers[found - 1].packets)
+        {
+            continue;
+        }
+        if (found < count)
+        {
+            found++;
+        }
+        talkers[found - 1] = talker;
+        qsort(talkers, found, sizeof(rate_limiter_talker_t), compare_talkers);
+    }
+    for (int i = 0; i < found; i++)
+    {
+        format_source_key(talkers[i].source, talkers[i].address, sizeof(talkers[i].address));
+    }
+    return found;
+}
+
+/**
+ * @brief Logs the sources that sent the most packets.
+ * @param limiter The rate limiter.
+ * @param count The maximum number of sources to log.
+ */
+void rate_limiter_log_top_talkers(rate_limiter_t *limiter, int count)
+{
+    rate_limiter_talker_t talkers[RATE_LIMITER_TOP_TALKERS];
+    if (count > RATE_LIMITER_TOP_TALKERS)
+    {
+        count = RATE_LIMITER_TOP_TALKERS;
+    }
+    int found = rate_limiter_get_top_talkers(limiter, talkers, count);
+    for (int i = 0; i < found; i++)
+    {
+        info("top talker %d: %s packets=%llu limited=%llu", i + 1, talkers[i].address,
+             (unsigned long long)talkers[i].packets, (unsigned long long)talkers[i].limited);
+    }
+}
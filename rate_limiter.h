@@ -0,0 +1,78 @@
+/**
+ * @file rate_limiter.h
+ * @brief Header for the per source address token bucket rate limiter of the receiver.
+ *
+ * The buckets live in a fixed size open addressing table, written by the receiver thread
+ * only. IPv4 sources have a bucket per address, IPv6 sources one per /64 prefix, since a
+ * single host usually owns a whole /64. A new source evicts the least recently seen entry of its probe window, which is an
+ * approximate LRU that never allocates. Other threads read the table without locking to
+ * report the top talkers.
+ */
+
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "metrics.h"
+
+#define DEFAULT_RATE_LIMIT_TABLE_SIZE 4096
+#define RATE_LIMITER_PROBES 8
+#define RATE_LIMITER_TOP_TALKERS 10
+#define RATE_LIMITER_SOURCE_LENGTH 48 // IPv6 prefix followed by "/64"
+
+typedef enum
+{
+    RATE_LIMIT_ACTION_DROP = 0,
+    RATE_LIMIT_ACTION_REJECT, // answer new INVITEs with 503, drop everything else
+} rate_limit_action_t;
+
+/**
+ * @struct rate_limiter_entry_t
+ * @brief Token bucket of a source address.
+ */
+typedef struct
+{
+    atomic_uint_least64_t source; // key of the source address, 0 when the entry is free
+    uint64_t last_seen_ms;
+    uint64_t tokens; // in thousandths of a packet
+    metrics_counter_t packets;
+    metrics_counter_t limited;
+} rate_limiter_entry_t;
+
+/**
+ * @struct rate_limiter_t
+ * @brief Per source rate limiter.
+ */
+typedef struct
+{
+    rate_limiter_entry_t *entries;
+    size_t size; // power of two
+    uint64_t rate;  // packets per second, 0 disables
+    uint64_t burst; // packets
+    rate_limit_action_t action;
+} rate_limiter_t;
+
+/**
+ * @struct rate_limiter_talker_t
+ * @brief Snapshot of the counters of a source address.
+ */
+typedef struct
+{
+    uint64_t source;
+    char address[RATE_LIMITER_SOURCE_LENGTH];
+    uint64_t packets;
+    uint64_t limited;
+} rate_limiter_talker_t;
+
+extern rate_limiter_t rate_limiter;
+
+int init_rate_limiter(rate_limiter_t *limiter, int table_size, int rate, int burst, rate_limit_action_t action);
+bool rate_limiter_enabled(const rate_limiter_t *limiter);
+bool rate_limiter_allow(rate_limiter_t *limiter, const struct sockaddr *address, uint64_t now_ms);
+int rate_limiter_get_top_talkers(rate_limiter_t *limiter, rate_limiter_talker_t *talkers, int count);
+void rate_limiter_log_top_talkers(rate_limiter_t *limiter, int count);
+
+#endif // RATE_LIMITER_H
@@ -0,0 +1,99 @@
+/**
+ * @file rcu.c
+ * @brief Implementation of a minimal quiescent state based read-copy-update scheme.
+ */
+
+#include "rcu.h"
+#include "log.h"
+#include <stddef.h>
+#include <unistd.h>
+
+static rcu_reader_t rcu_readers[RCU_MAX_READERS];
+static atomic_int rcu_reader_count = 0;
+static __thread rcu_reader_t *rcu_thread_reader = NULL;
+
+/**
+ * @brief Registers the calling thread as a reader, initially online.
+ * @return 0 on success, -1 if there are too many readers.
+ */
+int rcu_register_thread(void)
+{
+    if (rcu_thread_reader != NULL)
+    {
+        return 0;
+    }
+    int index = atomic_fetch_add(&rcu_reader_count, 1);
+    if (index >= RCU_MAX_READERS)
+    {
+        atomic_fetch_sub(&rcu_reader_count, 1);
+        error("Too many RCU readers");
+        return -1;
+    }
+    rcu_thread_reader = &rcu_readers[index];
+    atomic_store(&rcu_thread_reader->online, 1);
+    return 0;
+}
+
+/**
+ * @brief Announces that the calling reader holds no reference to RCU protected data.
+ */
+void rcu_quiescent_state(void)
+{
+    if (rcu_thread_reader != NULL)
+    {
+        atomic_fetch_add_explicit(&rcu_thread_reader->quiescent_count, 1, memory_order_release);
+    }
+}
+
+/**
+ * @brief Marks the calling reader as offline, for example before blocking in a system call.
+ * The reader must not hold references to RCU protected data while offline.
+ */
+void rcu_thread_offline(void)
+{
+    if (rcu_thread_reader != NULL)
+    {
+        atomic_store_explicit(&rcu_thread_reader->online, 0, memory_order_release);
+    }
+}
+
+/**
+ * @brief Marks the calling reader as online again.
+ */
+void rcu_thread_online(void)
+{
+    if (rcu_thread_reader != NULL)
+    {
+        atomic_store_explicit(&rcu_thread_reader->online, 1, memory_order_relaxed);
+        // pointers published before must be visible to the reads that follow
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+}
+
+/**
+ * @brief Waits until every reader has passed a quiescent state or been offline,
+ * so no reader still holds data unpublished before the call. Must not be called by a reader.
+ */
+void synchronize_rcu(void)
+{
+    uint_fast64_t snapshot[RCU_MAX_READERS];
+    int count = atomic_load(&rcu_reader_count);
+    if (count > RCU_MAX_READERS)
+    {
+        count = RCU_MAX_READERS;
+    }
+
+    atomic_thread_fence(memory_order_seq_cst);
+    for (int i = 0; i < count; i++)
+    {
+        snapshot[i] = atomic_load_explicit(&rcu_readers[i].quiescent_count, memory_order_acquire);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        while (atomic_load_explicit(&rcu_readers[i].online, memory_order_acquire) &&
+               atomic_load_explicit(&rcu_readers[i].quiescent_count, memory_order_acquire) == snapshot[i])
+        {
+            usleep(RCU_SYNCHRONIZE_POLL_US);
+        }
+    }
+}
@@ -0,0 +1,36 @@
+/**
+ * @file rcu.h
+ * @brief Header for a minimal quiescent state based read-copy-update scheme.
+ *
+ * Readers dereference shared pointers without any lock or atomic read-modify-write. They
+ * only announce a quiescent state between operations, or go offline before blocking. A
+ * writer publishes a new version with an atomic pointer exchange, then waits until every
+ * online reader has passed a quiescent state before freeing the old version.
+ */
+
+#ifndef RCU_H
+#define RCU_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define RCU_MAX_READERS 64
+#define RCU_SYNCHRONIZE_POLL_US 1000
+
+/**
+ * @struct rcu_reader_t
+ * @brief Quiescent state of a reader thread.
+ */
+typedef struct
+{
+    _Alignas(64) atomic_uint_fast64_t quiescent_count;
+    atomic_int online;
+} rcu_reader_t;
+
+int rcu_register_thread(void);
+void rcu_quiescent_state(void);
+void rcu_thread_offline(void);
+void rcu_thread_online(void);
+void synchronize_rcu(void);
+
+#endif // RCU_H
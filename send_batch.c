@@ -0,0 +1,143 @@
+/**
+ * @file send_batch.c
+ * @brief Implementation of the batched UDP sender of the classic backend.
+ */
+
+#include "log.h"
+#include "send_batch.h"
+#include "metrics.h"
+#include "utils.h"
+#include <errno.h>
+#include <string.h>
+#include <netinet/udp.h>
+
+/**
+ * @brief Checks whether the kernel accepts UDP_SEGMENT on a socket.
+ * @param socket The UDP socket.
+ * @return true if UDP GSO can be used.
+ */
+bool send_batch_gso_supported(int socket)
+{
+    int segment_size = 0;
+    return setsockopt(socket, SOL_UDP, UDP_SEGMENT, &segment_size, sizeof(segment_size)) == 0;
+}
+
+/**
+ * @brief Initializes an empty batch.
+ * @param batch The batch.
+ * @param gso Whether datagrams to the same peer are coalesced with UDP_SEGMENT.
+ */
+void init_send_batch(send_batch_t *batch, bool gso)
+{
+    if (batch == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    batch->count = 0;
+    batch->failures = 0;
+    batch->socket = -1;
+    batch->gso = gso;
+}
+
+/**
+ * @brief Copies a datagram into the batch, sending the batch first when it is full or holds datagrams of another socket.
+ * @return 0 on success, -1 with errno EINVAL on invalid parameters.
+ */
+int send_batch_add(send_batch_t *batch, int socket, const char *data, size_t length, const struct sockaddr_storage *address, socklen_t address_length)
+{
+    if (batch == NULL || data == NULL || length == 0 || length > SEND_BATCH_BUFFER_SIZE || address == NULL || address_length > sizeof(struct sockaddr_storage))
+    {
+        error("Invalid parameters");
+        errno = EINVAL;
+        return -1;
+    }
+    if (batch->count == SEND_BATCH_SIZE || (batch->count > 0 && batch->socket != socket))
+    {
+        batch->failures += send_batch_flush(batch);
+    }
+    batch->socket = socket;
+    memcpy(batch->buffers[batch->count], data, length);
+    batch->lengths[batch->count] = length;
+    memcpy(&batch->addresses[batch->count], address, address_length);
+    batch->address_lengths[batch->count] = address_length;
+    batch->count++;
+    return 0;
+}
+
+/**
+ * @brief Sends the batched datagrams with one sendmmsg.
+ * @param batch The batch.
+ * @return The number of datagrams that failed since the previous flush.
+ */
+int send_batch_flush(send_batch_t *batch)
+{
+    if (batch == NULL)
+    {
+        error("Invalid parameters");
+        return 0;
+    }
+    struct mmsghdr messages[SEND_BATCH_SIZE];
+    struct iovec iovs[SEND_BATCH_SIZE];
+    char controls[SEND_BATCH_SIZE][CMSG_SPACE(sizeof(uint16_t))];
+    int message_count = 0;
+
+    // a run of datagrams to one peer becomes one message, every segment but the last has the same length
+    for (int first = 0; first < batch->count;)
+    {
+        int last = first;
+        while (batch->gso && last + 1 < batch->count && batch->lengths[last] == batch->lengths[first] &&
+               batch->lengths[last + 1] <= batch->lengths[first] && sockaddr_equal(&batch->addresses[first], &batch->addresses[last + 1]))
+        {
+            last++;
+        }
+
+        struct msghdr *header = &messages[message_count].msg_hdr;
+        memset(&messages[message_count], 0, sizeof(struct mmsghdr));
+        for (int i = first; i <= last; i++)
+        {
+            iovs[i].iov_base = batch->buffers[i];
+            iovs[i].iov_len = batch->lengths[i];
+        }
+        header->msg_name = &batch->addresses[first];
+        header->msg_namelen = batch->address_lengths[first];
+        header->msg_iov = &iovs[first];
+        header->msg_iovlen = last - first + 1;
+        if (last > first)
+        {
+            header->msg_control = controls[message_count];
+            header->msg_controllen = sizeof(controls[message_count]);
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(header);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t segment_size = (uint16_t)batch->lengths[first];
+            memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+            worker_metrics_inc(segmented_sends);
+        }
+        message_count++;
+        first = last + 1;
+    }
+
+    int failures = batch->failures;
+    for (int sent = 0; sent < message_count;)
+    {
+        int rc = sendmmsg(batch->socket, &messages[sent], message_count - sent, 0);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            // sendmmsg only fails on the first message, skip it and send the rest
+            error("Failed to send SIP messages: %s", strerror(errno));
+            failures += (int)messages[sent].msg_hdr.msg_iovlen;
+            sent++;
+            continue;
+        }
+        sent += rc;
+    }
+    batch->count = 0;
+    batch->failures = 0;
+    return failures;
+}
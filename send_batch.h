@@ -0,0 +1,45 @@
+/**
+ * @file send_batch.h
+ * @brief Header for the batched UDP sender of the classic backend.
+ *
+ * A worker copies the datagrams it sends while processing into a batch, and sends the batch
+ * with a single sendmmsg once its queue is empty or the batch is full. Consecutive datagrams
+ * to the same peer form one message with UDP_SEGMENT when they have the same length, the
+ * last one excepted, so the kernel segments them in one pass.
+ */
+
+#ifndef SEND_BATCH_H
+#define SEND_BATCH_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define SEND_BATCH_SIZE 16
+#define SEND_BATCH_BUFFER_SIZE 1024 // BUFFER_SIZE of sip_message_t
+
+/**
+ * @struct send_batch_t
+ * @brief Datagrams of a single thread waiting for the next flush.
+ */
+typedef struct
+{
+    char buffers[SEND_BATCH_SIZE][SEND_BATCH_BUFFER_SIZE];
+    size_t lengths[SEND_BATCH_SIZE];
+    struct sockaddr_storage addresses[SEND_BATCH_SIZE];
+    socklen_t address_lengths[SEND_BATCH_SIZE];
+    int count;
+    int failures; // datagrams that failed in flushes of a full batch, reported by the next flush
+    int socket; // socket of the batched datagrams, a datagram for another socket flushes the batch first
+    bool gso; // coalesce datagrams to the same peer with UDP_SEGMENT
+} send_batch_t;
+
+bool send_batch_gso_supported(int socket);
+void init_send_batch(send_batch_t *batch, bool gso);
+int send_batch_add(send_batch_t *batch, int socket, const char *data, size_t length, const struct sockaddr_storage *address, socklen_t address_length);
+int send_batch_flush(send_batch_t *batch);
+
+#endif // SEND_BATCH_H
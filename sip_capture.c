@@ -0,0 +1,406 @@
+/**
+ * @file sip_capture.c
+ * @brief Implementation of the in-process pcap capture of the SIP datagrams received and sent by the workers.
+ */
+
+#include "sip_capture.h"
+#include "log.h"
+#include "metrics.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define PCAP_MAGIC_NANOSECONDS 0xa1b23c4d
+#define PCAP_FILE_HEADER_SIZE 24
+#define PCAP_RECORD_HEADER_SIZE 16
+#define PCAP_SNAPSHOT_LENGTH 65535
+#define LINKTYPE_RAW 101 // IPv4 or IPv6 told by the version of the packet
+#define IPV4_HEADER_SIZE 20
+#define IPV6_HEADER_SIZE 40
+#define UDP_HEADER_SIZE 8
+
+// set once before the workers start, read only afterwards
+static struct
+{
+    char prefix[SIP_CAPTURE_MAX_PATH];
+    size_t file_size;
+    int files;
+    int sample_percent;
+    char call_id[SIP_CAPTURE_MAX_CALL_ID];
+    size_t call_id_length;
+} settings;
+
+/**
+ * @brief Sets up the capture shared by all workers, before any of them is created.
+ * @param prefix The path prefix of the capture files, followed by the worker and the file number.
+ * @param file_size_mb The size of a capture file in megabytes.
+ * @param files The number of files kept per worker, 0 keeps all of them.
+ * @param sample_percent The share of calls captured.
+ * @param call_id The only Call-ID captured, NULL for all of them.
+ * @return 0 on success, -1 on invalid parameters.
+ */
+int sip_capture_configure(const char *prefix, int file_size_mb, int files, int sample_percent, const char *call_id)
+{
+    if (prefix == NULL || strlen(prefix) >= sizeof(settings.prefix) - 32 || file_size_mb <= 0 || files < 0 ||
+        sample_percent <= 0 || sample_percent > 100 || (call_id != NULL && strlen(call_id) >= sizeof(settings.call_id)))
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    strcpy(settings.prefix, prefix);
+    settings.file_size = (size_t)file_size_mb * 1024 * 1024;
+    settings.files = files;
+    settings.sample_percent = sample_percent;
+    settings.call_id_length = call_id != NULL ? strlen(call_id) : 0;
+    memcpy(settings.call_id, call_id != NULL ? call_id : "", settings.call_id_length);
+    info("Capturing %d%% of the calls%s%s to %s-w*.pcap", sample_percent, call_id != NULL ? " with Call-ID " : "",
+         call_id != NULL ? call_id : "", prefix);
+    return 0;
+}
+
+static void file_path(const sip_capture_t *capture, uint64_t sequence, char *path, size_t size)
+{
+    snprintf(path, size, "%s-w%d-%06llu.pcap", settings.prefix, capture->worker, (unsigned long long)sequence);
+}
+
+/**
+ * @brief Creates, preallocates and maps the current capture file, and deletes the file falling out of the ring.
+ * @return 0 on success, -1 on failure.
+ */
+static int open_file(sip_capture_t *capture)
+{
+    char path[SIP_CAPTURE_MAX_PATH];
+    file_path(capture, capture->sequence, path, sizeof(path));
+    capture->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (capture->fd < 0)
+    {
+        error("Failed to create capture file %s: %s", path, strerror(errno));
+        return -1;
+    }
+    // the blocks are reserved up front, a full disk fails here instead of faulting a write to the mapping
+    int rc = posix_fallocate(capture->fd, 0, (off_t)settings.file_size);
+    if (rc != 0)
+    {
+        error("Failed to allocate capture file %s: %s", path, strerror(rc));
+        close(capture->fd);
+        capture->fd = -1;
+        return -1;
+    }
+    capture->map = mmap(NULL, settings.file_size, PROT_READ | PROT_WRITE, MAP_SHARED, capture->fd, 0);
+    if (capture->map == MAP_FAILED)
+    {
+        error("Failed to map capture file %s: %s", path, strerror(errno));
+        capture->map = NULL;
+        close(capture->fd);
+        capture->fd = -1;
+        return -1;
+    }
+
+    // in host byte order, which readers tell by the magic
+    struct
+    {
+        uint32_t magic;
+        uint16_t version_major;
+        uint16_t version_minor;
+        int32_t timezone;
+        uint32_t accuracy;
+        uint32_t snapshot_length;
+        uint32_t link_type;
+    } header = {PCAP_MAGIC_NANOSECONDS, 2, 4, 0, 0, PCAP_SNAPSHOT_LENGTH, LINKTYPE_RAW};
+    memcpy(capture->map, &header, PCAP_FILE_HEADER_SIZE);
+    capture->used = PCAP_FILE_HEADER_SIZE;
+
+    if (settings.files > 0 && capture->sequence >= (uint64_t)settings.files)
+    {
+        file_path(capture, capture->sequence - (uint64_t)settings.files, path, sizeof(path));
+        if (unlink(path) != 0 && errno != ENOENT)
+        {
+            error("Failed to delete capture file %s: %s", path, strerror(errno));
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Unmaps the current capture file and truncates it to its records.
+ */
+static void close_file(sip_capture_t *capture)
+{
+    if (capture->map != NULL)
+    {
+        munmap(capture->map, settings.file_size);
+        capture->map = NULL;
+    }
+    if (capture->fd >= 0)
+    {
+        if (ftruncate(capture->fd, (off_t)capture->used) != 0)
+        {
+            error("Failed to truncate capture file: %s", strerror(errno));
+        }
+        close(capture->fd);
+        capture->fd = -1;
+    }
+}
+
+/**
+ * @brief Creates the capture of a worker with its first file.
+ * @param worker The index of the worker.
+ * @return The capture, or NULL on failure.
+ */
+sip_capture_t *sip_capture_create(int worker)
+{
+    if (worker < 0 || settings.file_size == 0)
+    {
+        error("Invalid parameters");
+        return NULL;
+    }
+    sip_capture_t *capture = calloc(1, sizeof(sip_capture_t));
+    if (capture == NULL)
+    {
+        error("Memory allocation failed");
+        return NULL;
+    }
+    capture->worker = worker;
+    capture->fd = -1;
+    if (open_file(capture) != 0)
+    {
+        free(capture);
+        return NULL;
+    }
+    return capture;
+}
+
+/**
+ * @brief Completes the current file of a capture and frees it.
+ * @param capture The capture, may be NULL.
+ */
+void sip_capture_destroy(sip_capture_t *capture)
+{
+    if (capture == NULL)
+    {
+        return;
+    }
+    close_file(capture);
+    free(capture);
+}
+
+/**
+ * @brief Selects the calls to capture by Call-ID, with the FNV-1a hash of the Call-ID for sampling.
+ */
+static bool is_selected(const char *call_id, size_t length)
+{
+    if (settings.call_id_length > 0 && (length != settings.call_id_length || memcmp(call_id, settings.call_id, length) != 0))
+    {
+        return false;
+    }
+    if (settings.sample_percent >= 100)
+    {
+        return true;
+    }
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)call_id[i]) * 16777619u;
+    }
+    return hash % 100 < (uint32_t)settings.sample_percent;
+}
+
+/**
+ * @brief Returns the local address of a socket, cached per worker.
+ * @param capture The capture of the worker.
+ * @param socket The socket, descriptors that are no socket have a zero address.
+ * @param family The family of the peer, which the local address must have.
+ * @param address Filled with the local address.
+ */
+static void get_local_address(sip_capture_t *capture, int socket, int family, struct sockaddr_storage *address)
+{
+    for (int i = 0; i < capture->local_count; i++)
+    {
+        if (capture->locals[i].socket == socket && capture->locals[i].address.ss_family == family)
+        {
+            memcpy(address, &capture->locals[i].address, sizeof(struct sockaddr_storage));
+            return;
+        }
+    }
+    socklen_t length = sizeof(struct sockaddr_storage);
+    if (getsockname(socket, (struct sockaddr *)address, &length) != 0 || address->ss_family != family)
+    {
+        memset(address, 0, sizeof(struct sockaddr_storage));
+        address->ss_family = (sa_family_t)family;
+    }
+    if (capture->local_count < SIP_CAPTURE_MAX_SOCKETS)
+    {
+        capture->locals[capture->local_count].socket = socket;
+        memcpy(&capture->locals[capture->local_count].address, address, sizeof(struct sockaddr_storage));
+        capture->local_count++;
+    }
+}
+
+static uint16_t ipv4_checksum(const uint8_t *header)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < IPV4_HEADER_SIZE; i += 2)
+    {
+        sum += (uint32_t)(header[i] << 8 | header[i + 1]);
+    }
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += sum >> 16;
+    return (uint16_t)~sum;
+}
+
+/**
+ * @brief Writes a datagram with a synthesized IP and UDP header into the mapped file, rotating a full file.
+ * @param capture The capture.
+ * @param timestamp_ns The wall clock time of the datagram.
+ * @param source The source address, IPv4 or IPv6.
+ * @param destination The destination address, of the family of the source.
+ * @param data The payload.
+ * @param length The length of the payload.
+ */
+static void write_record(sip_capture_t *capture, uint64_t timestamp_ns, const struct sockaddr_storage *source,
+                         const struct sockaddr_storage *destination, const char *data, size_t length)
+{
+    bool ipv4 = source->ss_family == AF_INET;
+    size_t header_size = (ipv4 ? IPV4_HEADER_SIZE : IPV6_HEADER_SIZE) + UDP_HEADER_SIZE;
+    size_t record_size = PCAP_RECORD_HEADER_SIZE + header_size + length;
+    if (header_size + length > PCAP_SNAPSHOT_LENGTH || PCAP_FILE_HEADER_SIZE + record_size > settings.file_size)
+    {
+        return;
+    }
+    if (capture->map != NULL && capture->used + record_size > settings.file_size)
+    {
+        close_file(capture);
+        capture->sequence++;
+        worker_metrics_inc(capture_rotations);
+        capture->retry_ms = 0;
+    }
+    // a file that failed to be created, out of descriptors or disk space, is retried at an interval
+    if (capture->map == NULL)
+    {
+        uint64_t now_ms = get_monotonic_time_ms();
+        if (now_ms < capture->retry_ms || open_file(capture) != 0)
+        {
+            if (now_ms >= capture->retry_ms)
+            {
+                capture->retry_ms = now_ms + SIP_CAPTURE_RETRY_INTERVAL_MS;
+            }
+            worker_metrics_inc(capture_drops);
+            return;
+        }
+    }
+
+    uint8_t *record = capture->map + capture->used;
+    uint32_t record_header[4] = {(uint32_t)(timestamp_ns / 1000000000), (uint32_t)(timestamp_ns % 1000000000),
+                                 (uint32_t)(header_size + length), (uint32_t)(header_size + length)};
+    memcpy(record, record_header, sizeof(record_header));
+    uint8_t *ip = record + PCAP_RECORD_HEADER_SIZE;
+    uint8_t *udp;
+    uint16_t udp_length = htons((uint16_t)(UDP_HEADER_SIZE + length));
+    if (ipv4)
+    {
+        uint16_t total_length = htons((uint16_t)(header_size + length));
+        memset(ip, 0, IPV4_HEADER_SIZE);
+        ip[0] = 0x45;
+        memcpy(ip + 2, &total_length, sizeof(total_length));
+        ip[6] = 0x40; // don't fragment
+        ip[8] = 64;
+        ip[9] = IPPROTO_UDP;
+        memcpy(ip + 12, &((const struct sockaddr_in *)source)->sin_addr, 4);
+        memcpy(ip + 16, &((const struct sockaddr_in *)destination)->sin_addr, 4);
+        uint16_t checksum = htons(ipv4_checksum(ip));
+        memcpy(ip + 10, &checksum, sizeof(checksum));
+        udp = ip + IPV4_HEADER_SIZE;
+    }
+    else
+    {
+        memset(ip, 0, IPV6_HEADER_SIZE);
+        ip[0] = 0x60;
+        memcpy(ip + 4, &udp_length, sizeof(udp_length));
+        ip[6] = IPPROTO_UDP;
+        ip[7] = 64;
+        memcpy(ip + 8, &((const struct sockaddr_in6 *)source)->sin6_addr, 16);
+        memcpy(ip + 24, &((const struct sockaddr_in6 *)destination)->sin6_addr, 16);
+        udp = ip + IPV6_HEADER_SIZE;
+    }
+    // the ports are at the same offset in IPv4 and IPv6 addresses, the UDP checksum is left out
+    memcpy(udp, &((const struct sockaddr_in *)source)->sin_port, 2);
+    memcpy(udp + 2, &((const struct sockaddr_in *)destination)->sin_port, 2);
+    memcpy(udp + 4, &udp_length, sizeof(udp_length));
+    memset(udp + 6, 0, 2);
+    memcpy(udp + UDP_HEADER_SIZE, data, length);
+    capture->used += record_size;
+    worker_metrics_inc(packets_captured);
+}
+
+/**
+ * @brief Decides whether the datagrams sent next are captured, from the message they answer.
+ * Timer events call it before sending, the previous message may belong to another call.
+ * @param capture The capture of the worker.
+ * @param message The message answered, with its Call-ID located.
+ */
+void sip_capture_select(sip_capture_t *capture, const sip_message_t *message)
+{
+    if (capture == NULL || message == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    capture->active = message->connection == 0 && message->call_id != NULL &&
+                      (message->client_addr.ss_family == AF_INET || message->client_addr.ss_family == AF_INET6) &&
+                      is_selected(message->call_id, message->call_id_length);
+}
+
+/**
+ * @brief Decides whether a message taken by the worker is captured, with the responses it causes, and captures it.
+ * @param capture The capture of the worker.
+ * @param message The message, with its Call-ID located by the receiver.
+ */
+void sip_capture_received(sip_capture_t *capture, sip_message_t *message)
+{
+    if (capture == NULL || message == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    sip_capture_select(capture, message);
+    if (!capture->active)
+    {
+        return;
+    }
+    struct sockaddr_storage local;
+    get_local_address(capture, message->socket, message->client_addr.ss_family, &local);
+    // the receive time is on the monotonic clock, pcap wants the wall clock
+    uint64_t age_ns = get_monotonic_time_ns() - message->receive_time_ns;
+    write_record(capture, get_real_time_ns() - age_ns, &message->client_addr, &local, message->buffer, message->buffer_length);
+}
+
+/**
+ * @brief Captures a datagram sent while processing a captured message.
+ * @param capture The capture of the worker.
+ * @param socket The socket the datagram is sent on.
+ * @param data The datagram.
+ * @param length The length of the datagram.
+ * @param address The destination of the datagram.
+ */
+void sip_capture_sent(sip_capture_t *capture, int socket, const char *data, size_t length,
+                      const struct sockaddr_storage *address)
+{
+    if (capture == NULL || data == NULL || address == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    if (!capture->active || (address->ss_family != AF_INET && address->ss_family != AF_INET6))
+    {
+        return;
+    }
+    struct sockaddr_storage local;
+    get_local_address(capture, socket, address->ss_family, &local);
+    write_record(capture, get_real_time_ns(), &local, address, data, length);
+}
@@ -0,0 +1,60 @@
+/**
+ * @file sip_capture.h
+ * @brief Header for the in-process pcap capture of the SIP datagrams received and sent by the workers.
+ *
+ * Every worker writes its own capture files, so no lock is taken. A file is preallocated
+ * to its full size and memory-mapped, and a datagram costs a memcpy of a synthesized IP and
+ * UDP header and of the payload into the mapping, the kernel writes the pages back. A full
+ * file is truncated to its records and the next one mapped, the oldest files of the worker
+ * are deleted so the files form a ring. Calls are selected by Call-ID, optionally matching
+ * one Call-ID, and sampled by a hash of it, so a captured call has all its datagrams in both
+ * directions. Only UDP is captured, with the local address of the receiving socket, which
+ * is the wildcard address for wildcard listeners.
+ */
+
+#ifndef SIP_CAPTURE_H
+#define SIP_CAPTURE_H
+
+#include "sip_message.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define SIP_CAPTURE_DEFAULT_FILE_SIZE_MB 64
+#define SIP_CAPTURE_DEFAULT_FILES 4 // files kept per worker
+#define SIP_CAPTURE_MAX_SOCKETS 16  // local addresses cached per worker
+#define SIP_CAPTURE_MAX_PATH 256
+#define SIP_CAPTURE_MAX_CALL_ID 256
+#define SIP_CAPTURE_RETRY_INTERVAL_MS 1000 // wait before creating a file again after a failure
+
+/**
+ * @struct sip_capture_t
+ * @brief The capture of a single worker thread.
+ */
+typedef struct
+{
+    int worker;       // index of the worker in the file names
+    uint64_t sequence; // number of the current file
+    int fd;
+    uint8_t *map;
+    size_t used;      // bytes written to the current file
+    uint64_t retry_ms; // monotonic time of the next attempt to create the file, after a failure
+    bool active;      // the message being processed is captured, and so are the responses it causes
+    struct
+    {
+        int socket;
+        struct sockaddr_storage address;
+    } locals[SIP_CAPTURE_MAX_SOCKETS];
+    int local_count;
+} sip_capture_t;
+
+int sip_capture_configure(const char *prefix, int file_size_mb, int files, int sample_percent, const char *call_id);
+sip_capture_t *sip_capture_create(int worker);
+void sip_capture_destroy(sip_capture_t *capture);
+void sip_capture_select(sip_capture_t *capture, const sip_message_t *message);
+void sip_capture_received(sip_capture_t *capture, sip_message_t *message);
+void sip_capture_sent(sip_capture_t *capture, int socket, const char *data, size_t length,
+                      const struct sockaddr_storage *address);
+
+#endif // SIP_CAPTURE_H
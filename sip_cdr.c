@@ -0,0 +1,317 @@
+/**
+ * @file sip_cdr.c
+ * @brief Implementation of the asynchronous call detail records of the calls handled by the workers.
+ */
+
+#include "sip_cdr.h"
+#include "log.h"
+#include "metrics.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIP_CDR_HEADER "call_id,from_tag,to_tag,setup_time,answer_time,end_time,final_code,end_state\n"
+#define SIP_CDR_LINE_MAX_SIZE (2 * SIP_CALL_ID_MAX_LENGTH + 4 * SIP_TAG_MAX_LENGTH + 128)
+
+__thread sip_cdr_ring_t *thread_cdr_ring = NULL;
+
+static struct
+{
+    int fd;
+    sip_cdr_ring_t *rings;
+    int ring_count;
+    pthread_t thread;
+    atomic_bool running;
+    size_t length;
+    char *output;
+    uint64_t records_written;
+    uint64_t write_errors;
+} writer = {.fd = -1};
+
+/**
+ * @brief Appends a field to a CSV line, quoted when it holds a quote, a comma or a line break.
+ * @return The new line length.
+ */
+static size_t append_field(char *line, size_t length, const char *value, size_t value_length)
+{
+    // the values are not terminated
+    bool quoted = false;
+    for (size_t i = 0; i < value_length && !quoted; i++)
+    {
+        quoted = value[i] == '"' || value[i] == ',' || value[i] == '\r' || value[i] == '\n';
+    }
+    if (!quoted)
+    {
+        memcpy(line + length, value, value_length);
+        return length + value_length;
+    }
+    line[length++] = '"';
+    for (size_t i = 0; i < value_length; i++)
+    {
+        if (value[i] == '"')
+        {
+            line[length++] = '"';
+        }
+        line[length++] = value[i];
+    }
+    line[length++] = '"';
+    return length;
+}
+
+/**
+ * @brief Appends a wall clock time as seconds since the epoch with microseconds, nothing for 0.
+ * @return The new line length.
+ */
+static size_t append_time(char *line, size_t length, uint64_t time_ns)
+{
+    if (time_ns > 0)
+    {
+        length += sprintf(line + length, "%llu.%06llu", (unsigned long long)(time_ns / 1000000000),
+                          (unsigned long long)(time_ns % 1000000000 / 1000));
+    }
+    line[length++] = ',';
+    return length;
+}
+
+/**
+ * @brief Formats a record as a CSV line.
+ * @return The line length.
+ */
+static size_t format_record(const sip_cdr_record_t *record, char *line)
+{
+    size_t length = append_field(line, 0, record->call_id, record->call_id_length);
+    line[length++] = ',';
+    length = append_field(line, length, record->from_tag, record->from_tag_length);
+    line[length++] = ',';
+    length = append_field(line, length, record->to_tag, record->to_tag_length);
+    line[length++] = ',';
+    length = append_time(line, length, record->setup_time_ns);
+    length = append_time(line, length, record->answer_time_ns);
+    length = append_time(line, length, record->end_time_ns);
+    length += sprintf(line + length, "%d,%s\n", record->final_response_code, call_states[record->state]);
+    return length;
+}
+
+/**
+ * @brief Appends the output buffer to the file. A failed write loses the buffered records.
+ */
+static void flush_output(void)
+{
+    size_t offset = 0;
+    while (offset < writer.length)
+    {
+        ssize_t written = write(writer.fd, writer.output + offset, writer.length - offset);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            writer.write_errors++;
+            error("Failed to write call detail records: %s", strerror(errno));
+            break;
+        }
+        offset += written;
+    }
+    writer.length = 0;
+}
+
+/**
+ * @brief Formats the records of a ring into the output buffer, writing it out whenever it fills up.
+ * @return The number of records formatted.
+ */
+static int drain_ring(sip_cdr_ring_t *ring)
+{
+    int count = 0;
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    for (; tail != head; tail++, count++)
+    {
+        if (writer.length + SIP_CDR_LINE_MAX_SIZE > SIP_CDR_OUTPUT_BUFFER_SIZE)
+        {
+            flush_output();
+        }
+        writer.length += format_record(&ring->records[tail % SIP_CDR_RING_SIZE], writer.output + writer.length);
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    writer.records_written += count;
+    return count;
+}
+
+/**
+ * @brief Writer thread function, collects the records of all workers and writes them in large batches.
+ */
+static void *writer_thread_func(void *arg)
+{
+    (void)arg;
+    uint64_t last_flush_ms = get_monotonic_time_ms();
+    bool running = true;
+    while (running)
+    {
+        // read before draining, so the records queued before the stop are all drained
+        running = atomic_load_explicit(&writer.running, memory_order_acquire);
+        int count = 0;
+        for (int i = 0; i < writer.ring_count; i++)
+        {
+            count += drain_ring(&writer.rings[i]);
+        }
+
+        uint64_t now_ms = get_monotonic_time_ms();
+        if (writer.length >= SIP_CDR_OUTPUT_BUFFER_SIZE / 2 || !running ||
+            (writer.length > 0 && now_ms - last_flush_ms >= SIP_CDR_FLUSH_INTERVAL_MS))
+        {
+            flush_output();
+            last_flush_ms = now_ms;
+        }
+        if (count == 0 && running)
+        {
+            struct timespec ts = {.tv_sec = 0, .tv_nsec = SIP_CDR_IDLE_SLEEP_MS * 1000000};
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Opens the call detail record file and starts the writer thread, before any worker starts.
+ * @param path The CSV file the records are appended to, a header is written when it is empty.
+ * @param ring_count The number of workers, each gets its own ring.
+ * @return 0 on success, -1 on failure.
+ */
+int sip_cdr_open(const char *path, int ring_count)
+{
+    if (path == NULL || ring_count <= 0)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    writer.rings = aligned_alloc(64, sizeof(sip_cdr_ring_t) * ring_count);
+    writer.output = malloc(SIP_CDR_OUTPUT_BUFFER_SIZE);
+    if (writer.rings == NULL || writer.output == NULL)
+    {
+        error("Memory allocation failed");
+        sip_cdr_close();
+        return -1;
+    }
+    for (int i = 0; i < ring_count; i++)
+    {
+        atomic_init(&writer.rings[i].head, 0);
+        atomic_init(&writer.rings[i].tail, 0);
+    }
+    writer.ring_count = ring_count;
+
+    struct stat st;
+    writer.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (writer.fd < 0 || fstat(writer.fd, &st) != 0)
+    {
+        error("Failed to open the call detail record file %s: %s", path, strerror(errno));
+        sip_cdr_close();
+        return -1;
+    }
+    if (st.st_size == 0)
+    {
+        writer.length = sizeof(SIP_CDR_HEADER) - 1;
+        memcpy(writer.output, SIP_CDR_HEADER, writer.length);
+    }
+
+    atomic_store_explicit(&writer.running, true, memory_order_release);
+    if (pthread_create(&writer.thread, NULL, writer_thread_func, NULL) != 0)
+    {
+        atomic_store_explicit(&writer.running, false, memory_order_release);
+        error("Failed to create the call detail record writer thread");
+        sip_cdr_close();
+        return -1;
+    }
+    info("Writing call detail records to %s", path);
+    return 0;
+}
+
+/**
+ * @brief Returns the ring of a worker.
+ * @param index The index of the worker.
+ * @return The ring, or NULL if call detail records are off.
+ */
+sip_cdr_ring_t *sip_cdr_get_ring(int index)
+{
+    if (index < 0 || index >= writer.ring_count)
+    {
+        return NULL;
+    }
+    return &writer.rings[index];
+}
+
+/**
+ * @brief Stops the writer thread once it has written the records queued so far, after the workers stopped.
+ */
+void sip_cdr_close(void)
+{
+    if (atomic_exchange(&writer.running, false))
+    {
+        pthread_join(writer.thread, NULL);
+        info("Wrote %llu call detail records, %llu failed writes", (unsigned long long)writer.records_written,
+             (unsigned long long)writer.write_errors);
+    }
+    if (writer.fd >= 0)
+    {
+        close(writer.fd);
+        writer.fd = -1;
+    }
+    free(writer.rings);
+    free(writer.output);
+    writer.rings = NULL;
+    writer.output = NULL;
+    writer.ring_count = 0;
+}
+
+/**
+ * @brief Queues the call detail record of a call to the writer thread, never blocking.
+ * @param ring The ring of the calling worker.
+ * @param call The call, with the dialog the tags are taken from.
+ */
+void sip_cdr_record_call(sip_cdr_ring_t *ring, const sip_call_t *call)
+{
+    if (ring == NULL || call == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= SIP_CDR_RING_SIZE)
+    {
+        worker_metrics_inc(cdr_drops);
+        return;
+    }
+
+    sip_cdr_record_t *record = &ring->records[head % SIP_CDR_RING_SIZE];
+    record->setup_time_ns = call->setup_time_ns;
+    record->answer_time_ns = call->answer_time_ns;
+    record->end_time_ns = get_real_time_ns();
+    record->final_response_code = call->final_response_code;
+    record->state = call->state;
+    record->call_id_length = call->call_id_length < sizeof(record->call_id) ? call->call_id_length : sizeof(record->call_id);
+    memcpy(record->call_id, call->call_id, record->call_id_length);
+    record->from_tag_length = 0;
+    record->to_tag_length = 0;
+    for (size_t i = 0; i < MAX_DIALOGS_PER_CALL; i++)
+    {
+        const sip_dialog_t *dialog = call->dialog[i];
+        if (dialog != NULL)
+        {
+            record->from_tag_length = dialog->from_tag_length < sizeof(record->from_tag) ? dialog->from_tag_length : sizeof(record->from_tag);
+            record->to_tag_length = dialog->to_tag_length < sizeof(record->to_tag) ? dialog->to_tag_length : sizeof(record->to_tag);
+            memcpy(record->from_tag, dialog->from_tag, record->from_tag_length);
+            memcpy(record->to_tag, dialog->to_tag, record->to_tag_length);
+            break;
+        }
+    }
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    worker_metrics_inc(cdrs_queued);
+}
@@ -0,0 +1,62 @@
+/**
+ * @file sip_cdr.h
+ * @brief Header for the asynchronous call detail records of the calls handled by the workers.
+ *
+ * A record is taken when a call terminates or fails, or is deleted by the reaper before,
+ * from the times and the final response code kept in the call by set_call_state. The worker
+ * copies it into its own single producer single consumer ring, a full ring drops the record
+ * and counts it instead of blocking. A background thread formats the records of all rings
+ * as CSV lines into a large buffer, and appends it to the file once it is half full or has
+ * waited for a flush interval, so the file is written in large sequential writes.
+ */
+
+#ifndef SIP_CDR_H
+#define SIP_CDR_H
+
+#include "sip_utils.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define SIP_CDR_RING_SIZE 2048                   // records queued per worker, a power of two
+#define SIP_CDR_OUTPUT_BUFFER_SIZE (1024 * 1024) // written out once half full
+#define SIP_CDR_FLUSH_INTERVAL_MS 1000           // longest wait of a record in the output buffer
+#define SIP_CDR_IDLE_SLEEP_MS 10
+
+/**
+ * @struct sip_cdr_record_t
+ * @brief The call detail record of a single call, times are wall clock nanoseconds.
+ */
+typedef struct
+{
+    uint64_t setup_time_ns;
+    uint64_t answer_time_ns; // 0 for calls never answered
+    uint64_t end_time_ns;
+    int final_response_code; // final response to the INVITE, 0 if none was sent
+    sip_call_state_t state;  // TERMINATED or FAILED, the last state of calls deleted by the reaper
+    uint16_t call_id_length;
+    uint8_t from_tag_length;
+    uint8_t to_tag_length;
+    char call_id[SIP_CALL_ID_MAX_LENGTH];
+    char from_tag[SIP_TAG_MAX_LENGTH];
+    char to_tag[SIP_TAG_MAX_LENGTH];
+} sip_cdr_record_t;
+
+/**
+ * @struct sip_cdr_ring_t
+ * @brief The records of a worker waiting for the writer thread.
+ */
+typedef struct
+{
+    _Alignas(64) atomic_uint_fast64_t head; // written by the worker
+    _Alignas(64) atomic_uint_fast64_t tail; // written by the writer thread
+    _Alignas(64) sip_cdr_record_t records[SIP_CDR_RING_SIZE];
+} sip_cdr_ring_t;
+
+extern __thread sip_cdr_ring_t *thread_cdr_ring;
+
+int sip_cdr_open(const char *path, int ring_count);
+sip_cdr_ring_t *sip_cdr_get_ring(int index);
+void sip_cdr_close(void);
+void sip_cdr_record_call(sip_cdr_ring_t *ring, const sip_call_t *call);
+
+#endif // SIP_CDR_H
@@ -0,0 +1,1034 @@
+/**
+ * @file sip_loadgen.c
+ * @brief Load generator running INVITE, ACK and BYE calls against the server over UDP.
+ *
+ * A single thread starts calls at a configured rate, up to a limit of calls in progress.
+ * The requests of a loop iteration go out with one sendmmsg and the responses come back
+ * with recvmmsg, and are parsed with the parser of the server. A call is identified by
+ * its Call-ID, which carries the slot of the call in the call table. Requests are never
+ * retransmitted, so every INVITE or BYE without a final response before the timeout is
+ * counted as lost. The time from an INVITE to its final response and from a BYE to its
+ * response is recorded in the latency histograms of the metrics registry. A share of the
+ * calls can be cancelled a while after their INVITE, racing the answer of the server. While
+ * holding, a call can refresh its session with a re-INVITE or an UPDATE at a fixed interval,
+ * as a session timer refresher does.
+ *
+ * Usage: sip_loadgen [options], see --help
+ */
+
+#include "log.h"
+#include "metrics.h"
+#include "sip_message.h"
+#include "utils.h"
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define LOADGEN_DEFAULT_TARGET "127.0.0.1"
+#define LOADGEN_DEFAULT_PORT 5060
+#define LOADGEN_DEFAULT_RATE 1000
+#define LOADGEN_DEFAULT_CONCURRENCY 1000
+#define LOADGEN_DEFAULT_CALLS 10000
+#define LOADGEN_DEFAULT_TIMEOUT_MS 2000
+#define LOADGEN_DEFAULT_BATCH 32
+#define LOADGEN_DEFAULT_REPORT_INTERVAL 1
+#define LOADGEN_MAX_BATCH 256
+#define LOADGEN_MAX_CONCURRENCY 1000000
+#define LOADGEN_SOCKET_BUFFER_SIZE (4 * 1024 * 1024)
+#define LOADGEN_POLL_TIMEOUT_MS 1
+#define LOADGEN_SCAN_INTERVAL_NS 1000000ULL // calls are checked for due BYEs and timeouts every millisecond
+#define LOADGEN_HISTOGRAM_BAR_WIDTH 40
+#define LOADGEN_HOST_MAX_LENGTH 64
+#define LOADGEN_MIN_SESSION_EXPIRES 90 // default Min-SE of a session timer, in seconds
+
+#define LOADGEN_CSEQ_INVITE 1 // the requests after the INVITE take the following CSeq numbers
+
+enum
+{
+    OPTION_TARGET = 256,
+    OPTION_RATE,
+    OPTION_CONCURRENCY,
+    OPTION_CALLS,
+    OPTION_DURATION,
+    OPTION_HOLD,
+    OPTION_CANCEL,
+    OPTION_CANCEL_DELAY,
+    OPTION_REFRESH,
+    OPTION_REFRESH_METHOD,
+    OPTION_TIMEOUT,
+    OPTION_BATCH,
+    OPTION_REPORT_INTERVAL,
+    OPTION_HELP,
+};
+
+typedef enum
+{
+    CALL_FREE = 0,
+    CALL_INVITING, // INVITE sent, waiting for its final response
+    CALL_HOLDING,  // answered and acknowledged, waiting to send the next refresh or the BYE
+    CALL_REFRESHING, // re-INVITE or UPDATE sent, waiting for its final response
+    CALL_BYEING,   // BYE sent, waiting for its response
+} loadgen_call_state_t;
+
+/**
+ * @struct loadgen_call_t
+ * @brief A slot of the call table.
+ */
+typedef struct
+{
+    loadgen_call_state_t state;
+    uint32_t generation;  // incremented when the slot is released, so late responses of a previous call are ignored
+    uint64_t sent_ns;     // time the pending request was sent
+    uint64_t deadline_ns; // response timeout, or time to send the next refresh or the BYE while holding
+    uint64_t bye_ns;      // time to send the BYE, once answered
+    int cseq;             // CSeq number of the last request of the call
+    uint64_t cancel_ns;   // time to send the CANCEL while inviting, 0 if the call is not cancelled
+    bool cancel_sent;
+    char to_tag[SIP_TAG_MAX_LENGTH + 1];
+} loadgen_call_t;
+
+/**
+ * @struct loadgen_config_t
+ * @brief Options of a run.
+ */
+typedef struct
+{
+    struct sockaddr_storage target;
+    socklen_t target_length;
+    int rate;          // calls started per second
+    int concurrency;   // calls in progress at most
+    long calls;        // calls to start, 0 for no limit
+    int duration;      // seconds to start calls for, 0 for no limit
+    int hold_ms;       // time between the ACK and the BYE
+    int cancel_percent; // share of the calls cancelled
+    int cancel_delay_ms; // time between the INVITE and the CANCEL
+    int refresh_ms;    // time between session refreshes while holding, 0 for none
+    const char *refresh_method; // INVITE or UPDATE
+    int timeout_ms;    // time to wait for a final response
+    int batch;         // requests per sendmmsg and responses per recvmmsg
+    int report_interval;
+} loadgen_config_t;
+
+/**
+ * @struct loadgen_stats_t
+ * @brief Outcomes of the calls of a run.
+ */
+typedef struct
+{
+    uint64_t started;
+    uint64_t throttled; // calls not started on schedule because the concurrency limit was reached
+    uint64_t answered;  // INVITEs with a 2xx response
+    uint64_t rejected;  // INVITEs with a failure response
+    uint64_t completed; // BYEs with a 2xx response
+    uint64_t bye_failures;
+    uint64_t invite_timeouts;
+    uint64_t bye_timeouts;
+    uint64_t provisional;
+    uint64_t cancels_sent;
+    uint64_t cancelled;         // INVITEs answered with 487 after their CANCEL
+    uint64_t cancel_too_late;   // INVITEs answered with 2xx after their CANCEL was sent
+    uint64_t cancel_ok;         // CANCELs with a 2xx response
+    uint64_t cancel_failures;   // CANCELs with a failure response, such as 481 for an unknown INVITE
+    uint64_t refreshes_sent;
+    uint64_t refreshed;         // refreshes with a 2xx response
+    uint64_t refresh_failures;
+    uint64_t refresh_timeouts;
+    uint64_t stale;     // responses of calls already finished, or of another run
+    uint64_t malformed; // datagrams that are not a response to a request of this run
+    uint64_t send_errors;
+    uint64_t final_codes[METRICS_STATUS_CODE_COUNT];
+    latency_histogram_t setup_latency; // INVITE to its final response
+    latency_histogram_t bye_latency;   // BYE to its response
+    latency_histogram_t refresh_latency; // re-INVITE or UPDATE to its final response
+} loadgen_stats_t;
+
+/**
+ * @struct loadgen_t
+ * @brief State of the load generator.
+ */
+typedef struct
+{
+    loadgen_config_t config;
+    int socket;
+    uint32_t run_id; // part of every Call-ID, tags and branches, so runs against the same server never collide
+    char local_host[LOADGEN_HOST_MAX_LENGTH];
+    char target_host[LOADGEN_HOST_MAX_LENGTH];
+    char refresh_headers[128]; // session timer headers of the refreshes
+
+    loadgen_call_t *calls;
+    uint32_t *free_slots;
+    uint32_t free_count;
+
+    struct mmsghdr send_headers[LOADGEN_MAX_BATCH];
+    struct iovec send_iovs[LOADGEN_MAX_BATCH];
+    char send_buffers[LOADGEN_MAX_BATCH][BUFFER_SIZE];
+    int send_count;
+
+    struct mmsghdr receive_headers[LOADGEN_MAX_BATCH];
+    struct iovec receive_iovs[LOADGEN_MAX_BATCH];
+    char receive_buffers[LOADGEN_MAX_BATCH][BUFFER_SIZE];
+    sip_message_t response;
+
+    loadgen_stats_t stats;
+} loadgen_t;
+
+static loadgen_t loadgen;
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop_signal(int signal_number)
+{
+    (void)signal_number;
+    stop_requested = 1;
+}
+
+static void print_usage(const char *program)
+{
+    printf("Usage: %s [options]\n"
+           "  --target <ip[:port]>       server to call (default %s:%d)\n"
+           "  --rate <cps>               calls started per second (default %d)\n"
+           "  --concurrency <calls>      calls in progress at most (default %d)\n"
+           "  --calls <count>            calls to start, 0 for no limit (default %d without --duration)\n"
+           "  --duration <sec>           seconds to start calls for, 0 for no limit (default 0)\n"
+           "  --hold <ms>                time between the ACK and the BYE (default 0)\n"
+           "  --cancel <%%>               share of the calls cancelled before their answer (default 0)\n"
+           "  --cancel-delay <ms>        time between the INVITE and its CANCEL (default 0)\n"
+           "  --refresh <ms>             time between session refreshes while holding, 0 for none (default 0)\n"
+           "  --refresh-method <method>  invite for re-INVITE refreshes, or update (default invite)\n"
+           "  --timeout <ms>             time to wait for a final response before a request is lost (default %d)\n"
+           "  --batch <count>            requests per sendmmsg and responses per recvmmsg (default %d, at most %d)\n"
+           "  --report-interval <sec>    progress line interval, 0 to disable (default %d)\n"
+           "  --help                     show this help\n",
+           program, LOADGEN_DEFAULT_TARGET, LOADGEN_DEFAULT_PORT, LOADGEN_DEFAULT_RATE, LOADGEN_DEFAULT_CONCURRENCY,
+           LOADGEN_DEFAULT_CALLS, LOADGEN_DEFAULT_TIMEOUT_MS, LOADGEN_DEFAULT_BATCH, LOADGEN_MAX_BATCH,
+           LOADGEN_DEFAULT_REPORT_INTERVAL);
+}
+
+/**
+ * @brief Parses a non-negative integer option.
+ * @return 0 on success, -1 if the value is not a number in range.
+ */
+static int parse_int_option(const char *name, const char *value, long min, long max, long *result)
+{
+    char *end = NULL;
+    errno = 0;
+    long number = strtol(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || number < min || number > max)
+    {
+        fprintf(stderr, "Invalid value for --%s: %s (expected %ld to %ld)\n", name, value, min, max);
+        return -1;
+    }
+    *result = number;
+    return 0;
+}
+
+/**
+ * @brief Parses the command line into the configuration of the run.
+ * @return 0 on success, 1 if the help was shown, -1 on invalid options.
+ */
+static int parse_options(loadgen_config_t *config, int argc, char *argv[])
+{
+    static const struct option options[] = {
+        {"target", required_argument, NULL, OPTION_TARGET},
+        {"rate", required_argument, NULL, OPTION_RATE},
+        {"concurrency", required_argument, NULL, OPTION_CONCURRENCY},
+        {"calls", required_argument, NULL, OPTION_CALLS},
+        {"duration", required_argument, NULL, OPTION_DURATION},
+        {"hold", required_argument, NULL, OPTION_HOLD},
+        {"cancel", required_argument, NULL, OPTION_CANCEL},
+        {"cancel-delay", required_argument, NULL, OPTION_CANCEL_DELAY},
+        {"refresh", required_argument, NULL, OPTION_REFRESH},
+        {"refresh-method", required_argument, NULL, OPTION_REFRESH_METHOD},
+        {"timeout", required_argument, NULL, OPTION_TIMEOUT},
+        {"batch", required_argument, NULL, OPTION_BATCH},
+        {"report-interval", required_argument, NULL, OPTION_REPORT_INTERVAL},
+        {"help", no_argument, NULL, OPTION_HELP},
+        {NULL, 0, NULL, 0},
+    };
+
+    memset(config, 0, sizeof(loadgen_config_t));
+    config->target_length = parse_socket_address(LOADGEN_DEFAULT_TARGET, LOADGEN_DEFAULT_PORT, &config->target);
+    config->rate = LOADGEN_DEFAULT_RATE;
+    config->concurrency = LOADGEN_DEFAULT_CONCURRENCY;
+    config->calls = -1;
+    config->refresh_method = METHOD_NAME_INVITE;
+    config->timeout_ms = LOADGEN_DEFAULT_TIMEOUT_MS;
+    config->batch = LOADGEN_DEFAULT_BATCH;
+    config->report_interval = LOADGEN_DEFAULT_REPORT_INTERVAL;
+
+    int option;
+    long value = 0;
+    while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        int rc = 0;
+        switch (option)
+        {
+        case OPTION_TARGET:
+            config->target_length = parse_socket_address(optarg, LOADGEN_DEFAULT_PORT, &config->target);
+            if (config->target_length == 0)
+            {
+                fprintf(stderr, "Invalid value for --target: %s\n", optarg);
+                rc = -1;
+            }
+            break;
+        case OPTION_RATE:
+            rc = parse_int_option("rate", optarg, 1, 10000000, &value);
+            config->rate = (int)value;
+            break;
+        case OPTION_CONCURRENCY:
+            rc = parse_int_option("concurrency", optarg, 1, LOADGEN_MAX_CONCURRENCY, &value);
+            config->concurrency = (int)value;
+            break;
+        case OPTION_CALLS:
+            rc = parse_int_option("calls", optarg, 0, 1000000000000L, &value);
+            config->calls = value;
+            break;
+        case OPTION_DURATION:
+            rc = parse_int_option("duration", optarg, 0, 86400 * 365, &value);
+            config->duration = (int)value;
+            break;
+        case OPTION_HOLD:
+            rc = parse_int_option("hold", optarg, 0, 3600000, &value);
+            config->hold_ms = (int)value;
+            break;
+        case OPTION_CANCEL:
+            rc = parse_int_option("cancel", optarg, 0, 100, &value);
+            config->cancel_percent = (int)value;
+            break;
+        case OPTION_CANCEL_DELAY:
+            rc = parse_int_option("cancel-delay", optarg, 0, 3600000, &value);
+            config->cancel_delay_ms = (int)value;
+            break;
+        case OPTION_REFRESH:
+            rc = parse_int_option("refresh", optarg, 0, 3600000, &value);
+            config->refresh_ms = (int)value;
+            break;
+        case OPTION_REFRESH_METHOD:
+            if (strcasecmp(optarg, "invite") == 0)
+            {
+                config->refresh_method = METHOD_NAME_INVITE;
+            }
+            else if (strcasecmp(optarg, "update") == 0)
+            {
+                config->refresh_method = METHOD_NAME_UPDATE;
+            }
+            else
+            {
+                fprintf(stderr, "Invalid value for --refresh-method: %s (expected invite or update)\n", optarg);
+                rc = -1;
+            }
+            break;
+        case OPTION_TIMEOUT:
+            rc = parse_int_option("timeout", optarg, 1, 3600000, &value);
+            config->timeout_ms = (int)value;
+            break;
+        case OPTION_BATCH:
+            rc = parse_int_option("batch", optarg, 1, LOADGEN_MAX_BATCH, &value);
+            config->batch = (int)value;
+            break;
+        case OPTION_REPORT_INTERVAL:
+            rc = parse_int_option("report-interval", optarg, 0, 3600, &value);
+            config->report_interval = (int)value;
+            break;
+        case OPTION_HELP:
+            print_usage(argv[0]);
+            return 1;
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+        if (rc != 0)
+        {
+            return -1;
+        }
+    }
+    if (optind < argc)
+    {
+        fprintf(stderr, "Unexpected argument: %s\n", argv[optind]);
+        return -1;
+    }
+    if (config->calls < 0)
+    {
+        config->calls = config->duration > 0 ? 0 : LOADGEN_DEFAULT_CALLS;
+    }
+    return 0;
+}
+
+/**
+ * @brief Opens the UDP socket connected to the target and allocates the call table.
+ * @return 0 on success, -1 on failure.
+ */
+static int loadgen_init(loadgen_t *generator)
+{
+    loadgen_config_t *config = &generator->config;
+    generator->socket = socket(config->target.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (generator->socket < 0)
+    {
+        error("Failed to create socket: %s", strerror(errno));
+        return -1;
+    }
+    // bursts of a batch per call slot must not overflow the socket buffers
+    int buffer_size = LOADGEN_SOCKET_BUFFER_SIZE;
+    setsockopt(generator->socket, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+    setsockopt(generator->socket, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    // a connected socket only receives from the target, and sends without an address per datagram
+    if (connect(generator->socket, (struct sockaddr *)&config->target, config->target_length) < 0)
+    {
+        error("Failed to connect to the target: %s", strerror(errno));
+        return -1;
+    }
+    struct sockaddr_storage local;
+    socklen_t local_length = sizeof(local);
+    if (getsockname(generator->socket, (struct sockaddr *)&local, &local_length) < 0)
+    {
+        error("Failed to get the local address: %s", strerror(errno));
+        return -1;
+    }
+    sockaddr_to_string(&local, generator->local_host, sizeof(generator->local_host));
+    sockaddr_to_string(&config->target, generator->target_host, sizeof(generator->target_host));
+    generator->run_id = (uint32_t)(get_real_time_ns() ^ ((uint64_t)getpid() << 16));
+    // a refresher sends its refresh halfway through the session interval
+    int session_expires = (2 * config->refresh_ms + 999) / 1000;
+    snprintf(generator->refresh_headers, sizeof(generator->refresh_headers),
+             "Session-Expires: %d;refresher=uac\r\nSupported: timer\r\n",
+             session_expires > LOADGEN_MIN_SESSION_EXPIRES ? session_expires : LOADGEN_MIN_SESSION_EXPIRES);
+
+    generator->calls = calloc((size_t)config->concurrency, sizeof(loadgen_call_t));
+    generator->free_slots = malloc((size_t)config->concurrency * sizeof(uint32_t));
+    if (generator->calls == NULL || generator->free_slots == NULL)
+    {
+        error("Failed to allocate the call table");
+        return -1;
+    }
+    // slots are taken from the end, so the first calls use the first slots
+    for (int i = 0; i < config->concurrency; i++)
+    {
+        generator->free_slots[i] = (uint32_t)(config->concurrency - 1 - i);
+    }
+    generator->free_count = (uint32_t)config->concurrency;
+
+    for (int i = 0; i < LOADGEN_MAX_BATCH; i++)
+    {
+        generator->send_iovs[i].iov_base = generator->send_buffers[i];
+        generator->send_headers[i].msg_hdr.msg_iov = &generator->send_iovs[i];
+        generator->send_headers[i].msg_hdr.msg_iovlen = 1;
+        generator->receive_iovs[i].iov_base = generator->receive_buffers[i];
+        generator->receive_iovs[i].iov_len = BUFFER_SIZE - 1; // room for the terminating null of the parser
+        generator->receive_headers[i].msg_hdr.msg_iov = &generator->receive_iovs[i];
+        generator->receive_headers[i].msg_hdr.msg_iovlen = 1;
+    }
+    return 0;
+}
+
+static void loadgen_destroy(loadgen_t *generator)
+{
+    if (generator->socket >= 0)
+    {
+        close(generator->socket);
+    }
+    free(generator->calls);
+    free(generator->free_slots);
+}
+
+/**
+ * @brief Sends the queued requests.
+ */
+static void flush_requests(loadgen_t *generator)
+{
+    int offset = 0;
+    while (offset < generator->send_count)
+    {
+        int sent = sendmmsg(generator->socket, &generator->send_headers[offset], (unsigned int)(generator->send_count - offset), 0);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            // a request the server never sees is reported as lost by its call
+            generator->stats.send_errors += (uint64_t)(generator->send_count - offset);
+            break;
+        }
+        offset += sent;
+    }
+    generator->send_count = 0;
+}
+
+/**
+ * @brief Queues a request of a call, flushing the queue when it is full.
+ * @param generator The load generator.
+ * @param slot The slot of the call.
+ * @param method The method of the request.
+ * @param cseq The CSeq number, which also tells the responses of the requests of the call apart.
+ * @param transaction Distinguishes the branches of the transactions of the call together with
+ * the CSeq number: 'i' for the INVITE, its CANCEL and the ACK of a failure response, 'a' for the
+ * ACK of a 2xx response, 'r' for a refresh and the ACK of its failure response, 'b' for the BYE.
+ */
+static void queue_request(loadgen_t *generator, uint32_t slot, const char *method, int cseq, char transaction)
+{
+    if (generator->send_count == generator->config.batch)
+    {
+        flush_requests(generator);
+    }
+    const loadgen_call_t *call = &generator->calls[slot];
+    bool has_to_tag = call->to_tag[0] != '\0';
+    char *buffer = generator->send_buffers[generator->send_count];
+    int length = snprintf(buffer, BUFFER_SIZE,
+                          "%s sip:service@%s " SIP_PROTOCOL_AND_VERSION "\r\n"
+                          HEADER_NAME_VIA ": " SIP_PROTOCOL_AND_VERSION "/UDP %s;" PARAM_NAME_BRANCH "=z9hG4bK-%08x-%u-%u-%c%d\r\n"
+                          HEADER_NAME_FROM ": <sip:loadgen@%s>;" PARAM_NAME_TAG "=%08x-%u-%u\r\n"
+                          HEADER_NAME_TO ": <sip:service@%s>%s%s\r\n"
+                          HEADER_NAME_CALL_ID ": %u-%u-%08x@sip_loadgen\r\n"
+                          HEADER_NAME_CSEQ ": %d %s\r\n"
+                          "Contact: <sip:loadgen@%s>\r\n"
+                          "%s"
+                          HEADER_NAME_MAX_FORWARDS ": 70\r\n"
+                          HEADER_NAME_CONTENT_LENGTH ": 0\r\n"
+                          "\r\n",
+                          method, generator->target_host,
+                          generator->local_host, generator->run_id, slot, call->generation, transaction, cseq,
+                          generator->local_host, generator->run_id, slot, call->generation,
+                          generator->target_host, has_to_tag ? ";" PARAM_NAME_TAG "=" : "", call->to_tag,
+                          slot, call->generation, generator->run_id,
+                          cseq, method,
+                          generator->local_host,
+                          transaction == 'r' ? generator->refresh_headers : "");
+    if (length < 0 || length >= BUFFER_SIZE)
+    {
+        error("Request too long for the send buffer");
+        return;
+    }
+    generator->send_iovs[generator->send_count].iov_len = (size_t)length;
+    generator->send_count++;
+}
+
+/**
+ * @brief Starts a call in a free slot by queueing its INVITE.
+ */
+static void start_call(loadgen_t *generator, uint64_t now)
+{
+    uint32_t slot = generator->free_slots[--generator->free_count];
+    loadgen_call_t *call = &generator->calls[slot];
+    call->state = CALL_INVITING;
+    call->to_tag[0] = '\0';
+    call->sent_ns = now;
+    call->deadline_ns = now + (uint64_t)generator->config.timeout_ms * 1000000ULL;
+    // spreads the cancelled calls evenly over the run
+    int percent = generator->config.cancel_percent;
+    bool cancelled = percent > 0 && (generator->stats.started * percent) % 100 < (uint64_t)percent;
+    call->cancel_ns = cancelled ? now + (uint64_t)generator->config.cancel_delay_ms * 1000000ULL : 0;
+    call->cancel_sent = false;
+    call->cseq = LOADGEN_CSEQ_INVITE;
+    queue_request(generator, slot, METHOD_NAME_INVITE, LOADGEN_CSEQ_INVITE, 'i');
+    generator->stats.started++;
+}
+
+/**
+ * @brief Releases the slot of a finished call.
+ */
+static void release_call(loadgen_t *generator, uint32_t slot)
+{
+    loadgen_call_t *call = &generator->calls[slot];
+    call->state = CALL_FREE;
+    call->generation++;
+    generator->free_slots[generator->free_count++] = slot;
+}
+
+/**
+ * @brief Queues the BYE of an answered call.
+ */
+static void send_bye(loadgen_t *generator, uint32_t slot, uint64_t now)
+{
+    loadgen_call_t *call = &generator->calls[slot];
+    call->state = CALL_BYEING;
+    call->sent_ns = now;
+    call->deadline_ns = now + (uint64_t)generator->config.timeout_ms * 1000000ULL;
+    call->cseq++;
+    queue_request(generator, slot, METHOD_NAME_BYE, call->cseq, 'b');
+}
+
+/**
+ * @brief Queues the session refresh of a holding call, a re-INVITE or an UPDATE.
+ */
+static void send_refresh(loadgen_t *generator, uint32_t slot, uint64_t now)
+{
+    loadgen_call_t *call = &generator->calls[slot];
+    call->state = CALL_REFRESHING;
+    call->sent_ns = now;
+    call->deadline_ns = now + (uint64_t)generator->config.timeout_ms * 1000000ULL;
+    call->cseq++;
+    queue_request(generator, slot, generator->config.refresh_method, call->cseq, 'r');
+    generator->stats.refreshes_sent++;
+}
+
+/**
+ * @brief Holds an answered call until its next refresh or its BYE, whichever comes first.
+ */
+static void hold_call(loadgen_t *generator, uint32_t slot, uint64_t now)
+{
+    loadgen_call_t *call = &generator->calls[slot];
+    call->state = CALL_HOLDING;
+    call->deadline_ns = call->bye_ns;
+    if (generator->config.refresh_ms > 0)
+    {
+        uint64_t refresh_ns = now + (uint64_t)generator->config.refresh_ms * 1000000ULL;
+        call->deadline_ns = refresh_ns < call->bye_ns ? refresh_ns : call->bye_ns;
+    }
+}
+
+/**
+ * @brief Queues the CANCEL of a call still waiting for the final response to its INVITE.
+ */
+static void send_cancel(loadgen_t *generator, uint32_t slot)
+{
+    loadgen_call_t *call = &generator->calls[slot];
+    call->cancel_ns = 0;
+    call->cancel_sent = true;
+    // the CANCEL has the branch, CSeq number and To header of the INVITE
+    queue_request(generator, slot, METHOD_NAME_CANCEL, LOADGEN_CSEQ_INVITE, 'i');
+    generator->stats.cancels_sent++;
+}
+
+/**
+ * @brief Handles the final response of the INVITE of a call: acknowledges it, and either
+ * holds the call or ends it.
+ */
+static void handle_invite_response(loadgen_t *generator, uint32_t slot, sip_message_t *response, uint64_t now)
+{
+    loadgen_call_t *call = &generator->calls[slot];
+    histogram_record(&generator->stats.setup_latency, now - call->sent_ns);
+
+    size_t to_length = 0;
+    size_t to_tag_length = 0;
+    const char *to_tag = get_message_to(response, &to_length) != NULL ? get_to_tag(response, &to_tag_length) : NULL;
+    if (to_tag != NULL && to_tag_length <= SIP_TAG_MAX_LENGTH)
+    {
+        memcpy(call->to_tag, to_tag, to_tag_length);
+        call->to_tag[to_tag_length] = '\0';
+    }
+
+    if (response->status_code > RESPONSE_CODE_SUCCESS_END)
+    {
+        // the ACK of a failure response belongs to the INVITE transaction and reuses its branch
+        queue_request(generator, slot, METHOD_NAME_ACK, LOADGEN_CSEQ_INVITE, 'i');
+        if (call->cancel_sent && response->status_code == RESPONSE_CODE_487)
+        {
+            generator->stats.cancelled++;
+        }
+        else
+        {
+            generator->stats.rejected++;
+        }
+        release_call(generator, slot);
+        return;
+    }
+    queue_request(generator, slot, METHOD_NAME_ACK, LOADGEN_CSEQ_INVITE, 'a');
+    generator->stats.answered++;
+    generator->stats.cancel_too_late += call->cancel_sent ? 1 : 0;
+    if (generator->config.hold_ms == 0)
+    {
+        send_bye(generator, slot, now);
+        return;
+    }
+    call->bye_ns = now + (uint64_t)generator->config.hold_ms * 1000000ULL;
+    hold_call(generator, slot, now);
+}
+
+/**
+ * @brief Handles the final response of a session refresh: acknowledges a re-INVITE and holds
+ * the call again. A failed refresh leaves the call as it is, its BYE tells whether it survived.
+ */
+static void handle_refresh_response(loadgen_t *generator, uint32_t slot, sip_message_t *response, uint64_t now)
+{
+    loadgen_call_t *call = &generator->calls[slot];
+    histogram_record(&generator->stats.refresh_latency, now - call->sent_ns);
+    bool success = response->status_code <= RESPONSE_CODE_SUCCESS_END;
+    if (strcmp(generator->config.refresh_method, METHOD_NAME_INVITE) == 0)
+    {
+        queue_request(generator, slot, METHOD_NAME_ACK, call->cseq, success ? 'a' : 'r');
+    }
+    if (success)
+    {
+        generator->stats.refreshed++;
+    }
+    else
+    {
+        generator->stats.refresh_failures++;
+    }
+    hold_call(generator, slot, now);
+}
+
+/**
+ * @brief Matches a received datagram to its call and advances the call.
+ */
+static void handle_response(loadgen_t *generator, const char *data, size_t length, uint64_t now)
+{
+    sip_message_t *response = &generator->response;
+    memset(response, 0, sizeof(sip_message_t));
+    memcpy(response->buffer, data, length);
+    response->buffer[length] = '\0';
+    response->buffer_length = length;
+
+    size_t call_id_length = 0;
+    size_t cseq_length = 0;
+    unsigned int slot = 0;
+    unsigned int generation = 0;
+    unsigned int run_id = 0;
+    if (parse_first_line(response) != ERROR_NONE || response->is_request)
+    {
+        generator->stats.malformed++;
+        return;
+    }
+    const char *call_id = get_message_call_id(response, &call_id_length);
+    const char *cseq = get_message_cseq(response, &cseq_length);
+    if (call_id == NULL || cseq == NULL || sscanf(call_id, "%u-%u-%x@", &slot, &generation, &run_id) != 3)
+    {
+        generator->stats.malformed++;
+        return;
+    }
+    if (run_id != generator->run_id || slot >= (unsigned int)generator->config.concurrency)
+    {
+        generator->stats.stale++;
+        return;
+    }
+
+    int code = response->status_code;
+    if (code >= METRICS_STATUS_CODE_MIN && code < METRICS_STATUS_CODE_MIN + METRICS_STATUS_CODE_COUNT)
+    {
+        generator->stats.final_codes[code - METRICS_STATUS_CODE_MIN] += code > RESPONSE_CODE_PROVISIONAL_END ? 1 : 0;
+    }
+    loadgen_call_t *call = &generator->calls[slot];
+    int cseq_number = atoi(cseq);
+    const char *cseq_method = cseq + strspn(cseq, "0123456789 \t");
+    if (call->generation == generation && call->cancel_sent && code > RESPONSE_CODE_PROVISIONAL_END &&
+        strncmp(cseq_method, METHOD_NAME_CANCEL, METHOD_SIZE_CANCEL) == 0)
+    {
+        // the response to the CANCEL, the INVITE gets its own final response
+        if (code <= RESPONSE_CODE_SUCCESS_END)
+        {
+            generator->stats.cancel_ok++;
+        }
+        else
+        {
+            generator->stats.cancel_failures++;
+        }
+        return;
+    }
+    // only the last request of a call waits for a response
+    if (call->generation != generation || cseq_number != call->cseq ||
+        (call->state != CALL_INVITING && call->state != CALL_REFRESHING && call->state != CALL_BYEING))
+    {
+        // retransmitted final responses and responses arriving after their timeout
+        generator->stats.stale++;
+        return;
+    }
+    if (code <= RESPONSE_CODE_PROVISIONAL_END)
+    {
+        generator->stats.provisional++;
+        return;
+    }
+
+    if (call->state == CALL_INVITING)
+    {
+        handle_invite_response(generator, slot, response, now);
+        return;
+    }
+    if (call->state == CALL_REFRESHING)
+    {
+        handle_refresh_response(generator, slot, response, now);
+        return;
+    }
+    histogram_record(&generator->stats.bye_latency, now - call->sent_ns);
+    if (code <= RESPONSE_CODE_SUCCESS_END)
+    {
+        generator->stats.completed++;
+    }
+    else
+    {
+        generator->stats.bye_failures++;
+    }
+    release_call(generator, slot);
+}
+
+/**
+ * @brief Receives and handles the responses waiting on the socket.
+ * @return The number of datagrams received.
+ */
+static int receive_responses(loadgen_t *generator)
+{
+    int total = 0;
+    while (1)
+    {
+        int count = recvmmsg(generator->socket, generator->receive_headers, (unsigned int)generator->config.batch, MSG_DONTWAIT, NULL);
+        if (count <= 0)
+        {
+            if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                // ICMP port unreachable while the server is down, its calls time out
+                generator->stats.malformed += errno == ECONNREFUSED ? 0 : 1;
+            }
+            return total;
+        }
+        uint64_t now = get_monotonic_time_ns();
+        for (int i = 0; i < count; i++)
+        {
+            if (generator->receive_headers[i].msg_hdr.msg_flags & MSG_TRUNC)
+            {
+                generator->stats.malformed++;
+                continue;
+            }
+            handle_response(generator, generator->receive_buffers[i], generator->receive_headers[i].msg_len, now);
+        }
+        total += count;
+        if (count < generator->config.batch)
+        {
+            return total;
+        }
+    }
+}
+
+/**
+ * @brief Sends the refreshes and BYEs that are due and times out calls without a response.
+ */
+static void check_calls(loadgen_t *generator, uint64_t now)
+{
+    for (uint32_t slot = 0; slot < (uint32_t)generator->config.concurrency; slot++)
+    {
+        loadgen_call_t *call = &generator->calls[slot];
+        if (call->state == CALL_INVITING && call->cancel_ns != 0 && now >= call->cancel_ns)
+        {
+            send_cancel(generator, slot);
+        }
+        if (call->state == CALL_FREE || now < call->deadline_ns)
+        {
+            continue;
+        }
+        switch (call->state)
+        {
+        case CALL_INVITING:
+            generator->stats.invite_timeouts++;
+            release_call(generator, slot);
+            break;
+        case CALL_HOLDING:
+            if (now >= call->bye_ns)
+            {
+                send_bye(generator, slot, now);
+            }
+            else
+            {
+                send_refresh(generator, slot, now);
+            }
+            break;
+        case CALL_REFRESHING:
+            // the call goes on, a late response is stale
+            generator->stats.refresh_timeouts++;
+            hold_call(generator, slot, now);
+            break;
+        case CALL_BYEING:
+            generator->stats.bye_timeouts++;
+            release_call(generator, slot);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static double to_ms(uint64_t value_ns)
+{
+    return value_ns / 1e6;
+}
+
+static void print_progress(const loadgen_t *generator, double elapsed, uint64_t interval_started, double interval_seconds)
+{
+    const loadgen_stats_t *stats = &generator->stats;
+    printf("[%7.1fs] started %-9lu answered %-9lu completed %-9lu rejected %-6lu lost %-6lu active %-7u %8.0f cps  setup p50 %.3f ms p99 %.3f ms\n",
+           elapsed, stats->started, stats->answered, stats->completed, stats->rejected,
+           stats->invite_timeouts + stats->bye_timeouts + stats->refresh_timeouts, (uint32_t)generator->config.concurrency - generator->free_count,
+           interval_seconds > 0 ? interval_started / interval_seconds : 0.0,
+           to_ms(histogram_percentile(&stats->setup_latency, 50)), to_ms(histogram_percentile(&stats->setup_latency, 99)));
+    fflush(stdout);
+}
+
+/**
+ * @brief Prints the percentiles of a latency histogram and its distribution over powers of two.
+ */
+static void print_histogram(const char *title, const latency_histogram_t *histogram)
+{
+    uint64_t count = metrics_counter_get(&histogram->count);
+    printf("\n%s: %lu samples\n", title, count);
+    if (count == 0)
+    {
+        return;
+    }
+    printf("  mean %.3f ms  p50 %.3f ms  p90 %.3f ms  p99 %.3f ms  p99.9 %.3f ms  max %.3f ms\n",
+           to_ms(metrics_counter_get(&histogram->sum) / count),
+           to_ms(histogram_percentile(histogram, 50)), to_ms(histogram_percentile(histogram, 90)),
+           to_ms(histogram_percentile(histogram, 99)), to_ms(histogram_percentile(histogram, 99.9)),
+           to_ms(metrics_counter_get(&histogram->max)));
+
+    // one row per power of two, from the first to the last row with samples
+    enum { ROW_COUNT = HISTOGRAM_BUCKET_COUNT / HISTOGRAM_SUB_BUCKET_COUNT };
+    uint64_t rows[ROW_COUNT] = {0};
+    int first = -1;
+    int last = -1;
+    uint64_t largest = 0;
+    for (int row = 0; row < ROW_COUNT; row++)
+    {
+        for (int i = 0; i < HISTOGRAM_SUB_BUCKET_COUNT; i++)
+        {
+            rows[row] += metrics_counter_get(&histogram->buckets[row * HISTOGRAM_SUB_BUCKET_COUNT + i]);
+        }
+        if (rows[row] > 0)
+        {
+            first = first < 0 ? row : first;
+            last = row;
+            largest = rows[row] > largest ? rows[row] : largest;
+        }
+    }
+    for (int row = first; row <= last; row++)
+    {
+        int width = (int)(rows[row] * LOADGEN_HISTOGRAM_BAR_WIDTH / largest);
+        printf("  <= %10.3f ms %10lu %6.2f%% |%.*s\n",
+               to_ms(histogram_bucket_upper_bound((row + 1) * HISTOGRAM_SUB_BUCKET_COUNT - 1)), rows[row],
+               100.0 * rows[row] / count, width, "########################################");
+    }
+}
+
+static void print_report(const loadgen_t *generator, double starting, double elapsed)
+{
+    const loadgen_stats_t *stats = &generator->stats;
+    uint64_t lost = stats->invite_timeouts + stats->bye_timeouts + stats->refresh_timeouts;
+    uint64_t requests = stats->started + stats->answered + stats->refreshes_sent;
+    printf("\nTarget %s, %.1f s, %.0f calls per second started over %.1f s\n", generator->target_host, elapsed,
+           starting > 0 ? stats->started / starting : 0.0, starting);
+    printf("Calls: started %lu, answered %lu, rejected %lu, completed %lu, BYE failures %lu, throttled %lu\n",
+           stats->started, stats->answered, stats->rejected, stats->completed, stats->bye_failures, stats->throttled);
+    printf("Lost: %lu INVITEs, %lu BYEs and %lu refreshes without a final response within %d ms (%.3f%% of %lu requests)\n",
+           stats->invite_timeouts, stats->bye_timeouts, stats->refresh_timeouts, generator->config.timeout_ms,
+           requests > 0 ? 100.0 * lost / requests : 0.0, requests);
+    if (stats->cancels_sent > 0)
+    {
+        printf("Cancels: sent %lu, 487 %lu, answered before the CANCEL %lu, CANCEL responses %lu ok %lu failed\n",
+               stats->cancels_sent, stats->cancelled, stats->cancel_too_late, stats->cancel_ok, stats->cancel_failures);
+    }
+    if (stats->refreshes_sent > 0)
+    {
+        printf("Refreshes: sent %lu %s, 2xx %lu, failed %lu\n", stats->refreshes_sent, generator->config.refresh_method,
+               stats->refreshed, stats->refresh_failures);
+    }
+    printf("Responses: %lu provisional, %lu stale, %lu malformed, %lu send errors\n",
+           stats->provisional, stats->stale, stats->malformed, stats->send_errors);
+    printf("Final responses:");
+    for (int i = 0; i < METRICS_STATUS_CODE_COUNT; i++)
+    {
+        if (stats->final_codes[i] > 0)
+        {
+            printf(" %d x %lu", i + METRICS_STATUS_CODE_MIN, stats->final_codes[i]);
+        }
+    }
+    printf("\n");
+    print_histogram("Call setup latency, INVITE to final response", &stats->setup_latency);
+    print_histogram("BYE latency, BYE to response", &stats->bye_latency);
+    if (stats->refreshes_sent > 0)
+    {
+        print_histogram("Session refresh latency, re-INVITE or UPDATE to final response", &stats->refresh_latency);
+    }
+}
+
+/**
+ * @brief Runs calls until the configured number of calls or duration is reached, or until
+ * interrupted, then waits for the calls in progress to finish.
+ */
+static void loadgen_run(loadgen_t *generator)
+{
+    loadgen_config_t *config = &generator->config;
+    loadgen_stats_t *stats = &generator->stats;
+    uint64_t start = get_monotonic_time_ns();
+    uint64_t scheduled = 0; // calls due so far, started or throttled
+    uint64_t last_scan = start;
+    uint64_t last_report = start;
+    uint64_t last_report_started = 0;
+    uint64_t stop = 0; // time the last call was started
+    bool stopping = false;
+    struct pollfd poll_fd = {.fd = generator->socket, .events = POLLIN};
+
+    while (!stopping || generator->free_count < (uint32_t)config->concurrency)
+    {
+        uint64_t now = get_monotonic_time_ns();
+        stopping = stopping || stop_requested ||
+                   (config->calls > 0 && stats->started >= (uint64_t)config->calls) ||
+                   (config->duration > 0 && now - start >= (uint64_t)config->duration * 1000000000ULL);
+        stop = stopping && stop == 0 ? now : stop;
+        if (!stopping)
+        {
+            uint64_t due = (uint64_t)((double)(now - start) * config->rate / 1e9);
+            while (scheduled < due)
+            {
+                scheduled++;
+                if (generator->free_count == 0)
+                {
+                    stats->throttled++;
+                    continue;
+                }
+                start_call(generator, now);
+                if (config->calls > 0 && stats->started >= (uint64_t)config->calls)
+                {
+                    break;
+                }
+            }
+        }
+        if (now - last_scan >= LOADGEN_SCAN_INTERVAL_NS)
+        {
+            check_calls(generator, now);
+            last_scan = now;
+        }
+        flush_requests(generator);
+
+        if (receive_responses(generator) == 0)
+        {
+            poll(&poll_fd, 1, LOADGEN_POLL_TIMEOUT_MS);
+            receive_responses(generator);
+        }
+        flush_requests(generator);
+
+        now = get_monotonic_time_ns();
+        if (config->report_interval > 0 && now - last_report >= (uint64_t)config->report_interval * 1000000000ULL)
+        {
+            print_progress(generator, (now - start) / 1e9, stats->started - last_report_started, (now - last_report) / 1e9);
+            last_report = now;
+            last_report_started = stats->started;
+        }
+    }
+    print_report(generator, (stop - start) / 1e9, (get_monotonic_time_ns() - start) / 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+    // the parser logs malformed messages only
+    log_set_level(LOG_LEVEL_ERROR);
+    int rc = parse_options(&loadgen.config, argc, argv);
+    if (rc != 0)
+    {
+        return rc > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    loadgen.socket = -1;
+    if (loadgen_init(&loadgen) != 0)
+    {
+        loadgen_destroy(&loadgen);
+        return EXIT_FAILURE;
+    }
+    signal(SIGINT, handle_stop_signal);
+    signal(SIGTERM, handle_stop_signal);
+
+    printf("Calling %s from %s at %d cps, %d calls in progress at most, %d ms hold\n",
+           loadgen.target_host, loadgen.local_host, loadgen.config.rate, loadgen.config.concurrency, loadgen.config.hold_ms);
+    loadgen_run(&loadgen);
+    loadgen_destroy(&loadgen);
+    return EXIT_SUCCESS;
+}
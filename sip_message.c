@@ -627,4 +627,58 @@ sip_method_t get_message_method(sip_message_t *message)
     }
 
     return message->method_type;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Classifies a message from its first line and To tag, without parsing it.
+ * Cheap enough to be done by the receiver for every packet.
+ * @param message The SIP message to classify, its To header is cached.
+ * @return The class of the message.
+ */
+sip_message_class_t classify_message(sip_message_t *message)
+{
+    if (message == NULL)
+    {
+        error("Invalid parameters");
+        return SIP_MESSAGE_CLASS_INITIAL_REQUEST;
+    }
+    const char *buffer = message->buffer;
+    if (strncmp(buffer, SIP_PROTOCOL_AND_VERSION, sizeof(SIP_PROTOCOL_AND_VERSION) - 1) == 0)
+    {
+        return SIP_MESSAGE_CLASS_RESPONSE;
+    }
+    if (strncmp(buffer, METHOD_NAME_ACK " ", METHOD_SIZE_ACK + 1) == 0)
+    {
+        return SIP_MESSAGE_CLASS_IN_DIALOG;
+    }
+    if (strncmp(buffer, METHOD_NAME_CANCEL " ", METHOD_SIZE_CANCEL + 1) == 0)
+    {
+        return SIP_MESSAGE_CLASS_CANCEL;
+    }
+
+    size_t length;
+    const char *to = get_message_to(message, &length);
+    if (to != NULL)
+    {
+        for (const char *param = memchr(to, ';', length); param != NULL;
+             param = memchr(param + 1, ';', to + length - param - 1))
+        {
+            const char *name = param + 1;
+            while (name < to + length && (*name == ' ' || *name == '\t'))
+            {
+                name++;
+            }
+            if ((size_t)(to + length - name) > sizeof(PARAM_NAME_TAG) &&
+                strncasecmp(name, PARAM_NAME_TAG "=", sizeof(PARAM_NAME_TAG)) == 0)
+            {
+                return SIP_MESSAGE_CLASS_IN_DIALOG;
+            }
+        }
+    }
+
+    if (strncmp(buffer, METHOD_NAME_INVITE " ", METHOD_SIZE_INVITE + 1) == 0)
+    {
+        return SIP_MESSAGE_CLASS_INITIAL_INVITE;
+    }
+    return SIP_MESSAGE_CLASS_INITIAL_REQUEST;
+}
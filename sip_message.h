@@ -8,6 +8,7 @@
 
 #include <netinet/in.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #define BUFFER_SIZE 1024
 
@@ -28,6 +29,7 @@
 #define HEADER_NAME_CSEQ "CSeq"
 #define HEADER_NAME_MAX_FORWARDS "Max-Forwards"
 #define HEADER_NAME_CONTENT_LENGTH "Content-Length"
+#define HEADER_NAME_RETRY_AFTER "Retry-After"
 
 #define PARAM_NAME_BRANCH "branch"
 #define PARAM_NAME_TAG "tag"
@@ -79,8 +81,12 @@ typedef enum
 #define RESPONSE_TEXT_400_BAD_REQUEST "Bad Request"
 #define RESPONSE_TEXT_403_FORBIDDEN "Forbidden"
 #define RESPONSE_TEXT_404_NOT_FOUND "Not Found"
+#define RESPONSE_TEXT_481_CALL_TRANSACTION_DOES_NOT_EXIST "Call/Transaction Does Not Exist"
+#define RESPONSE_TEXT_487_REQUEST_TERMINATED "Request Terminated"
+#define RESPONSE_TEXT_491_REQUEST_PENDING "Request Pending"
 #define RESPONSE_TEXT_500_INTERNAL_SERVER_ERROR "Internal Server Error"
 #define RESPONSE_TEXT_501_NOT_IMPLEMENTED "Not Implemented"
+#define RESPONSE_TEXT_503_SERVICE_UNAVAILABLE "Service Unavailable"
 
 typedef enum
 {
@@ -117,19 +123,36 @@ typedef enum
     RESPONSE_CODE_401 = 401,
     RESPONSE_CODE_403 = 403,
     RESPONSE_CODE_404 = 404,
+    RESPONSE_CODE_481 = 481,
+    RESPONSE_CODE_487 = 487,
+    RESPONSE_CODE_491 = 491,
     RESPONSE_CODE_CLIENT_ERROR_END = 499,
     RESPONSE_CODE_SERVER_ERROR_START = 500,
     RESPONSE_CODE_500 = 500,
     RESPONSE_CODE_501 = 501,
+    RESPONSE_CODE_503 = 503,
     RESPONSE_CODE_SERVER_ERROR_END = 599,
     RESPONSE_CODE_GLOBAL_FAILURE_START = 600,
     RESPONSE_CODE_GLOBAL_FAILURE_END = 699
 } sip_response_code_e;
 
+// coarse classification of a message done by the receiver before dispatching it
+typedef enum
+{
+    SIP_MESSAGE_CLASS_RESPONSE = 0,
+    SIP_MESSAGE_CLASS_IN_DIALOG,       // requests with a To tag, and ACK completing a transaction
+    SIP_MESSAGE_CLASS_INITIAL_INVITE,  // INVITE creating a new call
+    SIP_MESSAGE_CLASS_INITIAL_REQUEST, // other requests outside of a dialog
+    SIP_MESSAGE_CLASS_CANCEL,          // CANCEL of a pending INVITE, which must not overtake it
+} sip_message_class_t;
+
 typedef enum
 {
     PACKET_TYPE_INCOMING_SIP = 0,
-    PACKET_TYPE_DELETE_TRANSACTION
+    PACKET_TYPE_DELETE_TRANSACTION,
+    PACKET_TYPE_ANSWER_INVITE, // the answer delay of an INVITE has passed
+    PACKET_TYPE_DRAIN, // the server is shutting down, report when no transaction is left
+    PACKET_TYPE_STOP   // the worker thread exits
 } packet_type_e;
 
 /**
@@ -146,8 +169,16 @@ typedef struct
     char response[BUFFER_SIZE]; // TODO make it dynamic
     size_t response_length;
 
-    struct sockaddr_in client_addr;
+    struct sockaddr_storage client_addr;
     socklen_t client_addr_len;
+    int socket;          // the socket the message was received on, responses are sent on it
+    uint64_t connection; // handle of the TCP connection the message was received on, 0 for UDP
+
+    bool trace; // selected for per call debug tracing
+    uint64_t receive_time_ns;        // monotonic time recvmsg returned the message
+    uint64_t kernel_receive_time_ns; // kernel receive timestamp on the monotonic clock, 0 if unavailable
+    uint64_t dispatch_time_ns;       // monotonic time the message was queued to its worker
+    sip_message_class_t message_class;
 
     const char *call_id;
     size_t call_id_length;
@@ -203,7 +234,9 @@ const char *get_from_tag(sip_message_t *message, size_t *length);
 const char *get_to_tag(sip_message_t *message, size_t *length);
 const char *get_branch_param(sip_message_t *message, size_t *length);
 
+sip_msg_error_t parse_first_line(sip_message_t *message);
 sip_msg_error_t parse_message(sip_message_t *message);
 sip_method_t get_message_method(sip_message_t *message);
+sip_message_class_t classify_message(sip_message_t *message);
 
 #endif // SIP_MESSAGE_H
\ No newline at end of file
@@ -0,0 +1,164 @@
+/**
+ * @file sip_overload.c
+ * @brief Implementation of the admission controller shedding new calls when workers are overloaded.
+ */
+
+#include "sip_overload.h"
+#include "sip_server.h"
+#include "prng.h"
+#include "log.h"
+#include <stdio.h>
+#include <string.h>
+
+sip_overload_t sip_overload;
+
+/**
+ * @brief Initializes the admission controller.
+ * @param overload The admission controller.
+ * @param queue_high_percent Queue fill level starting to shed new calls, 0 disables.
+ * @param queue_low_percent Queue fill level below which new calls are admitted again.
+ * @param delay_high_ms Average queue delay starting to shed new calls, 0 disables.
+ * @param retry_after_sec Retry-After value of the 503 responses.
+ */
+void init_sip_overload(sip_overload_t *overload, int queue_high_percent, int queue_low_percent, int delay_high_ms, int retry_after_sec)
+{
+    if (overload == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    overload->queue_high_percent = queue_high_percent;
+    overload->queue_low_percent = queue_low_percent < queue_high_percent ? queue_low_percent : queue_high_percent;
+    overload->delay_high_ns = (uint64_t)delay_high_ms * 1000000;
+    overload->retry_after_sec = retry_after_sec;
+    for (int i = 0; i < METRICS_MAX_WORKERS; i++)
+    {
+        atomic_init(&overload->shedding[i], false);
+    }
+}
+
+/**
+ * @brief Updates the overload state of a worker with hysteresis.
+ * @param overload The admission controller.
+ * @param worker_index The index of the worker.
+ * @param queue_depth The number of messages waiting in the normal lane of the worker queue, where new calls wait.
+ * @param queue_capacity The capacity of that lane.
+ * @param queue_delay_ns The average time messages wait in the worker queue.
+ * @return true if new calls to the worker must be rejected.
+ */
+bool sip_overload_check(sip_overload_t *overload, int worker_index, int queue_depth, int queue_capacity, uint64_t queue_delay_ns)
+{
+    if (overload == NULL || worker_index < 0 || worker_index >= METRICS_MAX_WORKERS || queue_capacity <= 0)
+    {
+        error("Invalid parameters");
+        return false;
+    }
+    int fill_percent = queue_depth * 100 / queue_capacity;
+    bool shedding = atomic_load_explicit(&overload->shedding[worker_index], memory_order_relaxed);
+
+    if (!shedding)
+    {
+        bool queue_high = overload->queue_high_percent > 0 && fill_percent >= overload->queue_high_percent;
+        bool delay_high = overload->delay_high_ns > 0 && queue_delay_ns >= overload->delay_high_ns;
+        if (queue_high || delay_high)
+        {
+            info("Worker %d overloaded (queue %d%%, delay %lluus), rejecting new calls", worker_index, fill_percent,
+                 (unsigned long long)queue_delay_ns / 1000);
+            shedding = true;
+        }
+    }
+    else
+    {
+        // the average delay is only refreshed by dequeued messages, so an empty queue clears it
+        bool queue_low = fill_percent <= overload->queue_low_percent;
+        bool delay_low = overload->delay_high_ns == 0 || queue_depth == 0 || queue_delay_ns < overload->delay_high_ns / 2;
+        if (queue_low && delay_low)
+        {
+            info("Worker %d recovered (queue %d%%), admitting new calls", worker_index, fill_percent);
+            shedding = false;
+        }
+    }
+    atomic_store_explicit(&overload->shedding[worker_index], shedding, memory_order_relaxed);
+    return shedding;
+}
+
+/**
+ * @brief Returns whether new calls to a worker are currently rejected. Safe from any thread.
+ */
+bool sip_overload_is_shedding(sip_overload_t *overload, int worker_index)
+{
+    if (overload == NULL || worker_index < 0 || worker_index >= METRICS_MAX_WORKERS)
+    {
+        return false;
+    }
+    return atomic_load_explicit(&overload->shedding[worker_index], memory_order_relaxed);
+}
+
+/**
+ * @brief Checks if a message is the ACK of a stateless 503 sent by the admission controller.
+ * @param message The SIP message, classified as in-dialog.
+ * @return true if the message can be dropped.
+ */
+bool sip_overload_is_rejected_ack(sip_message_t *message)
+{
+    if (message == NULL || strncmp(message->buffer, METHOD_NAME_ACK " ", METHOD_SIZE_ACK + 1) != 0)
+    {
+        return false;
+    }
+    size_t length;
+    if (get_message_to(message, &length) == NULL)
+    {
+        return false;
+    }
+    const char *to_tag = get_to_tag(message, &length);
+    return to_tag != NULL && length > sizeof(SIP_OVERLOAD_TAG_PREFIX) - 1 &&
+           strncmp(to_tag, SIP_OVERLOAD_TAG_PREFIX, sizeof(SIP_OVERLOAD_TAG_PREFIX) - 1) == 0;
+}
+
+/**
+ * @brief Rejects a new INVITE with 503 and Retry-After without creating any state.
+ * @param overload The admission controller.
+ * @param server_socket The socket to send the response on.
+ * @param message The INVITE, its response buffer is used to build the 503.
+ * @return 0 on success, -1 on failure.
+ */
+int sip_overload_reject(sip_overload_t *overload, int server_socket, sip_message_t *message)
+{
+    if (overload == NULL || message == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    size_t via_length, from_length, to_length, call_id_length, cseq_length;
+    const char *via = get_message_via(message, &via_length);
+    const char *from = get_message_from(message, &from_length);
+    const char *to = get_message_to(message, &to_length);
+    const char *call_id = get_message_call_id(message, &call_id_length);
+    const char *cseq = get_message_cseq(message, &cseq_length);
+    if (via == NULL || from == NULL || to == NULL || call_id == NULL || cseq == NULL)
+    {
+        return -1;
+    }
+
+    char to_tag[SIP_BUILD_TAG_LENGTH + 1];
+    create_unique_token(to_tag, SIP_BUILD_TAG_LENGTH);
+    to_tag[SIP_BUILD_TAG_LENGTH] = '\0';
+
+    message->response_length = snprintf(message->response, sizeof(message->response),
+                                        SIP_PROTOCOL_AND_VERSION " %d %s\r\n" HEADER_NAME_VIA ": %.*s\r\n" HEADER_NAME_FROM ": %.*s\r\n" HEADER_NAME_TO ": %.*s;" PARAM_NAME_TAG "=" SIP_OVERLOAD_TAG_PREFIX "%s\r\n" HEADER_NAME_CALL_ID ": %.*s\r\n" HEADER_NAME_CSEQ ": %.*s\r\n" HEADER_NAME_RETRY_AFTER ": %d\r\n" HEADER_NAME_CONTENT_LENGTH ": 0\r\n"
+                                                                 "\r\n",
+                                        RESPONSE_CODE_503, RESPONSE_TEXT_503_SERVICE_UNAVAILABLE,
+                                        (int)via_length, via,
+                                        (int)from_length, from,
+                                        (int)to_length, to,
+                                        to_tag,
+                                        (int)call_id_length, call_id,
+                                        (int)cseq_length, cseq,
+                                        overload->retry_after_sec);
+    if (message->response_length >= sizeof(message->response))
+    {
+        error("Response too long");
+        return -1;
+    }
+    return send_message(server_socket, message->connection, message->response, message->response_length, &message->client_addr, message->client_addr_len, message->trace);
+}
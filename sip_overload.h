@@ -0,0 +1,49 @@
+/**
+ * @file sip_overload.h
+ * @brief Header for the admission controller shedding new calls when workers are overloaded.
+ *
+ * The receiver checks the queue depth and queue delay of the selected worker before
+ * dispatching a message. Above the high watermark new INVITEs are rejected statelessly with
+ * 503 and Retry-After until the worker is back below the low watermark, while responses and
+ * in-dialog requests are still admitted so established calls can complete.
+ */
+
+#ifndef SIP_OVERLOAD_H
+#define SIP_OVERLOAD_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "sip_message.h"
+#include "metrics.h"
+
+#define DEFAULT_OVERLOAD_QUEUE_HIGH_PERCENT 80
+#define DEFAULT_OVERLOAD_QUEUE_LOW_PERCENT 50
+#define DEFAULT_OVERLOAD_DELAY_HIGH_MS 200
+#define DEFAULT_OVERLOAD_RETRY_AFTER_SEC 5
+
+// to-tag prefix of stateless 503 responses, so their ACKs are absorbed by the receiver
+#define SIP_OVERLOAD_TAG_PREFIX "ol-"
+
+/**
+ * @struct sip_overload_t
+ * @brief Admission controller state, written by the receiver thread only.
+ */
+typedef struct
+{
+    int queue_high_percent; // start shedding at this queue fill level, 0 disables
+    int queue_low_percent;  // stop shedding below this queue fill level
+    uint64_t delay_high_ns; // start shedding at this average queue delay, 0 disables
+    int retry_after_sec;
+    atomic_bool shedding[METRICS_MAX_WORKERS];
+} sip_overload_t;
+
+extern sip_overload_t sip_overload;
+
+void init_sip_overload(sip_overload_t *overload, int queue_high_percent, int queue_low_percent, int delay_high_ms, int retry_after_sec);
+bool sip_overload_check(sip_overload_t *overload, int worker_index, int queue_depth, int queue_capacity, uint64_t queue_delay_ns);
+bool sip_overload_is_shedding(sip_overload_t *overload, int worker_index);
+bool sip_overload_is_rejected_ack(sip_message_t *message);
+int sip_overload_reject(sip_overload_t *overload, int server_socket, sip_message_t *message);
+
+#endif // SIP_OVERLOAD_H
@@ -0,0 +1,191 @@
+/**
+ * @file sip_reaper.c
+ * @brief Implementation of the incremental reaper of idle calls and dialogs.
+ */
+
+#include "sip_reaper.h"
+#include "log.h"
+#include "metrics.h"
+#include <string.h>
+
+/**
+ * @brief Initializes a reaper.
+ * @param reaper The reaper to initialize.
+ * @param idle_timeout_ms Inactivity period after which calls and dialogs are reaped, 0 disables reaping.
+ * @param batch_size The maximum number of calls and dialogs examined per step.
+ */
+void init_sip_reaper(sip_reaper_t *reaper, uint64_t idle_timeout_ms, int batch_size)
+{
+    if (reaper == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    memset(reaper, 0, sizeof(sip_reaper_t));
+    reaper->idle_timeout_ms = idle_timeout_ms;
+    reaper->batch_size = batch_size > 0 ? batch_size : 1;
+}
+
+/**
+ * @brief Unlinks the call at the reaper cursor from the list of calls and frees it.
+ * @param reaper The reaper.
+ * @param calls The list of calls.
+ */
+static void reap_call_at_cursor(sip_reaper_t *reaper, sip_call_t **calls)
+{
+    sip_call_t *call = reaper->call_cursor;
+    reaper->call_cursor = call->next;
+
+    if (reaper->call_cursor_previous == NULL && *calls == call)
+    {
+        *calls = call->next;
+        cleanup_call(call);
+    }
+    else if (reaper->call_cursor_previous != NULL && reaper->call_cursor_previous->next == call)
+    {
+        reaper->call_cursor_previous->next = call->next;
+        cleanup_call(call);
+    }
+    else
+    {
+        // a call was inserted in front of the cursor, fall back to a list walk
+        delete_call_by_pointer(calls, call);
+    }
+}
+
+/**
+ * @brief Unlinks the dialog at the reaper cursor from the list of dialogs and frees it.
+ * @param reaper The reaper.
+ * @param dialogs The list of dialogs.
+ */
+static void reap_dialog_at_cursor(sip_reaper_t *reaper, sip_dialog_t **dialogs)
+{
+    sip_dialog_t *dialog = reaper->dialog_cursor;
+    reaper->dialog_cursor = dialog->next;
+
+    if (reaper->dialog_cursor_previous == NULL && *dialogs == dialog)
+    {
+        *dialogs = dialog->next;
+        cleanup_dialog(dialog);
+    }
+    else if (reaper->dialog_cursor_previous != NULL && reaper->dialog_cursor_previous->next == dialog)
+    {
+        reaper->dialog_cursor_previous->next = dialog->next;
+        cleanup_dialog(dialog);
+    }
+    else
+    {
+        // a dialog was inserted in front of the cursor, fall back to a list walk
+        delete_dialog_by_pointer(dialogs, dialog);
+    }
+}
+
+/**
+ * @brief Examines a bounded number of calls and dialogs and reaps the idle ones.
+ * @param reaper The reaper.
+ * @param calls The list of calls.
+ * @param dialogs The list of dialogs.
+ * @param now_ms The current monotonic time in milliseconds.
+ */
+void sip_reaper_step(sip_reaper_t *reaper, sip_call_t **calls, sip_dialog_t **dialogs, uint64_t now_ms)
+{
+    if (reaper == NULL || calls == NULL || dialogs == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    if (reaper->idle_timeout_ms == 0)
+    {
+        return;
+    }
+
+    for (int i = 0; i < reaper->batch_size && *calls != NULL; i++)
+    {
+        if (reaper->call_cursor == NULL)
+        {
+            // wrap around to the head of the list
+            reaper->call_cursor = *calls;
+            reaper->call_cursor_previous = NULL;
+        }
+        sip_call_t *call = reaper->call_cursor;
+        if (now_ms - call->last_activity_ms >= reaper->idle_timeout_ms)
+        {
+            log("Reaping idle call: %.*s", (int)call->call_id_length, call->call_id);
+            reap_call_at_cursor(reaper, calls);
+            worker_metrics_inc(calls_reaped);
+        }
+        else
+        {
+            reaper->call_cursor_previous = call;
+            reaper->call_cursor = call->next;
+        }
+    }
+
+    for (int i = 0; i < reaper->batch_size && *dialogs != NULL; i++)
+    {
+        if (reaper->dialog_cursor == NULL)
+        {
+            // wrap around to the head of the list
+            reaper->dialog_cursor = *dialogs;
+            reaper->dialog_cursor_previous = NULL;
+        }
+        sip_dialog_t *dialog = reaper->dialog_cursor;
+        if (now_ms - dialog->last_activity_ms >= reaper->idle_timeout_ms)
+        {
+            log("Reaping idle dialog: %.*s %.*s", (int)dialog->from_tag_length, dialog->from_tag, (int)dialog->to_tag_length, dialog->to_tag);
+            reap_dialog_at_cursor(reaper, dialogs);
+            worker_metrics_inc(dialogs_reaped);
+        }
+        else
+        {
+            reaper->dialog_cursor_previous = dialog;
+            reaper->dialog_cursor = dialog->next;
+        }
+    }
+}
+
+/**
+ * @brief Moves the reaper cursors off a call that is about to be deleted elsewhere.
+ * @param reaper The reaper.
+ * @param call The call being deleted.
+ */
+void sip_reaper_forget_call(sip_reaper_t *reaper, sip_call_t *call)
+{
+    if (reaper == NULL || call == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    if (reaper->call_cursor == call)
+    {
+        reaper->call_cursor = call->next;
+    }
+    if (reaper->call_cursor_previous == call)
+    {
+        // the unlink check in reap_call_at_cursor falls back to a list walk
+        reaper->call_cursor_previous = NULL;
+    }
+}
+
+/**
+ * @brief Moves the reaper cursors off a dialog that is about to be deleted elsewhere.
+ * @param reaper The reaper.
+ * @param dialog The dialog being deleted.
+ */
+void sip_reaper_forget_dialog(sip_reaper_t *reaper, sip_dialog_t *dialog)
+{
+    if (reaper == NULL || dialog == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    if (reaper->dialog_cursor == dialog)
+    {
+        reaper->dialog_cursor = dialog->next;
+    }
+    if (reaper->dialog_cursor_previous == dialog)
+    {
+        // the unlink check in reap_dialog_at_cursor falls back to a list walk
+        reaper->dialog_cursor_previous = NULL;
+    }
+}
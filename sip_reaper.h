@@ -0,0 +1,36 @@
+/**
+ * @file sip_reaper.h
+ * @brief Header for the incremental reaper of idle calls and dialogs.
+ */
+
+#ifndef SIP_REAPER_H
+#define SIP_REAPER_H
+
+#include <stdint.h>
+#include "sip_utils.h"
+
+#define SIP_REAPER_WAKEUP_INTERVAL 1000
+
+/**
+ * @struct sip_reaper_t
+ * @brief Per worker state of the idle call and dialog reaper.
+ *
+ * The reaper walks the call and dialog lists a few entries at a time, resuming
+ * from a cursor on every worker loop iteration, so its cost per iteration is bounded.
+ */
+typedef struct
+{
+    uint64_t idle_timeout_ms;
+    int batch_size;
+    sip_call_t *call_cursor;
+    sip_call_t *call_cursor_previous;
+    sip_dialog_t *dialog_cursor;
+    sip_dialog_t *dialog_cursor_previous;
+} sip_reaper_t;
+
+void init_sip_reaper(sip_reaper_t *reaper, uint64_t idle_timeout_ms, int batch_size);
+void sip_reaper_step(sip_reaper_t *reaper, sip_call_t **calls, sip_dialog_t **dialogs, uint64_t now_ms);
+void sip_reaper_forget_call(sip_reaper_t *reaper, sip_call_t *call);
+void sip_reaper_forget_dialog(sip_reaper_t *reaper, sip_dialog_t *dialog);
+
+#endif // SIP_REAPER_H
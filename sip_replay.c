@@ -0,0 +1,235 @@
+/**
+ * @file sip_replay.c
+ * @brief Implementation of the replay of captured SIP over UDP traffic into the server.
+ */
+
+#include "sip_replay.h"
+#include "log.h"
+#include "metrics.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+sip_replay_t sip_replay = {.timer_fd = -1, .sink_fd = -1};
+
+/**
+ * @brief Wakes the receiver at a monotonic time, at once if the time has passed.
+ */
+static void arm_timer(sip_replay_t *replay, uint64_t due_ns)
+{
+    // a zero expiry would disarm the timer, an expiry in the past fires at once
+    due_ns = due_ns > 0 ? due_ns : 1;
+    struct itimerspec expiry = {.it_value = {.tv_sec = (time_t)(due_ns / 1000000000), .tv_nsec = (long)(due_ns % 1000000000)}};
+    if (timerfd_settime(replay->timer_fd, TFD_TIMER_ABSTIME, &expiry, NULL) != 0)
+    {
+        error("Failed to arm the replay timer: %s", strerror(errno));
+    }
+}
+
+/**
+ * @brief Opens a capture for replay and arms the timer for its first datagram.
+ * @param replay The replay to initialize.
+ * @param path The pcap or pcapng file.
+ * @param speed The factor of the original pace, 0 injects as fast as the workers keep up.
+ * @param port The destination port of the datagrams to inject, 0 injects all of them.
+ * @return 0 on success, -1 on failure.
+ */
+int sip_replay_init(sip_replay_t *replay, const char *path, double speed, int port)
+{
+    if (replay == NULL || path == NULL || speed < 0 || port < 0 || port > 65535)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    memset(replay, 0, sizeof(sip_replay_t));
+    replay->timer_fd = -1;
+    replay->sink_fd = -1;
+    replay->speed = speed;
+    replay->port = (uint16_t)port;
+    if (pcap_reader_open(&replay->reader, path) != 0)
+    {
+        return -1;
+    }
+    // a descriptor of its own, so no real socket is ever mistaken for the sink
+    replay->sink_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    replay->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (replay->sink_fd < 0 || replay->timer_fd < 0)
+    {
+        error("Failed to set up the replay of %s: %s", path, strerror(errno));
+        sip_replay_destroy(replay);
+        return -1;
+    }
+    arm_timer(replay, 0);
+    info("Replaying %s at %s", path, speed > 0 ? "its original pace" : "full speed");
+    return 0;
+}
+
+/**
+ * @brief Reads ahead the next datagram to inject.
+ * @return false at the end of the capture.
+ */
+static bool read_next(sip_replay_t *replay)
+{
+    while (pcap_reader_next(&replay->reader, &replay->next) == 1)
+    {
+        // the port is at the same offset in IPv4 and IPv6 addresses
+        uint16_t port = ntohs(((const struct sockaddr_in *)&replay->next.destination)->sin_port);
+        if (replay->next.length > 0 && (replay->port == 0 || port == replay->port))
+        {
+            return true;
+        }
+        replay->datagrams_filtered++;
+    }
+    return false;
+}
+
+/**
+ * @brief Injects the datagrams that are due, then arms the timer for the next one.
+ * @param replay The replay, whose timer fd became readable.
+ * @param budget The most datagrams injected before returning to the event loop.
+ * @param busy Tells whether the workers are behind, pausing a full speed replay. May be NULL.
+ * @param handle Injects a datagram, with the socket its message carries.
+ * @return 1 once the capture is exhausted, 0 while datagrams are left, -1 on invalid parameters.
+ */
+int sip_replay_process(sip_replay_t *replay, int budget, bool (*busy)(void),
+                       void (*handle)(const pcap_datagram_t *datagram, int socket))
+{
+    if (replay == NULL || replay->timer_fd < 0 || handle == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    uint64_t expirations;
+    if (read(replay->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+    {
+        error("Failed to read the replay timer: %s", strerror(errno));
+    }
+
+    for (int injected = 0; !replay->finished;)
+    {
+        if (!replay->has_next && !(replay->has_next = read_next(replay)))
+        {
+            replay->finished = true;
+            break;
+        }
+        uint64_t now_ns = get_monotonic_time_ns();
+        if (replay->start_ns == 0)
+        {
+            replay->start_ns = now_ns;
+            replay->first_capture_ns = replay->next.timestamp_ns;
+        }
+        if (replay->speed > 0)
+        {
+            // captures merged out of order inject late datagrams at once
+            uint64_t offset_ns = replay->next.timestamp_ns > replay->first_capture_ns ? replay->next.timestamp_ns - replay->first_capture_ns : 0;
+            uint64_t due_ns = replay->start_ns + (uint64_t)(offset_ns / replay->speed);
+            if (due_ns > now_ns)
+            {
+                arm_timer(replay, due_ns);
+                return 0;
+            }
+        }
+        else if (busy != NULL && busy())
+        {
+            replay->pauses++;
+            arm_timer(replay, now_ns + SIP_REPLAY_BACKOFF_NS);
+            return 0;
+        }
+        if (injected == budget)
+        {
+            arm_timer(replay, 0);
+            return 0;
+        }
+
+        handle(&replay->next, replay->sink_fd);
+        replay->has_next = false;
+        replay->datagrams_injected++;
+        replay->bytes_injected += replay->next.length;
+        replay->end_ns = now_ns;
+        injected++;
+    }
+    return 1;
+}
+
+/**
+ * @brief Logs the throughput of the replay and the processing cost per message measured by the workers.
+ * @param replay The finished replay.
+ * @param done_ns The monotonic time the workers were found done with the replayed messages.
+ */
+void sip_replay_report(const sip_replay_t *replay, uint64_t done_ns)
+{
+    if (replay == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    metrics_snapshot_t *snapshot = malloc(sizeof(metrics_snapshot_t));
+    if (snapshot == NULL)
+    {
+        error("Memory allocation failed");
+        return;
+    }
+    metrics_snapshot(snapshot);
+
+    double inject_seconds = (replay->end_ns - replay->start_ns) / 1e9;
+    double total_seconds = replay->start_ns > 0 && done_ns > replay->start_ns ? (done_ns - replay->start_ns) / 1e9 : 0;
+    info("Replay read %llu frames, skipped %llu that are not unfragmented UDP, filtered %llu to other ports",
+         (unsigned long long)replay->reader.frames_read, (unsigned long long)replay->reader.frames_skipped,
+         (unsigned long long)replay->datagrams_filtered);
+    info("Replay injected %llu datagrams, %llu bytes, in %.3f s, processed in %.3f s, %.1f messages/s, %llu pauses",
+         (unsigned long long)replay->datagrams_injected, (unsigned long long)replay->bytes_injected, inject_seconds,
+         total_seconds, total_seconds > 0 ? replay->datagrams_injected / total_seconds : 0.0, (unsigned long long)replay->pauses);
+
+    // receive to last response, queue wait included
+    for (int method = 0; method < METRICS_METHOD_COUNT; method++)
+    {
+        const latency_histogram_t *latency = &snapshot->total.worker.processing_latency[method];
+        uint64_t count = metrics_counter_get(&latency->count);
+        if (count > 0)
+        {
+            info("Replay %s: messages=%llu mean=%.1fus p50=%.1fus p99=%.1fus max=%.1fus", metrics_method_names[method],
+                 (unsigned long long)count, metrics_counter_get(&latency->sum) / 1e3 / count,
+                 histogram_percentile(latency, 50) / 1e3, histogram_percentile(latency, 99) / 1e3,
+                 metrics_counter_get(&latency->max) / 1e3);
+        }
+    }
+
+    // the work of the worker on each message, the discarded sends cost next to nothing
+    const latency_histogram_t *stages = snapshot->total.worker.stage_latency;
+    double cost_us[METRICS_STAGE_COUNT];
+    for (int stage = 0; stage < METRICS_STAGE_COUNT; stage++)
+    {
+        uint64_t count = metrics_counter_get(&stages[stage].count);
+        cost_us[stage] = count > 0 ? metrics_counter_get(&stages[stage].sum) / 1e3 / count : 0;
+    }
+    info("Replay cost per message: parse=%.2fus state=%.2fus send=%.2fus queue_wait=%.2fus",
+         cost_us[METRICS_STAGE_PARSE], cost_us[METRICS_STAGE_STATE], cost_us[METRICS_STAGE_SEND], cost_us[METRICS_STAGE_QUEUE_WAIT]);
+    free(snapshot);
+}
+
+/**
+ * @brief Closes the capture and the descriptors of a replay.
+ * @param replay The replay, which may have failed to initialize.
+ */
+void sip_replay_destroy(sip_replay_t *replay)
+{
+    if (replay == NULL)
+    {
+        return;
+    }
+    pcap_reader_close(&replay->reader);
+    if (replay->timer_fd >= 0)
+    {
+        close(replay->timer_fd);
+        replay->timer_fd = -1;
+    }
+    if (replay->sink_fd >= 0)
+    {
+        close(replay->sink_fd);
+        replay->sink_fd = -1;
+    }
+}
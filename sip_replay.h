@@ -0,0 +1,62 @@
+/**
+ * @file sip_replay.h
+ * @brief Header for the replay of captured SIP over UDP traffic into the server.
+ *
+ * The datagrams of a pcap or pcapng file are injected by the receiver thread into the same
+ * dispatch path as received ones, at their original pace scaled by a speed factor, or as
+ * fast as the workers keep up. Replayed messages carry a sink descriptor as their socket,
+ * so their responses are counted like sent ones and then discarded instead of reaching the
+ * addresses of the capture. Once every datagram is processed, throughput and the
+ * processing cost per message are reported from the worker metrics.
+ */
+
+#ifndef SIP_REPLAY_H
+#define SIP_REPLAY_H
+
+#include "pcap_reader.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SIP_REPLAY_MAX_QUEUE_DEPTH 256   // worker queue depth pausing a replay at full speed, below the overload levels
+#define SIP_REPLAY_BACKOFF_NS 100000     // pause of a replay at full speed waiting for the workers
+
+/**
+ * @struct sip_replay_t
+ * @brief A capture being replayed, owned by the receiver thread.
+ */
+typedef struct
+{
+    pcap_reader_t reader;
+    pcap_datagram_t next; // read ahead, injected once due
+    bool has_next;
+    bool finished;
+    double speed;         // factor of the original pace, 0 injects as fast as the workers keep up
+    uint16_t port;        // destination port of the datagrams injected, 0 injects all of them
+    int timer_fd;         // timerfd waking the receiver when the next datagram is due
+    int sink_fd;          // socket of replayed messages, responses sent on it are discarded
+    uint64_t first_capture_ns;
+    uint64_t start_ns;
+    uint64_t end_ns;      // monotonic time of the last injection
+    uint64_t datagrams_injected;
+    uint64_t bytes_injected;
+    uint64_t datagrams_filtered; // datagrams to other ports or without payload
+    uint64_t pauses;             // full speed injections paused for the workers
+} sip_replay_t;
+
+extern sip_replay_t sip_replay;
+
+int sip_replay_init(sip_replay_t *replay, const char *path, double speed, int port);
+int sip_replay_process(sip_replay_t *replay, int budget, bool (*busy)(void),
+                       void (*handle)(const pcap_datagram_t *datagram, int socket));
+void sip_replay_report(const sip_replay_t *replay, uint64_t done_ns);
+void sip_replay_destroy(sip_replay_t *replay);
+
+/**
+ * @brief Checks whether responses on a socket answer replayed messages.
+ */
+static inline bool sip_replay_is_sink(int socket)
+{
+    return socket >= 0 && socket == sip_replay.sink_fd;
+}
+
+#endif // SIP_REPLAY_H
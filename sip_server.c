@@ -6,21 +6,39 @@
 #include "sip_server.h"
 #include "sip_utils.h"
 #include "log.h"
+#include "utils.h"
+#include "sip_replay.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+
+// time spent in sendto for the message being processed by this thread
+static __thread uint64_t send_time_ns = 0;
+
+// io_uring sender or sendmmsg batch of the worker running on this thread, NULL for the receiver
+static __thread uring_sender_t *thread_sender = NULL;
+static __thread send_batch_t *thread_send_batch = NULL;
+static __thread tcp_send_batch_t *thread_tcp_batch = NULL;
+static __thread sip_capture_t *thread_capture = NULL;
+
+// control packets carry no data, so the same instance is enqueued to every worker
+static packet_type_e drain_packet = PACKET_TYPE_DRAIN;
+static packet_type_e stop_packet = PACKET_TYPE_STOP;
 
 /**
  * @brief Sends a SIP message to a specified destination and port.
  *
  * @param server_socket The socket to send the message on.
+ * @param connection The TCP connection to write the message to, 0 to send it as a datagram.
  * @param message The SIP message to be sent.
  * @param message_length The length of the SIP message.
  * @param client_addr The address of the client to send the message to.
  * @param client_addr_len The length of the client address structure.
+ * @param traced Whether the message belongs to a call selected for tracing.
  */
-int send_message(int server_socket, char *message, size_t message_length, struct sockaddr_in *client_addr, socklen_t client_addr_len)
+int send_message(int server_socket, uint64_t connection, char *message, size_t message_length, const struct sockaddr_storage *client_addr, socklen_t client_addr_len, bool traced)
 {
     if (server_socket < 0 || message == NULL || message_length == 0 || client_addr == NULL || client_addr_len == 0)
     {
@@ -28,14 +46,59 @@ int send_message(int server_socket, char *message, size_t message_length, struct
         return -1;
     }
     // TODO maybe use dedicated sender thread
-    log("Outgoing SIP message:\n<<<<<<<<<<<<<<<<<<<<<<<<<\n%.*s<<<<<<<<<<<<<<<<<<<<<<<<<\n", (int)message_length, message);
+    trace(traced, "Outgoing SIP message:\n<<<<<<<<<<<<<<<<<<<<<<<<<\n%.*s<<<<<<<<<<<<<<<<<<<<<<<<<\n", (int)message_length, message);
 
-    int rc = sendto(server_socket, message, message_length, 0, (struct sockaddr *)client_addr, client_addr_len);
+    uint64_t send_start_ns = get_monotonic_time_ns();
+    int rc;
+    if (sip_replay_is_sink(server_socket))
+    {
+        // replayed messages are answered to nobody, their responses only count
+        rc = 0;
+    }
+    else if (connection != 0)
+    {
+        // written with the other responses of the batch, one writev per connection
+        struct iovec iov = {.iov_base = message, .iov_len = message_length};
+        rc = thread_tcp_batch != NULL && message_length <= TCP_SEND_BUFFER_SIZE
+                 ? tcp_send_batch_add(thread_tcp_batch, connection, message, message_length)
+                 : tcp_transport_send(&tcp_transport, connection, &iov, 1);
+    }
+    else if (thread_sender != NULL && message_length <= URING_SEND_BUFFER_SIZE)
+    {
+        // submitted with the other responses of the batch, failures are counted on completion
+        rc = uring_sender_queue(thread_sender, server_socket, message, message_length, client_addr, client_addr_len);
+    }
+    else if (thread_send_batch != NULL && message_length <= SEND_BATCH_BUFFER_SIZE)
+    {
+        rc = send_batch_add(thread_send_batch, server_socket, message, message_length, client_addr, client_addr_len);
+    }
+    else
+    {
+        rc = sendto(server_socket, message, message_length, 0, (struct sockaddr *)client_addr, client_addr_len);
+    }
+    send_time_ns += get_monotonic_time_ns() - send_start_ns;
     if (rc < 0)
     {
+        worker_metrics_inc(send_errors);
         error("Failed to send SIP message: %s", strerror(errno));
         return -1;
     }
+    worker_metrics_inc(messages_sent);
+    worker_metrics_add(bytes_sent, message_length);
+    if (thread_capture != NULL)
+    {
+        sip_capture_sent(thread_capture, server_socket, message, message_length, client_addr);
+    }
+
+    // responses start with "SIP/2.0 " followed by the status code
+    if (message_length > sizeof(SIP_PROTOCOL_AND_VERSION) + 3 && strncmp(message, SIP_PROTOCOL_AND_VERSION, sizeof(SIP_PROTOCOL_AND_VERSION) - 1) == 0)
+    {
+        int status_code = atoi(message + sizeof(SIP_PROTOCOL_AND_VERSION));
+        if (status_code >= METRICS_STATUS_CODE_MIN && status_code < METRICS_STATUS_CODE_MIN + METRICS_STATUS_CODE_COUNT)
+        {
+            worker_metrics_inc(responses_sent[status_code - METRICS_STATUS_CODE_MIN]);
+        }
+    }
     return 0;
 }
 
@@ -65,7 +128,23 @@ void send_sip_error_response(int server_socket, sip_message_t *request, int stat
                                         (int)request->to_length, request->to,
                                         (int)request->call_id_length, request->call_id,
                                         (int)request->cseq_length, request->cseq);
-    send_message(server_socket, request->response, request->response_length, &request->client_addr, request->client_addr_len);
+    send_message(server_socket, request->connection, request->response, request->response_length, &request->client_addr, request->client_addr_len, request->trace);
+}
+
+/**
+ * @brief Records the final response of a transaction, and of its call when it answers the INVITE.
+ * @param transaction The transaction.
+ * @param status_code The status code of the final response.
+ */
+static void set_final_response_code(sip_transaction_t *transaction, int status_code)
+{
+    transaction->final_response_code = status_code;
+    // only the initial INVITE has no To tag, a re-INVITE leaves the code of the call alone
+    if (transaction->message->method_type == INVITE && transaction->message->to_tag_length == 0 &&
+        transaction->dialog != NULL && transaction->dialog->call != NULL)
+    {
+        transaction->dialog->call->final_response_code = status_code;
+    }
 }
 
 /**
@@ -93,7 +172,8 @@ int send_sip_error_response_over_transaction(int server_socket, sip_transaction_
     }
 
     char to_tag[sizeof(PARAM_NAME_TAG) + SIP_TAG_MAX_LENGTH + 8] = {0};
-    if (transaction->dialog != NULL && transaction->dialog->to_tag != NULL && strstr(request->to, transaction->dialog->to_tag) == NULL)
+    // the request carries the tag of the dialog once it is known, and the response copies its To header
+    if (transaction->dialog != NULL && request->to_tag_length == 0)
     {
         snprintf(to_tag, sizeof(to_tag), ";" PARAM_NAME_TAG "=%.*s", (int)transaction->dialog->to_tag_length, transaction->dialog->to_tag);
     }
@@ -108,8 +188,8 @@ int send_sip_error_response_over_transaction(int server_socket, sip_transaction_
                                         to_tag[0] != '\0' ? to_tag : "",
                                         (int)request->call_id_length, request->call_id,
                                         (int)request->cseq_length, request->cseq);
-    transaction->final_response_code = status_code;
-    return send_message(server_socket, request->response, request->response_length, &request->client_addr, request->client_addr_len);
+    set_final_response_code(transaction, status_code);
+    return send_message(server_socket, request->connection, request->response, request->response_length, &request->client_addr, request->client_addr_len, request->trace);
     // TODO retransmit
 }
 
@@ -137,7 +217,8 @@ int send_100_trying_response_over_transaction(int server_socket, sip_transaction
     }
 
     char to_tag[sizeof(PARAM_NAME_TAG) + SIP_TAG_MAX_LENGTH + 8] = {0};
-    if (transaction->dialog != NULL && transaction->dialog->to_tag != NULL && strstr(request->to, transaction->dialog->to_tag) == NULL)
+    // the request carries the tag of the dialog once it is known, and the response copies its To header
+    if (transaction->dialog != NULL && request->to_tag_length == 0)
     {
         snprintf(to_tag, sizeof(to_tag), ";" PARAM_NAME_TAG "=%.*s", (int)transaction->dialog->to_tag_length, transaction->dialog->to_tag);
     }
@@ -153,7 +234,7 @@ int send_100_trying_response_over_transaction(int server_socket, sip_transaction
                                         (int)request->call_id_length, request->call_id,
                                         (int)request->cseq_length, request->cseq);
     transaction->final_response_code = RESPONSE_CODE_100;
-    return send_message(server_socket, request->response, request->response_length, &request->client_addr, request->client_addr_len);
+    return send_message(server_socket, request->connection, request->response, request->response_length, &request->client_addr, request->client_addr_len, request->trace);
     // TODO retransmit
 }
 
@@ -180,7 +261,8 @@ int send_180_ring_response_over_transaction(int server_socket, sip_transaction_t
     }
 
     char to_tag[sizeof(PARAM_NAME_TAG) + SIP_TAG_MAX_LENGTH + 8] = {0};
-    if (transaction->dialog != NULL && transaction->dialog->to_tag != NULL && strstr(request->to, transaction->dialog->to_tag) == NULL)
+    // the request carries the tag of the dialog once it is known, and the response copies its To header
+    if (transaction->dialog != NULL && request->to_tag_length == 0)
     {
         snprintf(to_tag, sizeof(to_tag), ";" PARAM_NAME_TAG "=%.*s", (int)transaction->dialog->to_tag_length, transaction->dialog->to_tag);
     }
@@ -196,7 +278,7 @@ int send_180_ring_response_over_transaction(int server_socket, sip_transaction_t
                                         (int)request->call_id_length, request->call_id,
                                         (int)request->cseq_length, request->cseq);
     transaction->final_response_code = RESPONSE_CODE_180;
-    return send_message(server_socket, request->response, request->response_length, &request->client_addr, request->client_addr_len);
+    return send_message(server_socket, request->connection, request->response, request->response_length, &request->client_addr, request->client_addr_len, request->trace);
     // TODO retransmit
 }
 
@@ -223,7 +305,8 @@ int send_sip_200_ok_response_over_transaction(int server_socket, sip_transaction
     }
 
     char to_tag[sizeof(PARAM_NAME_TAG) + SIP_TAG_MAX_LENGTH + 8] = {0};
-    if (transaction->dialog != NULL && transaction->dialog->to_tag != NULL && strstr(request->to, transaction->dialog->to_tag) == NULL)
+    // the request carries the tag of the dialog once it is known, and the response copies its To header
+    if (transaction->dialog != NULL && request->to_tag_length == 0)
     {
         snprintf(to_tag, sizeof(to_tag), ";" PARAM_NAME_TAG "=%.*s", (int)transaction->dialog->to_tag_length, transaction->dialog->to_tag);
     }
@@ -238,8 +321,8 @@ int send_sip_200_ok_response_over_transaction(int server_socket, sip_transaction
                                         to_tag[0] != '\0' ? to_tag : "",
                                         (int)request->call_id_length, request->call_id,
                                         (int)request->cseq_length, request->cseq);
-    transaction->final_response_code = RESPONSE_CODE_200;
-    return send_message(server_socket, request->response, request->response_length, &request->client_addr, request->client_addr_len);
+    set_final_response_code(transaction, RESPONSE_CODE_200);
+    return send_message(server_socket, request->connection, request->response, request->response_length, &request->client_addr, request->client_addr_len, request->trace);
     // TODO retransmit
 }
 
@@ -265,28 +348,71 @@ int send_last_response_over_transaction(int server_socket, sip_transaction_t *tr
         error("Transaction has no associated request message");
         return -1;
     }
-    return send_message(server_socket, request->response, request->response_length, &request->client_addr, request->client_addr_len);
+    return send_message(server_socket, request->connection, request->response, request->response_length, &request->client_addr, request->client_addr_len, request->trace);
     // TODO retransmit
 }
 
 /**
- * @brief Checks if two sockaddr_in structures are equal.
+ * @brief Answers a ringing INVITE with 200 OK, confirming its dialog and establishing its call.
  *
- * @param a Pointer to the first sockaddr_in structure.
- * @param b Pointer to the second sockaddr_in structure.
- * @return 0 if the structures are equal, -1 otherwise.
+ * @param transaction The INVITE transaction, with its dialog and call.
  */
-int sockaddr_in_equal(const struct sockaddr_in *a, const struct sockaddr_in *b)
+static void answer_invite_request(sip_transaction_t *transaction)
 {
-    if (a == NULL || b == NULL)
-        return -1;
-    if (a->sin_family != b->sin_family)
-        return -1;
-    if (a->sin_port != b->sin_port)
-        return -1;
-    if (a->sin_addr.s_addr != b->sin_addr.s_addr)
-        return -1;
-    return 0;
+    sip_dialog_t *dialog = transaction->dialog;
+    sip_call_t *call = dialog->call;
+    if (send_sip_200_ok_response_over_transaction(transaction->message->socket, transaction) != 0)
+    {
+        error("Failed to send 200 OK response");
+        send_sip_error_response_over_transaction(transaction->message->socket, transaction, RESPONSE_CODE_500, RESPONSE_TEXT_500_INTERNAL_SERVER_ERROR);
+        set_transaction_state(transaction, SIP_TRANSACTION_STATE_COMPLETED);
+        set_dialog_state(dialog, SIP_DIALOG_STATE_TERMINATED);
+        set_call_state(call, SIP_CALL_STATE_FAILED);
+        return;
+    }
+    set_transaction_state(transaction, SIP_TRANSACTION_STATE_TERMINATED);
+    set_dialog_state(dialog, SIP_DIALOG_STATE_CONFIRMED);
+    set_call_state(call, SIP_CALL_STATE_ESTABLISHED);
+}
+
+/**
+ * @brief Processes a re-INVITE or an UPDATE within an existing dialog, such as the session refresh of a session timer.
+ *
+ * The dialog and call found for the request are reused as they are, the request only refreshes
+ * their activity time and gets a 200 OK carrying the To tag it already has. No session timer
+ * is negotiated, so the client refreshes at the interval it chose.
+ *
+ * @param worker The SIP server worker thread.
+ * @param transaction The transaction of the request, with its dialog.
+ */
+static void process_session_refresh(worker_thread_t *worker, sip_transaction_t *transaction)
+{
+    sip_message_t *request = transaction->message;
+    sip_dialog_t *dialog = transaction->dialog;
+    log("Processing SIP %s within a dialog", request->method);
+
+    if (dialog->state == SIP_DIALOG_STATE_TERMINATED || dialog->call == NULL)
+    {
+        send_sip_error_response_over_transaction(request->socket, transaction, RESPONSE_CODE_481, RESPONSE_TEXT_481_CALL_TRANSACTION_DOES_NOT_EXIST);
+    }
+    else if (dialog->state != SIP_DIALOG_STATE_CONFIRMED && request->method_type == INVITE)
+    {
+        // the initial INVITE of the dialog has no final response yet, an UPDATE may still refresh an early dialog
+        send_sip_error_response_over_transaction(request->socket, transaction, RESPONSE_CODE_491, RESPONSE_TEXT_491_REQUEST_PENDING);
+    }
+    else if (send_sip_200_ok_response_over_transaction(request->socket, transaction) != 0)
+    {
+        error("Failed to send 200 OK response");
+        send_sip_error_response_over_transaction(request->socket, transaction, RESPONSE_CODE_500, RESPONSE_TEXT_500_INTERNAL_SERVER_ERROR);
+    }
+    else
+    {
+        worker_metrics_inc(session_refreshes);
+    }
+    // the ACK of a 2xx to a re-INVITE is a transaction of its own, as for the initial INVITE
+    set_transaction_state(transaction, request->method_type == INVITE && transaction->final_response_code > RESPONSE_CODE_SUCCESS_END
+                                           ? SIP_TRANSACTION_STATE_COMPLETED
+                                           : SIP_TRANSACTION_STATE_TERMINATED);
 }
 
 /**
@@ -308,10 +434,18 @@ void process_invite_request(worker_thread_t *worker, sip_transaction_t *transact
     if (transaction->dialog == NULL)
     { // new INVITE request
 
-        if (send_100_trying_response_over_transaction(worker->server_socket, transaction) != 0)
+        if (request->to_tag_length > 0)
+        {
+            // a re-INVITE whose dialog is gone, it must not start a new call
+            send_sip_error_response_over_transaction(transaction->message->socket, transaction, RESPONSE_CODE_481, RESPONSE_TEXT_481_CALL_TRANSACTION_DOES_NOT_EXIST);
+            set_transaction_state(transaction, SIP_TRANSACTION_STATE_COMPLETED);
+            return;
+        }
+
+        if (send_100_trying_response_over_transaction(transaction->message->socket, transaction) != 0)
         {
             error("Failed to send 100 Trying response");
-            send_sip_error_response_over_transaction(worker->server_socket, transaction, RESPONSE_CODE_500, RESPONSE_TEXT_500_INTERNAL_SERVER_ERROR);
+            send_sip_error_response_over_transaction(transaction->message->socket, transaction, RESPONSE_CODE_500, RESPONSE_TEXT_500_INTERNAL_SERVER_ERROR);
             set_transaction_state(transaction, SIP_TRANSACTION_STATE_COMPLETED);
             return;
         }
@@ -322,7 +456,7 @@ void process_invite_request(worker_thread_t *worker, sip_transaction_t *transact
         if (dialog == NULL)
         {
             error("Failed to create new SIP dialog");
-            send_sip_error_response_over_transaction(worker->server_socket, transaction, RESPONSE_CODE_500, RESPONSE_TEXT_500_INTERNAL_SERVER_ERROR);
+            send_sip_error_response_over_transaction(transaction->message->socket, transaction, RESPONSE_CODE_500, RESPONSE_TEXT_500_INTERNAL_SERVER_ERROR);
             set_transaction_state(transaction, SIP_TRANSACTION_STATE_COMPLETED);
             return;
         }
@@ -330,12 +464,11 @@ void process_invite_request(worker_thread_t *worker, sip_transaction_t *transact
         set_transaction_dialog(transaction, dialog);
         set_dialog_state(dialog, SIP_DIALOG_STATE_EARLY);
 
-        // TODO check if call exists, it would be re-INVITE
         sip_call_t *call = create_new_call(&worker->calls, request->call_id, request->call_id_length);
         if (call == NULL)
         {
             error("Failed to create new SIP call");
-            send_sip_error_response_over_transaction(worker->server_socket, transaction, RESPONSE_CODE_500, RESPONSE_TEXT_500_INTERNAL_SERVER_ERROR);
+            send_sip_error_response_over_transaction(transaction->message->socket, transaction, RESPONSE_CODE_500, RESPONSE_TEXT_500_INTERNAL_SERVER_ERROR);
             set_transaction_state(transaction, SIP_TRANSACTION_STATE_COMPLETED);
             set_dialog_state(dialog, SIP_DIALOG_STATE_TERMINATED);
             return;
@@ -344,10 +477,10 @@ void process_invite_request(worker_thread_t *worker, sip_transaction_t *transact
         set_dialog_call(dialog, call);
         set_call_state(call, SIP_CALL_STATE_INCOMING);
 
-        if (send_180_ring_response_over_transaction(worker->server_socket, transaction) != 0)
+        if (send_180_ring_response_over_transaction(transaction->message->socket, transaction) != 0)
         {
             error("Failed to send 180 Ringing response");
-            send_sip_error_response_over_transaction(worker->server_socket, transaction, RESPONSE_CODE_500, RESPONSE_TEXT_500_INTERNAL_SERVER_ERROR);
+            send_sip_error_response_over_transaction(transaction->message->socket, transaction, RESPONSE_CODE_500, RESPONSE_TEXT_500_INTERNAL_SERVER_ERROR);
             set_transaction_state(transaction, SIP_TRANSACTION_STATE_COMPLETED);
             set_dialog_state(dialog, SIP_DIALOG_STATE_TERMINATED);
             set_call_state(call, SIP_CALL_STATE_FAILED);
@@ -355,23 +488,20 @@ void process_invite_request(worker_thread_t *worker, sip_transaction_t *transact
         }
 
         set_call_state(call, SIP_CALL_STATE_RINGING);
-        // TODO to simulate call setup delay, send 200 OK after a short delay in a timer logic
-        if (send_sip_200_ok_response_over_transaction(worker->server_socket, transaction) != 0)
+        if (worker->answer_delay_ms > 0)
         {
-            error("Failed to send 200 OK response");
-            send_sip_error_response_over_transaction(worker->server_socket, transaction, RESPONSE_CODE_500, RESPONSE_TEXT_500_INTERNAL_SERVER_ERROR);
-            set_transaction_state(transaction, SIP_TRANSACTION_STATE_COMPLETED);
-            set_dialog_state(dialog, SIP_DIALOG_STATE_TERMINATED);
-            set_call_state(call, SIP_CALL_STATE_FAILED);
-            return;
+            // answered when the delay has passed, unless a CANCEL ends the transaction first
+            if (schedule_transaction_answer(transaction, worker->answer_delay_ms) == 0)
+            {
+                return;
+            }
+            error("Failed to schedule the answer, answering at once");
         }
-        set_transaction_state(transaction, SIP_TRANSACTION_STATE_TERMINATED);
-        set_dialog_state(dialog, SIP_DIALOG_STATE_CONFIRMED);
-        set_call_state(call, SIP_CALL_STATE_ESTABLISHED);
+        answer_invite_request(transaction);
     }
     else
     {
-        // TODO re-INVITE
+        process_session_refresh(worker, transaction);
     }
 }
 
@@ -425,26 +555,124 @@ void process_bye_request(worker_thread_t *worker, sip_transaction_t *transaction
 
     if (transaction->dialog == NULL || transaction->dialog->call == NULL)
     {
-        send_sip_error_response_over_transaction(worker->server_socket, transaction, RESPONSE_CODE_404, RESPONSE_TEXT_404_NOT_FOUND);
+        send_sip_error_response_over_transaction(transaction->message->socket, transaction, RESPONSE_CODE_404, RESPONSE_TEXT_404_NOT_FOUND);
         goto cleanup;
     }
 
     if (transaction->dialog->state == SIP_DIALOG_STATE_CONFIRMED)
     {
         set_call_state(transaction->dialog->call, SIP_CALL_STATE_TERMINATING);
-        send_sip_200_ok_response_over_transaction(worker->server_socket, transaction);
+        send_sip_200_ok_response_over_transaction(transaction->message->socket, transaction);
         set_call_state(transaction->dialog->call, SIP_CALL_STATE_TERMINATED);
         set_dialog_state(transaction->dialog, SIP_DIALOG_STATE_TERMINATED);
     }
     else
     {
-        send_sip_error_response_over_transaction(worker->server_socket, transaction, RESPONSE_CODE_403, RESPONSE_TEXT_403_FORBIDDEN);
+        send_sip_error_response_over_transaction(transaction->message->socket, transaction, RESPONSE_CODE_403, RESPONSE_TEXT_403_FORBIDDEN);
     }
 
 cleanup:
     set_transaction_state(transaction, SIP_TRANSACTION_STATE_TERMINATED);
 }
 
+/**
+ * @brief Processes a SIP UPDATE request.
+ *
+ * @param worker The SIP server worker thread.
+ * @param transaction The SIP transaction associated with the request.
+ */
+void process_update_request(worker_thread_t *worker, sip_transaction_t *transaction)
+{
+    if (worker == NULL || transaction == NULL || transaction->message == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    log("Processing SIP UPDATE request");
+
+    if (transaction->dialog == NULL)
+    {
+        send_sip_error_response_over_transaction(transaction->message->socket, transaction, RESPONSE_CODE_481, RESPONSE_TEXT_481_CALL_TRANSACTION_DOES_NOT_EXIST);
+        set_transaction_state(transaction, SIP_TRANSACTION_STATE_TERMINATED);
+        return;
+    }
+    process_session_refresh(worker, transaction);
+}
+
+/**
+ * @brief Sends the 200 OK response to a CANCEL, with the To tag of the dialog of the INVITE.
+ *
+ * @param server_socket The socket to send the response on.
+ * @param request The CANCEL, its response buffer is used to build the response.
+ * @param dialog The dialog of the cancelled INVITE, NULL if it has none.
+ * @return 0 on success, -1 on failure.
+ */
+static int send_cancel_response(int server_socket, sip_message_t *request, const sip_dialog_t *dialog)
+{
+    char to_tag[sizeof(PARAM_NAME_TAG) + SIP_TAG_MAX_LENGTH + 8] = {0};
+    if (dialog != NULL && request->to_tag_length == 0)
+    {
+        snprintf(to_tag, sizeof(to_tag), ";" PARAM_NAME_TAG "=%.*s", (int)dialog->to_tag_length, dialog->to_tag);
+    }
+
+    request->response_length = snprintf(request->response, sizeof(request->response),
+                                        SIP_PROTOCOL_AND_VERSION " %d " RESPONSE_TEXT_200_OK "\r\n" HEADER_NAME_VIA ": %.*s\r\n" HEADER_NAME_FROM ": %.*s\r\n" HEADER_NAME_TO ": %.*s%s\r\n" HEADER_NAME_CALL_ID ": %.*s\r\n" HEADER_NAME_CSEQ ": %.*s\r\n" HEADER_NAME_CONTENT_LENGTH ": 0\r\n"
+                                                                 "\r\n",
+                                        RESPONSE_CODE_200,
+                                        (int)request->via_length, request->via,
+                                        (int)request->from_length, request->from,
+                                        (int)request->to_length, request->to,
+                                        to_tag,
+                                        (int)request->call_id_length, request->call_id,
+                                        (int)request->cseq_length, request->cseq);
+    return send_message(server_socket, request->connection, request->response, request->response_length, &request->client_addr, request->client_addr_len, request->trace);
+}
+
+/**
+ * @brief Processes a SIP CANCEL request matching a pending INVITE transaction.
+ *
+ * The CANCEL is answered at once and not kept, a retransmitted CANCEL is simply answered again.
+ * An INVITE without a final response yet is answered with 487, which ends its dialog and call.
+ *
+ * @param worker The SIP server worker thread.
+ * @param transaction The INVITE transaction the CANCEL has the branch of.
+ * @param message The CANCEL.
+ */
+void process_cancel_request(worker_thread_t *worker, sip_transaction_t *transaction, sip_message_t *message)
+{
+    if (worker == NULL || transaction == NULL || transaction->message == NULL || message == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    log("Processing SIP CANCEL request");
+
+    if (send_cancel_response(message->socket, message, transaction->dialog) != 0)
+    {
+        error("Failed to send 200 OK response to CANCEL");
+    }
+    if (transaction->state == SIP_TRANSACTION_STATE_PROCEEDING)
+    {
+        worker_metrics_inc(invites_cancelled);
+        send_sip_error_response_over_transaction(transaction->message->socket, transaction, RESPONSE_CODE_487, RESPONSE_TEXT_487_REQUEST_TERMINATED);
+        set_transaction_state(transaction, SIP_TRANSACTION_STATE_COMPLETED);
+        if (transaction->dialog != NULL)
+        {
+            if (transaction->dialog->call != NULL)
+            {
+                set_call_state(transaction->dialog->call, SIP_CALL_STATE_FAILED);
+            }
+            set_dialog_state(transaction->dialog, SIP_DIALOG_STATE_TERMINATED);
+        }
+    }
+    else
+    {
+        // the final response of the INVITE went out first, the call goes on and ends with a BYE
+        log("CANCEL after the final response to the INVITE");
+    }
+    cleanup_sip_message(message);
+}
+
 /**
  * @brief Processes a SIP request message.
  *
@@ -466,7 +694,7 @@ void process_sip_request(worker_thread_t *worker, sip_message_t *message)
         if (transaction == NULL)
         {
             error("Failed to create new SIP transaction");
-            send_sip_error_response(worker->server_socket, message, RESPONSE_CODE_500, RESPONSE_TEXT_500_INTERNAL_SERVER_ERROR);
+            send_sip_error_response(message->socket, message, RESPONSE_CODE_500, RESPONSE_TEXT_500_INTERNAL_SERVER_ERROR);
             cleanup_sip_message(message);
             return;
         }
@@ -478,7 +706,7 @@ void process_sip_request(worker_thread_t *worker, sip_message_t *message)
     {
         if (message->cseq_length != transaction->message->cseq_length ||
             strncmp(message->cseq, transaction->message->cseq, message->cseq_length) != 0 ||
-            sockaddr_in_equal(&message->client_addr, &transaction->message->client_addr) != 0)
+            !sockaddr_equal(&message->client_addr, &transaction->message->client_addr))
         {
             log("Received message is different than existing transaction message.");
             if (transaction->message->method_type == INVITE && message->method_type == ACK)
@@ -486,6 +714,12 @@ void process_sip_request(worker_thread_t *worker, sip_message_t *message)
                 log("ACK for INVITE");
                 transaction->ack_message = message;
             }
+            else if (transaction->message->method_type == INVITE && message->method_type == CANCEL)
+            {
+                // a CANCEL carries the branch of the INVITE it cancels, so the lookup found the INVITE
+                process_cancel_request(worker, transaction, message);
+                return;
+            }
             else
             {
                 error("New request for existing transaction branch id");
@@ -495,10 +729,11 @@ void process_sip_request(worker_thread_t *worker, sip_message_t *message)
         }
         else
         {
-            if (send_last_response_over_transaction(worker->server_socket, transaction) != 0)
+            worker_metrics_inc(retransmissions_absorbed);
+            if (send_last_response_over_transaction(transaction->message->socket, transaction) != 0)
             {
                 error("Failed to resend last response over transaction");
-                send_sip_error_response_over_transaction(worker->server_socket, transaction, RESPONSE_CODE_500, RESPONSE_TEXT_500_INTERNAL_SERVER_ERROR);
+                send_sip_error_response_over_transaction(transaction->message->socket, transaction, RESPONSE_CODE_500, RESPONSE_TEXT_500_INTERNAL_SERVER_ERROR);
             }
             cleanup_sip_message(message);
             return;
@@ -523,10 +758,17 @@ void process_sip_request(worker_thread_t *worker, sip_message_t *message)
         return process_ack_request(worker, transaction);
     case BYE:
         return process_bye_request(worker, transaction);
+    case UPDATE:
+        return process_update_request(worker, transaction);
+    case CANCEL:
+        // no pending INVITE has the branch of the CANCEL
+        send_sip_error_response_over_transaction(transaction->message->socket, transaction, RESPONSE_CODE_481, RESPONSE_TEXT_481_CALL_TRANSACTION_DOES_NOT_EXIST);
+        set_transaction_state(transaction, SIP_TRANSACTION_STATE_TERMINATED);
+        break;
     default:
         // TODO other methods
         error("Unsupported SIP method: %s", message->method);
-        send_sip_error_response_over_transaction(worker->server_socket, transaction, RESPONSE_CODE_501, RESPONSE_TEXT_501_NOT_IMPLEMENTED);
+        send_sip_error_response_over_transaction(transaction->message->socket, transaction, RESPONSE_CODE_501, RESPONSE_TEXT_501_NOT_IMPLEMENTED);
         set_transaction_state(transaction, SIP_TRANSACTION_STATE_TERMINATED);
     }
 }
@@ -561,7 +803,7 @@ void process_sip_response(worker_thread_t *worker, sip_message_t *message)
  * @param worker The SIP server worker thread.
  * @param event The transaction delete event.
  */
-void delete_transaction(worker_thread_t *worker, transaction_delete_t *event)
+void delete_transaction(worker_thread_t *worker, transaction_event_t *event)
 {
     if (worker == NULL || event == NULL)
     {
@@ -586,16 +828,171 @@ void delete_transaction(worker_thread_t *worker, transaction_delete_t *event)
     {
         sip_call_t *call = dialog->call;
         log("Deleting dialog: %.*s %.*s", (int)dialog->from_tag_length, dialog->from_tag, (int)dialog->to_tag_length, dialog->to_tag);
+        sip_reaper_forget_dialog(&worker->reaper, dialog);
         delete_dialog_by_pointer(&(worker->dialogs), dialog);
 
-        if (call != NULL && call->state == SIP_CALL_STATE_TERMINATED)
+        if (call != NULL && (call->state == SIP_CALL_STATE_TERMINATED || call->state == SIP_CALL_STATE_FAILED))
         {
             log("Deleting call: %.*s", (int)call->call_id_length, call->call_id);
+            sip_reaper_forget_call(&worker->reaper, call);
             delete_call_by_pointer(&(worker->calls), call);
         }
     }
 }
 
+/**
+ * @brief Answers an INVITE whose answer delay has passed, unless a CANCEL ended it before.
+ *
+ * @param worker The SIP server worker thread.
+ * @param event The answer event of the transaction.
+ */
+static void answer_delayed_invite(worker_thread_t *worker, transaction_event_t *event)
+{
+    sip_transaction_t *transaction = worker->transactions ? find_transaction_by_id(worker->transactions, event->branch, event->branch_length) : NULL;
+    if (transaction == NULL || transaction->state != SIP_TRANSACTION_STATE_PROCEEDING || transaction->message->method_type != INVITE ||
+        transaction->dialog == NULL || transaction->dialog->call == NULL)
+    {
+        log("INVITE %.*s was answered before its answer delay passed", (int)event->branch_length, event->branch);
+        return;
+    }
+    if (worker->capture != NULL)
+    {
+        // the answer belongs to the INVITE, not to the message the worker took last
+        sip_capture_select(worker->capture, transaction->message);
+    }
+    answer_invite_request(transaction);
+}
+
+/**
+ * @brief Records the latency stages a message went through before the worker dequeued it,
+ * and updates the average queue delay of the worker.
+ * @param worker The worker thread.
+ * @param message The dequeued message.
+ * @param dequeue_time_ns The monotonic time the message was dequeued.
+ */
+static void record_receive_stages(worker_thread_t *worker, const sip_message_t *message, uint64_t dequeue_time_ns)
+{
+    if (message->dispatch_time_ns != 0)
+    {
+        // moving average over about 8 messages, the admission controller reacts within a burst
+        uint64_t sample = dequeue_time_ns - message->dispatch_time_ns;
+        uint64_t average = atomic_load_explicit(&worker->queue_delay_ns, memory_order_relaxed);
+        atomic_store_explicit(&worker->queue_delay_ns, average - average / 8 + sample / 8, memory_order_relaxed);
+    }
+    if (worker->metrics == NULL)
+    {
+        return;
+    }
+    latency_histogram_t *stages = worker->metrics->worker.stage_latency;
+    if (message->kernel_receive_time_ns != 0)
+    {
+        histogram_record(&stages[METRICS_STAGE_SOCKET_WAIT], message->receive_time_ns - message->kernel_receive_time_ns);
+    }
+    if (message->dispatch_time_ns != 0)
+    {
+        histogram_record(&stages[METRICS_STAGE_DISPATCH], message->dispatch_time_ns - message->receive_time_ns);
+        histogram_record(&stages[METRICS_STAGE_QUEUE_WAIT], dequeue_time_ns - message->dispatch_time_ns);
+    }
+}
+
+/**
+ * @brief Publishes whether the worker still has transactions, and wakes up the receiver
+ * when the last one is gone.
+ * @param worker The draining worker.
+ */
+static void report_drain_progress(worker_thread_t *worker)
+{
+    bool drained = worker->transactions == NULL && get_message_queue_depth(&worker->queue) == 0;
+    if (drained && !atomic_exchange(&worker->drained, true))
+    {
+        uint64_t one = 1;
+        if (write(worker->drain_eventfd, &one, sizeof(one)) < 0)
+        {
+            error("Failed to report drain progress: %s", strerror(errno));
+        }
+    }
+    else if (!drained)
+    {
+        atomic_store(&worker->drained, false);
+    }
+}
+
+/**
+ * @brief Sends the responses batched by the worker and counts the failed ones.
+ * @param worker The worker.
+ * @param wait_count The number of io_uring completions to wait for.
+ */
+static void flush_sends(worker_thread_t *worker, unsigned wait_count)
+{
+    int failures = 0;
+    if (worker->sender != NULL)
+    {
+        failures = uring_sender_flush(worker->sender, wait_count);
+    }
+    else if (worker->send_batch != NULL)
+    {
+        failures = send_batch_flush(worker->send_batch);
+    }
+    if (worker->tcp_batch != NULL)
+    {
+        failures += tcp_send_batch_flush(worker->tcp_batch);
+    }
+    if (failures > 0)
+    {
+        worker_metrics_add(send_errors, failures);
+    }
+}
+
+/**
+ * @brief Enqueues a control packet, waiting for room when the lane is full.
+ */
+static void enqueue_control_packet(worker_thread_t *worker, packet_type_e *packet, message_queue_lane_t lane)
+{
+    while (!enqueue_message_to_lane(&worker->queue, packet, lane))
+    {
+        usleep(1000);
+    }
+}
+
+/**
+ * @brief Tells a worker that the server is shutting down. The worker keeps processing
+ * messages and sets drained once it has no transaction left.
+ * @param worker The worker.
+ * @return 0 on success, -1 on invalid parameters.
+ */
+int sip_worker_start_drain(worker_thread_t *worker)
+{
+    if (worker == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    enqueue_control_packet(worker, &drain_packet, MESSAGE_QUEUE_LANE_PRIORITY);
+    return 0;
+}
+
+/**
+ * @brief Stops a worker after the messages already queued to it, and joins its thread.
+ * @param worker The worker.
+ * @return 0 on success, -1 on failure.
+ */
+int sip_worker_stop(worker_thread_t *worker)
+{
+    if (worker == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    // queued behind the new requests, so the worker answers them before exiting
+    enqueue_control_packet(worker, &stop_packet, MESSAGE_QUEUE_LANE_NORMAL);
+    if (pthread_join(worker->thread, NULL) != 0)
+    {
+        error("Failed to join worker thread");
+        return -1;
+    }
+    return 0;
+}
+
 /**
  * @brief Worker thread function to process SIP messages. Parses and processes incoming SIP messages.
  * @param arg Pointer to the worker thread's message queue.
@@ -612,11 +1009,21 @@ void *process_sip_messages(void *arg)
     message_queue_t *queue = &worker->queue;
     void *packet;
 
+    thread_worker_metrics = worker->metrics;
+    thread_sender = worker->sender;
+    thread_send_batch = worker->send_batch;
+    thread_tcp_batch = worker->tcp_batch;
+    thread_capture = worker->capture;
+    thread_cdr_ring = worker->cdr;
+    bool draining = false;
+
     while (1)
     {
-        if (dequeue_message(queue, &packet))
+        if (dequeue_message_timeout(queue, &packet, SIP_REAPER_WAKEUP_INTERVAL))
         {
+            uint64_t dequeue_time_ns = get_monotonic_time_ns();
             packet_type_e packet_type = *((packet_type_e *)packet);
+            worker_metrics_inc(packets_processed);
 
             switch (packet_type)
             {
@@ -624,34 +1031,91 @@ void *process_sip_messages(void *arg)
 
                 // Process the SIP message here
                 sip_message_t *message = (sip_message_t *)packet;
-                log("Incoming SIP message:\n>>>>>>>>>>>>>>>>>>>>>>>>>\n%s>>>>>>>>>>>>>>>>>>>>>>>>>\n", message->buffer);
+                if (worker->capture != NULL)
+                {
+                    sip_capture_received(worker->capture, message);
+                }
+                trace(message->trace, "Incoming SIP message:\n>>>>>>>>>>>>>>>>>>>>>>>>>\n%s>>>>>>>>>>>>>>>>>>>>>>>>>\n", message->buffer);
+                record_receive_stages(worker, message, dequeue_time_ns);
 
+                uint64_t parse_start_ns = get_monotonic_time_ns();
                 sip_msg_error_t err = parse_message(message);
+                uint64_t parse_end_ns = get_monotonic_time_ns();
                 if (err != ERROR_NONE)
                 {
+                    worker_metrics_inc(parse_errors[err]);
                     error("Failed to parse SIP message: %d", err);
                     cleanup_sip_message(message);
                     break;
                 }
 
+                // the message may be freed while it is processed
+                sip_method_t method = message->method_type;
+                uint64_t receive_time_ns = message->receive_time_ns;
+                send_time_ns = 0;
                 if (message->is_request)
                 {
+                    worker_metrics_inc(requests_received[method]);
                     process_sip_request(worker, message);
                 }
                 else
                 {
+                    worker_metrics_inc(responses_received);
                     process_sip_response(worker, message);
                 }
+                if (worker->metrics != NULL)
+                {
+                    uint64_t end_ns = get_monotonic_time_ns();
+                    histogram_record(&worker->metrics->worker.processing_latency[method], end_ns - receive_time_ns);
+                    histogram_record(&worker->metrics->worker.stage_latency[METRICS_STAGE_PARSE], parse_end_ns - parse_start_ns);
+                    histogram_record(&worker->metrics->worker.stage_latency[METRICS_STAGE_STATE], end_ns - parse_end_ns - send_time_ns);
+                    if (send_time_ns > 0)
+                    {
+                        histogram_record(&worker->metrics->worker.stage_latency[METRICS_STAGE_SEND], send_time_ns);
+                    }
+                }
                 break;
             case PACKET_TYPE_DELETE_TRANSACTION:
-                transaction_delete_t *event = (transaction_delete_t *)packet;
+                transaction_event_t *event = (transaction_event_t *)packet;
+                worker_metrics_inc(timer_events_processed);
                 delete_transaction(worker, event);
                 free(event);
                 break;
+            case PACKET_TYPE_ANSWER_INVITE:
+                transaction_event_t *answer = (transaction_event_t *)packet;
+                worker_metrics_inc(timer_events_processed);
+                answer_delayed_invite(worker, answer);
+                free(answer);
+                break;
+            case PACKET_TYPE_DRAIN:
+                draining = true;
+                break;
+            case PACKET_TYPE_STOP:
+                // the priority burst limit can take the stop packet before the priority lane is empty,
+                // nothing else enqueues at this point, so there is room behind the messages left
+                if (get_message_queue_depth(queue) > 0)
+                {
+                    enqueue_message_to_lane(queue, packet, MESSAGE_QUEUE_LANE_NORMAL);
+                    break;
+                }
+                flush_sends(worker, worker->sender != NULL ? worker->sender->pending + worker->sender->in_flight : 0);
+                return NULL;
             default:
                 break;
             }
         }
+
+        // responses wait for a batch while more messages are queued, never while the worker sleeps
+        if ((worker->sender != NULL && worker->sender->pending >= URING_SEND_BATCH) || get_message_queue_depth(queue) == 0)
+        {
+            flush_sends(worker, 0);
+        }
+
+        sip_reaper_step(&worker->reaper, &worker->calls, &worker->dialogs, get_monotonic_time_ms());
+        if (draining)
+        {
+            report_drain_progress(worker);
+        }
     }
 
     return NULL;
@@ -7,8 +7,16 @@
 #define SIP_SERVER_H
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include "message_queue.h"
 #include "sip_utils.h"
+#include "sip_reaper.h"
+#include "metrics.h"
+#include "uring.h"
+#include "send_batch.h"
+#include "tcp_transport.h"
+#include "sip_capture.h"
+#include "sip_cdr.h"
 
 /**
  * @struct worker_thread_t
@@ -21,9 +29,22 @@ typedef struct
     sip_call_t *calls;               // TODO hash map for calls
     sip_dialog_t *dialogs;           // TODO hash map for dialogs
     sip_transaction_t *transactions; // TODO hash map for transactions
-    int server_socket;               // TODO maybe need to implement dedicated sender thread
+    uring_sender_t *sender;          // batches the responses with io_uring, NULL sends with sendto
+    send_batch_t *send_batch;        // batches the responses with sendmmsg and UDP GSO when there is no sender
+    tcp_send_batch_t *tcp_batch;     // batches the responses to TCP connections, NULL writes each at once
+    sip_capture_t *capture;          // pcap capture of the sampled calls, NULL when capture is off
+    sip_cdr_ring_t *cdr;             // call detail records queued to the writer thread, NULL when they are off
+    sip_reaper_t reaper;
+    int answer_delay_ms;             // time from the 180 Ringing to the 200 OK of an INVITE, 0 answers at once
+    worker_metrics_t *metrics;
+    atomic_uint_fast64_t queue_delay_ns; // moving average of the queue wait, read by the receiver
+    int drain_eventfd;                   // written when the worker runs out of transactions while draining
+    atomic_bool drained;                 // no transaction left since the drain started
 } worker_thread_t;
 
 void *process_sip_messages(void *arg);
+int sip_worker_start_drain(worker_thread_t *worker);
+int sip_worker_stop(worker_thread_t *worker);
+int send_message(int server_socket, uint64_t connection, char *message, size_t message_length, const struct sockaddr_storage *client_addr, socklen_t client_addr_len, bool traced);
 
 #endif // SIP_SERVER_H
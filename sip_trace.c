@@ -0,0 +1,220 @@
+/**
+ * @file sip_trace.c
+ * @brief Implementation of per call debug tracing, selected by Call-ID or source address.
+ *
+ * Messages are matched once in the receiver thread, which also owns the trace selection,
+ * and carry the result in sip_message_t.trace. Only traced messages pay for the full
+ * message dumps when the runtime log level is below debug. The selections given on the
+ * command line and those loaded from the trace file are kept apart, so reloading the file
+ * never loses the command line ones.
+ */
+
+#include "sip_trace.h"
+#include "sip_message.h"
+#include "log.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+
+typedef struct
+{
+    char call_id[SIP_CALL_ID_MAX_LENGTH + 1];
+    size_t call_id_length;
+} sip_trace_call_id_t;
+
+typedef struct
+{
+    struct sockaddr_storage address; // a port of 0 matches any port
+} sip_trace_source_t;
+
+typedef struct
+{
+    sip_trace_call_id_t call_ids[SIP_TRACE_MAX_CALL_IDS];
+    size_t call_id_count;
+    sip_trace_source_t sources[SIP_TRACE_MAX_SOURCES];
+    size_t source_count;
+} sip_trace_set_t;
+
+static sip_trace_set_t command_line_set; // kept for the whole run
+static sip_trace_set_t file_set;         // replaced by every load of the trace file
+
+/**
+ * @brief Adds a Call-ID to a trace selection.
+ * @return 0 on success, -1 on failure.
+ */
+static int add_call_id(sip_trace_set_t *set, const char *call_id, size_t call_id_length)
+{
+    if (call_id == NULL || call_id_length == 0 || call_id_length > SIP_CALL_ID_MAX_LENGTH)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    if (set->call_id_count == SIP_TRACE_MAX_CALL_IDS)
+    {
+        error("Too many traced Call-IDs");
+        return -1;
+    }
+    sip_trace_call_id_t *entry = &set->call_ids[set->call_id_count];
+    memcpy(entry->call_id, call_id, call_id_length);
+    entry->call_id[call_id_length] = '\0';
+    entry->call_id_length = call_id_length;
+    set->call_id_count++;
+    info("Tracing Call-ID: %.*s", (int)call_id_length, call_id);
+    return 0;
+}
+
+/**
+ * @brief Adds a source address to a trace selection.
+ * @return 0 on success, -1 on failure.
+ */
+static int add_source(sip_trace_set_t *set, const char *source)
+{
+    if (source == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    if (set->source_count == SIP_TRACE_MAX_SOURCES)
+    {
+        error("Too many traced sources");
+        return -1;
+    }
+    sip_trace_source_t *entry = &set->sources[set->source_count];
+    if (parse_socket_address(source, 0, &entry->address) == 0)
+    {
+        error("Invalid trace source: %s", source);
+        return -1;
+    }
+    sockaddr_unmap(&entry->address);
+    set->source_count++;
+    info("Tracing source: %s", source);
+    return 0;
+}
+
+/**
+ * @brief Adds a Call-ID to trace for the whole run, a reload of the trace file keeps it.
+ * @param call_id The Call-ID.
+ * @param call_id_length The length of the Call-ID.
+ * @return 0 on success, -1 on failure.
+ */
+int sip_trace_add_call_id(const char *call_id, size_t call_id_length)
+{
+    return add_call_id(&command_line_set, call_id, call_id_length);
+}
+
+/**
+ * @brief Adds a source address to trace for the whole run, a reload of the trace file keeps it.
+ * @param source The source address as "ip", "ip:port" or "[ipv6]:port".
+ * @return 0 on success, -1 on failure.
+ */
+int sip_trace_add_source(const char *source)
+{
+    return add_source(&command_line_set, source);
+}
+
+/**
+ * @brief Replaces the trace selection loaded from a file with the contents of the file, the
+ * selection added with sip_trace_add_call_id and sip_trace_add_source stays.
+ *
+ * Each line is either "call-id <Call-ID>" or "source <ip>[:<port>]", an IPv6 source with a port
+ * in brackets, lines starting with '#' are ignored.
+ *
+ * @param path The path of the file.
+ * @return 0 on success, -1 on failure.
+ */
+int sip_trace_load_file(const char *path)
+{
+    if (path == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        error("Failed to open trace file: %s", path);
+        return -1;
+    }
+    file_set.call_id_count = 0;
+    file_set.source_count = 0;
+
+    char line[SIP_CALL_ID_MAX_LENGTH + 32];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '#' || line[0] == '\0')
+        {
+            continue;
+        }
+        if (strncmp(line, "call-id ", 8) == 0)
+        {
+            add_call_id(&file_set, line + 8, strlen(line + 8));
+        }
+        else if (strncmp(line, "source ", 7) == 0)
+        {
+            add_source(&file_set, line + 7);
+        }
+        else
+        {
+            error("Invalid trace file line: %s", line);
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+/**
+ * @brief Checks whether a message matches one trace selection.
+ * @return true if the message matches.
+ */
+static bool set_match(const sip_trace_set_t *set, const char *call_id, size_t call_id_length, const struct sockaddr_storage *source)
+{
+    for (size_t i = 0; i < set->call_id_count; i++)
+    {
+        if (set->call_ids[i].call_id_length == call_id_length && memcmp(set->call_ids[i].call_id, call_id, call_id_length) == 0)
+        {
+            return true;
+        }
+    }
+    if (source != NULL && set->source_count > 0)
+    {
+        // sources of a dual stack socket arrive IPv4 mapped
+        struct sockaddr_storage address = *source;
+        sockaddr_unmap(&address);
+        for (size_t i = 0; i < set->source_count; i++)
+        {
+            // sin_port and sin6_port share their offset
+            struct sockaddr_storage pattern = set->sources[i].address;
+            if (((struct sockaddr_in *)&pattern)->sin_port == 0)
+            {
+                ((struct sockaddr_in *)&pattern)->sin_port = ((struct sockaddr_in *)&address)->sin_port;
+            }
+            if (sockaddr_equal(&pattern, &address))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Checks whether a message should be traced.
+ * @param call_id The Call-ID of the message.
+ * @param call_id_length The length of the Call-ID.
+ * @param source The source address of the message.
+ * @return true if the message should be traced.
+ */
+bool sip_trace_match(const char *call_id, size_t call_id_length, const struct sockaddr_storage *source)
+{
+    if (__builtin_expect(command_line_set.call_id_count == 0 && command_line_set.source_count == 0 &&
+                             file_set.call_id_count == 0 && file_set.source_count == 0,
+                         1))
+    {
+        return false;
+    }
+    return set_match(&command_line_set, call_id, call_id_length, source) ||
+           set_match(&file_set, call_id, call_id_length, source);
+}
@@ -0,0 +1,21 @@
+/**
+ * @file sip_trace.h
+ * @brief Header for per call debug tracing, selected by Call-ID or source address.
+ */
+
+#ifndef SIP_TRACE_H
+#define SIP_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+#define SIP_TRACE_MAX_CALL_IDS 64
+#define SIP_TRACE_MAX_SOURCES 64
+
+int sip_trace_add_call_id(const char *call_id, size_t call_id_length);
+int sip_trace_add_source(const char *source);
+int sip_trace_load_file(const char *path);
+bool sip_trace_match(const char *call_id, size_t call_id_length, const struct sockaddr_storage *source);
+
+#endif // SIP_TRACE_H
@@ -1,6 +1,10 @@
 #include "sip_utils.h"
 #include "log.h"
 #include "timer_manager.h"
+#include "utils.h"
+#include "prng.h"
+#include "metrics.h"
+#include "sip_cdr.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -58,8 +62,10 @@ sip_call_t *create_new_call(sip_call_t **calls, const char *call_id, size_t call
     memset(new_call, 0, sizeof(sip_call_t));
     snprintf(new_call->call_id, sizeof(new_call->call_id), "%.*s", (int)call_id_length, call_id);
     new_call->call_id_length = call_id_length;
+    new_call->last_activity_ms = get_monotonic_time_ms();
     new_call->next = *calls;
     *calls = new_call;
+    worker_metrics_inc(calls_created);
     return new_call;
 }
 
@@ -75,6 +81,11 @@ void cleanup_call(sip_call_t *call)
         return;
     }
 
+    // calls deleted by the reaper before terminating are recorded with their last state
+    if (thread_cdr_ring != NULL && !call->recorded && call->setup_time_ns != 0)
+    {
+        sip_cdr_record_call(thread_cdr_ring, call);
+    }
     for (size_t i = 0; i < MAX_DIALOGS_PER_CALL; i++)
     {
         if (call->dialog[i] != NULL)
@@ -88,6 +99,7 @@ void cleanup_call(sip_call_t *call)
         }
     }
     free(call);
+    worker_metrics_inc(calls_deleted);
 }
 
 /**
@@ -256,6 +268,31 @@ void set_call_state(sip_call_t *call, sip_call_state_t state)
     }
     log("Setting call state from %s to %s id %.*s", call_states[call->state], call_states[state], (int)call->call_id_length, call->call_id);
     call->state = state;
+    call->last_activity_ms = get_monotonic_time_ms();
+
+    if (thread_cdr_ring == NULL)
+    {
+        return;
+    }
+    switch (state)
+    {
+    case SIP_CALL_STATE_INCOMING:
+        call->setup_time_ns = get_real_time_ns();
+        break;
+    case SIP_CALL_STATE_ESTABLISHED:
+        call->answer_time_ns = get_real_time_ns();
+        break;
+    case SIP_CALL_STATE_FAILED:
+    case SIP_CALL_STATE_TERMINATED:
+        if (!call->recorded)
+        {
+            sip_cdr_record_call(thread_cdr_ring, call);
+            call->recorded = true;
+        }
+        break;
+    default:
+        break;
+    }
 }
 
 /**
@@ -303,13 +340,7 @@ void create_to_tag(char *to_tag_buffer, size_t buffer_size)
         error("Invalid parameters");
         return;
     }
-    char c;
-    size_t i;
-    for (i = 0; i < buffer_size; i++)
-    {
-        c = '0' + (rand() % 10);
-        to_tag_buffer[i] = c;
-    }
+    create_unique_token(to_tag_buffer, buffer_size);
 }
 
 /**
@@ -336,8 +367,10 @@ sip_dialog_t *create_new_dialog(sip_dialog_t **dialogs, const char *from_tag, si
     new_dialog->from_tag_length = from_tag_length;
     create_to_tag(new_dialog->to_tag, SIP_BUILD_TAG_LENGTH);
     new_dialog->to_tag_length = SIP_BUILD_TAG_LENGTH;
+    new_dialog->last_activity_ms = get_monotonic_time_ms();
     new_dialog->next = *dialogs;
     *dialogs = new_dialog;
+    worker_metrics_inc(dialogs_created);
     return new_dialog;
 }
 
@@ -369,6 +402,7 @@ void cleanup_dialog(sip_dialog_t *dialog)
         remove_dialog_from_call(dialog->call, dialog);
     }
     free(dialog);
+    worker_metrics_inc(dialogs_deleted);
 }
 
 /**
@@ -534,6 +568,7 @@ void set_dialog_state(sip_dialog_t *dialog, sip_dialog_state_t state)
     }
     log("Setting dialog state from %s to %s id %.*s %.*s", dialog_states[dialog->state], dialog_states[state], (int)dialog->from_tag_length, dialog->from_tag, (int)dialog->to_tag_length, dialog->to_tag);
     dialog->state = state;
+    dialog->last_activity_ms = get_monotonic_time_ms();
 }
 
 /**
@@ -610,6 +645,7 @@ sip_transaction_t *create_new_transaction(sip_transaction_t **transactions, cons
     new_transaction->branch_length = branch_length;
     new_transaction->next = *transactions;
     *transactions = new_transaction;
+    worker_metrics_inc(transactions_created);
     return new_transaction;
 }
 
@@ -634,6 +670,7 @@ void cleanup_transaction(sip_transaction_t *transaction)
         cleanup_sip_message(transaction->ack_message);
     }
     free(transaction);
+    worker_metrics_inc(transactions_deleted);
 }
 
 /**
@@ -745,6 +782,13 @@ void set_transaction_dialog(sip_transaction_t *transaction, sip_dialog_t *dialog
     }
     transaction->dialog = dialog;
     add_transaction_to_dialog(dialog, transaction);
+
+    // any transaction within the dialog counts as activity for the dialog and its call
+    dialog->last_activity_ms = get_monotonic_time_ms();
+    if (dialog->call != NULL)
+    {
+        dialog->call->last_activity_ms = dialog->last_activity_ms;
+    }
 }
 
 /**
@@ -758,9 +802,36 @@ void transaction_delete_timeout(void *data)
         error("Invalid parameters");
         return;
     }
-    transaction_delete_t *event = (transaction_delete_t *)data;
+    transaction_event_t *event = (transaction_event_t *)data;
     log("Transaction: %.*s delete timeout", (int)event->branch_length, event->branch);
-    enqueue_message(event->queue, event);
+    // deleting a transaction releases its state, so it is not delayed behind new requests
+    if (!enqueue_message_to_lane(event->queue, event, MESSAGE_QUEUE_LANE_PRIORITY))
+    {
+        // the worker queue is full, try again shortly instead of leaking the transaction
+        metrics_counter_add_shared(&timer_metrics.timer.timer_event_enqueue_failures, 1);
+        timer_one_shot_add(SIP_TRANSACTION_DELETE_RETRY_TIMEOUT, transaction_delete_timeout, event);
+    }
+}
+
+/**
+ * @brief Queues the answer of an INVITE to its worker once its answer delay has passed.
+ * @param data The answer event of the transaction.
+ */
+static void transaction_answer_timeout(void *data)
+{
+    if (data == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    transaction_event_t *event = (transaction_event_t *)data;
+    log("Transaction: %.*s answer timeout", (int)event->branch_length, event->branch);
+    // queued behind the requests already received, so a CANCEL sent before the answer is due wins
+    if (!enqueue_message_to_lane(event->queue, event, MESSAGE_QUEUE_LANE_NORMAL))
+    {
+        metrics_counter_add_shared(&timer_metrics.timer.timer_event_enqueue_failures, 1);
+        timer_one_shot_add(SIP_TRANSACTION_DELETE_RETRY_TIMEOUT, transaction_answer_timeout, event);
+    }
 }
 
 /**
@@ -774,7 +845,7 @@ void transaction_wait_ack_timeout(void *data)
         error("Invalid parameters");
         return;
     }
-    transaction_delete_t *event = (transaction_delete_t *)data;
+    transaction_event_t *event = (transaction_event_t *)data;
     log("Transaction: %.*s wait ack timeout", (int)event->branch_length, event->branch);
     timer_one_shot_add(SIP_TRANSACTION_DELETE_TIMEOUT, transaction_delete_timeout, event);
 }
@@ -786,7 +857,7 @@ void transaction_wait_ack_timeout(void *data)
  */
 void set_transaction_state(sip_transaction_t *transaction, sip_transaction_state_t state)
 {
-    transaction_delete_t *event = NULL;
+    transaction_event_t *event = NULL;
     if (transaction == NULL)
     {
         error("Invalid parameters");
@@ -805,10 +876,10 @@ void set_transaction_state(sip_transaction_t *transaction, sip_transaction_state
     {
     case SIP_TRANSACTION_STATE_COMPLETED:
         // start timer for ACK
-        event = malloc(sizeof(transaction_delete_t));
+        event = malloc(sizeof(transaction_event_t));
         if (event == NULL)
         {
-            error("Failed to allocate memory for transaction_delete_t");
+            error("Failed to allocate memory for transaction_event_t");
             return;
         }
         event->packet_type = PACKET_TYPE_DELETE_TRANSACTION;
@@ -819,10 +890,10 @@ void set_transaction_state(sip_transaction_t *transaction, sip_transaction_state
         break;
     case SIP_TRANSACTION_STATE_TERMINATED:
         // start timer for cleanup
-        event = malloc(sizeof(transaction_delete_t));
+        event = malloc(sizeof(transaction_event_t));
         if (event == NULL)
         {
-            error("Failed to allocate memory for transaction_delete_t");
+            error("Failed to allocate memory for transaction_event_t");
             return;
         }
         event->packet_type = PACKET_TYPE_DELETE_TRANSACTION;
@@ -834,4 +905,36 @@ void set_transaction_state(sip_transaction_t *transaction, sip_transaction_state
     default:
         break;
     }
+}
+
+/**
+ * @brief Schedules the answer of an INVITE transaction, which its worker sends unless the
+ * transaction got a final response in the meantime.
+ * @param transaction The INVITE transaction.
+ * @param delay_ms The time from now to the answer.
+ * @return 0 on success, -1 on failure.
+ */
+int schedule_transaction_answer(sip_transaction_t *transaction, int delay_ms)
+{
+    if (transaction == NULL || delay_ms <= 0)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    transaction_event_t *event = malloc(sizeof(transaction_event_t));
+    if (event == NULL)
+    {
+        error("Failed to allocate memory for transaction_event_t");
+        return -1;
+    }
+    event->packet_type = PACKET_TYPE_ANSWER_INVITE;
+    event->branch_length = transaction->branch_length;
+    event->queue = transaction->queue;
+    snprintf(event->branch, sizeof(event->branch), "%.*s", (int)transaction->branch_length, transaction->branch);
+    if (timer_one_shot_add(delay_ms, transaction_answer_timeout, event) != 0)
+    {
+        free(event);
+        return -1;
+    }
+    return 0;
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 #define SIP_UTILS_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include "sip_message.h"
 #include "timer_manager.h"
 #include "message_queue.h"
@@ -15,6 +16,7 @@
 #define MAX_TXNS_PER_DIALOG 32
 #define SIP_TRANSACTION_WAIT_ACK_TIMEOUT 5000
 #define SIP_TRANSACTION_DELETE_TIMEOUT 5000
+#define SIP_TRANSACTION_DELETE_RETRY_TIMEOUT 100
 
 #define SIP_TRANSACTION_STATE_IDLE_TEXT "IDLE"
 #define SIP_TRANSACTION_STATE_PROCEEDING_TEXT "PROCEEDING"
@@ -86,6 +88,7 @@ struct sip_dialog_s
     //
     sip_call_t *call;
     sip_dialog_state_t state;
+    uint64_t last_activity_ms;
     char from_tag[SIP_TAG_MAX_LENGTH + 1];
     size_t from_tag_length;
     char to_tag[SIP_TAG_MAX_LENGTH + 1];
@@ -98,17 +101,25 @@ struct sip_call_s
     sip_dialog_t *dialog[MAX_DIALOGS_PER_CALL];
     //
     sip_call_state_t state;
+    uint64_t last_activity_ms;
     char call_id[SIP_CALL_ID_MAX_LENGTH + 1];
     size_t call_id_length;
+    uint64_t setup_time_ns;  // wall clock time of the INVITE, kept for the call detail record
+    uint64_t answer_time_ns; // wall clock time of the 200 OK to the INVITE, 0 until answered
+    int final_response_code; // final response to the INVITE, 0 until sent
+    bool recorded;           // the call detail record is queued
 };
 
+extern const char *call_states[];
+
+// event of a transaction timer, deletion or delayed answer, queued to the worker of the transaction
 typedef struct
 {
     packet_type_e packet_type;
     char branch[SIP_BRANCH_MAX_LENGTH + 1];
     size_t branch_length;
     message_queue_t *queue;
-} transaction_delete_t;
+} transaction_event_t;
 
 sip_call_t *find_call_by_id(sip_call_t *calls, const char *call_id, size_t call_id_length);
 sip_call_t *create_new_call(sip_call_t **calls, const char *call_id, size_t call_id_length);
@@ -140,5 +151,6 @@ void cleanup_transaction(sip_transaction_t *transaction);
 void delete_all_transactions(sip_transaction_t **transactions);
 void set_transaction_dialog(sip_transaction_t *transaction, sip_dialog_t *dialog);
 void set_transaction_state(sip_transaction_t *transaction, sip_transaction_state_t state);
+int schedule_transaction_answer(sip_transaction_t *transaction, int delay_ms);
 
 #endif // SIP_UTILS_H
\ No newline at end of file
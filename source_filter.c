@@ -0,0 +1,395 @@
+/**
+ * @file source_filter.c
+ * @brief Implementation of the source address block and allow list with longest prefix match.
+ *
+ * The filter file has one rule per line, "block <prefix>" or "allow <prefix>", where the
+ * prefix is an IPv4 or IPv6 address with an optional /length. Lines starting with # are
+ * comments. The most specific matching prefix decides, and unmatched sources are allowed,
+ * so an allow list is "block 0.0.0.0/0" followed by allow rules.
+ */
+
+#include "source_filter.h"
+#include "rcu.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+/**
+ * @struct source_filter_rule_t
+ * @brief Parsed filter rule.
+ */
+typedef struct
+{
+    int family;
+    uint8_t address[16];
+    int prefix_length;
+    source_filter_action_t action;
+    size_t line;
+} source_filter_rule_t;
+
+static _Atomic(source_filter_table_t *) current_table = NULL;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_table(source_filter_table_t *table)
+{
+    if (table != NULL)
+    {
+        free(table->nodes);
+        free(table);
+    }
+}
+
+/**
+ * @brief Parses a filter rule line.
+ * @return 1 for a rule, 0 for an empty or comment line, -1 on error.
+ */
+static int parse_rule(char *line, source_filter_rule_t *rule)
+{
+    char *save = NULL;
+    char *keyword = strtok_r(line, " \t\r\n", &save);
+    if (keyword == NULL || keyword[0] == '#')
+    {
+        return 0;
+    }
+    char *prefix = strtok_r(NULL, " \t\r\n", &save);
+    if (prefix == NULL || strtok_r(NULL, " \t\r\n", &save) != NULL)
+    {
+        return -1;
+    }
+
+    if (strcmp(keyword, "block") == 0)
+    {
+        rule->action = SOURCE_FILTER_BLOCK;
+    }
+    else if (strcmp(keyword, "allow") == 0)
+    {
+        rule->action = SOURCE_FILTER_ALLOW;
+    }
+    else
+    {
+        return -1;
+    }
+
+    char *slash = strchr(prefix, '/');
+    if (slash != NULL)
+    {
+        *slash = '\0';
+    }
+    memset(rule->address, 0, sizeof(rule->address));
+    if (inet_pton(AF_INET, prefix, rule->address) == 1)
+    {
+        rule->family = AF_INET;
+        rule->prefix_length = 32;
+    }
+    else if (inet_pton(AF_INET6, prefix, rule->address) == 1)
+    {
+        rule->family = AF_INET6;
+        rule->prefix_length = 128;
+    }
+    else
+    {
+        return -1;
+    }
+    if (slash != NULL)
+    {
+        char *end;
+        long length = strtol(slash + 1, &end, 10);
+        if (*end != '\0' || end == slash + 1 || length < 0 || length > rule->prefix_length)
+        {
+            return -1;
+        }
+        rule->prefix_length = (int)length;
+    }
+    return 1;
+}
+
+static int compare_rules(const void *a, const void *b)
+{
+    const source_filter_rule_t *first = a;
+    const source_filter_rule_t *second = b;
+    if (first->prefix_length != second->prefix_length)
+    {
+        return first->prefix_length - second->prefix_length;
+    }
+    return first->line < second->line ? -1 : 1;
+}
+
+/**
+ * @brief Appends a node filled with an entry to the table being built.
+ * @return The index of the node, or -1 on allocation failure.
+ */
+static int64_t add_node(source_filter_table_t *table, uint32_t *capacity, uint32_t entry)
+{
+    if (table->node_count == *capacity)
+    {
+        uint32_t new_capacity = *capacity * 2;
+        source_filter_node_t *nodes = realloc(table->nodes, sizeof(source_filter_node_t) * new_capacity);
+        if (nodes == NULL)
+        {
+            return -1;
+        }
+        table->nodes = nodes;
+        *capacity = new_capacity;
+    }
+    source_filter_node_t *node = &table->nodes[table->node_count];
+    for (int i = 0; i < SOURCE_FILTER_NODE_SIZE; i++)
+    {
+        node->entries[i] = entry;
+    }
+    return table->node_count++;
+}
+
+/**
+ * @brief Inserts a rule with prefix expansion. Rules must be inserted by increasing prefix
+ * length, so a rule only overwrites the entries of shorter prefixes.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int insert_rule(source_filter_table_t *table, uint32_t *capacity, const source_filter_rule_t *rule)
+{
+    uint32_t index = rule->family == AF_INET ? 0 : 1;
+    int level = 0;
+    while (rule->prefix_length > (level + 1) * SOURCE_FILTER_STRIDE_BITS)
+    {
+        uint32_t entry = table->nodes[index].entries[rule->address[level]];
+        if (!(entry & SOURCE_FILTER_CHILD))
+        {
+            // the child inherits the action of the shorter prefix covering it
+            int64_t child = add_node(table, capacity, entry);
+            if (child < 0)
+            {
+                return -1;
+            }
+            entry = SOURCE_FILTER_CHILD | (uint32_t)child;
+            table->nodes[index].entries[rule->address[level]] = entry;
+        }
+        index = entry & ~SOURCE_FILTER_CHILD;
+        level++;
+    }
+
+    int span_bits = (level + 1) * SOURCE_FILTER_STRIDE_BITS - rule->prefix_length;
+    uint32_t first = rule->address[level] & ~((1u << span_bits) - 1) & (SOURCE_FILTER_NODE_SIZE - 1);
+    for (uint32_t slot = first; slot < first + (1u << span_bits); slot++)
+    {
+        table->nodes[index].entries[slot] = rule->action;
+    }
+    return 0;
+}
+
+/**
+ * @brief Compiles a filter file into a table.
+ * @return The table, or NULL on failure.
+ */
+static source_filter_table_t *build_table(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        error("Failed to open source filter file %s", path);
+        return NULL;
+    }
+
+    size_t rule_count = 0;
+    size_t rule_capacity = 64;
+    source_filter_rule_t *rules = malloc(sizeof(source_filter_rule_t) * rule_capacity);
+    source_filter_table_t *table = calloc(1, sizeof(source_filter_table_t));
+    uint32_t node_capacity = 16;
+    if (table != NULL)
+    {
+        table->nodes = malloc(sizeof(source_filter_node_t) * node_capacity);
+    }
+    if (rules == NULL || table == NULL || table->nodes == NULL)
+    {
+        error("Memory allocation failed");
+        goto fail;
+    }
+
+    char line[SOURCE_FILTER_LINE_MAX_LENGTH];
+    size_t line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line_number++;
+        if (rule_count == rule_capacity)
+        {
+            source_filter_rule_t *grown = realloc(rules, sizeof(source_filter_rule_t) * rule_capacity * 2);
+            if (grown == NULL)
+            {
+                error("Memory allocation failed");
+                goto fail;
+            }
+            rules = grown;
+            rule_capacity *= 2;
+        }
+        int rc = parse_rule(line, &rules[rule_count]);
+        if (rc < 0)
+        {
+            error("Invalid source filter rule in %s line %zu", path, line_number);
+            goto fail;
+        }
+        if (rc > 0)
+        {
+            rules[rule_count].line = line_number;
+            rule_count++;
+        }
+    }
+
+    // the roots of both families, unmatched sources fall through to no match
+    add_node(table, &node_capacity, SOURCE_FILTER_NO_MATCH);
+    add_node(table, &node_capacity, SOURCE_FILTER_NO_MATCH);
+    qsort(rules, rule_count, sizeof(source_filter_rule_t), compare_rules);
+    for (size_t i = 0; i < rule_count; i++)
+    {
+        if (insert_rule(table, &node_capacity, &rules[i]) != 0)
+        {
+            error("Memory allocation failed");
+            goto fail;
+        }
+    }
+    table->rule_count = (uint32_t)rule_count;
+
+    fclose(file);
+    free(rules);
+    return table;
+
+fail:
+    fclose(file);
+    free(rules);
+    free_table(table);
+    return NULL;
+}
+
+/**
+ * @brief Publishes a table and frees the previous one once no reader can use it.
+ */
+static void publish_table(source_filter_table_t *table)
+{
+    source_filter_table_t *previous = atomic_exchange_explicit(&current_table, table, memory_order_acq_rel);
+    if (previous != NULL)
+    {
+        synchronize_rcu();
+        free_table(previous);
+    }
+}
+
+/**
+ * @brief Loads a filter file and replaces the current filter. Must not be called by an RCU reader.
+ * @param path The path of the filter file.
+ * @return 0 on success, -1 on failure, in which case the current filter is kept.
+ */
+int source_filter_load_file(const char *path)
+{
+    if (path == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    pthread_mutex_lock(&writer_mutex);
+    source_filter_table_t *table = build_table(path);
+    if (table == NULL)
+    {
+        pthread_mutex_unlock(&writer_mutex);
+        return -1;
+    }
+    info("Loaded %u source filter rules from %s into %u trie nodes", table->rule_count, path, table->node_count);
+    publish_table(table);
+    pthread_mutex_unlock(&writer_mutex);
+    return 0;
+}
+
+static void *reload_thread(void *arg)
+{
+    char *path = arg;
+    source_filter_load_file(path);
+    free(path);
+    return NULL;
+}
+
+/**
+ * @brief Reloads a filter file on a background thread, so RCU readers can request it.
+ * @param path The path of the filter file.
+ * @return 0 if the reload was started, -1 on failure.
+ */
+int source_filter_reload_async(const char *path)
+{
+    if (path == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    char *copy = strdup(path);
+    if (copy == NULL)
+    {
+        error("Memory allocation failed");
+        return -1;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int rc = pthread_create(&thread, &attr, reload_thread, copy);
+    pthread_attr_destroy(&attr);
+    if (rc != 0)
+    {
+        error("Failed to create source filter reload thread");
+        free(copy);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds the action of the longest prefix matching an address.
+ * @param table The compiled filter.
+ * @param family AF_INET or AF_INET6.
+ * @param address The address in network byte order, 4 or 16 bytes.
+ * @return The action of the longest matching prefix, or SOURCE_FILTER_NO_MATCH.
+ */
+source_filter_action_t source_filter_lookup(const source_filter_table_t *table, int family, const uint8_t *address)
+{
+    int length = family == AF_INET ? 4 : 16;
+    uint32_t index = family == AF_INET ? 0 : 1;
+    for (int level = 0; level < length; level++)
+    {
+        uint32_t entry = table->nodes[index].entries[address[level]];
+        if (!(entry & SOURCE_FILTER_CHILD))
+        {
+            return (source_filter_action_t)entry;
+        }
+        index = entry & ~SOURCE_FILTER_CHILD;
+    }
+    return SOURCE_FILTER_NO_MATCH;
+}
+
+/**
+ * @brief Checks a source address against the current filter without taking any lock.
+ * Must be called by a registered RCU reader.
+ * @param address The source address.
+ * @return false if the source is blocked.
+ */
+bool source_filter_allow(const struct sockaddr *address)
+{
+    const source_filter_table_t *table = atomic_load_explicit(&current_table, memory_order_acquire);
+    if (table == NULL || address == NULL)
+    {
+        return true;
+    }
+    if (address->sa_family == AF_INET)
+    {
+        const struct sockaddr_in *ipv4 = (const struct sockaddr_in *)address;
+        return source_filter_lookup(table, AF_INET, (const uint8_t *)&ipv4->sin_addr) != SOURCE_FILTER_BLOCK;
+    }
+    if (address->sa_family == AF_INET6)
+    {
+        const struct sockaddr_in6 *ipv6 = (const struct sockaddr_in6 *)address;
+        if (IN6_IS_ADDR_V4MAPPED(&ipv6->sin6_addr))
+        {
+            return source_filter_lookup(table, AF_INET, ipv6->sin6_addr.s6_addr + 12) != SOURCE_FILTER_BLOCK;
+        }
+        return source_filter_lookup(table, AF_INET6, ipv6->sin6_addr.s6_addr) != SOURCE_FILTER_BLOCK;
+    }
+    return true;
+}
@@ -0,0 +1,57 @@
+/**
+ * @file source_filter.h
+ * @brief Header for the source address block and allow list with longest prefix match.
+ *
+ * Rules are compiled into a multibit trie with 8 bit strides and prefix expansion, one root
+ * for IPv4 and one for IPv6, so a lookup is at most 4 or 16 array reads. The compiled table
+ * is immutable and published with RCU: lookups never take a lock, and a reload builds a
+ * new table on its own thread and frees the old one once no reader can use it anymore.
+ */
+
+#ifndef SOURCE_FILTER_H
+#define SOURCE_FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define SOURCE_FILTER_STRIDE_BITS 8
+#define SOURCE_FILTER_NODE_SIZE (1 << SOURCE_FILTER_STRIDE_BITS)
+#define SOURCE_FILTER_LINE_MAX_LENGTH 256
+
+typedef enum
+{
+    SOURCE_FILTER_NO_MATCH = 0,
+    SOURCE_FILTER_ALLOW,
+    SOURCE_FILTER_BLOCK
+} source_filter_action_t;
+
+/**
+ * @struct source_filter_node_t
+ * @brief Trie node covering 8 bits of an address. An entry is either an action or,
+ * with SOURCE_FILTER_CHILD set, the index of the child node.
+ */
+typedef struct
+{
+    uint32_t entries[SOURCE_FILTER_NODE_SIZE];
+} source_filter_node_t;
+
+#define SOURCE_FILTER_CHILD 0x80000000u
+
+/**
+ * @struct source_filter_table_t
+ * @brief Immutable compiled filter.
+ */
+typedef struct
+{
+    source_filter_node_t *nodes; // nodes[0] is the IPv4 root and nodes[1] the IPv6 root
+    uint32_t node_count;
+    uint32_t rule_count;
+} source_filter_table_t;
+
+int source_filter_load_file(const char *path);
+int source_filter_reload_async(const char *path);
+source_filter_action_t source_filter_lookup(const source_filter_table_t *table, int family, const uint8_t *address);
+bool source_filter_allow(const struct sockaddr *address);
+
+#endif // SOURCE_FILTER_H
@@ -0,0 +1,719 @@
+/**
+ * @file tcp_transport.c
+ * @brief Implementation of the SIP over TCP transport.
+ */
+
+#include "log.h"
+#include "tcp_transport.h"
+#include "metrics.h"
+#include "tls_server.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <openssl/err.h>
+
+// connection handles are never below 1 << 32
+#define TCP_LISTEN_EVENT 0
+#define TCP_TLS_LISTEN_EVENT 1
+
+tcp_transport_t tcp_transport = {.listen_socket = -1, .tls_listen_socket = -1, .epoll_fd = -1};
+
+static uint64_t get_connection_handle(const tcp_transport_t *transport, const tcp_connection_t *connection)
+{
+    return (uint64_t)connection->generation << 32 | (uint64_t)(connection - transport->connections);
+}
+
+/**
+ * @brief Returns the connection of a handle, NULL if the handle is invalid.
+ */
+static tcp_connection_t *get_connection(tcp_transport_t *transport, uint64_t handle)
+{
+    uint32_t slot = (uint32_t)handle;
+    if (transport->connections == NULL || slot >= transport->capacity)
+    {
+        return NULL;
+    }
+    return &transport->connections[slot];
+}
+
+/**
+ * @brief Creates the connection table and the epoll instance the listeners are added to.
+ * @param transport The transport to initialize.
+ * @param max_connections The number of TCP and TLS connections served at once.
+ * @return 0 on success, -1 on failure.
+ */
+int tcp_transport_init(tcp_transport_t *transport, int max_connections)
+{
+    if (transport == NULL || max_connections <= 0)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    memset(transport, 0, sizeof(tcp_transport_t));
+    transport->listen_socket = -1;
+    transport->tls_listen_socket = -1;
+    transport->epoll_fd = -1;
+
+    transport->capacity = (uint32_t)max_connections;
+    transport->connections = calloc(transport->capacity, sizeof(tcp_connection_t));
+    transport->free_slots = malloc(transport->capacity * sizeof(uint32_t));
+    if (transport->connections == NULL || transport->free_slots == NULL)
+    {
+        error("Memory allocation failed");
+        tcp_transport_destroy(transport);
+        return -1;
+    }
+    // slots are handed out from the end of the free list, lowest first
+    for (uint32_t i = 0; i < transport->capacity; i++)
+    {
+        transport->connections[i].fd = -1;
+        transport->connections[i].generation = 1;
+        pthread_mutex_init(&transport->connections[i].write_lock, NULL);
+        transport->free_slots[i] = transport->capacity - 1 - i;
+    }
+    transport->free_count = transport->capacity;
+
+    transport->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (transport->epoll_fd < 0)
+    {
+        error("Failed to set up the TCP event loop: %s", strerror(errno));
+        tcp_transport_destroy(transport);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds the plain TCP or the TLS listener.
+ * @param transport The initialized transport.
+ * @param address The IPv4 or IPv6 address to listen on.
+ * @param address_length The length of the address.
+ * @param tls The TLS server handshaking the accepted connections, NULL for plain TCP.
+ * @return 0 on success, -1 on failure.
+ */
+int tcp_transport_listen(tcp_transport_t *transport, const struct sockaddr_storage *address, socklen_t address_length, struct tls_server *tls)
+{
+    if (!tcp_transport_enabled(transport) || address == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    const char *protocol = tls != NULL ? "TLS" : "TCP";
+    char address_string[SOCKADDR_STRING_LENGTH];
+    sockaddr_to_string(address, address_string, sizeof(address_string));
+    int listen_socket = socket(address->ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int enable = 1;
+    struct epoll_event event = {.events = EPOLLIN | EPOLLET, .data.u64 = tls != NULL ? TCP_TLS_LISTEN_EVENT : TCP_LISTEN_EVENT};
+    if (listen_socket < 0 ||
+        setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0 ||
+        bind(listen_socket, (const struct sockaddr *)address, address_length) < 0 ||
+        listen(listen_socket, TCP_LISTEN_BACKLOG) < 0 ||
+        epoll_ctl(transport->epoll_fd, EPOLL_CTL_ADD, listen_socket, &event) < 0)
+    {
+        error("Failed to listen on %s %s: %s", protocol, address_string, strerror(errno));
+        if (listen_socket >= 0)
+        {
+            close(listen_socket);
+        }
+        return -1;
+    }
+    if (tls != NULL)
+    {
+        transport->tls_listen_socket = listen_socket;
+        transport->tls = tls;
+    }
+    else
+    {
+        transport->listen_socket = listen_socket;
+    }
+    info("SIP server listening on %s %s, up to %u connections", protocol, address_string, transport->capacity);
+    return 0;
+}
+
+bool tcp_transport_enabled(const tcp_transport_t *transport)
+{
+    return transport != NULL && transport->epoll_fd >= 0;
+}
+
+/**
+ * @brief Closes a connection and frees its slot. Must only be called by the receiver thread.
+ */
+static void close_connection(tcp_transport_t *transport, tcp_connection_t *connection)
+{
+    pthread_mutex_lock(&connection->write_lock);
+    if (connection->ssl != NULL)
+    {
+        // the close_notify is sent only if the socket takes it right away
+        if (SSL_is_init_finished(connection->ssl))
+        {
+            SSL_shutdown(connection->ssl);
+        }
+        SSL_free(connection->ssl);
+        connection->ssl = NULL;
+    }
+    close(connection->fd);
+    connection->fd = -1;
+    connection->generation++;
+    free(connection->write_buffer);
+    connection->write_buffer = NULL;
+    connection->write_length = 0;
+    pthread_mutex_unlock(&connection->write_lock);
+
+    free(connection->read_buffer);
+    connection->read_buffer = NULL;
+    connection->read_length = 0;
+    transport->free_slots[transport->free_count++] = (uint32_t)(connection - transport->connections);
+    metrics_counter_add(&receiver_metrics.receiver.tcp_connections_closed, 1);
+}
+
+/**
+ * @brief Starts watching a connection for reads and for room to write its pending bytes.
+ * @param transport The transport.
+ * @param connection The connection, accepted or done with its TLS handshake.
+ * @return 0 on success, -1 on failure.
+ */
+int tcp_transport_watch(tcp_transport_t *transport, tcp_connection_t *connection)
+{
+    if (!tcp_transport_enabled(transport) || connection == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    struct epoll_event event = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+                                .data.u64 = get_connection_handle(transport, connection)};
+    if (epoll_ctl(transport->epoll_fd, EPOLL_CTL_ADD, connection->fd, &event) < 0)
+    {
+        error("Failed to watch TCP connection: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Accepts every pending connection of a listener, refusing those above the connection limit.
+ * @param transport The transport.
+ * @param listen_socket The plain TCP or the TLS listener.
+ * @param tls The TLS server of the listener, NULL for plain TCP.
+ */
+static void accept_connections(tcp_transport_t *transport, int listen_socket, tls_server_t *tls)
+{
+    while (1)
+    {
+        struct sockaddr_storage address;
+        socklen_t address_length = sizeof(address);
+        int fd = accept4(listen_socket, (struct sockaddr *)&address, &address_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                error("Failed to accept TCP connection: %s", strerror(errno));
+            }
+            return;
+        }
+        char *read_buffer = transport->free_count > 0 ? malloc(TCP_READ_BUFFER_SIZE) : NULL;
+        SSL *ssl = read_buffer != NULL && tls != NULL ? tls_server_new_ssl(tls, fd) : NULL;
+        if (read_buffer == NULL || (tls != NULL && ssl == NULL))
+        {
+            metrics_counter_add(&receiver_metrics.receiver.tcp_connections_rejected, 1);
+            free(read_buffer);
+            close(fd);
+            continue;
+        }
+
+        // responses are small and written in batches, so Nagle would only delay them
+        int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        tcp_connection_t *connection = &transport->connections[transport->free_slots[--transport->free_count]];
+        memcpy(&connection->address, &address, address_length);
+        connection->address_length = address_length;
+        connection->read_buffer = read_buffer;
+        connection->read_length = 0;
+        connection->accept_time_ns = get_monotonic_time_ns();
+        pthread_mutex_lock(&connection->write_lock);
+        connection->fd = fd;
+        connection->ssl = ssl;
+        pthread_mutex_unlock(&connection->write_lock);
+
+        // a TLS connection is watched once the handshake threads are done with it
+        if (ssl != NULL ? tls_server_start_handshake(tls, connection) != 0 : tcp_transport_watch(transport, connection) != 0)
+        {
+            close_connection(transport, connection);
+            continue;
+        }
+        metrics_counter_add(&receiver_metrics.receiver.tcp_connections_accepted, 1);
+    }
+}
+
+/**
+ * @brief Finds the Content-Length of a message header, also in its compact form "l".
+ * @param header The header, up to and including the empty line.
+ * @param length The length of the header.
+ * @return The body length, -1 if the header has no valid Content-Length.
+ */
+static long get_content_length(const char *header, size_t length)
+{
+    const char *end = header + length;
+    for (const char *line = header; line < end;)
+    {
+        const char *line_end = memchr(line, '\n', (size_t)(end - line));
+        line_end = line_end != NULL ? line_end : end;
+        size_t name_length = 0;
+        if ((size_t)(line_end - line) > 14 && strncasecmp(line, "Content-Length", 14) == 0)
+        {
+            name_length = 14;
+        }
+        else if (line_end - line > 1 && (line[0] == 'l' || line[0] == 'L') && (line[1] == ':' || line[1] == ' ' || line[1] == '\t'))
+        {
+            name_length = 1;
+        }
+        if (name_length > 0)
+        {
+            const char *value = line + name_length;
+            while (value < line_end && (*value == ' ' || *value == '\t'))
+            {
+                value++;
+            }
+            if (value < line_end && *value == ':')
+            {
+                char *number_end;
+                long content_length = strtol(value + 1, &number_end, 10);
+                return number_end > value + 1 && content_length >= 0 ? content_length : -1;
+            }
+        }
+        line = line_end + 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief Hands every complete message of the read buffer to the handler and keeps the
+ * incomplete tail at the start of the buffer.
+ * @return 0 on success, -1 if the stream cannot be framed.
+ */
+static int frame_messages(tcp_transport_t *transport, tcp_connection_t *connection, tcp_message_handler_t handler)
+{
+    uint64_t handle = get_connection_handle(transport, connection);
+    char *buffer = connection->read_buffer;
+    size_t offset = 0;
+    while (offset < connection->read_length)
+    {
+        // empty lines between messages are keepalives
+        if (buffer[offset] == '\r' || buffer[offset] == '\n')
+        {
+            offset++;
+            continue;
+        }
+        size_t available = connection->read_length - offset;
+        const char *header_end = memmem(buffer + offset, available, "\r\n\r\n", 4);
+        if (header_end == NULL)
+        {
+            break;
+        }
+        size_t header_length = (size_t)(header_end - (buffer + offset)) + 4;
+        long content_length = get_content_length(buffer + offset, header_length);
+        if (content_length < 0 || header_length + (size_t)content_length > TCP_READ_BUFFER_SIZE)
+        {
+            // a stream message must declare its body length, nothing after it can be found otherwise
+            return -1;
+        }
+        if (header_length + (size_t)content_length > available)
+        {
+            break;
+        }
+        handler(buffer + offset, header_length + (size_t)content_length, handle, connection->fd,
+                &connection->address, connection->address_length);
+        offset += header_length + (size_t)content_length;
+    }
+    if (offset > 0)
+    {
+        memmove(buffer, buffer + offset, connection->read_length - offset);
+        connection->read_length -= offset;
+    }
+    return connection->read_length == TCP_READ_BUFFER_SIZE ? -1 : 0;
+}
+
+/**
+ * @brief Maps the outcome of an SSL_read or SSL_write to the conventions of read and write.
+ * @return The bytes transferred, 0 at the end of the stream, -1 with errno EAGAIN when the
+ * socket is not ready, or -1 with another errno when the connection failed.
+ */
+static ssize_t get_stream_result(int rc, int ssl_error)
+{
+    switch (ssl_error)
+    {
+    case SSL_ERROR_NONE:
+        return rc;
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    default:
+        errno = ECONNRESET;
+        return -1;
+    }
+}
+
+/**
+ * @brief Reads from a connection, decrypting the records of a TLS connection.
+ * @return As read.
+ */
+static ssize_t read_stream(tcp_connection_t *connection, char *buffer, size_t length)
+{
+    if (connection->ssl == NULL)
+    {
+        return read(connection->fd, buffer, length);
+    }
+    pthread_mutex_lock(&connection->write_lock);
+    ERR_clear_error();
+    int rc = SSL_read(connection->ssl, buffer, (int)length);
+    ssize_t result = get_stream_result(rc, rc > 0 ? SSL_ERROR_NONE : SSL_get_error(connection->ssl, rc));
+    pthread_mutex_unlock(&connection->write_lock);
+    return result;
+}
+
+/**
+ * @brief Writes to a connection, encrypting for a TLS connection. Must be called with the write lock held.
+ * @return As writev.
+ */
+static ssize_t write_stream(tcp_connection_t *connection, const struct iovec *iov, int iov_count)
+{
+    if (connection->ssl == NULL)
+    {
+        return writev(connection->fd, iov, iov_count);
+    }
+    // one SSL_write packs a batch of responses into as few records as it fits
+    char records[TCP_SEND_BATCH_SIZE * TCP_SEND_BUFFER_SIZE];
+    const char *data = iov[0].iov_base;
+    size_t length = iov[0].iov_len;
+    if (iov_count > 1)
+    {
+        length = 0;
+        for (int i = 0; i < iov_count && length < sizeof(records); i++)
+        {
+            size_t part = iov[i].iov_len < sizeof(records) - length ? iov[i].iov_len : sizeof(records) - length;
+            memcpy(records + length, iov[i].iov_base, part);
+            length += part;
+        }
+        data = records;
+    }
+    ERR_clear_error();
+    int rc = SSL_write(connection->ssl, data, length < INT32_MAX ? (int)length : INT32_MAX);
+    return get_stream_result(rc, rc > 0 ? SSL_ERROR_NONE : SSL_get_error(connection->ssl, rc));
+}
+
+/**
+ * @brief Reads a connection until the socket is empty, framing the messages as they arrive.
+ */
+static void read_connection(tcp_transport_t *transport, tcp_connection_t *connection, tcp_message_handler_t handler)
+{
+    while (1)
+    {
+        ssize_t bytes_read = read_stream(connection, connection->read_buffer + connection->read_length,
+                                         TCP_READ_BUFFER_SIZE - connection->read_length);
+        if (bytes_read > 0)
+        {
+            connection->read_length += (size_t)bytes_read;
+            if (frame_messages(transport, connection, handler) != 0)
+            {
+                metrics_counter_add(&receiver_metrics.receiver.tcp_framing_errors, 1);
+                close_connection(transport, connection);
+                return;
+            }
+            continue;
+        }
+        if (bytes_read < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+        close_connection(transport, connection);
+        return;
+    }
+}
+
+/**
+ * @brief Writes what a connection could not take before. Must be called with the write lock held.
+ */
+static void flush_write_buffer(tcp_connection_t *connection)
+{
+    while (connection->fd >= 0 && connection->write_length > 0)
+    {
+        struct iovec iov = {.iov_base = connection->write_buffer, .iov_len = connection->write_length};
+        ssize_t written = write_stream(connection, &iov, 1);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                // the receiver sees the shutdown as a hang up and closes the connection
+                shutdown(connection->fd, SHUT_RDWR);
+            }
+            return;
+        }
+        memmove(connection->write_buffer, connection->write_buffer + written, connection->write_length - (size_t)written);
+        connection->write_length -= (size_t)written;
+    }
+}
+
+/**
+ * @brief Handles the ready listener and connections. Must only be called by the receiver thread.
+ * @param transport The transport.
+ * @param handler Called for every framed message.
+ * @return The number of events handled, -1 on failure.
+ */
+int tcp_transport_process(tcp_transport_t *transport, tcp_message_handler_t handler)
+{
+    if (!tcp_transport_enabled(transport) || handler == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    struct epoll_event events[TCP_EVENT_BATCH];
+    int count = epoll_wait(transport->epoll_fd, events, TCP_EVENT_BATCH, 0);
+    for (int i = 0; i < count; i++)
+    {
+        if (events[i].data.u64 == TCP_LISTEN_EVENT)
+        {
+            accept_connections(transport, transport->listen_socket, NULL);
+            continue;
+        }
+        if (events[i].data.u64 == TCP_TLS_LISTEN_EVENT)
+        {
+            accept_connections(transport, transport->tls_listen_socket, transport->tls);
+            continue;
+        }
+        // events of a connection closed earlier in the batch belong to an older generation
+        tcp_connection_t *connection = get_connection(transport, events[i].data.u64);
+        if (connection == NULL || connection->fd < 0 || get_connection_handle(transport, connection) != events[i].data.u64)
+        {
+            continue;
+        }
+        if (events[i].events & EPOLLOUT)
+        {
+            pthread_mutex_lock(&connection->write_lock);
+            flush_write_buffer(connection);
+            pthread_mutex_unlock(&connection->write_lock);
+        }
+        // the handshake may have left the first records in the SSL object, the socket then reports no EPOLLIN
+        if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) ||
+            (connection->ssl != NULL && SSL_has_pending(connection->ssl)))
+        {
+            read_connection(transport, connection, handler);
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Writes a response to a connection, keeping what the socket does not take for EPOLLOUT.
+ * @param transport The transport.
+ * @param connection The handle of the connection the request arrived on.
+ * @param iov The data to write.
+ * @param iov_count The number of buffers.
+ * @return 0 on success, -1 if the connection is gone or fell too far behind.
+ */
+int tcp_transport_send(tcp_transport_t *transport, uint64_t connection, const struct iovec *iov, int iov_count)
+{
+    tcp_connection_t *target = get_connection(transport, connection);
+    if (target == NULL || iov == NULL || iov_count <= 0 || iov_count > TCP_SEND_BATCH_SIZE)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    size_t total = 0;
+    for (int i = 0; i < iov_count; i++)
+    {
+        total += iov[i].iov_len;
+    }
+
+    pthread_mutex_lock(&target->write_lock);
+    if (target->fd < 0 || target->generation != (uint32_t)(connection >> 32))
+    {
+        pthread_mutex_unlock(&target->write_lock);
+        errno = ENOTCONN;
+        return -1;
+    }
+    // bytes already waiting go first, so responses keep their order
+    size_t written = 0;
+    if (target->write_length == 0)
+    {
+        ssize_t rc;
+        do
+        {
+            rc = write_stream(target, iov, iov_count);
+        } while (rc < 0 && errno == EINTR);
+        if (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            int saved_errno = errno;
+            shutdown(target->fd, SHUT_RDWR);
+            pthread_mutex_unlock(&target->write_lock);
+            errno = saved_errno;
+            return -1;
+        }
+        written = rc > 0 ? (size_t)rc : 0;
+    }
+    if (written < total)
+    {
+        if (target->write_buffer == NULL)
+        {
+            target->write_buffer = malloc(TCP_WRITE_BUFFER_SIZE);
+        }
+        if (target->write_buffer == NULL || target->write_length + total - written > TCP_WRITE_BUFFER_SIZE)
+        {
+            worker_metrics_inc(tcp_write_overflows);
+            shutdown(target->fd, SHUT_RDWR);
+            pthread_mutex_unlock(&target->write_lock);
+            errno = ENOBUFS;
+            return -1;
+        }
+        for (int i = 0; i < iov_count; i++)
+        {
+            size_t skip = written < iov[i].iov_len ? written : iov[i].iov_len;
+            memcpy(target->write_buffer + target->write_length, (const char *)iov[i].iov_base + skip, iov[i].iov_len - skip);
+            target->write_length += iov[i].iov_len - skip;
+            written -= skip;
+        }
+    }
+    pthread_mutex_unlock(&target->write_lock);
+    return 0;
+}
+
+/**
+ * @brief Closes every connection and the listener.
+ * @param transport The transport.
+ */
+void tcp_transport_destroy(tcp_transport_t *transport)
+{
+    if (transport == NULL)
+    {
+        return;
+    }
+    for (uint32_t i = 0; transport->connections != NULL && i < transport->capacity; i++)
+    {
+        if (transport->connections[i].fd >= 0)
+        {
+            close_connection(transport, &transport->connections[i]);
+        }
+        pthread_mutex_destroy(&transport->connections[i].write_lock);
+    }
+    if (transport->epoll_fd >= 0)
+    {
+        close(transport->epoll_fd);
+    }
+    if (transport->listen_socket >= 0)
+    {
+        close(transport->listen_socket);
+    }
+    if (transport->tls_listen_socket >= 0)
+    {
+        close(transport->tls_listen_socket);
+    }
+    free(transport->connections);
+    free(transport->free_slots);
+    memset(transport, 0, sizeof(tcp_transport_t));
+    transport->listen_socket = -1;
+    transport->tls_listen_socket = -1;
+    transport->epoll_fd = -1;
+}
+
+/**
+ * @brief Initializes an empty batch.
+ * @param batch The batch.
+ * @param transport The transport the batched responses are written to.
+ */
+void init_tcp_send_batch(tcp_send_batch_t *batch, tcp_transport_t *transport)
+{
+    if (batch == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    batch->transport = transport;
+    batch->count = 0;
+    batch->failures = 0;
+}
+
+/**
+ * @brief Copies a response into the batch, writing the batch first when it is full.
+ * @return 0 on success, -1 with errno EINVAL on invalid parameters.
+ */
+int tcp_send_batch_add(tcp_send_batch_t *batch, uint64_t connection, const char *data, size_t length)
+{
+    if (batch == NULL || connection == 0 || data == NULL || length == 0 || length > TCP_SEND_BUFFER_SIZE)
+    {
+        error("Invalid parameters");
+        errno = EINVAL;
+        return -1;
+    }
+    if (batch->count == TCP_SEND_BATCH_SIZE)
+    {
+        batch->failures += tcp_send_batch_flush(batch);
+    }
+    memcpy(batch->buffers[batch->count], data, length);
+    batch->lengths[batch->count] = length;
+    batch->connections[batch->count] = connection;
+    batch->count++;
+    return 0;
+}
+
+/**
+ * @brief Writes the batched responses with one writev per connection, in their order.
+ * @param batch The batch.
+ * @return The number of responses that failed since the previous flush.
+ */
+int tcp_send_batch_flush(tcp_send_batch_t *batch)
+{
+    if (batch == NULL)
+    {
+        error("Invalid parameters");
+        return 0;
+    }
+    int failures = batch->failures;
+    uint32_t written = 0; // bit per batched response
+    for (int first = 0; first < batch->count; first++)
+    {
+        if (written & (1u << first))
+        {
+            continue;
+        }
+        struct iovec iov[TCP_SEND_BATCH_SIZE];
+        int iov_count = 0;
+        for (int i = first; i < batch->count; i++)
+        {
+            if (batch->connections[i] == batch->connections[first])
+            {
+                iov[iov_count].iov_base = batch->buffers[i];
+                iov[iov_count].iov_len = batch->lengths[i];
+                iov_count++;
+                written |= 1u << i;
+            }
+        }
+        if (tcp_transport_send(batch->transport, batch->connections[first], iov, iov_count) != 0)
+        {
+            failures += iov_count;
+        }
+    }
+    batch->count = 0;
+    batch->failures = 0;
+    return failures;
+}
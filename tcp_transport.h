@@ -0,0 +1,110 @@
+/**
+ * @file tcp_transport.h
+ * @brief Header for the SIP over TCP transport.
+ *
+ * The receiver accepts and reads the connections from an edge-triggered epoll instance of
+ * their own, nested in the receiver event loop. Messages are framed by Content-Length in
+ * place in the read buffer of their connection and carry a connection handle, the slot of
+ * the connection tagged with its generation, so a response for a closed connection never
+ * reaches the next connection of the slot. Workers write their responses directly, batched
+ * per connection with writev. What a full socket buffer does not take is kept by the
+ * connection and written by the receiver on EPOLLOUT.
+ *
+ * A TLS listener shares the connection table. Its connections carry an SSL object, are
+ * handed to the handshake threads of the TLS server after accept and are only watched by
+ * the receiver once their handshake is done.
+ */
+
+#ifndef TCP_TRANSPORT_H
+#define TCP_TRANSPORT_H
+
+#include <openssl/ssl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define TCP_DEFAULT_MAX_CONNECTIONS 16384
+#define TCP_LISTEN_BACKLOG 1024
+#define TCP_READ_BUFFER_SIZE 8192   // largest message a connection can frame
+#define TCP_WRITE_BUFFER_SIZE 65536 // responses a slow peer can fall behind before it is disconnected
+#define TCP_EVENT_BATCH 64          // connection events handled per receiver wakeup
+#define TCP_SEND_BATCH_SIZE 16
+#define TCP_SEND_BUFFER_SIZE 1024 // BUFFER_SIZE of sip_message_t
+
+struct tls_server;
+
+/**
+ * @struct tcp_connection_t
+ * @brief An accepted connection. The receiver owns the read side and closes it, writers
+ * hold the write lock, which also keeps the file descriptor open while they use it. The
+ * receiver reads TLS connections under the write lock too, as an SSL object is not safe
+ * for concurrent use.
+ */
+typedef struct tcp_connection
+{
+    int fd; // -1 when the slot is free
+    uint32_t generation;
+    struct sockaddr_storage address;
+    socklen_t address_length;
+    SSL *ssl;                // NULL for plain TCP
+    uint64_t accept_time_ns; // start of the TLS handshake
+    struct tcp_connection *handshake_prev; // handshakes of the same handshake thread, oldest first
+    struct tcp_connection *handshake_next;
+    char *read_buffer;
+    size_t read_length;
+    pthread_mutex_t write_lock;
+    char *write_buffer; // allocated when a write first falls behind
+    size_t write_length;
+} tcp_connection_t;
+
+/**
+ * @struct tcp_transport_t
+ * @brief The TCP and TLS listeners with their shared connection table.
+ */
+typedef struct
+{
+    int listen_socket;       // plain TCP, -1 when disabled
+    int tls_listen_socket;   // TLS, -1 when disabled
+    struct tls_server *tls; // handshakes and SSL objects of the TLS listener
+    int epoll_fd;
+    tcp_connection_t *connections;
+    uint32_t capacity;
+    uint32_t *free_slots;
+    uint32_t free_count;
+} tcp_transport_t;
+
+/**
+ * @struct tcp_send_batch_t
+ * @brief Responses of a single thread waiting for the next flush.
+ */
+typedef struct
+{
+    tcp_transport_t *transport;
+    char buffers[TCP_SEND_BATCH_SIZE][TCP_SEND_BUFFER_SIZE];
+    size_t lengths[TCP_SEND_BATCH_SIZE];
+    uint64_t connections[TCP_SEND_BATCH_SIZE];
+    int count;
+    int failures; // responses that failed in flushes of a full batch, reported by the next flush
+} tcp_send_batch_t;
+
+// called by the receiver for every framed message, the data is only valid during the call
+typedef void (*tcp_message_handler_t)(const char *data, size_t length, uint64_t connection, int fd,
+                                      const struct sockaddr_storage *address, socklen_t address_length);
+
+extern tcp_transport_t tcp_transport;
+
+int tcp_transport_init(tcp_transport_t *transport, int max_connections);
+int tcp_transport_listen(tcp_transport_t *transport, const struct sockaddr_storage *address, socklen_t address_length, struct tls_server *tls);
+bool tcp_transport_enabled(const tcp_transport_t *transport);
+int tcp_transport_watch(tcp_transport_t *transport, tcp_connection_t *connection);
+int tcp_transport_process(tcp_transport_t *transport, tcp_message_handler_t handler);
+int tcp_transport_send(tcp_transport_t *transport, uint64_t connection, const struct iovec *iov, int iov_count);
+void tcp_transport_destroy(tcp_transport_t *transport);
+void init_tcp_send_batch(tcp_send_batch_t *batch, tcp_transport_t *transport);
+int tcp_send_batch_add(tcp_send_batch_t *batch, uint64_t connection, const char *data, size_t length);
+int tcp_send_batch_flush(tcp_send_batch_t *batch);
+
+#endif // TCP_TRANSPORT_H
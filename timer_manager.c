@@ -1,7 +1,9 @@
 #include "timer_manager.h"
 #include "log.h"
+#include "metrics.h"
 #include <sys/timerfd.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -17,6 +19,7 @@ typedef struct timer_s
 } timer_s;
 
 static int epfd = -1;
+static int wakeup_fd = -1; // registered with a NULL timer, written to stop the thread
 static pthread_t timer_thread;
 static int running = 0;
 
@@ -35,9 +38,14 @@ static void *timer_thread_func(void *arg)
         for (int i = 0; i < n; i++)
         {
             timer_s *t = (timer_s *)events[i].data.ptr;
+            if (t == NULL)
+            {
+                continue;
+            }
             uint64_t expirations;
             read(t->tfd, &expirations, sizeof(expirations));
 
+            metrics_counter_add(&timer_metrics.timer.timers_fired, 1);
             t->cb(t->user_data);
 
             epoll_ctl(epfd, EPOLL_CTL_DEL, t->tfd, NULL);
@@ -59,10 +67,26 @@ int timer_one_shot_init()
         error("epoll_create1 failed: %s", strerror(errno));
         return -1;
     }
+    wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (wakeup_fd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, wakeup_fd, &ev) < 0)
+    {
+        error("Failed to create timer wakeup event: %s", strerror(errno));
+        if (wakeup_fd >= 0)
+        {
+            close(wakeup_fd);
+        }
+        close(epfd);
+        return -1;
+    }
     running = 1;
     if (pthread_create(&timer_thread, NULL, timer_thread_func, NULL) != 0)
     {
         error("pthread_create failed: %s", strerror(errno));
+        close(wakeup_fd);
         close(epfd);
         return -1;
     }
@@ -74,9 +98,16 @@ int timer_one_shot_init()
  */
 void timer_one_shot_shutdown()
 {
+    uint64_t one = 1;
     running = 0;
+    if (write(wakeup_fd, &one, sizeof(one)) < 0)
+    {
+        error("Failed to wake up the timer thread: %s", strerror(errno));
+    }
     pthread_join(timer_thread, NULL);
+    close(wakeup_fd);
     close(epfd);
+    wakeup_fd = -1;
     epfd = -1;
 }
 
@@ -90,7 +121,10 @@ int timer_one_shot_add(int initial_ms, timer_callback_t callback, void *user_dat
 
     timer_s *t = malloc(sizeof(timer_s));
     if (!t)
+    {
+        metrics_counter_add_shared(&timer_metrics.timer.timer_add_failures, 1);
         return -1;
+    }
 
     t->cb = callback;
     t->user_data = user_data;
@@ -98,6 +132,7 @@ int timer_one_shot_add(int initial_ms, timer_callback_t callback, void *user_dat
     t->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
     if (t->tfd < 0)
     {
+        metrics_counter_add_shared(&timer_metrics.timer.timer_add_failures, 1);
         free(t);
         return -1;
     }
@@ -110,6 +145,7 @@ int timer_one_shot_add(int initial_ms, timer_callback_t callback, void *user_dat
 
     if (timerfd_settime(t->tfd, 0, &its, NULL) < 0)
     {
+        metrics_counter_add_shared(&timer_metrics.timer.timer_add_failures, 1);
         close(t->tfd);
         free(t);
         return -1;
@@ -122,10 +158,12 @@ int timer_one_shot_add(int initial_ms, timer_callback_t callback, void *user_dat
 
     if (epoll_ctl(epfd, EPOLL_CTL_ADD, t->tfd, &ev) < 0)
     {
+        metrics_counter_add_shared(&timer_metrics.timer.timer_add_failures, 1);
         close(t->tfd);
         free(t);
         return -1;
     }
 
+    metrics_counter_add_shared(&timer_metrics.timer.timers_added, 1);
     return 0;
 }
@@ -0,0 +1,354 @@
+/**
+ * @file tls_server.c
+ * @brief Implementation of the TLS server of the TCP transport.
+ */
+
+#include "log.h"
+#include "tls_server.h"
+#include "utils.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/err.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+tls_server_t tls_server = {.stop_fd = -1};
+
+/**
+ * @brief Returns the reason of the last OpenSSL error of the calling thread.
+ */
+static const char *get_ssl_error(void)
+{
+    const char *reason = ERR_reason_error_string(ERR_peek_last_error());
+    return reason != NULL ? reason : "unknown error";
+}
+
+/**
+ * @brief Appends a connection to the handshakes of a thread, which are kept in accept order
+ * so the oldest one is the first to time out.
+ */
+static void add_handshake(tls_handshake_thread_t *thread, tcp_connection_t *connection)
+{
+    pthread_mutex_lock(&thread->lock);
+    connection->handshake_prev = thread->newest;
+    connection->handshake_next = NULL;
+    if (thread->newest != NULL)
+    {
+        thread->newest->handshake_next = connection;
+    }
+    else
+    {
+        thread->oldest = connection;
+    }
+    thread->newest = connection;
+    pthread_mutex_unlock(&thread->lock);
+}
+
+static void remove_handshake(tls_handshake_thread_t *thread, tcp_connection_t *connection)
+{
+    pthread_mutex_lock(&thread->lock);
+    if (connection->handshake_prev != NULL)
+    {
+        connection->handshake_prev->handshake_next = connection->handshake_next;
+    }
+    else
+    {
+        thread->oldest = connection->handshake_next;
+    }
+    if (connection->handshake_next != NULL)
+    {
+        connection->handshake_next->handshake_prev = connection->handshake_prev;
+    }
+    else
+    {
+        thread->newest = connection->handshake_prev;
+    }
+    connection->handshake_prev = NULL;
+    connection->handshake_next = NULL;
+    pthread_mutex_unlock(&thread->lock);
+}
+
+/**
+ * @brief Gives a connection whose handshake is over back to the transport, which closes it
+ * after a failure when it reads the hang up.
+ */
+static void finish_handshake(tls_handshake_thread_t *thread, tcp_connection_t *connection, bool failed)
+{
+    epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    remove_handshake(thread, connection);
+    if (failed)
+    {
+        metrics_counter_add(&thread->metrics->tls.handshake_failures, 1);
+        shutdown(connection->fd, SHUT_RDWR);
+    }
+    if (tcp_transport_watch(thread->server->transport, connection) != 0)
+    {
+        shutdown(connection->fd, SHUT_RDWR);
+    }
+}
+
+/**
+ * @brief Advances the handshake of a connection, and gives the connection back to the
+ * transport once the handshake is done or failed.
+ * @param thread The handshake thread owning the connection.
+ * @param connection The connection.
+ */
+static void continue_handshake(tls_handshake_thread_t *thread, tcp_connection_t *connection)
+{
+    pthread_mutex_lock(&connection->write_lock);
+    ERR_clear_error();
+    int rc = SSL_do_handshake(connection->ssl);
+    int ssl_error = rc == 1 ? SSL_ERROR_NONE : SSL_get_error(connection->ssl, rc);
+    bool resumed = ssl_error == SSL_ERROR_NONE && SSL_session_reused(connection->ssl);
+    bool offloaded = ssl_error == SSL_ERROR_NONE && BIO_get_ktls_send(SSL_get_wbio(connection->ssl));
+    pthread_mutex_unlock(&connection->write_lock);
+
+    if (ssl_error == SSL_ERROR_WANT_READ || ssl_error == SSL_ERROR_WANT_WRITE)
+    {
+        struct epoll_event event = {.events = (ssl_error == SSL_ERROR_WANT_READ ? EPOLLIN : EPOLLOUT) | EPOLLONESHOT,
+                                    .data.ptr = connection};
+        if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) == 0)
+        {
+            return;
+        }
+        error("Failed to watch TLS handshake: %s", strerror(errno));
+        ssl_error = SSL_ERROR_SYSCALL;
+    }
+
+    if (ssl_error == SSL_ERROR_NONE)
+    {
+        metrics_counter_add(&thread->metrics->tls.handshakes_completed, 1);
+        metrics_counter_add(&thread->metrics->tls.handshakes_resumed, resumed ? 1 : 0);
+        metrics_counter_add(&thread->metrics->tls.ktls_offloads, offloaded ? 1 : 0);
+        histogram_record(&thread->metrics->tls.handshake_latency[resumed ? 1 : 0], get_monotonic_time_ns() - connection->accept_time_ns);
+    }
+    else
+    {
+        log("TLS handshake failed: %s", ssl_error == SSL_ERROR_SSL ? get_ssl_error() : "connection lost");
+    }
+    finish_handshake(thread, connection, ssl_error != SSL_ERROR_NONE);
+}
+
+/**
+ * @brief Disconnects the peers that have not finished their handshake in time, so a peer
+ * that never sends its ClientHello cannot hold its connection slot.
+ * @param thread The handshake thread.
+ */
+static void expire_handshakes(tls_handshake_thread_t *thread)
+{
+    uint64_t deadline_ns = get_monotonic_time_ns() - (uint64_t)TLS_HANDSHAKE_TIMEOUT_MS * 1000000;
+    while (1)
+    {
+        // only this thread removes handshakes, the oldest one stays valid after the unlock
+        pthread_mutex_lock(&thread->lock);
+        tcp_connection_t *connection = thread->oldest;
+        pthread_mutex_unlock(&thread->lock);
+        if (connection == NULL || connection->accept_time_ns > deadline_ns)
+        {
+            return;
+        }
+        log("TLS handshake timed out");
+        finish_handshake(thread, connection, true);
+    }
+}
+
+/**
+ * @brief Drives the handshakes of a handshake thread until the server stops.
+ * @param arg The handshake thread.
+ */
+static void *handshake_thread_func(void *arg)
+{
+    tls_handshake_thread_t *thread = (tls_handshake_thread_t *)arg;
+    struct epoll_event events[TLS_HANDSHAKE_EVENT_BATCH];
+    while (1)
+    {
+        int count = epoll_wait(thread->epoll_fd, events, TLS_HANDSHAKE_EVENT_BATCH, TLS_HANDSHAKE_SWEEP_MS);
+        if (count < 0 && errno != EINTR)
+        {
+            error("Failed to wait for TLS handshakes: %s", strerror(errno));
+            return NULL;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            // the stop eventfd is the only event without a connection
+            if (events[i].data.ptr == NULL)
+            {
+                return NULL;
+            }
+            continue_handshake(thread, (tcp_connection_t *)events[i].data.ptr);
+        }
+        expire_handshakes(thread);
+    }
+}
+
+/**
+ * @brief Creates the TLS context from a certificate chain and its key, and starts the handshake threads.
+ * @param server The server to initialize.
+ * @param transport The transport the TLS connections are given back to after their handshake.
+ * @param certificate_file PEM file of the certificate chain, leaf first.
+ * @param key_file PEM file of the private key.
+ * @param handshake_threads The number of handshake threads.
+ * @return 0 on success, -1 on failure.
+ */
+int tls_server_init(tls_server_t *server, tcp_transport_t *transport, const char *certificate_file, const char *key_file, int handshake_threads)
+{
+    if (server == NULL || transport == NULL || certificate_file == NULL || key_file == NULL ||
+        handshake_threads <= 0 || handshake_threads > METRICS_MAX_TLS_THREADS)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    memset(server, 0, sizeof(tls_server_t));
+    server->transport = transport;
+    server->stop_fd = -1;
+
+    server->context = SSL_CTX_new(TLS_server_method());
+    if (server->context == NULL ||
+        SSL_CTX_set_min_proto_version(server->context, TLS1_2_VERSION) != 1 ||
+        SSL_CTX_use_certificate_chain_file(server->context, certificate_file) != 1 ||
+        SSL_CTX_use_PrivateKey_file(server->context, key_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(server->context) != 1)
+    {
+        error("Failed to load TLS certificate %s and key %s: %s", certificate_file, key_file, get_ssl_error());
+        tls_server_destroy(server);
+        return -1;
+    }
+    // responses pending on a full socket are retried from a buffer that moves and grows, and
+    // partial writes report what the socket took; idle connections give back their buffers
+    SSL_CTX_set_mode(server->context, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+    // sessions resume from stateless tickets only, the handshake threads share no session cache
+    SSL_CTX_set_session_cache_mode(server->context, SSL_SESS_CACHE_OFF);
+    SSL_CTX_set_num_tickets(server->context, TLS_SESSION_TICKETS);
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(server->context, SSL_OP_ENABLE_KTLS);
+#endif
+
+    server->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server->stop_fd < 0)
+    {
+        error("Failed to create the TLS stop eventfd: %s", strerror(errno));
+        tls_server_destroy(server);
+        return -1;
+    }
+    for (int i = 0; i < handshake_threads; i++)
+    {
+        tls_handshake_thread_t *thread = &server->threads[i];
+        thread->server = server;
+        thread->metrics = &tls_metrics[i];
+        pthread_mutex_init(&thread->lock, NULL);
+        thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+        if (thread->epoll_fd < 0 || epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, server->stop_fd, &event) < 0)
+        {
+            error("Failed to set up the TLS handshake thread: %s", strerror(errno));
+            if (thread->epoll_fd >= 0)
+            {
+                close(thread->epoll_fd);
+            }
+            tls_server_destroy(server);
+            return -1;
+        }
+        if (pthread_create(&thread->thread, NULL, handshake_thread_func, thread) != 0)
+        {
+            error("Failed to create TLS handshake thread");
+            close(thread->epoll_fd);
+            tls_server_destroy(server);
+            return -1;
+        }
+        server->thread_count++;
+    }
+    info("TLS handshakes on %d threads, certificate %s", handshake_threads, certificate_file);
+    return 0;
+}
+
+bool tls_server_enabled(const tls_server_t *server)
+{
+    return server != NULL && server->context != NULL;
+}
+
+/**
+ * @brief Creates the server side SSL object of an accepted connection.
+ * @param server The server.
+ * @param fd The accepted socket.
+ * @return The SSL object, NULL on failure.
+ */
+SSL *tls_server_new_ssl(tls_server_t *server, int fd)
+{
+    if (!tls_server_enabled(server) || fd < 0)
+    {
+        error("Invalid parameters");
+        return NULL;
+    }
+    SSL *ssl = SSL_new(server->context);
+    if (ssl == NULL || SSL_set_fd(ssl, fd) != 1)
+    {
+        error("Failed to create TLS connection: %s", get_ssl_error());
+        SSL_free(ssl);
+        return NULL;
+    }
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
+
+/**
+ * @brief Hands an accepted connection to the next handshake thread. Must only be called by the receiver thread.
+ * @param server The server.
+ * @param connection The connection with its SSL object, not watched by the transport yet.
+ * @return 0 on success, -1 on failure.
+ */
+int tls_server_start_handshake(tls_server_t *server, tcp_connection_t *connection)
+{
+    if (!tls_server_enabled(server) || server->thread_count == 0 || connection == NULL || connection->ssl == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    tls_handshake_thread_t *thread = &server->threads[server->next_thread++ % (uint32_t)server->thread_count];
+    // listed before it is watched, the thread may finish the handshake at once
+    add_handshake(thread, connection);
+    // the client speaks first
+    struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = connection};
+    if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, connection->fd, &event) < 0)
+    {
+        error("Failed to watch TLS handshake: %s", strerror(errno));
+        remove_handshake(thread, connection);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Stops the handshake threads and frees the TLS context. Connections still
+ * handshaking are closed with the transport afterwards.
+ * @param server The server.
+ */
+void tls_server_destroy(tls_server_t *server)
+{
+    if (server == NULL)
+    {
+        return;
+    }
+    if (server->thread_count > 0)
+    {
+        uint64_t one = 1;
+        if (write(server->stop_fd, &one, sizeof(one)) < 0)
+        {
+            error("Failed to stop TLS handshake threads: %s", strerror(errno));
+        }
+        for (int i = 0; i < server->thread_count; i++)
+        {
+            pthread_join(server->threads[i].thread, NULL);
+            close(server->threads[i].epoll_fd);
+            pthread_mutex_destroy(&server->threads[i].lock);
+        }
+    }
+    if (server->stop_fd >= 0)
+    {
+        close(server->stop_fd);
+    }
+    SSL_CTX_free(server->context);
+    memset(server, 0, sizeof(tls_server_t));
+    server->stop_fd = -1;
+}
@@ -0,0 +1,68 @@
+/**
+ * @file tls_server.h
+ * @brief Header for the TLS server of the TCP transport.
+ *
+ * Handshakes run on a pool of threads of their own, so the public key operations of a
+ * reconnect storm never delay the receiver or the workers. The receiver hands an accepted
+ * connection to a handshake thread, which drives the handshake from an epoll instance of
+ * its own and gives the connection back to the transport once it is done. Sessions resume
+ * from stateless tickets, which need no session cache shared by the handshake threads, and
+ * records are encrypted by kernel TLS when both the kernel and OpenSSL support it.
+ */
+
+#ifndef TLS_SERVER_H
+#define TLS_SERVER_H
+
+#include "metrics.h"
+#include "tcp_transport.h"
+#include <openssl/ssl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TLS_DEFAULT_HANDSHAKE_THREADS 2
+#define TLS_HANDSHAKE_EVENT_BATCH 64
+#define TLS_SESSION_TICKETS 1 // tickets issued per full handshake, a client resumes from the latest one
+#define TLS_HANDSHAKE_TIMEOUT_MS 10000 // a peer that has not finished its handshake by then is disconnected
+#define TLS_HANDSHAKE_SWEEP_MS 1000    // interval of the handshake timeout checks
+
+struct tls_server;
+
+/**
+ * @struct tls_handshake_thread_t
+ * @brief A handshake thread with the connections it is handshaking.
+ */
+typedef struct
+{
+    pthread_t thread;
+    int epoll_fd;
+    struct tls_server *server;
+    tls_metrics_t *metrics;
+    pthread_mutex_t lock; // the receiver appends handshakes, the thread removes them
+    tcp_connection_t *oldest;
+    tcp_connection_t *newest;
+} tls_handshake_thread_t;
+
+/**
+ * @struct tls_server_t
+ * @brief The TLS context of the TLS listener and its handshake threads.
+ */
+typedef struct tls_server
+{
+    SSL_CTX *context;
+    tcp_transport_t *transport;
+    tls_handshake_thread_t threads[METRICS_MAX_TLS_THREADS];
+    int thread_count;
+    int stop_fd;          // eventfd stopping the handshake threads
+    uint32_t next_thread; // round robin over the threads, receiver only
+} tls_server_t;
+
+extern tls_server_t tls_server;
+
+int tls_server_init(tls_server_t *server, tcp_transport_t *transport, const char *certificate_file, const char *key_file, int handshake_threads);
+bool tls_server_enabled(const tls_server_t *server);
+SSL *tls_server_new_ssl(tls_server_t *server, int fd);
+int tls_server_start_handshake(tls_server_t *server, tcp_connection_t *connection);
+void tls_server_destroy(tls_server_t *server);
+
+#endif // TLS_SERVER_H
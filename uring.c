@@ -0,0 +1,528 @@
+/**
+ * @file uring.c
+ * @brief Implementation of the io_uring network backend.
+ */
+
+#include "uring.h"
+#include "log.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg, unsigned count)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+static void uring_destroy(uring_t *ring)
+{
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+    {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+    {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->fd >= 0)
+    {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(uring_t));
+    ring->fd = -1;
+}
+
+/**
+ * @brief Creates a ring and maps its submission and completion queues.
+ * @param ring The ring to initialize.
+ * @param entries The size of the submission queue.
+ * @param cq_entries The size of the completion queue, at least the number of completions
+ * that can be pending at once, since overflowing ones are only posted on the next enter.
+ * @return 0 on success, -1 on failure.
+ */
+static int uring_init(uring_t *ring, unsigned entries, unsigned cq_entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(uring_t));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = cq_entries;
+    ring->fd = uring_setup(entries, &params);
+    if (ring->fd < 0)
+    {
+        error("io_uring_setup failed: %s", strerror(errno));
+        return -1;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->sq_ring_size = ring->cq_ring_size > ring->sq_ring_size ? ring->cq_ring_size : ring->sq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+    {
+        error("Failed to map the io_uring submission queue: %s", strerror(errno));
+        uring_destroy(ring);
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ring = ring->sq_ring;
+    }
+    else
+    {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED)
+        {
+            error("Failed to map the io_uring completion queue: %s", strerror(errno));
+            uring_destroy(ring);
+            return -1;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        error("Failed to map the io_uring submission entries: %s", strerror(errno));
+        uring_destroy(ring);
+        return -1;
+    }
+
+    char *sq = ring->sq_ring;
+    char *cq = ring->cq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sq_flags = (unsigned *)(sq + params.sq_off.flags);
+    ring->sq_entries = params.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+/**
+ * @brief Returns a cleared submission entry, or NULL when the submission queue is full.
+ */
+static struct io_uring_sqe *uring_get_sqe(uring_t *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries)
+    {
+        return NULL;
+    }
+    unsigned index = ring->sqe_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+    return sqe;
+}
+
+/**
+ * @brief Publishes the prepared entries and submits them, optionally waiting for completions.
+ * @return The number of entries submitted, or -1 with errno set on failure.
+ */
+static int uring_submit(uring_t *ring, unsigned wait_count)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned to_submit = ring->sqe_tail - tail;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    if (to_submit == 0 && wait_count == 0)
+    {
+        return 0;
+    }
+    int rc;
+    do
+    {
+        rc = uring_enter(ring->fd, to_submit, wait_count, wait_count > 0 ? IORING_ENTER_GETEVENTS : 0);
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0)
+    {
+        int saved_errno = errno;
+        error("io_uring_enter failed: %s", strerror(errno));
+        errno = saved_errno;
+    }
+    return rc;
+}
+
+static struct io_uring_cqe *uring_peek_cqe(uring_t *ring)
+{
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+static void uring_cqe_seen(uring_t *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Hands a receive buffer back to the kernel.
+ */
+static void add_receive_buffer(uring_receiver_t *receiver, uint16_t buffer_id)
+{
+    struct io_uring_buf *buffer = &receiver->buffer_ring->bufs[receiver->buffer_tail & (URING_RECEIVE_BUFFER_COUNT - 1)];
+    buffer->addr = (uint64_t)(uintptr_t)(receiver->buffers + (size_t)buffer_id * URING_RECEIVE_BUFFER_SIZE);
+    buffer->len = URING_RECEIVE_BUFFER_SIZE;
+    buffer->bid = buffer_id;
+    receiver->buffer_tail++;
+    __atomic_store_n(&receiver->buffer_ring->tail, receiver->buffer_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Submits the multishot recvmsg, which stays armed until the buffers run out.
+ */
+static int arm_receive(uring_receiver_t *receiver)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&receiver->ring);
+    if (sqe == NULL)
+    {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = receiver->socket;
+    sqe->addr = (uint64_t)(uintptr_t)&receiver->header;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_RECEIVE_BUFFER_GROUP;
+    if (uring_submit(&receiver->ring, 0) < 0)
+    {
+        return -1;
+    }
+    receiver->armed = true;
+    return 0;
+}
+
+/**
+ * @brief Sets up the receive ring of a socket and arms the multishot recvmsg.
+ * @param receiver The receiver to initialize.
+ * @param socket The non-blocking server socket.
+ * @return 0 on success, -1 on failure.
+ */
+int uring_receiver_init(uring_receiver_t *receiver, int socket)
+{
+    if (receiver == NULL || socket < 0)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    memset(receiver, 0, sizeof(uring_receiver_t));
+    receiver->socket = socket;
+    // every completion holds a buffer, so the completion queue never overflows
+    if (uring_init(&receiver->ring, 8, URING_RECEIVE_BUFFER_COUNT) != 0)
+    {
+        return -1;
+    }
+
+    // the buffer ring is shared with the kernel and must be page aligned
+    receiver->buffer_ring_size = URING_RECEIVE_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    receiver->buffer_ring = mmap(NULL, receiver->buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    receiver->buffers = malloc((size_t)URING_RECEIVE_BUFFER_COUNT * URING_RECEIVE_BUFFER_SIZE);
+    if (receiver->buffer_ring == MAP_FAILED || receiver->buffers == NULL)
+    {
+        error("Memory allocation failed");
+        if (receiver->buffer_ring == MAP_FAILED)
+        {
+            receiver->buffer_ring = NULL;
+        }
+        uring_receiver_destroy(receiver);
+        return -1;
+    }
+
+    struct io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = (uint64_t)(uintptr_t)receiver->buffer_ring;
+    registration.ring_entries = URING_RECEIVE_BUFFER_COUNT;
+    registration.bgid = URING_RECEIVE_BUFFER_GROUP;
+    if (uring_register(receiver->ring.fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+    {
+        error("Failed to register the io_uring receive buffers: %s", strerror(errno));
+        uring_receiver_destroy(receiver);
+        return -1;
+    }
+    for (uint16_t i = 0; i < URING_RECEIVE_BUFFER_COUNT; i++)
+    {
+        add_receive_buffer(receiver, i);
+    }
+
+    // every buffer starts with the recvmsg header, then room for an IPv6 address and a timestamp
+    receiver->header.msg_namelen = sizeof(struct sockaddr_in6);
+    receiver->header.msg_controllen = CMSG_SPACE(sizeof(struct timespec));
+    if (arm_receive(receiver) != 0)
+    {
+        uring_receiver_destroy(receiver);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Takes the next received datagram without a system call, rearming the multishot
+ * recvmsg when the kernel stopped it.
+ * @param receiver The receiver.
+ * @param datagram Filled with the datagram, to be released with uring_receiver_release.
+ * @return 1 if a datagram was returned, 0 if none is pending.
+ */
+int uring_receiver_next(uring_receiver_t *receiver, uring_datagram_t *datagram)
+{
+    if (receiver == NULL || datagram == NULL)
+    {
+        error("Invalid parameters");
+        return 0;
+    }
+    struct io_uring_cqe *cqe;
+    while ((cqe = uring_peek_cqe(&receiver->ring)) != NULL)
+    {
+        int32_t result = cqe->res;
+        uint32_t flags = cqe->flags;
+        uring_cqe_seen(&receiver->ring);
+        if (!(flags & IORING_CQE_F_MORE))
+        {
+            receiver->armed = false;
+        }
+        if (result < 0)
+        {
+            // ENOBUFS stops the multishot until buffers are released
+            if (result != -ENOBUFS)
+            {
+                error("io_uring recvmsg failed: %s", strerror(-result));
+            }
+            continue;
+        }
+        if (!(flags & IORING_CQE_F_BUFFER))
+        {
+            continue;
+        }
+
+        uint16_t buffer_id = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+        char *buffer = receiver->buffers + (size_t)buffer_id * URING_RECEIVE_BUFFER_SIZE;
+        size_t layout = sizeof(struct io_uring_recvmsg_out) + receiver->header.msg_namelen + receiver->header.msg_controllen;
+        if ((size_t)result < layout)
+        {
+            add_receive_buffer(receiver, buffer_id);
+            continue;
+        }
+        struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buffer;
+        char *name = buffer + sizeof(struct io_uring_recvmsg_out);
+        datagram->address = (const struct sockaddr *)name;
+        datagram->address_length = out->namelen < receiver->header.msg_namelen ? out->namelen : receiver->header.msg_namelen;
+        datagram->control = name + receiver->header.msg_namelen;
+        datagram->control_length = out->controllen;
+        datagram->payload = (const char *)datagram->control + receiver->header.msg_controllen;
+        datagram->length = (size_t)result - layout;
+        datagram->truncated = (out->flags & MSG_TRUNC) != 0;
+        datagram->buffer_id = buffer_id;
+        return 1;
+    }
+
+    if (!receiver->armed)
+    {
+        arm_receive(receiver);
+    }
+    else if (__atomic_load_n(receiver->ring.sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW)
+    {
+        uring_enter(receiver->ring.fd, 0, 0, IORING_ENTER_GETEVENTS);
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the buffer of a datagram to the kernel.
+ */
+void uring_receiver_release(uring_receiver_t *receiver, const uring_datagram_t *datagram)
+{
+    if (receiver == NULL || datagram == NULL)
+    {
+        error("Invalid parameters");
+        return;
+    }
+    add_receive_buffer(receiver, datagram->buffer_id);
+}
+
+void uring_receiver_destroy(uring_receiver_t *receiver)
+{
+    if (receiver == NULL)
+    {
+        return;
+    }
+    if (receiver->ring.fd > 0)
+    {
+        uring_destroy(&receiver->ring);
+    }
+    if (receiver->buffer_ring != NULL)
+    {
+        munmap(receiver->buffer_ring, receiver->buffer_ring_size);
+    }
+    free(receiver->buffers);
+    memset(receiver, 0, sizeof(uring_receiver_t));
+    receiver->ring.fd = -1;
+}
+
+/**
+ * @brief Sets up the send ring of a thread.
+ * @param sender The sender to initialize.
+ * @return 0 on success, -1 on failure.
+ */
+int uring_sender_init(uring_sender_t *sender)
+{
+    if (sender == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    memset(sender, 0, sizeof(uring_sender_t));
+    sender->slots = calloc(URING_SEND_SLOTS, sizeof(uring_send_slot_t));
+    if (sender->slots == NULL)
+    {
+        error("Memory allocation failed");
+        return -1;
+    }
+    if (uring_init(&sender->ring, URING_SEND_SLOTS, URING_SEND_SLOTS) != 0)
+    {
+        free(sender->slots);
+        sender->slots = NULL;
+        return -1;
+    }
+    for (unsigned i = 0; i < URING_SEND_SLOTS; i++)
+    {
+        sender->free_slots[i] = (uint16_t)i;
+    }
+    sender->free_count = URING_SEND_SLOTS;
+    return 0;
+}
+
+/**
+ * @brief Copies a datagram into a free slot and queues its sendmsg. Nothing is submitted
+ * until the next flush, unless every slot is in use.
+ * @return 0 on success, -1 with errno set on failure, ENOBUFS when no slot or submission
+ * entry is free.
+ */
+int uring_sender_queue(uring_sender_t *sender, int socket, const char *data, size_t length, const struct sockaddr_storage *address, socklen_t address_length)
+{
+    if (sender == NULL || data == NULL || length > URING_SEND_BUFFER_SIZE || address == NULL || address_length > sizeof(struct sockaddr_storage))
+    {
+        error("Invalid parameters");
+        errno = EINVAL;
+        return -1;
+    }
+    if (sender->free_count == 0 && uring_sender_flush(sender, 1) < 0)
+    {
+        return -1;
+    }
+    if (sender->free_count == 0)
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(&sender->ring);
+    if (sqe == NULL)
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    uint16_t index = sender->free_slots[--sender->free_count];
+    uring_send_slot_t *slot = &sender->slots[index];
+    memcpy(slot->buffer, data, length);
+    memcpy(&slot->address, address, address_length);
+    slot->iov.iov_base = slot->buffer;
+    slot->iov.iov_len = length;
+    memset(&slot->header, 0, sizeof(slot->header));
+    slot->header.msg_name = &slot->address;
+    slot->header.msg_namelen = address_length;
+    slot->header.msg_iov = &slot->iov;
+    slot->header.msg_iovlen = 1;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = socket;
+    sqe->addr = (uint64_t)(uintptr_t)&slot->header;
+    sqe->len = 1;
+    sqe->user_data = index;
+    sender->pending++;
+    return 0;
+}
+
+/**
+ * @brief Submits the queued sends in one system call and reaps the completed ones.
+ * @param sender The sender.
+ * @param wait_count The number of completions to wait for.
+ * @return The number of sends that failed, or -1 if the submission failed.
+ */
+int uring_sender_flush(uring_sender_t *sender, unsigned wait_count)
+{
+    if (sender == NULL)
+    {
+        error("Invalid parameters");
+        return -1;
+    }
+    if (wait_count > sender->in_flight + sender->pending)
+    {
+        wait_count = sender->in_flight + sender->pending;
+    }
+    if (sender->pending > 0 || wait_count > 0)
+    {
+        int submitted = uring_submit(&sender->ring, wait_count);
+        if (submitted < 0)
+        {
+            return -1;
+        }
+        sender->pending -= (unsigned)submitted;
+        sender->in_flight += (unsigned)submitted;
+    }
+
+    int failures = 0;
+    struct io_uring_cqe *cqe;
+    while ((cqe = uring_peek_cqe(&sender->ring)) != NULL)
+    {
+        if (cqe->res < 0)
+        {
+            error("io_uring sendmsg failed: %s", strerror(-cqe->res));
+            failures++;
+        }
+        sender->free_slots[sender->free_count++] = (uint16_t)cqe->user_data;
+        sender->in_flight--;
+        uring_cqe_seen(&sender->ring);
+    }
+    return failures;
+}
+
+void uring_sender_destroy(uring_sender_t *sender)
+{
+    if (sender == NULL || sender->slots == NULL)
+    {
+        return;
+    }
+    uring_sender_flush(sender, sender->in_flight + sender->pending);
+    uring_destroy(&sender->ring);
+    free(sender->slots);
+    sender->slots = NULL;
+}
@@ -0,0 +1,128 @@
+/**
+ * @file uring.h
+ * @brief Header for the io_uring network backend.
+ *
+ * The rings are set up with raw system calls, so no liburing is needed. The receiver keeps
+ * one multishot recvmsg armed on the server socket, taking its buffers from a provided
+ * buffer ring, so datagrams arrive as completions without a system call each. Each worker
+ * owns a sender that queues sendmsg submissions and submits them in batches.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define URING_RECEIVE_BUFFER_COUNT 256 // power of two
+#define URING_RECEIVE_BUFFER_SIZE 2048 // recvmsg header, address, control messages and payload
+#define URING_RECEIVE_BUFFER_GROUP 0
+#define URING_SEND_SLOTS 64
+#define URING_SEND_BUFFER_SIZE 1024 // BUFFER_SIZE of sip_message_t
+#define URING_SEND_BATCH 16         // queued sends submitted together when the worker stays busy
+
+typedef enum
+{
+    IO_BACKEND_CLASSIC = 0, // recvmsg per datagram and sendto per response
+    IO_BACKEND_IO_URING
+} io_backend_t;
+
+/**
+ * @struct uring_t
+ * @brief Submission and completion rings mapped from the kernel.
+ */
+typedef struct
+{
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *sq_flags;
+    unsigned sq_entries;
+    unsigned sqe_tail; // prepared entries, published to sq_tail on submit
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} uring_t;
+
+/**
+ * @struct uring_datagram_t
+ * @brief Datagram received into a provided buffer, valid until the buffer is released.
+ */
+typedef struct
+{
+    const char *payload;
+    size_t length;
+    bool truncated;
+    const struct sockaddr *address;
+    socklen_t address_length;
+    void *control;
+    size_t control_length;
+    uint16_t buffer_id;
+} uring_datagram_t;
+
+/**
+ * @struct uring_receiver_t
+ * @brief Multishot recvmsg on a socket with its provided buffer ring.
+ */
+typedef struct
+{
+    uring_t ring;
+    int socket;
+    struct io_uring_buf_ring *buffer_ring;
+    size_t buffer_ring_size;
+    char *buffers;
+    uint16_t buffer_tail;
+    struct msghdr header; // only the address and control lengths are used, as a layout for every buffer
+    bool armed;
+} uring_receiver_t;
+
+/**
+ * @struct uring_send_slot_t
+ * @brief Copy of a response that stays valid until its sendmsg completes.
+ */
+typedef struct
+{
+    char buffer[URING_SEND_BUFFER_SIZE];
+    struct sockaddr_storage address;
+    struct iovec iov;
+    struct msghdr header;
+} uring_send_slot_t;
+
+/**
+ * @struct uring_sender_t
+ * @brief Batched sendmsg submissions of a single thread.
+ */
+typedef struct
+{
+    uring_t ring;
+    uring_send_slot_t *slots;
+    uint16_t free_slots[URING_SEND_SLOTS];
+    unsigned free_count;
+    unsigned pending;   // queued but not submitted yet
+    unsigned in_flight; // submitted but not completed yet
+} uring_sender_t;
+
+int uring_receiver_init(uring_receiver_t *receiver, int socket);
+int uring_receiver_next(uring_receiver_t *receiver, uring_datagram_t *datagram);
+void uring_receiver_release(uring_receiver_t *receiver, const uring_datagram_t *datagram);
+void uring_receiver_destroy(uring_receiver_t *receiver);
+int uring_sender_init(uring_sender_t *sender);
+int uring_sender_queue(uring_sender_t *sender, int socket, const char *data, size_t length, const struct sockaddr_storage *address, socklen_t address_length);
+int uring_sender_flush(uring_sender_t *sender, unsigned wait_count);
+void uring_sender_destroy(uring_sender_t *sender);
+
+#endif // URING_H
@@ -1,5 +1,11 @@
 #include "utils.h"
 #include "log.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
 
 int string_to_int_hash(const char *str, size_t length)
 {
@@ -14,4 +20,185 @@ int string_to_int_hash(const char *str, size_t length)
         hash += str[i];
     }
     return hash;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Returns the current monotonic time in milliseconds.
+ * @return Milliseconds since an unspecified starting point.
+ */
+uint64_t get_monotonic_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Returns the current monotonic time in nanoseconds.
+ * @return Nanoseconds since an unspecified starting point.
+ */
+uint64_t get_monotonic_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Returns the wall clock time, the clock of kernel socket timestamps.
+ * @return The time in nanoseconds since the epoch.
+ */
+uint64_t get_real_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Parses "ip", "ip:port", "[ipv6]" or "[ipv6]:port", a bare IPv6 address has no port.
+ * @param text The address to parse.
+ * @param default_port The port used when the text has none.
+ * @param address The parsed address.
+ * @return The length of the parsed address, 0 if the text is not a valid address.
+ */
+socklen_t parse_socket_address(const char *text, int default_port, struct sockaddr_storage *address)
+{
+    if (text == NULL || address == NULL)
+    {
+        error("Invalid parameters");
+        return 0;
+    }
+    char host[INET6_ADDRSTRLEN];
+    const char *port = NULL;
+    size_t host_length;
+    if (text[0] == '[')
+    {
+        const char *end = strchr(text, ']');
+        if (end == NULL || (end[1] != '\0' && end[1] != ':'))
+        {
+            return 0;
+        }
+        host_length = (size_t)(end - text - 1);
+        text++;
+        port = end[1] == ':' ? end + 2 : NULL;
+    }
+    else
+    {
+        const char *colon = strchr(text, ':');
+        bool ipv6 = colon != NULL && strchr(colon + 1, ':') != NULL;
+        host_length = colon != NULL && !ipv6 ? (size_t)(colon - text) : strlen(text);
+        port = colon != NULL && !ipv6 ? colon + 1 : NULL;
+    }
+    if (host_length == 0 || host_length >= sizeof(host))
+    {
+        return 0;
+    }
+    memcpy(host, text, host_length);
+    host[host_length] = '\0';
+
+    char *port_end = NULL;
+    long port_number = port != NULL ? strtol(port, &port_end, 10) : default_port;
+    if ((port != NULL && (*port == '\0' || *port_end != '\0')) || port_number < 0 || port_number > 65535)
+    {
+        return 0;
+    }
+
+    memset(address, 0, sizeof(struct sockaddr_storage));
+    struct sockaddr_in *ipv4 = (struct sockaddr_in *)address;
+    struct sockaddr_in6 *ipv6 = (struct sockaddr_in6 *)address;
+    if (inet_pton(AF_INET, host, &ipv4->sin_addr) == 1)
+    {
+        ipv4->sin_family = AF_INET;
+        ipv4->sin_port = htons((uint16_t)port_number);
+        return sizeof(struct sockaddr_in);
+    }
+    if (inet_pton(AF_INET6, host, &ipv6->sin6_addr) == 1)
+    {
+        ipv6->sin6_family = AF_INET6;
+        ipv6->sin6_port = htons((uint16_t)port_number);
+        return sizeof(struct sockaddr_in6);
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks if two IPv4 or IPv6 socket addresses have the same family, address and port.
+ * @param a The first address.
+ * @param b The second address.
+ * @return true if the addresses are equal.
+ */
+bool sockaddr_equal(const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+    if (a == NULL || b == NULL || a->ss_family != b->ss_family)
+    {
+        return false;
+    }
+    if (a->ss_family == AF_INET)
+    {
+        const struct sockaddr_in *first = (const struct sockaddr_in *)a;
+        const struct sockaddr_in *second = (const struct sockaddr_in *)b;
+        return first->sin_port == second->sin_port && first->sin_addr.s_addr == second->sin_addr.s_addr;
+    }
+    if (a->ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6 *first = (const struct sockaddr_in6 *)a;
+        const struct sockaddr_in6 *second = (const struct sockaddr_in6 *)b;
+        return first->sin6_port == second->sin6_port && memcmp(&first->sin6_addr, &second->sin6_addr, sizeof(struct in6_addr)) == 0 &&
+               first->sin6_scope_id == second->sin6_scope_id;
+    }
+    return false;
+}
+
+/**
+ * @brief Converts an IPv4 mapped IPv6 address, as received on a dual stack socket, to IPv4.
+ * @param address The address, left unchanged if it is not IPv4 mapped.
+ */
+void sockaddr_unmap(struct sockaddr_storage *address)
+{
+    const struct sockaddr_in6 *ipv6 = (const struct sockaddr_in6 *)address;
+    if (address == NULL || address->ss_family != AF_INET6 || !IN6_IS_ADDR_V4MAPPED(&ipv6->sin6_addr))
+    {
+        return;
+    }
+    struct sockaddr_in ipv4;
+    memset(&ipv4, 0, sizeof(ipv4));
+    ipv4.sin_family = AF_INET;
+    ipv4.sin_port = ipv6->sin6_port;
+    memcpy(&ipv4.sin_addr, ipv6->sin6_addr.s6_addr + 12, sizeof(ipv4.sin_addr));
+    memcpy(address, &ipv4, sizeof(ipv4));
+}
+
+/**
+ * @brief Formats an IPv4 or IPv6 socket address as "ip:port" or "[ipv6]:port".
+ * @param address The address.
+ * @param buffer The output buffer, SOCKADDR_STRING_LENGTH bytes are enough.
+ * @param size The size of the buffer.
+ * @return The buffer.
+ */
+const char *sockaddr_to_string(const struct sockaddr_storage *address, char *buffer, size_t size)
+{
+    if (address == NULL || buffer == NULL || size == 0)
+    {
+        error("Invalid parameters");
+        return "";
+    }
+    char host[INET6_ADDRSTRLEN] = "?";
+    if (address->ss_family == AF_INET)
+    {
+        const struct sockaddr_in *ipv4 = (const struct sockaddr_in *)address;
+        inet_ntop(AF_INET, &ipv4->sin_addr, host, sizeof(host));
+        snprintf(buffer, size, "%s:%u", host, ntohs(ipv4->sin_port));
+    }
+    else if (address->ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6 *ipv6 = (const struct sockaddr_in6 *)address;
+        inet_ntop(AF_INET6, &ipv6->sin6_addr, host, sizeof(host));
+        snprintf(buffer, size, "[%s]:%u", host, ntohs(ipv6->sin6_port));
+    }
+    else
+    {
+        snprintf(buffer, size, "%s", host);
+    }
+    return buffer;
+}
@@ -6,8 +6,20 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define SOCKADDR_STRING_LENGTH 56 // "[" IPv6 address "]:" port
 
 int string_to_int_hash(const char *str, size_t length);
+uint64_t get_monotonic_time_ms(void);
+uint64_t get_monotonic_time_ns(void);
+uint64_t get_real_time_ns(void);
+socklen_t parse_socket_address(const char *text, int default_port, struct sockaddr_storage *address);
+bool sockaddr_equal(const struct sockaddr_storage *a, const struct sockaddr_storage *b);
+void sockaddr_unmap(struct sockaddr_storage *address);
+const char *sockaddr_to_string(const struct sockaddr_storage *address, char *buffer, size_t size);
 
-#endif // UTILS_H
\ No newline at end of file
+#endif // UTILS_H